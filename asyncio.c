@@ -0,0 +1,479 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- asynchronous file I/O ---------------------------------------------- */
+
+// needed for syscall()
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "asyncio.h"
+#include "unpaper.h"
+
+// writes in flight at once, and entries of the submission queue
+#define ASYNC_QUEUE_DEPTH 64
+
+/*
+ * With --async-io, the input files of the next sheets are read into memory
+ * ahead of their processing, and the output files are written while the next
+ * sheets are processed, so that the latency of each file, seeking on spinning
+ * disks or going through network file systems, overlaps with the processing
+ * instead of adding to it. Reads and writes are submitted to an io_uring
+ * where the kernel offers one; otherwise the kernel is only asked to read the
+ * files ahead, and the files are written on the spot.
+ *
+ * Files are only read and written from the main thread.
+ */
+struct AsyncFile {
+  char *name;
+  int fd;
+  uint8_t *data;
+  size_t size;
+  size_t done; // bytes read or written so far
+  bool pending; // submitted and not completed yet
+
+  // writes only: the temporary file renamed once complete, and what to call
+  // once the data is written
+  char *tmpName;
+  void (*release)(void *opaque);
+  void *opaque;
+};
+
+static bool enabled = false;
+// set once a fatal error stops unpaper, which only finishes the writes left
+static bool aborting = false;
+
+// files read ahead, the oldest making room for the next ones
+static struct AsyncFile *reads = NULL;
+static int readsCount = 0;
+static int readsNext = 0;
+
+static struct AsyncFile writes[ASYNC_QUEUE_DEPTH];
+
+/* --- io_uring ----------------------------------------------------------- */
+
+#ifdef HAVE_IO_URING
+/*
+ * The ring is driven through the system calls directly, as the main thread
+ * alone submits to it and reaps its completions.
+ */
+static struct {
+  int fd;
+  unsigned inFlight;
+  unsigned entries;
+  void *sqRing;
+  size_t sqRingSize;
+  void *cqRing;
+  size_t cqRingSize;
+  struct io_uring_sqe *sqes;
+  unsigned *sqTail;
+  unsigned *sqMask;
+  unsigned *sqArray;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned *cqMask;
+  struct io_uring_cqe *cqes;
+} ring = {.fd = -1};
+
+static void ringClose(void) {
+  if (ring.sqes != NULL && ring.sqes != MAP_FAILED)
+    munmap(ring.sqes, ring.entries * sizeof(struct io_uring_sqe));
+  if (ring.cqRing != NULL && ring.cqRing != MAP_FAILED &&
+      ring.cqRing != ring.sqRing)
+    munmap(ring.cqRing, ring.cqRingSize);
+  if (ring.sqRing != NULL && ring.sqRing != MAP_FAILED)
+    munmap(ring.sqRing, ring.sqRingSize);
+  if (ring.fd >= 0)
+    close(ring.fd);
+
+  memset(&ring, 0, sizeof(ring));
+  ring.fd = -1;
+}
+
+static bool ringOpen(void) {
+  struct io_uring_params params;
+
+  memset(&params, 0, sizeof(params));
+  ring.fd = syscall(SYS_io_uring_setup, ASYNC_QUEUE_DEPTH, &params);
+  if (ring.fd < 0) {
+    ring.fd = -1;
+    return false;
+  }
+
+  ring.entries = params.sq_entries;
+  ring.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring.cqRingSize =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single) {
+    ring.sqRingSize = ring.cqRingSize = max(ring.sqRingSize, ring.cqRingSize);
+  }
+
+  ring.sqRing = mmap(NULL, ring.sqRingSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, ring.fd, IORING_OFF_SQ_RING);
+  ring.cqRing = single ? ring.sqRing
+                       : mmap(NULL, ring.cqRingSize, PROT_READ | PROT_WRITE,
+                              MAP_SHARED, ring.fd, IORING_OFF_CQ_RING);
+  ring.sqes = mmap(NULL, ring.entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd,
+                   IORING_OFF_SQES);
+  if (ring.sqRing == MAP_FAILED || ring.cqRing == MAP_FAILED ||
+      ring.sqes == MAP_FAILED) {
+    ringClose();
+    return false;
+  }
+
+  uint8_t *sq = ring.sqRing;
+  uint8_t *cq = ring.cqRing;
+  ring.sqTail = (unsigned *)(sq + params.sq_off.tail);
+  ring.sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring.sqArray = (unsigned *)(sq + params.sq_off.array);
+  ring.cqHead = (unsigned *)(cq + params.cq_off.head);
+  ring.cqTail = (unsigned *)(cq + params.cq_off.tail);
+  ring.cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return true;
+}
+
+static void completeRead(struct AsyncFile *file, int result);
+static void completeWrite(struct AsyncFile *file, int result);
+
+/**
+ * Hands the completed requests to their files, waiting for one at least
+ * when wait is set.
+ */
+static void ringReap(bool wait) {
+  if (wait) {
+    while (syscall(SYS_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS,
+                   NULL, 0) < 0 &&
+           errno == EINTR) {
+    }
+  }
+
+  unsigned head = *ring.cqHead;
+  const unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+
+  while (head != tail) {
+    const struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqMask];
+    struct AsyncFile *file = (struct AsyncFile *)(uintptr_t)cqe->user_data;
+    const int result = cqe->res;
+
+    // consumed first, as a failed write stops unpaper, which reaps the ring
+    // again to finish the other writes
+    __atomic_store_n(ring.cqHead, ++head, __ATOMIC_RELEASE);
+    ring.inFlight--;
+    if (file->tmpName != NULL) {
+      completeWrite(file, result);
+    } else {
+      completeRead(file, result);
+    }
+  }
+}
+
+/**
+ * Submits the read or write of the rest of a file. Returns false when the
+ * ring cannot take it, and the file is to be read or written on the spot.
+ */
+static bool ringSubmit(struct AsyncFile *file, bool write) {
+  if (ring.fd < 0 || file->size - file->done > UINT_MAX)
+    return false;
+
+  while (ring.inFlight == ring.entries) {
+    ringReap(true);
+  }
+
+  const unsigned tail = *ring.sqTail;
+  const unsigned index = tail & *ring.sqMask;
+  struct io_uring_sqe *sqe = &ring.sqes[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+  sqe->fd = file->fd;
+  sqe->off = file->done;
+  sqe->addr = (uintptr_t)(file->data + file->done);
+  sqe->len = file->size - file->done;
+  sqe->user_data = (uintptr_t)file;
+  ring.sqArray[index] = index;
+  __atomic_store_n(ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+
+  if (syscall(SYS_io_uring_enter, ring.fd, 1, 0, 0, NULL, 0) != 1) {
+    // taken back, as the kernel did not consume it
+    __atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+    return false;
+  }
+
+  ring.inFlight++;
+  file->pending = true;
+  return true;
+}
+
+static void waitFile(struct AsyncFile *file) {
+  while (file->pending) {
+    ringReap(true);
+  }
+}
+#else
+static bool ringOpen(void) { return false; }
+
+static void ringClose(void) {}
+
+static bool ringSubmit(struct AsyncFile *file, bool write) { return false; }
+
+static void waitFile(struct AsyncFile *file) {}
+#endif
+
+/* --- reading ahead ------------------------------------------------------ */
+
+static void dropRead(struct AsyncFile *file) {
+  waitFile(file);
+  if (file->fd >= 0)
+    close(file->fd);
+  free(file->name);
+  free(file->data);
+  memset(file, 0, sizeof(*file));
+  file->fd = -1;
+}
+
+static void completeRead(struct AsyncFile *file, int result) {
+  file->pending = false;
+  if (result > 0) {
+    file->done += result;
+    // the rest of a short read is read on the spot when needed
+    if (file->done == file->size) {
+      close(file->fd);
+      file->fd = -1;
+    }
+  }
+}
+
+/**
+ * Starts reading the file ahead, unless already read or being read. Files
+ * that cannot be opened are left to fail when the sheet loads them.
+ */
+void asyncReadAhead(const char *filename) {
+  struct stat statBuf;
+
+  for (int i = 0; i < readsCount; i++) {
+    if (reads[i].name != NULL && strcmp(reads[i].name, filename) == 0)
+      return;
+  }
+
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return;
+  if (fstat(fd, &statBuf) != 0 || !S_ISREG(statBuf.st_mode) ||
+      statBuf.st_size == 0) {
+    close(fd);
+    return;
+  }
+
+  struct AsyncFile *file = &reads[readsNext];
+  readsNext = (readsNext + 1) % readsCount;
+  dropRead(file);
+
+  file->name = strdup(filename);
+  file->fd = fd;
+  file->size = statBuf.st_size;
+  file->data = malloc(file->size);
+  if (file->name == NULL || file->data == NULL) {
+    dropRead(file);
+    return;
+  }
+
+  if (!ringSubmit(file, false)) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  }
+}
+
+/**
+ * Gives the content of a file read ahead, waiting for its read to complete.
+ * Returns false for files not read ahead, or that could not be read, which
+ * are then read as usual.
+ */
+bool asyncInput(const char *filename, const uint8_t **data, size_t *size) {
+  struct AsyncFile *file = NULL;
+
+  for (int i = 0; i < readsCount && file == NULL; i++) {
+    if (reads[i].name != NULL && strcmp(reads[i].name, filename) == 0)
+      file = &reads[i];
+  }
+  if (file == NULL)
+    return false;
+
+  waitFile(file);
+  while (file->done < file->size) {
+    const ssize_t read = pread(file->fd, file->data + file->done,
+                               file->size - file->done, file->done);
+    if (read < 0 && errno == EINTR)
+      continue;
+    if (read <= 0) {
+      dropRead(file);
+      return false;
+    }
+    file->done += read;
+  }
+  if (file->fd >= 0) {
+    close(file->fd);
+    file->fd = -1;
+  }
+
+  *data = file->data;
+  *size = file->size;
+  return true;
+}
+
+/* --- writing behind ----------------------------------------------------- */
+
+static void completeWrite(struct AsyncFile *file, int result) {
+  file->pending = false;
+  if (result > 0)
+    file->done += result;
+
+  // the rest of a short or failed write is written on the spot
+  while (file->done < file->size) {
+    const ssize_t written = pwrite(file->fd, file->data + file->done,
+                                   file->size - file->done, file->done);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      break;
+    file->done += written;
+  }
+
+  const bool complete = (file->done == file->size);
+  if (close(file->fd) != 0 || !complete ||
+      rename(file->tmpName, file->name) != 0) {
+    unlink(file->tmpName);
+    // unpaper is stopping already
+    if (!aborting)
+      errOutput("unable to write %s.", file->name);
+  }
+
+  if (file->release != NULL)
+    file->release(file->opaque);
+  free(file->name);
+  free(file->tmpName);
+  memset(file, 0, sizeof(*file));
+  file->fd = -1;
+}
+
+/**
+ * Writes an output file, to a temporary file renamed once complete as for
+ * every output file, and calls release with opaque once the data is no
+ * longer needed. The write completes later on, at the latest by
+ * asyncFlush(), unless written on the spot.
+ */
+void asyncWrite(const char *filename, const uint8_t *data, size_t size,
+                void (*release)(void *opaque), void *opaque) {
+  int slot = 0;
+
+  while (slot < ASYNC_QUEUE_DEPTH && writes[slot].name != NULL) {
+    slot++;
+  }
+  if (slot == ASYNC_QUEUE_DEPTH) {
+    slot = 0;
+    waitFile(&writes[slot]);
+  }
+
+  char *tmpName = malloc(strlen(filename) + 5);
+  sprintf(tmpName, "%s.tmp", filename);
+  const int fd = open(tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    errOutput("cannot open %s for writing.", tmpName);
+
+  struct AsyncFile *file = &writes[slot];
+  file->name = strdup(filename);
+  file->tmpName = tmpName;
+  file->fd = fd;
+  file->data = (uint8_t *)data;
+  file->size = size;
+  file->done = 0;
+  file->release = release;
+  file->opaque = opaque;
+
+  if (!ringSubmit(file, true))
+    completeWrite(file, 0);
+}
+
+/**
+ * Waits for the output files written so far to be complete.
+ */
+void asyncFlush(void) {
+  for (int i = 0; i < ASYNC_QUEUE_DEPTH; i++) {
+    waitFile(&writes[i]);
+  }
+}
+
+/**
+ * Finishes the writes left when a fatal error stops unpaper: the output files
+ * of the sheets processed before it are written out as they would have been
+ * on the spot, and the temporary files of those that fail are removed.
+ */
+void asyncAbort(void) {
+  if (!enabled || aborting)
+    return;
+
+  aborting = true;
+  asyncFlush();
+}
+
+/* --- setup -------------------------------------------------------------- */
+
+/**
+ * Sets up reading ahead the input files of as many sheets, and writing the
+ * output files behind.
+ */
+void asyncInit(int sheets, VERBOSE_LEVEL verbose) {
+  enabled = true;
+
+  // up to two pages for each sheet read ahead, and for the one processed
+  readsCount = 2 * (sheets + 1);
+  reads = calloc(readsCount, sizeof(struct AsyncFile));
+  for (int i = 0; i < readsCount; i++) {
+    reads[i].fd = -1;
+  }
+  for (int i = 0; i < ASYNC_QUEUE_DEPTH; i++) {
+    writes[i].fd = -1;
+  }
+
+  if (!ringOpen() && verbose >= VERBOSE_MORE) {
+    printf("io_uring not available, reading ahead through the page cache.\n");
+  }
+}
+
+bool asyncEnabled(void) { return enabled; }
+
+void asyncClose(void) {
+  if (!enabled)
+    return;
+
+  asyncFlush();
+  for (int i = 0; i < readsCount; i++) {
+    dropRead(&reads[i]);
+  }
+  free(reads);
+  reads = NULL;
+  readsCount = 0;
+  readsNext = 0;
+
+  ringClose();
+  enabled = false;
+}
@@ -0,0 +1,30 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+
+/* --- asynchronous file I/O ---------------------------------------------- */
+
+void asyncInit(int sheets, VERBOSE_LEVEL verbose);
+
+bool asyncEnabled(void);
+
+void asyncReadAhead(const char *filename);
+
+bool asyncInput(const char *filename, const uint8_t **data, size_t *size);
+
+void asyncWrite(const char *filename, const uint8_t *data, size_t size,
+                void (*release)(void *opaque), void *opaque);
+
+void asyncFlush(void);
+
+void asyncAbort(void);
+
+void asyncClose(void);
@@ -0,0 +1,503 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- micro-benchmarks of the image primitives --------------------------- */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+
+#include "../cpu.h"
+#include "../imageprocess.h"
+#include "../parallel.h"
+#include "../tools.h"
+#include "../unpaper.h"
+
+#define BENCH_DEFAULT_TILE 1024
+#define BENCH_DEFAULT_WARMUP 2
+#define BENCH_DEFAULT_REPEAT 15
+
+static const int benchFormats[] = {
+    AV_PIX_FMT_GRAY8,     AV_PIX_FMT_Y400A,     AV_PIX_FMT_RGB24,
+    AV_PIX_FMT_MONOWHITE, AV_PIX_FMT_MONOBLACK,
+};
+#define BENCH_FORMATS_COUNT (sizeof(benchFormats) / sizeof(benchFormats[0]))
+
+static const char *interpolateNames[INTERP_FUNCTIONS_COUNT] = {
+    [INTERP_NN] = "nearest",
+    [INTERP_LINEAR] = "linear",
+    [INTERP_CUBIC] = "cubic",
+};
+
+struct BenchKernel;
+
+typedef void (*BenchFunction)(const struct BenchKernel *kernel, AVFrame *tile,
+                              AVFrame *target);
+
+struct BenchKernel {
+  char name[64];
+  BenchFunction run;
+  int format;
+  // format of the target image, for kernels writing to a second image
+  int targetFormat;
+  int interpolation;
+  // kernels changing the tile get a fresh copy before each sample
+  bool modifies;
+  // pixels visited per run, for the throughput
+  long long pixels;
+};
+
+// keeps the compiler from dropping the results of the measured calls
+static volatile long long benchSink;
+
+/* --- kernels ------------------------------------------------------------ */
+
+// the options the kernels run with, set up in main()
+static struct Options options;
+
+static void benchGetPixel(const struct BenchKernel *kernel, AVFrame *tile,
+                          AVFrame *target) {
+  long long sum = 0;
+
+  for (int y = 0; y < tile->height; y++) {
+    for (int x = 0; x < tile->width; x++) {
+      sum += getPixel(x, y, tile);
+    }
+  }
+  benchSink = sum;
+}
+
+static void benchSetPixel(const struct BenchKernel *kernel, AVFrame *tile,
+                          AVFrame *target) {
+  for (int y = 0; y < tile->height; y++) {
+    for (int x = 0; x < tile->width; x++) {
+      setPixel(((x ^ y) & 8) ? WHITE24 : BLACK24, x, y, tile,
+               options.absBlackThreshold);
+    }
+  }
+}
+
+static void benchCountPixelsRect(const struct BenchKernel *kernel,
+                                 AVFrame *tile, AVFrame *target) {
+  benchSink = countPixelsRect(0, 0, tile->width - 1, tile->height - 1, 0,
+                              options.absBlackThreshold, false, tile);
+}
+
+static void benchInverseBrightnessRect(const struct BenchKernel *kernel,
+                                       AVFrame *tile, AVFrame *target) {
+  benchSink =
+      inverseBrightnessRect(0, 0, tile->width - 1, tile->height - 1, tile);
+}
+
+static void benchInverseLightnessRect(const struct BenchKernel *kernel,
+                                      AVFrame *tile, AVFrame *target) {
+  benchSink =
+      inverseLightnessRect(0, 0, tile->width - 1, tile->height - 1, tile);
+}
+
+static void benchDarknessRect(const struct BenchKernel *kernel, AVFrame *tile,
+                              AVFrame *target) {
+  benchSink = darknessRect(0, 0, tile->width - 1, tile->height - 1, tile);
+}
+
+static void benchFloodFill(const struct BenchKernel *kernel, AVFrame *tile,
+                           AVFrame *target) {
+  // the tile has a dark blot in the middle, as removed by the blackfilter
+  floodFill(tile->width / 2, tile->height / 2, WHITE24, 0,
+            options.absBlackThreshold, options.blackfilterIntensity, tile,
+            options.absBlackThreshold);
+}
+
+static void benchCountPixelNeighbors(const struct BenchKernel *kernel,
+                                     AVFrame *tile, AVFrame *target) {
+  long long sum = 0;
+
+  for (int y = 0; y < tile->height; y += 4) {
+    for (int x = 0; x < tile->width; x += 4) {
+      sum += countPixelNeighbors(x, y, options.noisefilterIntensity,
+                                 options.absWhiteThreshold, tile);
+    }
+  }
+  benchSink = sum;
+}
+
+static void benchRotate(const struct BenchKernel *kernel, AVFrame *tile,
+                        AVFrame *target) {
+  options.interpolateType = kernel->interpolation;
+  rotate(&options, degreesToRadians(1.5), tile, target);
+}
+
+static void benchCopyImageArea(const struct BenchKernel *kernel, AVFrame *tile,
+                               AVFrame *target) {
+  copyImageArea(0, 0, tile->width, tile->height, tile, 0, 0, target,
+                options.absBlackThreshold);
+}
+
+static void benchBlackfilter(const struct BenchKernel *kernel, AVFrame *tile,
+                             AVFrame *target) {
+  blackfilter(&options, tile);
+}
+
+static void benchNoisefilter(const struct BenchKernel *kernel, AVFrame *tile,
+                             AVFrame *target) {
+  benchSink = noisefilter(&options, tile);
+}
+
+static void benchBlurfilter(const struct BenchKernel *kernel, AVFrame *tile,
+                            AVFrame *target) {
+  benchSink = blurfilter(&options, tile);
+}
+
+static void benchGrayfilter(const struct BenchKernel *kernel, AVFrame *tile,
+                            AVFrame *target) {
+  benchSink = grayfilter(&options, tile);
+}
+
+/* --- kernel table ------------------------------------------------------- */
+
+static struct BenchKernel *kernels = NULL;
+static int kernelCount = 0;
+
+static struct BenchKernel *addKernel(BenchFunction run, int format,
+                                     bool modifies, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static struct BenchKernel *addKernel(BenchFunction run, int format,
+                                     bool modifies, const char *fmt, ...) {
+  struct BenchKernel *kernel;
+  va_list vl;
+
+  kernels = realloc(kernels, (kernelCount + 1) * sizeof(kernels[0]));
+  if (kernels == NULL)
+    errOutput("unable to allocate benchmark kernels.");
+  kernel = &kernels[kernelCount++];
+
+  memset(kernel, 0, sizeof(*kernel));
+  kernel->run = run;
+  kernel->format = format;
+  kernel->targetFormat = AV_PIX_FMT_NONE;
+  kernel->modifies = modifies;
+
+  va_start(vl, fmt);
+  vsnprintf(kernel->name, sizeof(kernel->name), fmt, vl);
+  va_end(vl);
+
+  return kernel;
+}
+
+static void registerKernels(int tileSize) {
+  const long long pixels = (long long)tileSize * tileSize;
+
+  for (size_t i = 0; i < BENCH_FORMATS_COUNT; i++) {
+    const int format = benchFormats[i];
+    const char *name = av_get_pix_fmt_name(format);
+    struct {
+      const char *name;
+      BenchFunction run;
+      bool modifies;
+      long long pixels;
+    } perFormat[] = {
+        {"getPixel", benchGetPixel, false, pixels},
+        {"setPixel", benchSetPixel, true, pixels},
+        {"countPixelsRect", benchCountPixelsRect, false, pixels},
+        {"inverseBrightnessRect", benchInverseBrightnessRect, false, pixels},
+        {"inverseLightnessRect", benchInverseLightnessRect, false, pixels},
+        {"darknessRect", benchDarknessRect, false, pixels},
+        {"floodFill", benchFloodFill, true, pixels},
+        {"countPixelNeighbors", benchCountPixelNeighbors, false, pixels / 16},
+        {"blackfilter", benchBlackfilter, true, pixels},
+        {"noisefilter", benchNoisefilter, true, pixels},
+        {"blurfilter", benchBlurfilter, true, pixels},
+        {"grayfilter", benchGrayfilter, true, pixels},
+    };
+
+    for (size_t k = 0; k < sizeof(perFormat) / sizeof(perFormat[0]); k++) {
+      addKernel(perFormat[k].run, format, perFormat[k].modifies, "%s/%s",
+                perFormat[k].name, name)
+          ->pixels = perFormat[k].pixels;
+    }
+
+    for (int interp = 0; interp < INTERP_FUNCTIONS_COUNT; interp++) {
+      struct BenchKernel *kernel =
+          addKernel(benchRotate, format, false, "rotate/%s/%s",
+                    interpolateNames[interp], name);
+      kernel->targetFormat = format;
+      kernel->interpolation = interp;
+      kernel->pixels = pixels;
+    }
+
+    for (size_t j = 0; j < BENCH_FORMATS_COUNT; j++) {
+      struct BenchKernel *kernel =
+          addKernel(benchCopyImageArea, format, false, "copyImageArea/%s/%s",
+                    name, av_get_pix_fmt_name(benchFormats[j]));
+      kernel->targetFormat = benchFormats[j];
+      kernel->pixels = pixels;
+    }
+  }
+}
+
+/* --- test tile ---------------------------------------------------------- */
+
+static uint32_t benchRandom(uint32_t *state) {
+  // xorshift32, so that every run measures the same tile
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+/**
+ * Creates a tile looking like a piece of a scanned page: lines of glyph-like
+ * marks, specks of noise, a gray smudge and a dark blot in the middle.
+ */
+static AVFrame *createTile(int tileSize, int format) {
+  AVFrame *tile = NULL;
+  uint32_t state = 0x2545f491;
+
+  initImage(&tile, tileSize, tileSize, format);
+  fillImage(tile, options.sheetBackground, options.absBlackThreshold);
+
+  for (int top = tileSize / 16; top + 24 < tileSize; top += 40) {
+    for (int left = tileSize / 16; left + 16 < tileSize; left += 18) {
+      const int height = (benchRandom(&state) % 3 == 0) ? 24 : 16;
+
+      if (benchRandom(&state) % 6 == 0)
+        continue; // space between words
+      for (int y = top + 24 - height; y < top + 24; y++) {
+        for (int x = left; x < left + 3; x++) {
+          setPixel(BLACK24, x, y, tile, options.absBlackThreshold);
+        }
+      }
+      for (int x = left; x < left + 12; x++) {
+        setPixel(BLACK24, x, top + 8, tile, options.absBlackThreshold);
+        setPixel(BLACK24, x, top + 23, tile, options.absBlackThreshold);
+      }
+    }
+  }
+
+  for (int i = 0; i < tileSize * tileSize / 2000; i++) {
+    setPixel(GRAY24, benchRandom(&state) % tileSize,
+             benchRandom(&state) % tileSize, tile, options.absBlackThreshold);
+  }
+
+  for (int y = 0; y < tileSize / 8; y++) {
+    for (int x = 0; x < tileSize / 8; x++) {
+      setPixel(0x808080, tileSize / 8 + x, tileSize - tileSize / 4 + y, tile,
+               options.absBlackThreshold);
+    }
+  }
+
+  for (int y = tileSize / 2 - tileSize / 8; y < tileSize / 2 + tileSize / 8;
+       y++) {
+    for (int x = tileSize / 2 - tileSize / 8; x < tileSize / 2 + tileSize / 8;
+         x++) {
+      setPixel(BLACK24, x, y, tile, options.absBlackThreshold);
+    }
+  }
+
+  return tile;
+}
+
+/* --- measurement -------------------------------------------------------- */
+
+struct BenchResult {
+  int samples;
+  double min;
+  double median;
+  double mean;
+  double stddev;
+};
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compareDouble(const void *a, const void *b) {
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void runKernel(const struct BenchKernel *kernel, int tileSize,
+                      int warmup, int repeat, struct BenchResult *result) {
+  AVFrame *source = createTile(tileSize, kernel->format);
+  AVFrame *tile = NULL;
+  AVFrame *target = NULL;
+  double *samples = calloc(repeat, sizeof(double));
+  double sum = 0.0;
+  double squares = 0.0;
+
+  if (samples == NULL)
+    errOutput("unable to allocate benchmark samples.");
+
+  initImage(&tile, tileSize, tileSize, kernel->format);
+  if (kernel->targetFormat != AV_PIX_FMT_NONE) {
+    initImage(&target, tileSize, tileSize, kernel->targetFormat);
+    fillImage(target, options.sheetBackground, options.absBlackThreshold);
+  }
+
+  for (int i = 0; i < warmup + repeat; i++) {
+    if (i == 0 || kernel->modifies)
+      av_frame_copy(tile, source);
+
+    const double start = now();
+    kernel->run(kernel, tile, target);
+    const double elapsed = now() - start;
+
+    if (i >= warmup)
+      samples[i - warmup] = elapsed;
+  }
+
+  for (int i = 0; i < repeat; i++) {
+    sum += samples[i];
+  }
+  result->samples = repeat;
+  result->mean = sum / repeat;
+  for (int i = 0; i < repeat; i++) {
+    squares += (samples[i] - result->mean) * (samples[i] - result->mean);
+  }
+  result->stddev = (repeat > 1) ? sqrt(squares / (repeat - 1)) : 0.0;
+
+  qsort(samples, repeat, sizeof(double), compareDouble);
+  result->min = samples[0];
+  result->median = (repeat % 2) ? samples[repeat / 2]
+                                : (samples[repeat / 2 - 1] +
+                                   samples[repeat / 2]) /
+                                      2;
+
+  free(samples);
+  av_frame_free(&source);
+  av_frame_free(&tile);
+  av_frame_free(&target);
+}
+
+static void writeResult(FILE *f, const struct BenchKernel *kernel,
+                        const struct BenchResult *result, bool first) {
+  fprintf(f,
+          "%s\n    {\"name\": \"%s\", \"pixels\": %lld, \"samples\": %d, "
+          "\"min\": %.9f, \"median\": %.9f, \"mean\": %.9f, "
+          "\"stddev\": %.9f}",
+          first ? "" : ",", kernel->name, kernel->pixels, result->samples,
+          result->min, result->median, result->mean, result->stddev);
+}
+
+static const struct option benchOptions[] = {
+    {"filter", required_argument, NULL, 'f'},
+    {"tile", required_argument, NULL, 't'},
+    {"warmup", required_argument, NULL, 'w'},
+    {"repeat", required_argument, NULL, 'r'},
+    {"json", required_argument, NULL, 'j'},
+    {"list", no_argument, NULL, 'l'},
+    {NULL, no_argument, NULL, 0},
+};
+
+int main(int argc, char *argv[]) {
+  const char *filter = NULL;
+  const char *jsonFilename = NULL;
+  int tileSize = BENCH_DEFAULT_TILE;
+  int warmup = BENCH_DEFAULT_WARMUP;
+  int repeat = BENCH_DEFAULT_REPEAT;
+  bool list = false;
+  FILE *json = NULL;
+  bool first = true;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "f:t:w:r:j:l", benchOptions, NULL)) !=
+         -1) {
+    switch (c) {
+    case 'f':
+      filter = optarg;
+      break;
+    case 't':
+      tileSize = atoi(optarg);
+      break;
+    case 'w':
+      warmup = atoi(optarg);
+      break;
+    case 'r':
+      repeat = atoi(optarg);
+      break;
+    case 'j':
+      jsonFilename = optarg;
+      break;
+    case 'l':
+      list = true;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [--filter SUBSTRING] [--tile SIZE] "
+                      "[--warmup N] [--repeat N] [--json FILE] [--list]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  if (tileSize < 64 || warmup < 0 || repeat < 1)
+    errOutput("invalid benchmark parameters.");
+
+  // same defaults as the program, set when parsing the command line
+  optionsInit(&options);
+  options.verbose = VERBOSE_QUIET;
+  updateAbsoluteParameters(&options);
+  cpuInit(options.verbose);
+
+  registerKernels(tileSize);
+
+  if (jsonFilename != NULL) {
+    json = fopen(jsonFilename, "w");
+    if (json == NULL)
+      errOutput("unable to open %s.", jsonFilename);
+    fprintf(json,
+            "{\"tile\": %d, \"warmup\": %d, \"repeat\": %d, "
+            "\"kernels\": [",
+            tileSize, warmup, repeat);
+  }
+
+  if (!list) {
+    printf("%-44s %12s %12s %8s %10s\n", "kernel", "median us", "min us",
+           "stddev", "Mpx/s");
+  }
+
+  for (int i = 0; i < kernelCount; i++) {
+    const struct BenchKernel *kernel = &kernels[i];
+    struct BenchResult result;
+
+    if (filter != NULL && strstr(kernel->name, filter) == NULL)
+      continue;
+    if (list) {
+      printf("%s\n", kernel->name);
+      continue;
+    }
+
+    runKernel(kernel, tileSize, warmup, repeat, &result);
+    printf("%-44s %12.1f %12.1f %7.1f%% %10.2f\n", kernel->name,
+           result.median * 1e6, result.min * 1e6,
+           100.0 * result.stddev / result.mean,
+           kernel->pixels / result.median / 1e6);
+    fflush(stdout);
+
+    if (json != NULL) {
+      writeResult(json, kernel, &result, first);
+      first = false;
+    }
+  }
+
+  if (json != NULL) {
+    fprintf(json, "\n  ]}\n");
+    fclose(json);
+  }
+
+  free(kernels);
+  return 0;
+}
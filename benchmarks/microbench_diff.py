@@ -0,0 +1,84 @@
+# SPDX-FileCopyrightText: 2021 The unpaper authors
+#
+# SPDX-License-Identifier: GPL-2.0-only
+# SPDX-License-Identifier: MIT
+
+"""Compares two result files of the unpaper micro-benchmarks.
+
+A kernel is reported as changed when its median time moved by more than the
+threshold, and by more than the noise of both runs, estimated as twice their
+standard deviations.
+"""
+
+import argparse
+import json
+import pathlib
+import sys
+
+
+def load(path: pathlib.Path) -> dict[str, dict]:
+    results = json.loads(path.read_text())
+    return {kernel["name"]: kernel for kernel in results["kernels"]}
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline", type=pathlib.Path)
+    parser.add_argument("contender", type=pathlib.Path)
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=5.0,
+        help="minimum change of the median to report, in percent",
+    )
+    parser.add_argument(
+        "--all", action="store_true", help="also list the unchanged kernels"
+    )
+    parser.add_argument(
+        "--fail-on-regression",
+        action="store_true",
+        help="exit with an error if any kernel got slower",
+    )
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    contender = load(args.contender)
+    regressions = 0
+
+    print(f"{'kernel':<44} {'baseline us':>12} {'contender us':>12} {'change':>8}")
+    for name, old in baseline.items():
+        new = contender.get(name)
+        if new is None:
+            print(f"{name:<44} {old['median'] * 1e6:12.1f} {'-':>12} {'gone':>8}")
+            continue
+
+        change = 100.0 * (new["median"] - old["median"]) / old["median"]
+        noise = 2 * (old["stddev"] + new["stddev"])
+        significant = (
+            abs(change) >= args.threshold
+            and abs(new["median"] - old["median"]) > noise
+        )
+        if significant and change > 0:
+            verdict = "slower"
+            regressions += 1
+        elif significant:
+            verdict = "faster"
+        else:
+            verdict = ""
+
+        if significant or args.all:
+            print(
+                f"{name:<44} {old['median'] * 1e6:12.1f} "
+                f"{new['median'] * 1e6:12.1f} {change:+7.1f}% {verdict}"
+            )
+
+    for name in sorted(contender.keys() - baseline.keys()):
+        new = contender[name]
+        print(f"{name:<44} {'-':>12} {new['median'] * 1e6:12.1f} {'new':>8}")
+
+    if args.fail_on_regression and regressions > 0:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
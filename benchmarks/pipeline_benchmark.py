@@ -0,0 +1,157 @@
+# SPDX-FileCopyrightText: 2021 The unpaper authors
+#
+# SPDX-License-Identifier: GPL-2.0-only
+# SPDX-License-Identifier: MIT
+
+"""Measures the throughput of unpaper on a synthetic page corpus.
+
+Each page of the corpus is processed with the full pipeline, and then once
+per filter with every other filter disabled. The stage timings reported by
+unpaper --timings are turned into pixels per second for each stage.
+"""
+
+import argparse
+import json
+import os
+import pathlib
+import statistics
+import sys
+import tempfile
+from typing import Optional, Sequence
+
+import stage_timings
+import synthetic_pages
+
+# filters that can be disabled with --no-<filter>
+FILTERS = (
+    "blackfilter",
+    "noisefilter",
+    "blurfilter",
+    "grayfilter",
+    "mask-scan",
+    "mask-center",
+    "deskew",
+    "border-scan",
+)
+
+# filters run on their own, with the stages they are measured by; deskewing
+# works on the masks, so it needs the mask scan too
+ISOLATED = {
+    "blackfilter": (("blackfilter",), "blackfilter"),
+    "noisefilter": (("noisefilter",), "noisefilter"),
+    "blurfilter": (("blurfilter",), "blurfilter"),
+    "grayfilter": (("grayfilter",), "grayfilter"),
+    "mask-scan": (("mask-scan",), "mask-detect"),
+    "deskew": (("mask-scan", "deskew"), "deskew-detect"),
+    "border-scan": (("border-scan",), "border-scan"),
+}
+
+
+def measure(
+    unpaper: str,
+    spec: synthetic_pages.PageSpec,
+    source: pathlib.Path,
+    workdir: pathlib.Path,
+    options: Sequence[str],
+    repeat: int,
+) -> dict:
+    """Runs unpaper repeat times, keeping the median wall time and the stage
+    timings of the fastest run."""
+
+    if spec.layout == "double":
+        options = ["--layout", "double"] + list(options)
+    runs = [
+        stage_timings.run_unpaper(unpaper, options, source, workdir)
+        for _ in range(repeat)
+    ]
+    walls = [wall for wall, _ in runs]
+    _, records = min(runs, key=lambda run: run[0])
+    pixels = spec.size[0] * spec.size[1]
+    stages = stage_timings.stage_totals(records)
+
+    median = statistics.median(walls)
+    return {
+        "wall": median,
+        "walls": walls,
+        "pixels": pixels,
+        "pixels_per_second": pixels / median,
+        "stages": stages,
+    }
+
+
+def megapixels(value: Optional[float]) -> str:
+    return f"{value / 1e6:10.2f}" if value is not None else f"{'-':>10}"
+
+
+def print_result(name: str, result: dict, stage: Optional[str] = None) -> None:
+    stage_rate = None
+    if stage is not None and stage in result["stages"]:
+        stage_rate = result["stages"][stage]["pixels_per_second"]
+    print(
+        f"{name:<40} {result['wall']:9.3f} "
+        f"{megapixels(result['pixels_per_second'])} {megapixels(stage_rate)}"
+    )
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument(
+        "--unpaper",
+        default=os.getenv("TEST_UNPAPER_BINARY", "unpaper"),
+        help="unpaper binary to measure",
+    )
+    parser.add_argument(
+        "--corpus",
+        type=pathlib.Path,
+        help="directory keeping the generated pages between runs",
+    )
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument(
+        "--no-isolated",
+        dest="isolated",
+        action="store_false",
+        help="only measure the full pipeline",
+    )
+    parser.add_argument(
+        "--json", type=pathlib.Path, help="write the results to a JSON file"
+    )
+    synthetic_pages.add_arguments(parser)
+    args = parser.parse_args()
+
+    results = {}
+    with tempfile.TemporaryDirectory(prefix="unpaper-bench-") as tmp:
+        workdir = pathlib.Path(tmp)
+        specs = synthetic_pages.specs_from_arguments(args)
+        sources = synthetic_pages.write_corpus(args.corpus or workdir, specs)
+
+        print(f"{'page / stage':<40} {'wall s':>9} {'Mpx/s':>10} {'stage Mpx/s':>10}")
+        for spec, source in zip(specs, sources):
+            result = measure(args.unpaper, spec, source, workdir, [], args.repeat)
+            result["isolated"] = {}
+            print_result(spec.name, result)
+            for stage, stage_result in sorted(result["stages"].items()):
+                print(
+                    f"  {stage:<38} {stage_result['wall']:9.3f} "
+                    f"{megapixels(stage_result['pixels_per_second'])}"
+                )
+
+            if args.isolated:
+                for name, (enabled, stage) in ISOLATED.items():
+                    options = [
+                        f"--no-{filter}" for filter in FILTERS if filter not in enabled
+                    ]
+                    isolated = measure(
+                        args.unpaper, spec, source, workdir, options, args.repeat
+                    )
+                    result["isolated"][name] = isolated
+                    print_result(f"  only {name}", isolated, stage)
+
+            results[spec.name] = result
+            sys.stdout.flush()
+
+    if args.json is not None:
+        args.json.write_text(json.dumps(results, indent=2) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,50 @@
+# SPDX-FileCopyrightText: 2021 The unpaper authors
+#
+# SPDX-License-Identifier: GPL-2.0-only
+# SPDX-License-Identifier: MIT
+
+"""Runs unpaper with --timings and collects the time spent in each stage."""
+
+import json
+import pathlib
+import subprocess
+import time
+from typing import Sequence
+
+
+def run_unpaper(
+    unpaper: str,
+    options: Sequence[str],
+    source: pathlib.Path,
+    workdir: pathlib.Path,
+) -> tuple[float, list[dict]]:
+    """Processes source once, returns the wall time and the stage records."""
+
+    timings = workdir / "timings.jsonl"
+    result = workdir / ("result" + source.suffix)
+    cmdline = [unpaper, "-q", "--overwrite", "--timings", str(timings)]
+    cmdline += list(options) + [str(source), str(result)]
+
+    start = time.perf_counter()
+    subprocess.run(cmdline, check=True)
+    wall = time.perf_counter() - start
+
+    records = [json.loads(line) for line in timings.read_text().splitlines()]
+    return wall, records
+
+
+def stage_totals(records: Sequence[dict]) -> dict[str, dict]:
+    """Sums the wall time and the pixels processed by each stage."""
+
+    stages = {}
+    for record in records:
+        if record["stage"] == "sheet":
+            continue
+        stage = stages.setdefault(record["stage"], {"wall": 0.0, "pixels": 0})
+        stage["wall"] += record["wall"]
+        stage["pixels"] += record["width"] * record["height"]
+    for stage in stages.values():
+        stage["pixels_per_second"] = (
+            stage["pixels"] / stage["wall"] if stage["wall"] > 0 else None
+        )
+    return stages
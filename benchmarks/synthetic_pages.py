@@ -0,0 +1,253 @@
+# SPDX-FileCopyrightText: 2021 The unpaper authors
+#
+# SPDX-License-Identifier: GPL-2.0-only
+# SPDX-License-Identifier: MIT
+
+"""Deterministic generator of synthetic scanned pages.
+
+The pages imitate printed text as it comes out of a scanner: lines of
+glyph-sized marks grouped in words and paragraphs, a slight skew, dark
+borders left by the scanner lid and specks of noise. The same parameters
+always produce the same pixels, so the pages can be regenerated anywhere
+instead of being stored or downloaded.
+"""
+
+import argparse
+import dataclasses
+import hashlib
+import itertools
+import pathlib
+import random
+from typing import Iterator, Sequence
+
+import PIL.Image
+import PIL.ImageDraw
+import PIL.ImageOps
+
+KINDS = ("bitonal", "gray", "color")
+RESOLUTIONS = (150, 300, 600, 1200)
+LAYOUTS = ("single", "double")
+
+# unless the full matrix is asked for, one page of each kind
+DEFAULT_RESOLUTIONS = (300,)
+DEFAULT_LAYOUTS = ("single",)
+
+# A4 portrait, in inches
+PAGE_SIZE = (8.27, 11.69)
+
+_SUFFIXES = {"bitonal": ".pbm", "gray": ".pgm", "color": ".ppm"}
+
+
+@dataclasses.dataclass(frozen=True)
+class PageSpec:
+    kind: str = "bitonal"
+    dpi: int = 300
+    layout: str = "single"
+    # fraction of the pixels covered by specks of noise
+    noise: float = 0.0005
+    # rotation of the printed content, in degrees
+    skew: float = 1.0
+    # width of the dark scanner borders, in inches
+    border: float = 0.25
+    seed: int = 1
+
+    @property
+    def name(self) -> str:
+        return f"{self.kind}-{self.dpi}dpi-{self.layout}"
+
+    @property
+    def size(self) -> tuple[int, int]:
+        width = round(PAGE_SIZE[0] * self.dpi)
+        height = round(PAGE_SIZE[1] * self.dpi)
+        if self.layout == "double":
+            return (2 * width, height)
+        return (width, height)
+
+
+def _draw_text(
+    draw: PIL.ImageDraw.ImageDraw,
+    rng: random.Random,
+    box: tuple[int, int, int, int],
+    dpi: int,
+) -> None:
+    """Fills box with lines of glyph-like marks, at about 11pt."""
+
+    left, top, right, bottom = box
+    line_height = round(dpi * 0.17)
+    x_height = max(1, round(dpi * 0.05))
+    ascender = max(2, round(dpi * 0.075))
+    glyph_width = max(1, round(dpi * 0.055))
+    stroke = max(1, round(dpi * 0.012))
+    space = max(2, round(dpi * 0.04))
+
+    y = top
+    while y + line_height <= bottom:
+        # paragraph breaks, with the last line of a paragraph left short
+        if rng.random() < 0.08:
+            y += line_height
+            continue
+        baseline = y + ascender
+        end = right if rng.random() > 0.12 else rng.randint(left, right)
+        x = left + (3 * glyph_width if rng.random() < 0.1 else 0)
+        while x < end:
+            for _ in range(rng.randint(1, 10)):
+                if x + glyph_width > end:
+                    break
+                height = ascender if rng.random() < 0.3 else x_height
+                draw.rectangle(
+                    (x, baseline - height, x + stroke - 1, baseline),
+                    fill=0,
+                )
+                right_edge = x + glyph_width - stroke
+                draw.rectangle(
+                    (x, baseline - x_height, right_edge, baseline - x_height + stroke),
+                    fill=0,
+                )
+                if rng.random() < 0.5:
+                    draw.rectangle(
+                        (x, baseline - stroke, right_edge, baseline), fill=0
+                    )
+                x += glyph_width
+            x += space
+        y += line_height
+
+
+def generate(spec: PageSpec) -> PIL.Image.Image:
+    """Generates the page described by spec."""
+
+    rng = random.Random(repr(spec))
+    width, height = spec.size
+    pages = 2 if spec.layout == "double" else 1
+    page_width = width // pages
+    margin = spec.dpi
+
+    image = PIL.Image.new("L", (width, height), 255)
+    draw = PIL.ImageDraw.Draw(image)
+    for page in range(pages):
+        _draw_text(
+            draw,
+            rng,
+            (
+                page * page_width + margin,
+                margin,
+                (page + 1) * page_width - margin,
+                height - margin,
+            ),
+            spec.dpi,
+        )
+
+    if spec.skew:
+        image = image.rotate(
+            spec.skew,
+            resample=PIL.Image.Resampling.BILINEAR,
+            fillcolor=255,
+        )
+    draw = PIL.ImageDraw.Draw(image)
+
+    # uneven dark borders, as left by the scanner lid
+    if spec.border > 0:
+        border = spec.border * spec.dpi
+        for edge in range(4):
+            depth = round(border * rng.uniform(0.5, 1.5))
+            shade = rng.randint(0, 40)
+            draw.rectangle(
+                [
+                    (0, 0, depth, height),
+                    (0, 0, width, depth),
+                    (width - depth, 0, width, height),
+                    (0, height - depth, width, height),
+                ][edge],
+                fill=shade,
+            )
+
+    specks = round(spec.noise * width * height)
+    speck_size = max(1, spec.dpi // 300)
+    for _ in range(specks):
+        x = rng.randrange(width)
+        y = rng.randrange(height)
+        draw.rectangle(
+            (x, y, x + speck_size - 1, y + speck_size - 1),
+            fill=rng.randint(0, 96),
+        )
+
+    if spec.kind == "bitonal":
+        return image.point(lambda v: 255 if v >= 128 else 0).convert(
+            "1", dither=PIL.Image.Dither.NONE
+        )
+    if spec.kind == "gray":
+        return image.point(lambda v: 24 + v * 208 // 255)
+    return PIL.ImageOps.colorize(image, black=(24, 24, 56), white=(246, 241, 228))
+
+
+def corpus(
+    kinds: Sequence[str] = KINDS,
+    resolutions: Sequence[int] = RESOLUTIONS,
+    layouts: Sequence[str] = LAYOUTS,
+    **kwargs,
+) -> Iterator[PageSpec]:
+    for kind, dpi, layout in itertools.product(kinds, resolutions, layouts):
+        yield PageSpec(kind=kind, dpi=dpi, layout=layout, **kwargs)
+
+
+def write_corpus(
+    directory: pathlib.Path, specs: Sequence[PageSpec]
+) -> list[pathlib.Path]:
+    """Generates the pages in directory, unless already there."""
+
+    directory.mkdir(parents=True, exist_ok=True)
+    paths = []
+    for spec in specs:
+        # the digest tells apart pages generated with different noise, skew,
+        # border or seed
+        digest = hashlib.sha256(repr(spec).encode()).hexdigest()[:8]
+        path = directory / f"{spec.name}-{digest}{_SUFFIXES[spec.kind]}"
+        if not path.exists():
+            partial = path.with_name(path.name + ".tmp")
+            generate(spec).save(partial, format="PPM")
+            partial.replace(path)
+        paths.append(path)
+    return paths
+
+
+def add_arguments(parser: argparse.ArgumentParser) -> None:
+    parser.add_argument("--kind", choices=KINDS, action="append")
+    parser.add_argument("--dpi", type=int, choices=RESOLUTIONS, action="append")
+    parser.add_argument("--layout", choices=LAYOUTS, action="append")
+    parser.add_argument("--noise", type=float, default=PageSpec.noise)
+    parser.add_argument("--skew", type=float, default=PageSpec.skew)
+    parser.add_argument("--border", type=float, default=PageSpec.border)
+    parser.add_argument("--seed", type=int, default=PageSpec.seed)
+    parser.add_argument(
+        "--full",
+        action="store_true",
+        help="every kind, resolution and layout not selected otherwise, "
+        "instead of one page of each kind at 300 dpi",
+    )
+
+
+def specs_from_arguments(args: argparse.Namespace) -> list[PageSpec]:
+    return list(
+        corpus(
+            args.kind or KINDS,
+            args.dpi or (RESOLUTIONS if args.full else DEFAULT_RESOLUTIONS),
+            args.layout or (LAYOUTS if args.full else DEFAULT_LAYOUTS),
+            noise=args.noise,
+            skew=args.skew,
+            border=args.border,
+            seed=args.seed,
+        )
+    )
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("directory", type=pathlib.Path)
+    add_arguments(parser)
+    args = parser.parse_args()
+
+    for path in write_corpus(args.directory, specs_from_arguments(args)):
+        print(path)
+
+
+if __name__ == "__main__":
+    main()
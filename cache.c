@@ -0,0 +1,360 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- detection cache ---------------------------------------------------- */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libavutil/hash.h>
+
+#include "cache.h"
+#include "parse.h"
+#include "sheet.h"
+#include "unpaper.h"
+
+#define CACHE_MAGIC "unpaper-detection 1"
+
+static int cacheHits = 0;
+static int cacheMisses = 0;
+
+static void hashFlag(struct AVHashContext *ctx, const struct Options *options,
+                     int nr, struct MultiIndex multiIndex) {
+  const bool excluded = isExcluded(nr, multiIndex, options->ignoreMultiIndex);
+  hashValue(ctx, excluded);
+}
+
+/**
+ * Feeds every parameter that can influence the result of mask, rotation or
+ * border detection into the hash. Output-only settings (post-processing,
+ * output type) are deliberately left out, so that changing them does not
+ * invalidate the cache.
+ */
+void hashDetectionParameters(struct AVHashContext *ctx,
+                             const struct RunState *run) {
+  const struct Options *options = &run->options;
+
+  hashValue(ctx, options->inputCount);
+  hashValue(ctx, options->layout);
+  hashValue(ctx, options->sheetBackground);
+  hashValue(ctx, options->interpolateType);
+  hashValue(ctx, options->preRotate);
+  hashValue(ctx, options->preMirror);
+  hashValue(ctx, options->preShift);
+  hashValue(ctx, options->preMaskCount);
+  av_hash_update(ctx, (const uint8_t *)options->preMask,
+                 options->preMaskCount * sizeof(options->preMask[0]));
+  hashValue(ctx, options->stretchSize);
+  hashValue(ctx, options->zoomFactor);
+  hashValue(ctx, options->size);
+  hashValue(ctx, options->absBlackThreshold);
+  hashValue(ctx, options->absWhiteThreshold);
+
+  hashValue(ctx, options->pointCount);
+  av_hash_update(ctx, (const uint8_t *)options->point,
+                 options->pointCount * sizeof(options->point[0]));
+  hashValue(ctx, options->maskCount);
+  av_hash_update(ctx, (const uint8_t *)options->mask,
+                 options->maskCount * sizeof(options->mask[0]));
+  hashValue(ctx, options->preWipeCount);
+  av_hash_update(ctx, (const uint8_t *)options->preWipe,
+                 options->preWipeCount * sizeof(options->preWipe[0]));
+  hashValue(ctx, options->wipeCount);
+  av_hash_update(ctx, (const uint8_t *)options->wipe,
+                 options->wipeCount * sizeof(options->wipe[0]));
+  hashValue(ctx, options->middleWipe);
+  hashValue(ctx, options->preBorder);
+  hashValue(ctx, options->border);
+
+  hashValue(ctx, options->blackfilterScanDirections);
+  hashValue(ctx, options->blackfilterScanSize);
+  hashValue(ctx, options->blackfilterScanDepth);
+  hashValue(ctx, options->blackfilterScanStep);
+  hashValue(ctx, options->absBlackfilterScanThreshold);
+  hashValue(ctx, options->blackfilterExcludeCount);
+  av_hash_update(ctx, (const uint8_t *)options->blackfilterExclude,
+                 options->blackfilterExcludeCount * sizeof(
+                     options->blackfilterExclude[0]));
+  hashValue(ctx, options->blackfilterIntensity);
+  hashValue(ctx, options->noisefilterIntensity);
+  hashValue(ctx, options->blurfilterScanSize);
+  hashValue(ctx, options->blurfilterScanStep);
+  hashValue(ctx, options->blurfilterIntensity);
+  hashValue(ctx, options->grayfilterScanSize);
+  hashValue(ctx, options->grayfilterScanStep);
+  hashValue(ctx, options->absGrayfilterThreshold);
+
+  hashValue(ctx, options->maskScanDirections);
+  hashValue(ctx, options->maskScanSize);
+  hashValue(ctx, options->maskScanDepth);
+  hashValue(ctx, options->maskScanStep);
+  hashValue(ctx, options->maskScanThreshold);
+  hashValue(ctx, options->maskScanMinimum);
+  hashValue(ctx, options->maskScanMaximum);
+  hashValue(ctx, options->maskColor);
+
+  hashValue(ctx, options->deskewScanEdges);
+  hashValue(ctx, run->deskewScanSize);
+  hashValue(ctx, options->deskewScanDepth);
+  hashValue(ctx, options->deskewScanRangeRad);
+  hashValue(ctx, options->deskewScanStepRad);
+  hashValue(ctx, options->deskewScanDeviationRad);
+
+  hashValue(ctx, options->borderScanDirections);
+  hashValue(ctx, options->borderScanSize);
+  hashValue(ctx, options->borderScanStep);
+  hashValue(ctx, options->borderScanThreshold);
+  hashValue(ctx, options->outsideBorderscanMaskCount);
+  av_hash_update(ctx, (const uint8_t *)options->outsideBorderscanMask,
+                 options->outsideBorderscanMaskCount *
+                     sizeof(options->outsideBorderscanMask[0]));
+}
+
+/**
+ * Feeds the per-sheet switches (--no-xxx options) that apply to sheet nr into
+ * the hash.
+ */
+void hashSheetSwitches(struct AVHashContext *ctx,
+                       const struct Options *options, int nr) {
+  hashFlag(ctx, options, nr, options->noBlackfilterMultiIndex);
+  hashFlag(ctx, options, nr, options->noNoisefilterMultiIndex);
+  hashFlag(ctx, options, nr, options->noBlurfilterMultiIndex);
+  hashFlag(ctx, options, nr, options->noGrayfilterMultiIndex);
+  hashFlag(ctx, options, nr, options->noMaskScanMultiIndex);
+  hashFlag(ctx, options, nr, options->noMaskCenterMultiIndex);
+  hashFlag(ctx, options, nr, options->noDeskewMultiIndex);
+  hashFlag(ctx, options, nr, options->noWipeMultiIndex);
+  hashFlag(ctx, options, nr, options->noBorderMultiIndex);
+  hashFlag(ctx, options, nr, options->noBorderScanMultiIndex);
+  hashFlag(ctx, options, nr, options->noBorderAlignMultiIndex);
+}
+
+/**
+ * Feeds the parameters only applied after detection, up to writing the
+ * output files, into the hash.
+ */
+void hashOutputParameters(struct AVHashContext *ctx,
+                          const struct Options *options) {
+  hashValue(ctx, options->outputCount);
+  hashValue(ctx, options->postWipeCount);
+  av_hash_update(ctx, (const uint8_t *)options->postWipe,
+                 options->postWipeCount * sizeof(options->postWipe[0]));
+  hashValue(ctx, options->postBorder);
+  hashValue(ctx, options->postMirror);
+  hashValue(ctx, options->postShift);
+  hashValue(ctx, options->postRotate);
+  hashValue(ctx, options->postStretchSize);
+  hashValue(ctx, options->postZoomFactor);
+  hashValue(ctx, options->postSize);
+  hashValue(ctx, options->borderAlign);
+  hashValue(ctx, options->borderAlignMargin);
+}
+
+/**
+ * Calculates the cache key for a sheet: a hash of the content of all its
+ * input files, the size of the assembled sheet and all detection-relevant
+ * parameters.
+ *
+ * @param key buffer receiving the hex-encoded key
+ * @param inputFileNames input files of the sheet, NULL for blank pages
+ */
+void detectionCacheKey(const struct RunState *run, char key[DETECTION_KEY_SIZE],
+                       char *inputFileNames[], int nr, AVFrame *sheet) {
+  const struct Options *options = &run->options;
+  struct AVHashContext *ctx = NULL;
+
+  if (av_hash_alloc(&ctx, "SHA256") < 0)
+    errOutput("unable to allocate hash context.");
+  av_hash_init(ctx);
+
+  for (int i = 0; i < options->inputCount; i++) {
+    if (inputFileNames[i] != NULL) {
+      hashFile(ctx, inputFileNames[i]);
+    } else {
+      av_hash_update(ctx, (const uint8_t *)BLANK_TEXT, strlen(BLANK_TEXT));
+    }
+  }
+  hashValue(ctx, sheet->width);
+  hashValue(ctx, sheet->height);
+  hashValue(ctx, sheet->format);
+  hashDetectionParameters(ctx, run);
+  hashSheetSwitches(ctx, options, nr);
+
+  av_hash_final_hex(ctx, (uint8_t *)key, DETECTION_KEY_SIZE);
+  av_hash_freep(&ctx);
+}
+
+static void cacheFileName(const struct Options *options, char *buf, size_t len,
+                          const char *key, const char *suffix) {
+  snprintf(buf, len, "%s/%s.detect%s", options->detectionCacheDirectory, key,
+           suffix);
+}
+
+/**
+ * Loads the cached detection results for a key.
+ *
+ * @return true if a valid entry was found, false otherwise
+ */
+bool detectionCacheLookup(const struct Options *options, const char *key,
+                          struct DetectionResult *result) {
+  char filename[PATH_MAX];
+  char magic[32];
+  bool valid = true;
+  FILE *f;
+
+  memset(result, 0, sizeof(*result));
+
+  cacheFileName(options, filename, sizeof(filename), key, "");
+  f = fopen(filename, "r");
+  if (f == NULL) {
+    cacheMisses++;
+    return false;
+  }
+
+  valid = (fgets(magic, sizeof(magic), f) != NULL) &&
+          (strncmp(magic, CACHE_MAGIC, strlen(CACHE_MAGIC)) == 0);
+  valid = valid && fscanf(f, " scan-size %d", &result->deskewScanSize) == 1;
+
+  for (int phase = 0; valid && phase < DETECT_MASKS_PHASES_COUNT; phase++) {
+    int p;
+    valid = fscanf(f, " masks %d %d %d", &p, &result->maskCount[phase],
+                   &result->validCount[phase]) == 3 &&
+            p == phase && result->maskCount[phase] >= 0 &&
+            result->maskCount[phase] <= MAX_MASKS &&
+            result->validCount[phase] >= 0 &&
+            result->validCount[phase] <= MAX_MASKS;
+    for (int i = 0; valid && i < result->maskCount[phase]; i++) {
+      int *m = result->mask[phase][i];
+      valid = fscanf(f, " %d %d %d %d", &m[LEFT], &m[TOP], &m[RIGHT],
+                     &m[BOTTOM]) == 4;
+    }
+    for (int i = 0; valid && i < result->validCount[phase]; i++) {
+      int v;
+      valid = fscanf(f, " %d", &v) == 1;
+      result->maskValid[phase][i] = (v != 0);
+    }
+  }
+
+  valid = valid && fscanf(f, " rotation %d", &result->rotationCount) == 1 &&
+          result->rotationCount >= 0 && result->rotationCount <= MAX_MASKS;
+  for (int i = 0; valid && i < result->rotationCount; i++) {
+    valid = fscanf(f, " %a", &result->rotation[i]) == 1;
+  }
+
+  valid = valid && fscanf(f, " border %d", &result->borderCount) == 1 &&
+          result->borderCount >= 0 && result->borderCount <= MAX_MASKS;
+  for (int i = 0; valid && i < result->borderCount; i++) {
+    int *b = result->border[i];
+    valid = fscanf(f, " %d %d %d %d", &b[LEFT], &b[TOP], &b[RIGHT],
+                   &b[BOTTOM]) == 4;
+  }
+
+  fclose(f);
+
+  if (!valid) {
+    if (options->verbose >= VERBOSE_NORMAL) {
+      printf("ignoring corrupt detection cache entry %s\n", filename);
+    }
+    memset(result, 0, sizeof(*result));
+    cacheMisses++;
+    return false;
+  }
+
+  if (options->verbose >= VERBOSE_NORMAL) {
+    printf("using cached detection results %s\n", filename);
+  }
+  cacheHits++;
+  return true;
+}
+
+/**
+ * Stores detection results for a key. The entry is written to a temporary
+ * file first and renamed in place, so that concurrent runs sharing a cache
+ * directory never see partial entries.
+ */
+void detectionCacheStore(const struct Options *options, const char *key,
+                         const struct DetectionResult *result) {
+  char filename[PATH_MAX];
+  char tmpFilename[PATH_MAX];
+  char suffix[32];
+  FILE *f;
+
+  if (mkdir(options->detectionCacheDirectory, 0777) != 0 && errno != EEXIST)
+    errOutput("unable to create detection cache directory %s.",
+              options->detectionCacheDirectory);
+
+  cacheFileName(options, filename, sizeof(filename), key, "");
+  snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+  cacheFileName(options, tmpFilename, sizeof(tmpFilename), key, suffix);
+
+  f = fopen(tmpFilename, "w");
+  if (f == NULL)
+    errOutput("unable to write detection cache entry %s.", tmpFilename);
+
+  fprintf(f, "%s\n", CACHE_MAGIC);
+  fprintf(f, "scan-size %d\n", result->deskewScanSize);
+  for (int phase = 0; phase < DETECT_MASKS_PHASES_COUNT; phase++) {
+    fprintf(f, "masks %d %d %d\n", phase, result->maskCount[phase],
+            result->validCount[phase]);
+    for (int i = 0; i < result->maskCount[phase]; i++) {
+      const int *m = result->mask[phase][i];
+      fprintf(f, "%d %d %d %d\n", m[LEFT], m[TOP], m[RIGHT], m[BOTTOM]);
+    }
+    for (int i = 0; i < result->validCount[phase]; i++) {
+      fprintf(f, "%d ", result->maskValid[phase][i] ? 1 : 0);
+    }
+    fprintf(f, "\n");
+  }
+  // hexadecimal floats round-trip exactly
+  fprintf(f, "rotation %d\n", result->rotationCount);
+  for (int i = 0; i < result->rotationCount; i++) {
+    fprintf(f, "%a\n", result->rotation[i]);
+  }
+  fprintf(f, "border %d\n", result->borderCount);
+  for (int i = 0; i < result->borderCount; i++) {
+    const int *b = result->border[i];
+    fprintf(f, "%d %d %d %d\n", b[LEFT], b[TOP], b[RIGHT], b[BOTTOM]);
+  }
+
+  if (fclose(f) != 0 || rename(tmpFilename, filename) != 0) {
+    unlink(tmpFilename);
+    errOutput("unable to write detection cache entry %s.", filename);
+  }
+}
+
+/**
+ * Records the masks found by the last detectMasks() call.
+ */
+void recordMasks(const struct Options *options, struct DetectionResult *result,
+                 DETECT_MASKS_PHASES phase) {
+  result->maskCount[phase] = options->maskCount;
+  memcpy(result->mask[phase], options->mask,
+         options->maskCount * sizeof(options->mask[0]));
+  result->validCount[phase] = options->pointCount;
+  memcpy(result->maskValid[phase], options->maskValid,
+         options->pointCount * sizeof(options->maskValid[0]));
+}
+
+/**
+ * Restores the masks as if detectMasks() had been called.
+ */
+void restoreMasks(struct Options *options, const struct DetectionResult *result,
+                  DETECT_MASKS_PHASES phase) {
+  options->maskCount = result->maskCount[phase];
+  memcpy(options->mask, result->mask[phase],
+         options->maskCount * sizeof(options->mask[0]));
+  memcpy(options->maskValid, result->maskValid[phase],
+         result->validCount[phase] * sizeof(options->maskValid[0]));
+}
+
+void printDetectionCacheStats(void) {
+  printf("detection cache: %d hits, %d misses\n", cacheHits, cacheMisses);
+}
@@ -0,0 +1,70 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+
+#include <libavutil/frame.h>
+
+#include "constants.h"
+
+/* --- detection cache ---------------------------------------------------- */
+
+// detectMasks() is run up to three times per sheet: before masking, before
+// deskewing and before centering.
+typedef enum {
+  DETECT_MASKS_INITIAL,
+  DETECT_MASKS_DESKEW,
+  DETECT_MASKS_CENTER,
+  DETECT_MASKS_PHASES_COUNT
+} DETECT_MASKS_PHASES;
+
+// size of a hex-encoded SHA-256 digest, including the terminating NUL
+#define DETECTION_KEY_SIZE 65
+
+struct DetectionResult {
+  int maskCount[DETECT_MASKS_PHASES_COUNT];
+  int mask[DETECT_MASKS_PHASES_COUNT][MAX_MASKS][EDGES_COUNT];
+  int validCount[DETECT_MASKS_PHASES_COUNT];
+  bool maskValid[DETECT_MASKS_PHASES_COUNT][MAX_MASKS];
+  int rotationCount;
+  float rotation[MAX_MASKS];
+  int borderCount;
+  int border[MAX_MASKS][EDGES_COUNT];
+  int deskewScanSize;
+};
+
+#define hashValue(ctx, v)                                                      \
+  av_hash_update(ctx, (const uint8_t *)&(v), sizeof(v))
+
+struct AVHashContext;
+struct Options;
+struct RunState;
+
+void hashDetectionParameters(struct AVHashContext *ctx,
+                             const struct RunState *run);
+
+void hashSheetSwitches(struct AVHashContext *ctx,
+                       const struct Options *options, int nr);
+
+void hashOutputParameters(struct AVHashContext *ctx,
+                          const struct Options *options);
+
+void detectionCacheKey(const struct RunState *run, char key[DETECTION_KEY_SIZE],
+                       char *inputFileNames[], int nr, AVFrame *sheet);
+
+bool detectionCacheLookup(const struct Options *options, const char *key,
+                          struct DetectionResult *result);
+
+void detectionCacheStore(const struct Options *options, const char *key,
+                         const struct DetectionResult *result);
+
+void recordMasks(const struct Options *options, struct DetectionResult *result,
+                 DETECT_MASKS_PHASES phase);
+
+void restoreMasks(struct Options *options, const struct DetectionResult *result,
+                  DETECT_MASKS_PHASES phase);
+
+void printDetectionCacheStats(void);
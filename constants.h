@@ -19,6 +19,7 @@
 #define GRAY24 0x1F1F1F
 #define BLACK24 0x000000
 #define BLANK_TEXT "<blank>"
+#define BLANK_SCAN_STEP 4 // sampling distance of blank sheet detection
 
 typedef enum {
   VERBOSE_QUIET = -1,
@@ -46,6 +47,12 @@ typedef enum {
   LAYOUTS_COUNT
 } LAYOUTS;
 
+typedef enum {
+  SHARD_CONTIGUOUS,
+  SHARD_ROUND_ROBIN,
+  SHARD_MODES_COUNT
+} SHARD_MODES;
+
 typedef enum {
   INTERP_NN,
   INTERP_LINEAR,
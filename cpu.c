@@ -0,0 +1,394 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- CPU feature dispatch ----------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86
+#include <immintrin.h>
+#endif
+
+#include "cpu.h"
+#include "unpaper.h"
+
+static const char *levelNames[CPU_LEVELS_COUNT] = {
+    [CPU_SCALAR] = "scalar",
+    [CPU_SSE4] = "sse4",
+    [CPU_AVX2] = "avx2",
+    [CPU_AVX512] = "avx512",
+};
+
+/* --- scalar kernels ----------------------------------------------------- */
+
+static int countRangeScalar(const uint8_t *row, int n, uint8_t min,
+                            uint8_t max) {
+  int count = 0;
+
+  for (int i = 0; i < n; i++) {
+    count += (row[i] >= min) && (row[i] <= max);
+  }
+  return count;
+}
+
+static uint64_t sumScalar(const uint8_t *row, int n) {
+  uint64_t total = 0;
+
+  for (int i = 0; i < n; i++) {
+    total += row[i];
+  }
+  return total;
+}
+
+static void grayRGB24Scalar(const uint8_t *rgb, uint8_t *gray, int n) {
+  for (int i = 0; i < n; i++) {
+    gray[i] = (rgb[3 * i] + rgb[3 * i + 1] + rgb[3 * i + 2]) / 3;
+  }
+}
+
+static void fillRGB24Scalar(uint8_t *rgb, int n, uint8_t r, uint8_t g,
+                            uint8_t b) {
+  for (int i = 0; i < n; i++) {
+    rgb[3 * i] = r;
+    rgb[3 * i + 1] = g;
+    rgb[3 * i + 2] = b;
+  }
+}
+
+#ifdef CPU_X86
+
+/* --- SSE4 kernels ------------------------------------------------------- */
+
+// Bytes x with min <= x <= max are those with (uint8_t)(x - min) <=
+// max - min, which needs a single unsigned comparison.
+
+__attribute__((target("sse4.2,popcnt"))) static int
+countRangeSSE4(const uint8_t *row, int n, uint8_t min, uint8_t max) {
+  const __m128i low = _mm_set1_epi8((char)min);
+  const __m128i range = _mm_set1_epi8((char)(uint8_t)(max - min));
+  int count = 0;
+  int i = 0;
+
+  if (max < min)
+    return 0;
+
+  for (; i + 16 <= n; i += 16) {
+    const __m128i v =
+        _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(row + i)), low);
+    const __m128i in = _mm_cmpeq_epi8(_mm_max_epu8(v, range), range);
+    count += __builtin_popcount(_mm_movemask_epi8(in));
+  }
+  return count + countRangeScalar(row + i, n - i, min, max);
+}
+
+__attribute__((target("sse4.2"))) static uint64_t sumSSE4(const uint8_t *row,
+                                                          int n) {
+  __m128i total = _mm_setzero_si128();
+  uint64_t lanes[2];
+  int i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(row + i));
+    total = _mm_add_epi64(total, _mm_sad_epu8(v, _mm_setzero_si128()));
+  }
+  // stored rather than extracted, as 64-bit extracts need x86-64
+  _mm_storeu_si128((__m128i *)lanes, total);
+  return lanes[0] + lanes[1] + sumScalar(row + i, n - i);
+}
+
+// Gathers one component of 16 RGB24 pixels, spread over three registers.
+#define Z -1
+static const int8_t gatherRGB24[3][3][16] = {
+    // red
+    {{0, 3, 6, 9, 12, 15, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, Z, 2, 5, 8, 11, 14, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 1, 4, 7, 10, 13}},
+    // green
+    {{1, 4, 7, 10, 13, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, 0, 3, 6, 9, 12, 15, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 2, 5, 8, 11, 14}},
+    // blue
+    {{2, 5, 8, 11, 14, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, 1, 4, 7, 10, 13, Z, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 0, 3, 6, 9, 12, 15}},
+};
+#undef Z
+
+__attribute__((target("sse4.2"))) static __m128i
+gatherComponent(__m128i a, __m128i b, __m128i c, int component) {
+  const __m128i *masks = (const __m128i *)gatherRGB24[component];
+
+  return _mm_or_si128(
+      _mm_or_si128(_mm_shuffle_epi8(a, _mm_loadu_si128(&masks[0])),
+                   _mm_shuffle_epi8(b, _mm_loadu_si128(&masks[1]))),
+      _mm_shuffle_epi8(c, _mm_loadu_si128(&masks[2])));
+}
+
+// sum / 3 for sums up to 765, as (sum * 0xaaab) >> 17
+__attribute__((target("sse4.2"))) static __m128i divideBy3(__m128i sum) {
+  return _mm_srli_epi16(_mm_mulhi_epu16(sum, _mm_set1_epi16((short)0xaaab)),
+                        1);
+}
+
+__attribute__((target("sse4.2"))) static void
+grayRGB24SSE4(const uint8_t *rgb, uint8_t *gray, int n) {
+  int i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    const __m128i a = _mm_loadu_si128((const __m128i *)(rgb + 3 * i));
+    const __m128i b = _mm_loadu_si128((const __m128i *)(rgb + 3 * i + 16));
+    const __m128i c = _mm_loadu_si128((const __m128i *)(rgb + 3 * i + 32));
+    const __m128i r = gatherComponent(a, b, c, 0);
+    const __m128i g = gatherComponent(a, b, c, 1);
+    const __m128i bl = gatherComponent(a, b, c, 2);
+
+    const __m128i low = _mm_add_epi16(
+        _mm_add_epi16(_mm_cvtepu8_epi16(r), _mm_cvtepu8_epi16(g)),
+        _mm_cvtepu8_epi16(bl));
+    const __m128i high =
+        _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(r, _mm_setzero_si128()),
+                                    _mm_unpackhi_epi8(g, _mm_setzero_si128())),
+                      _mm_unpackhi_epi8(bl, _mm_setzero_si128()));
+
+    _mm_storeu_si128((__m128i *)(gray + i),
+                     _mm_packus_epi16(divideBy3(low), divideBy3(high)));
+  }
+  grayRGB24Scalar(rgb + 3 * i, gray + i, n - i);
+}
+
+__attribute__((target("sse4.2"))) static void
+fillRGB24SSE4(uint8_t *rgb, int n, uint8_t r, uint8_t g, uint8_t b) {
+  uint8_t pattern[48];
+  int i = 0;
+
+  fillRGB24Scalar(pattern, 16, r, g, b);
+  const __m128i p0 = _mm_loadu_si128((const __m128i *)pattern);
+  const __m128i p1 = _mm_loadu_si128((const __m128i *)(pattern + 16));
+  const __m128i p2 = _mm_loadu_si128((const __m128i *)(pattern + 32));
+
+  for (; i + 16 <= n; i += 16) {
+    _mm_storeu_si128((__m128i *)(rgb + 3 * i), p0);
+    _mm_storeu_si128((__m128i *)(rgb + 3 * i + 16), p1);
+    _mm_storeu_si128((__m128i *)(rgb + 3 * i + 32), p2);
+  }
+  fillRGB24Scalar(rgb + 3 * i, n - i, r, g, b);
+}
+
+/* --- AVX2 kernels ------------------------------------------------------- */
+
+__attribute__((target("avx2,popcnt"))) static int
+countRangeAVX2(const uint8_t *row, int n, uint8_t min, uint8_t max) {
+  const __m256i low = _mm256_set1_epi8((char)min);
+  const __m256i range = _mm256_set1_epi8((char)(uint8_t)(max - min));
+  int count = 0;
+  int i = 0;
+
+  if (max < min)
+    return 0;
+
+  for (; i + 32 <= n; i += 32) {
+    const __m256i v =
+        _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *)(row + i)), low);
+    const __m256i in = _mm256_cmpeq_epi8(_mm256_max_epu8(v, range), range);
+    count += __builtin_popcount((unsigned int)_mm256_movemask_epi8(in));
+  }
+  return count + countRangeScalar(row + i, n - i, min, max);
+}
+
+__attribute__((target("avx2"))) static uint64_t sumAVX2(const uint8_t *row,
+                                                       int n) {
+  __m256i total = _mm256_setzero_si256();
+  uint64_t lanes[4];
+  int i = 0;
+
+  for (; i + 32 <= n; i += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)(row + i));
+    total = _mm256_add_epi64(total, _mm256_sad_epu8(v, _mm256_setzero_si256()));
+  }
+  _mm256_storeu_si256((__m256i *)lanes, total);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sumScalar(row + i, n - i);
+}
+
+__attribute__((target("avx2"))) static void
+fillRGB24AVX2(uint8_t *rgb, int n, uint8_t r, uint8_t g, uint8_t b) {
+  uint8_t pattern[96];
+  int i = 0;
+
+  fillRGB24Scalar(pattern, 32, r, g, b);
+  const __m256i p0 = _mm256_loadu_si256((const __m256i *)pattern);
+  const __m256i p1 = _mm256_loadu_si256((const __m256i *)(pattern + 32));
+  const __m256i p2 = _mm256_loadu_si256((const __m256i *)(pattern + 64));
+
+  for (; i + 32 <= n; i += 32) {
+    _mm256_storeu_si256((__m256i *)(rgb + 3 * i), p0);
+    _mm256_storeu_si256((__m256i *)(rgb + 3 * i + 32), p1);
+    _mm256_storeu_si256((__m256i *)(rgb + 3 * i + 64), p2);
+  }
+  fillRGB24Scalar(rgb + 3 * i, n - i, r, g, b);
+}
+
+/* --- AVX-512 kernels ---------------------------------------------------- */
+
+__attribute__((target("avx512f,avx512bw,popcnt"))) static int
+countRangeAVX512(const uint8_t *row, int n, uint8_t min, uint8_t max) {
+  const __m512i low = _mm512_set1_epi8((char)min);
+  const __m512i range = _mm512_set1_epi8((char)(uint8_t)(max - min));
+  int count = 0;
+  int i = 0;
+
+  if (max < min)
+    return 0;
+
+  for (; i + 64 <= n; i += 64) {
+    const __m512i v = _mm512_sub_epi8(_mm512_loadu_si512(row + i), low);
+    count += __builtin_popcountll(_mm512_cmple_epu8_mask(v, range));
+  }
+  return count + countRangeScalar(row + i, n - i, min, max);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static uint64_t
+sumAVX512(const uint8_t *row, int n) {
+  __m512i total = _mm512_setzero_si512();
+  int i = 0;
+
+  for (; i + 64 <= n; i += 64) {
+    const __m512i v = _mm512_loadu_si512(row + i);
+    total = _mm512_add_epi64(total, _mm512_sad_epu8(v, _mm512_setzero_si512()));
+  }
+  return (uint64_t)_mm512_reduce_add_epi64(total) + sumScalar(row + i, n - i);
+}
+
+#endif
+
+/* --- dispatch ----------------------------------------------------------- */
+
+// Kernels built for each level; a missing kernel falls back to the best one
+// of a lower level.
+static const struct RowKernels levelKernels[CPU_LEVELS_COUNT] = {
+    [CPU_SCALAR] = {countRangeScalar, sumScalar, grayRGB24Scalar,
+                    fillRGB24Scalar},
+#ifdef CPU_X86
+    [CPU_SSE4] = {countRangeSSE4, sumSSE4, grayRGB24SSE4, fillRGB24SSE4},
+    [CPU_AVX2] = {countRangeAVX2, sumAVX2, NULL, fillRGB24AVX2},
+    [CPU_AVX512] = {countRangeAVX512, sumAVX512, NULL, NULL},
+#endif
+};
+
+struct RowKernels rowKernels = {countRangeScalar, sumScalar, grayRGB24Scalar,
+                                fillRGB24Scalar};
+
+// level each kernel has been selected from, for the report
+static struct {
+  CPU_LEVEL countRange;
+  CPU_LEVEL sum;
+  CPU_LEVEL grayRGB24;
+  CPU_LEVEL fillRGB24;
+} selectedLevels;
+
+const char *cpuLevelName(CPU_LEVEL level) { return levelNames[level]; }
+
+bool cpuSupported(CPU_LEVEL level) {
+#ifdef CPU_X86
+  __builtin_cpu_init();
+
+  switch (level) {
+  case CPU_SCALAR:
+    return true;
+  case CPU_SSE4:
+    return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+  case CPU_AVX2:
+    return cpuSupported(CPU_SSE4) && __builtin_cpu_supports("avx2");
+  case CPU_AVX512:
+    return cpuSupported(CPU_AVX2) && __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw");
+  default:
+    return false;
+  }
+#else
+  return level == CPU_SCALAR;
+#endif
+}
+
+/**
+ * Selects the best kernels built for level or any level below.
+ */
+void cpuSelect(CPU_LEVEL level) {
+#define selectKernel(kernel)                                                   \
+  for (int l = level; l >= CPU_SCALAR; l--) {                                  \
+    if (levelKernels[l].kernel != NULL) {                                      \
+      rowKernels.kernel = levelKernels[l].kernel;                              \
+      selectedLevels.kernel = l;                                               \
+      break;                                                                   \
+    }                                                                          \
+  }
+
+  selectKernel(countRange);
+  selectKernel(sum);
+  selectKernel(grayRGB24);
+  selectKernel(fillRGB24);
+
+#undef selectKernel
+}
+
+/**
+ * Finds the level to select the kernels for: the best level supported by the
+ * CPU, or the level named by the UNPAPER_CPU environment variable.
+ *
+ * @return false when UNPAPER_CPU names no level this CPU supports, with the
+ * message in error
+ */
+bool cpuLevel(CPU_LEVEL *level, char *error, size_t errorSize) {
+  const char *override = getenv("UNPAPER_CPU");
+
+  *level = CPU_SCALAR;
+  if (override != NULL && override[0] != '\0') {
+    while (*level < CPU_LEVELS_COUNT &&
+           strcmp(override, levelNames[*level]) != 0)
+      (*level)++;
+    if (*level == CPU_LEVELS_COUNT) {
+      snprintf(error, errorSize,
+               "unknown CPU level UNPAPER_CPU=%s, expected scalar, sse4, "
+               "avx2 or avx512.",
+               override);
+      return false;
+    }
+    if (!cpuSupported(*level)) {
+      snprintf(error, errorSize, "UNPAPER_CPU=%s is not supported by this CPU.",
+               override);
+      return false;
+    }
+  } else {
+    while (*level + 1 < CPU_LEVELS_COUNT && cpuSupported(*level + 1))
+      (*level)++;
+  }
+  return true;
+}
+
+/**
+ * Selects the kernels once at startup: for the best level supported by the
+ * CPU, or for the level named by the UNPAPER_CPU environment variable.
+ */
+void cpuInit(VERBOSE_LEVEL verbose) {
+  const char *override = getenv("UNPAPER_CPU");
+  CPU_LEVEL level;
+  char error[256];
+
+  if (!cpuLevel(&level, error, sizeof(error)))
+    errOutput("%s", error);
+
+  cpuSelect(level);
+
+  if (verbose >= VERBOSE_MORE) {
+    printf("cpu level: %s%s\n", levelNames[level],
+           (override != NULL && override[0] != '\0') ? " (UNPAPER_CPU)" : "");
+    printf("row kernels: countRange %s, sum %s, grayRGB24 %s, fillRGB24 %s\n",
+           levelNames[selectedLevels.countRange],
+           levelNames[selectedLevels.sum],
+           levelNames[selectedLevels.grayRGB24],
+           levelNames[selectedLevels.fillRGB24]);
+  }
+}
@@ -0,0 +1,48 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+
+/* --- CPU feature dispatch ----------------------------------------------- */
+
+// Instruction set levels the row kernels are built for, from the most
+// portable up. Every level includes the ones below it.
+typedef enum {
+  CPU_SCALAR,
+  CPU_SSE4,
+  CPU_AVX2,
+  CPU_AVX512,
+  CPU_LEVELS_COUNT
+} CPU_LEVEL;
+
+// Kernels working on a row of pixels, selected for the CPU the program runs
+// on.
+struct RowKernels {
+  // counts the bytes of row whose value lies between min and max
+  int (*countRange)(const uint8_t *row, int n, uint8_t min, uint8_t max);
+  // sums the bytes of row
+  uint64_t (*sum)(const uint8_t *row, int n);
+  // converts n RGB24 pixels to grayscale, the average of their components
+  void (*grayRGB24)(const uint8_t *rgb, uint8_t *gray, int n);
+  // fills n RGB24 pixels with one color
+  void (*fillRGB24)(uint8_t *rgb, int n, uint8_t r, uint8_t g, uint8_t b);
+};
+
+extern struct RowKernels rowKernels;
+
+bool cpuSupported(CPU_LEVEL level);
+
+void cpuSelect(CPU_LEVEL level);
+
+bool cpuLevel(CPU_LEVEL *level, char *error, size_t errorSize);
+
+void cpuInit(VERBOSE_LEVEL verbose);
+
+const char *cpuLevelName(CPU_LEVEL level);
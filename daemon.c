@@ -0,0 +1,590 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- daemon ------------------------------------------------------------- */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "unpaper.h"
+
+#define DAEMON_MAX_ARGS 256
+#define DAEMON_MAX_REQUEST (64 * 1024)
+#define DAEMON_MAX_OUTPUT (64 * 1024)
+#define DAEMON_MAX_FDS 16
+#define DAEMON_BACKLOG 64
+// how long a stopping daemon waits for clients to take their answers
+#define DAEMON_STOP_TIMEOUT 5000
+
+/*
+ * Clients connect to the socket and send requests, each a 4-byte length in
+ * network byte order followed by that many bytes: the options and the input
+ * and output files of a run, each terminated by a NUL byte. File descriptors
+ * sent along with the bytes of a request (SCM_RIGHTS) are open in the job as
+ * 3, 4, ... in the order they were sent, so that /dev/fd/3 can be given as
+ * input or output file.
+ *
+ * Each request runs as a job in a process of its own, forked from the daemon
+ * with everything set up before the request came in. Requests wait in order
+ * until fewer than --daemon-jobs jobs run. Once its job is over, a request
+ * is answered with a 4-byte length and a record in the same format as the
+ * spool results: the number of the request on its connection, counting from
+ * 1, its status and timing, an empty line, and what the job printed. A
+ * connection can send any number of requests without waiting for the answers,
+ * which come in the order the jobs finish. Answers wait in the daemon while
+ * the client is slow to take them, and a client closing its connection leaves
+ * its requests unanswered.
+ */
+
+struct Connection {
+  int fd;
+  int id;
+  // bytes and descriptors received, not making up a whole request yet; the
+  // descriptors belong to the request of the last byte received with them
+  uint8_t *buffer;
+  size_t length;
+  int fds[DAEMON_MAX_FDS];
+  size_t fdOffsets[DAEMON_MAX_FDS];
+  int fdCount;
+  int requests;
+  // requests not answered yet
+  int pending;
+  // the client is done sending requests, but still waits for answers
+  bool eof;
+  // answers the client did not take yet
+  uint8_t *output;
+  size_t outputLength;
+};
+
+struct Request {
+  int connection;
+  int number;
+  char *arguments;
+  size_t length;
+  int fds[DAEMON_MAX_FDS];
+  int fdCount;
+
+  // set once the request runs
+  pid_t pid;
+  FILE *output;
+  struct timespec start;
+};
+
+static int listenFd = -1;
+static int wakeupPipe[2] = {-1, -1};
+
+static struct Connection *connections = NULL;
+static int connectionCount = 0;
+static int nextConnectionId = 1;
+
+// in the order they came in
+static struct Request *requests = NULL;
+static int requestCount = 0;
+static int running = 0;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void wakeup(int signum) {
+  const int savedErrno = errno;
+
+  if (signum != SIGCHLD)
+    stopping = 1;
+  if (write(wakeupPipe[1], "", 1) < 0) {
+    // the pipe is full: the main loop wakes up anyway
+  }
+  errno = savedErrno;
+}
+
+static void closeFds(int *fds, int count) {
+  for (int i = 0; i < count; i++) {
+    close(fds[i]);
+  }
+}
+
+static struct Connection *findConnection(int id) {
+  for (int i = 0; i < connectionCount; i++) {
+    if (connections[i].id == id)
+      return &connections[i];
+  }
+  return NULL;
+}
+
+static void closeConnection(int index) {
+  struct Connection *connection = &connections[index];
+
+  close(connection->fd);
+  closeFds(connection->fds, connection->fdCount);
+  free(connection->buffer);
+  free(connection->output);
+
+  // requests still queued are dropped, running ones are not answered
+  for (int i = 0; i < requestCount;) {
+    if (requests[i].connection == connection->id && requests[i].pid == 0) {
+      closeFds(requests[i].fds, requests[i].fdCount);
+      free(requests[i].arguments);
+      memmove(&requests[i], &requests[i + 1],
+              (requestCount - i - 1) * sizeof(struct Request));
+      requestCount--;
+    } else {
+      i++;
+    }
+  }
+
+  memmove(&connections[index], &connections[index + 1],
+          (connectionCount - index - 1) * sizeof(struct Connection));
+  connectionCount--;
+}
+
+/**
+ * Sends as much of the queued answers as the client takes without waiting,
+ * and returns false if the client went away.
+ */
+static bool sendAnswers(struct Connection *connection) {
+  while (connection->outputLength > 0) {
+    const ssize_t sent = send(connection->fd, connection->output,
+                              connection->outputLength, MSG_NOSIGNAL);
+    if (sent < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+    connection->outputLength -= sent;
+    memmove(connection->output, connection->output + sent,
+            connection->outputLength);
+  }
+  return true;
+}
+
+/**
+ * Queues an answer to a request and sends what the client takes of it, and
+ * returns false if the client went away.
+ */
+static bool answer(struct Connection *connection, const char *text,
+                   size_t length) {
+  const uint32_t header = htonl(length);
+  const size_t queued = connection->outputLength;
+
+  connection->pending--;
+  connection->outputLength += sizeof(header) + length;
+  connection->output =
+      realloc(connection->output, connection->outputLength);
+  memcpy(connection->output + queued, &header, sizeof(header));
+  memcpy(connection->output + queued + sizeof(header), text, length);
+  return sendAnswers(connection);
+}
+
+/**
+ * Takes the whole requests out of what a connection received, and returns
+ * false if it sent something that is not a request.
+ */
+static bool takeRequests(struct Connection *connection) {
+  while (connection->length >= sizeof(uint32_t)) {
+    uint32_t length;
+
+    memcpy(&length, connection->buffer, sizeof(length));
+    length = ntohl(length);
+    if (length == 0 || length > DAEMON_MAX_REQUEST)
+      return false;
+    if (connection->length < sizeof(uint32_t) + length)
+      return true;
+
+    const char *arguments = (char *)connection->buffer + sizeof(uint32_t);
+    if (arguments[length - 1] != '\0')
+      return false;
+
+    requests = realloc(requests, (requestCount + 1) * sizeof(struct Request));
+    struct Request *request = &requests[requestCount++];
+    memset(request, 0, sizeof(*request));
+    request->connection = connection->id;
+    request->number = ++connection->requests;
+    request->arguments = malloc(length);
+    memcpy(request->arguments, arguments, length);
+    request->length = length;
+    connection->pending++;
+
+    const size_t taken = sizeof(uint32_t) + length;
+    int kept = 0;
+    for (int i = 0; i < connection->fdCount; i++) {
+      if (connection->fdOffsets[i] <= taken) {
+        request->fds[request->fdCount++] = connection->fds[i];
+      } else {
+        connection->fds[kept] = connection->fds[i];
+        connection->fdOffsets[kept++] = connection->fdOffsets[i] - taken;
+      }
+    }
+    connection->fdCount = kept;
+
+    connection->length -= taken;
+    memmove(connection->buffer, connection->buffer + taken,
+            connection->length);
+  }
+  return true;
+}
+
+/**
+ * Receives what a connection sent, and returns false once it is to be
+ * closed.
+ */
+static bool receive(struct Connection *connection) {
+  uint8_t data[4096];
+  union {
+    char buffer[CMSG_SPACE(DAEMON_MAX_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {.iov_base = data, .iov_len = sizeof(data)};
+  struct msghdr message = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control.buffer,
+      .msg_controllen = sizeof(control.buffer),
+  };
+
+  const ssize_t length = recvmsg(connection->fd, &message, 0);
+  if (length < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&message, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+
+    const int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int fds[DAEMON_MAX_FDS];
+    memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+      if (connection->fdCount < DAEMON_MAX_FDS) {
+        connection->fdOffsets[connection->fdCount] =
+            connection->length + length;
+        connection->fds[connection->fdCount++] = fds[i];
+      } else {
+        close(fds[i]);
+      }
+    }
+  }
+
+  if (length == 0) {
+    connection->eof = true;
+    return connection->pending > 0;
+  }
+
+  connection->buffer =
+      realloc(connection->buffer, connection->length + length);
+  memcpy(connection->buffer + connection->length, data, length);
+  connection->length += length;
+  return takeRequests(connection);
+}
+
+/**
+ * Sets the process of a job up: the daemon's descriptors are closed, the
+ * output goes to the answer, the descriptors of the request are moved to 3,
+ * 4, ..., and argv is set to the arguments of the request.
+ */
+static void enterJob(struct Request *request, int *argc, char ***argv) {
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+
+  close(listenFd);
+  close(wakeupPipe[0]);
+  close(wakeupPipe[1]);
+  for (int i = 0; i < connectionCount; i++) {
+    close(connections[i].fd);
+    closeFds(connections[i].fds, connections[i].fdCount);
+  }
+  for (int i = 0; i < requestCount; i++) {
+    if (&requests[i] == request)
+      continue;
+    closeFds(requests[i].fds, requests[i].fdCount);
+    if (requests[i].output != NULL)
+      close(fileno(requests[i].output));
+  }
+
+  dup2(fileno(request->output), STDOUT_FILENO);
+  dup2(fileno(request->output), STDERR_FILENO);
+  close(fileno(request->output));
+  // keeps messages and errors in order
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  int moved[DAEMON_MAX_FDS];
+  for (int i = 0; i < request->fdCount; i++) {
+    moved[i] = fcntl(request->fds[i], F_DUPFD, 3 + request->fdCount);
+    close(request->fds[i]);
+  }
+  for (int i = 0; i < request->fdCount; i++) {
+    dup2(moved[i], 3 + i);
+    close(moved[i]);
+  }
+
+  char *program = (*argv)[0];
+  *argv = calloc(DAEMON_MAX_ARGS + 2, sizeof(char *));
+  (*argv)[0] = program;
+  *argc = 1;
+  for (size_t offset = 0; offset < request->length;
+       offset += strlen(request->arguments + offset) + 1) {
+    if (*argc > DAEMON_MAX_ARGS)
+      errOutput("too many arguments in request %d.", request->number);
+    (*argv)[(*argc)++] = request->arguments + offset;
+  }
+  (*argv)[*argc] = NULL;
+}
+
+/**
+ * Starts the jobs of the requests waiting the longest, as long as fewer
+ * than the limit run. Returns true in the process of a job.
+ */
+static bool startJobs(int limit, int *argc, char ***argv) {
+  for (int i = 0; i < requestCount && running < limit; i++) {
+    struct Request *request = &requests[i];
+
+    if (request->pid != 0)
+      continue;
+
+    request->output = tmpfile();
+    if (request->output == NULL)
+      errOutput("unable to create output file of request %d.",
+                request->number);
+
+    fflush(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &request->start);
+    request->pid = fork();
+    if (request->pid < 0)
+      errOutput("unable to fork request %d.", request->number);
+
+    if (request->pid == 0) {
+      enterJob(request, argc, argv);
+      return true;
+    }
+
+    closeFds(request->fds, request->fdCount);
+    request->fdCount = 0;
+    running++;
+  }
+  return false;
+}
+
+/**
+ * Answers the request whose job is over.
+ */
+static bool finishJob(const struct Options *options, int index, int status) {
+  struct Request *request = &requests[index];
+  const bool succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  struct timespec end;
+  char *text = malloc(256 + DAEMON_MAX_OUTPUT);
+  size_t length;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double seconds = (end.tv_sec - request->start.tv_sec) +
+                         (end.tv_nsec - request->start.tv_nsec) / 1e9;
+
+  length = sprintf(text, "request %d\nstatus %s\n", request->number,
+                   succeeded ? "done" : "failed");
+  if (WIFEXITED(status)) {
+    length += sprintf(text + length, "exit %d\n", WEXITSTATUS(status));
+  } else if (WIFSIGNALED(status)) {
+    length += sprintf(text + length, "signal %d\n", WTERMSIG(status));
+  }
+  length += sprintf(text + length, "seconds %.3f\n\n", seconds);
+
+  // the job shares the offset of the file, and left it at the end
+  fseek(request->output, 0, SEEK_SET);
+  length += fread(text + length, 1, DAEMON_MAX_OUTPUT, request->output);
+  fclose(request->output);
+
+  if (options->verbose >= VERBOSE_NORMAL) {
+    printf("request %d: %s in %.3f seconds.\n", request->number,
+           succeeded ? "done" : "failed", seconds);
+  }
+
+  struct Connection *connection = findConnection(request->connection);
+  free(request->arguments);
+  memmove(&requests[index], &requests[index + 1],
+          (requestCount - index - 1) * sizeof(struct Request));
+  requestCount--;
+  running--;
+
+  if (connection != NULL && !answer(connection, text, length)) {
+    closeConnection(connection - connections);
+  }
+  free(text);
+  return succeeded;
+}
+
+static void openSocket(const struct Options *options) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+
+  if (strlen(options->daemonSocket) >= sizeof(address.sun_path))
+    errOutput("socket path %s too long.", options->daemonSocket);
+  strcpy(address.sun_path, options->daemonSocket);
+
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0 ||
+      bind(listenFd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(listenFd, DAEMON_BACKLOG) != 0) {
+    errOutput("unable to listen on socket %s: %s.", options->daemonSocket,
+              strerror(errno));
+  }
+}
+
+/**
+ * Tells whether answers wait for their clients to take them.
+ */
+static bool answersQueued(void) {
+  for (int i = 0; i < connectionCount; i++) {
+    if (connections[i].outputLength > 0)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Answers the requests sent to the daemon socket, until told to stop by
+ * SIGINT or SIGTERM. Each request runs in a process of its own: the
+ * function only returns in that process, with argc and argv set to the
+ * arguments of the request. The daemon itself exits.
+ */
+void daemonRun(const struct Options *options, int *argc, char ***argv) {
+  const int limit = (options->daemonJobs == 0)
+                        ? max((int)sysconf(_SC_NPROCESSORS_ONLN), 1)
+                        : options->daemonJobs;
+  struct sigaction action;
+  int done = 0;
+  int failed = 0;
+
+  if (pipe(wakeupPipe) != 0)
+    errOutput("unable to create pipe: %s.", strerror(errno));
+  fcntl(wakeupPipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(wakeupPipe[1], F_SETFL, O_NONBLOCK);
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = wakeup;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGCHLD, &action, NULL);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  openSocket(options);
+  if (options->verbose >= VERBOSE_NORMAL) {
+    printf("listening on socket %s, running up to %d jobs.\n",
+           options->daemonSocket, limit);
+  }
+
+  while (!stopping || running > 0 || answersQueued()) {
+    if (!stopping && startJobs(limit, argc, argv))
+      return;
+
+    fflush(stdout);
+
+    const int count = 2 + connectionCount;
+    struct pollfd *fds = calloc(count, sizeof(struct pollfd));
+    fds[0] = (struct pollfd){.fd = wakeupPipe[0], .events = POLLIN};
+    fds[1] = (struct pollfd){.fd = stopping ? -1 : listenFd, .events = POLLIN};
+    for (int i = 0; i < connectionCount; i++) {
+      fds[2 + i] = (struct pollfd){
+          .fd = connections[i].fd,
+          .events = (connections[i].eof ? 0 : POLLIN) |
+                    (connections[i].outputLength > 0 ? POLLOUT : 0),
+      };
+    }
+
+    // once stopped, only the answers are left to send
+    const int ready =
+        poll(fds, count, (stopping && running == 0) ? DAEMON_STOP_TIMEOUT : -1);
+    if (ready < 0) {
+      free(fds);
+      if (errno == EINTR)
+        continue;
+      errOutput("unable to wait on socket %s: %s.", options->daemonSocket,
+                strerror(errno));
+    }
+    if (ready == 0) {
+      free(fds);
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      char drain[64];
+      while (read(wakeupPipe[0], drain, sizeof(drain)) > 0) {
+      }
+    }
+
+    // backwards, so that closing a connection leaves the others in place
+    for (int i = connectionCount - 1; i >= 0; i--) {
+      const short revents = fds[2 + i].revents;
+
+      if (revents == 0)
+        continue;
+      if ((revents & POLLOUT) && !sendAnswers(&connections[i])) {
+        closeConnection(i);
+      } else if (connections[i].eof) {
+        // the client went away without waiting for its answers
+        if (revents & (POLLHUP | POLLERR))
+          closeConnection(i);
+      } else if (!receive(&connections[i])) {
+        closeConnection(i);
+      }
+    }
+
+    if (fds[1].revents & POLLIN) {
+      const int fd = accept(listenFd, NULL, NULL);
+      if (fd >= 0) {
+        // answers are queued rather than waiting on a slow client
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        connections = realloc(connections, (connectionCount + 1) *
+                                               sizeof(struct Connection));
+        connections[connectionCount++] = (struct Connection){
+            .fd = fd,
+            .id = nextConnectionId++,
+        };
+      }
+    }
+    free(fds);
+
+    pid_t pid;
+    int status;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      for (int i = 0; i < requestCount; i++) {
+        if (requests[i].pid != pid)
+          continue;
+        if (finishJob(options, i, status)) {
+          done++;
+        } else {
+          failed++;
+        }
+        break;
+      }
+    }
+
+    // connections done sending, with every request answered
+    for (int i = connectionCount - 1; i >= 0; i--) {
+      if (connections[i].eof && connections[i].pending == 0 &&
+          connections[i].outputLength == 0)
+        closeConnection(i);
+    }
+  }
+
+  while (connectionCount > 0) {
+    closeConnection(connectionCount - 1);
+  }
+  close(listenFd);
+  unlink(options->daemonSocket);
+
+  if (options->verbose > VERBOSE_QUIET) {
+    printf("daemon %s: %d jobs done, %d failed.\n", options->daemonSocket, done,
+           failed);
+  }
+  exit(0);
+}
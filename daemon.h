@@ -0,0 +1,11 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+/* --- daemon ------------------------------------------------------------- */
+
+struct Options;
+
+void daemonRun(const struct Options *options, int *argc, char ***argv);
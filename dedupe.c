@@ -0,0 +1,243 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- sheet deduplication ------------------------------------------------ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include <libavutil/hash.h>
+#include <libavutil/imgutils.h>
+
+#include "asyncio.h"
+#include "dedupe.h"
+#include "sheet.h"
+#include "unpaper.h"
+
+// A processed sheet, remembered so that identical later sheets can reuse its
+// output files. Besides the output size, the entry keeps the global state the
+// pipeline leaves behind for the following sheets, so that skipping the
+// pipeline does not change how those are processed.
+struct DedupeEntry {
+  char key[DETECTION_KEY_SIZE];
+  char *outputs[2];
+  unsigned long lastUsed;
+  int width;
+  int height;
+  int deskewScanSize;
+  int maskCount;
+  int mask[MAX_MASKS][EDGES_COUNT];
+  bool maskValid[MAX_MASKS];
+  int wipeCount;
+  int wipe[MAX_MASKS][EDGES_COUNT];
+};
+
+static struct DedupeEntry *entries = NULL;
+static int entryCount = 0;
+static int entryCapacity = 0;
+static unsigned long useCounter = 0;
+
+static int dedupeHits = 0;
+static int dedupeMisses = 0;
+static int dedupeEvictions = 0;
+
+void dedupeInit(int capacity) {
+  entryCapacity = capacity;
+  entries = calloc(capacity, sizeof(entries[0]));
+  if (entries == NULL)
+    errOutput("unable to allocate deduplication cache.");
+}
+
+static void freeEntry(struct DedupeEntry *entry) {
+  for (int i = 0; i < 2; i++) {
+    free(entry->outputs[i]);
+    entry->outputs[i] = NULL;
+  }
+}
+
+void dedupeClose(void) {
+  for (int i = 0; i < entryCount; i++) {
+    freeEntry(&entries[i]);
+  }
+  free(entries);
+  entries = NULL;
+  entryCount = 0;
+}
+
+/**
+ * Calculates the deduplication key of an assembled sheet: a hash of its
+ * pixels together with everything that can make the same pixels come out
+ * differently, namely the parameters, as the options of a manifest sheet
+ * change them for that sheet alone, the per-sheet switches and the state
+ * left behind by previous sheets.
+ */
+void dedupeSheetKey(const struct RunState *run, char key[DETECTION_KEY_SIZE],
+                    AVFrame *sheet, int nr) {
+  struct AVHashContext *ctx = NULL;
+  const int rowSize = av_image_get_linesize(sheet->format, sheet->width, 0);
+
+  if (av_hash_alloc(&ctx, "SHA256") < 0)
+    errOutput("unable to allocate hash context.");
+  av_hash_init(ctx);
+
+  hashValue(ctx, sheet->width);
+  hashValue(ctx, sheet->height);
+  hashValue(ctx, sheet->format);
+  for (int y = 0; y < sheet->height; y++) {
+    av_hash_update(ctx, sheet->data[0] + y * sheet->linesize[0], rowSize);
+  }
+
+  // the masks, wipes and deskew scan size previous sheets leave are among
+  // the detection parameters
+  hashDetectionParameters(ctx, run);
+  hashOutputParameters(ctx, &run->options);
+  hashSheetSwitches(ctx, &run->options, nr);
+  hashValue(ctx, run->outputPixFmt);
+
+  av_hash_final_hex(ctx, (uint8_t *)key, DETECTION_KEY_SIZE);
+  av_hash_freep(&ctx);
+}
+
+/**
+ * Creates target as a copy of source, preferring a hard link.
+ */
+static void duplicateFile(const char *source, const char *target) {
+  char tmpFilename[PATH_MAX];
+  char buffer[65536];
+  size_t len;
+  FILE *in;
+  FILE *out;
+  bool copied = true;
+
+  if (strcmp(source, target) == 0)
+    return;
+
+  if (unlink(target) != 0 && errno != ENOENT)
+    errOutput("unable to replace %s.", target);
+
+  if (link(source, target) == 0)
+    return;
+
+  snprintf(tmpFilename, sizeof(tmpFilename), "%s.tmp", target);
+  in = fopen(source, "rb");
+  if (in == NULL)
+    errOutput("unable to copy %s to %s.", source, target);
+  out = fopen(tmpFilename, "wb");
+  if (out == NULL) {
+    fclose(in);
+    errOutput("unable to copy %s to %s.", source, target);
+  }
+
+  while (copied && (len = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    copied = (fwrite(buffer, 1, len, out) == len);
+  }
+  copied = copied && !ferror(in);
+  fclose(in);
+  copied = (fclose(out) == 0) && copied;
+
+  if (!copied || rename(tmpFilename, target) != 0) {
+    unlink(tmpFilename);
+    errOutput("unable to copy %s to %s.", source, target);
+  }
+}
+
+/**
+ * Looks up an earlier sheet with the same key. On a match, its output files
+ * are duplicated to outputFileNames and the state of the run after that
+ * sheet restored, with the size of the processed sheet.
+ *
+ * @return true if the earlier output was reused
+ */
+bool dedupeLookup(struct RunState *run, const char *key,
+                  char *outputFileNames[]) {
+  struct Options *options = &run->options;
+  struct DedupeEntry *entry = NULL;
+
+  for (int i = 0; i < entryCount && entry == NULL; i++) {
+    if (strcmp(entries[i].key, key) == 0)
+      entry = &entries[i];
+  }
+
+  // the earlier output may still be written behind, or have been removed in
+  // the meantime
+  if (entry != NULL)
+    asyncFlush();
+  for (int i = 0; entry != NULL && i < options->outputCount; i++) {
+    if (access(entry->outputs[i], R_OK) != 0)
+      entry = NULL;
+  }
+
+  if (entry == NULL) {
+    dedupeMisses++;
+    return false;
+  }
+
+  for (int i = 0; i < options->outputCount; i++) {
+    if (options->verbose >= VERBOSE_MORE) {
+      printf("duplicating %s to %s.\n", entry->outputs[i],
+             outputFileNames[i]);
+    }
+    duplicateFile(entry->outputs[i], outputFileNames[i]);
+  }
+
+  run->width = entry->width;
+  run->height = entry->height;
+  run->deskewScanSize = entry->deskewScanSize;
+  options->maskCount = entry->maskCount;
+  memcpy(options->mask, entry->mask, sizeof(options->mask));
+  memcpy(options->maskValid, entry->maskValid, sizeof(options->maskValid));
+  options->wipeCount = entry->wipeCount;
+  memcpy(options->wipe, entry->wipe, sizeof(options->wipe));
+
+  entry->lastUsed = ++useCounter;
+  dedupeHits++;
+  return true;
+}
+
+/**
+ * Remembers the output of a processed sheet, evicting the least recently
+ * used entry if the cache is full.
+ */
+void dedupeStore(const struct RunState *run, const char *key,
+                 char *outputFileNames[]) {
+  const struct Options *options = &run->options;
+  struct DedupeEntry *entry;
+
+  if (entryCount < entryCapacity) {
+    entry = &entries[entryCount++];
+  } else {
+    entry = &entries[0];
+    for (int i = 1; i < entryCount; i++) {
+      if (entries[i].lastUsed < entry->lastUsed)
+        entry = &entries[i];
+    }
+    freeEntry(entry);
+    dedupeEvictions++;
+  }
+
+  strcpy(entry->key, key);
+  for (int i = 0; i < options->outputCount; i++) {
+    entry->outputs[i] = strdup(outputFileNames[i]);
+  }
+  entry->lastUsed = ++useCounter;
+  entry->width = run->width;
+  entry->height = run->height;
+  entry->deskewScanSize = run->deskewScanSize;
+  entry->maskCount = options->maskCount;
+  memcpy(entry->mask, options->mask, sizeof(options->mask));
+  memcpy(entry->maskValid, options->maskValid, sizeof(options->maskValid));
+  entry->wipeCount = options->wipeCount;
+  memcpy(entry->wipe, options->wipe, sizeof(options->wipe));
+}
+
+void printDedupeStats(void) {
+  printf("dedupe: %d sheet%s reused, %d processed, %d evicted\n", dedupeHits,
+         pluralS(dedupeHits), dedupeMisses, dedupeEvictions);
+}
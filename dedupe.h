@@ -0,0 +1,32 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+
+#include <libavutil/frame.h>
+
+#include "cache.h"
+
+/* --- sheet deduplication ------------------------------------------------ */
+
+#define DEDUPE_DEFAULT_SIZE 64
+
+void dedupeInit(int capacity);
+
+void dedupeClose(void);
+
+struct RunState;
+
+void dedupeSheetKey(const struct RunState *run, char key[DETECTION_KEY_SIZE],
+                    AVFrame *sheet, int nr);
+
+bool dedupeLookup(struct RunState *run, const char *key,
+                  char *outputFileNames[]);
+
+void dedupeStore(const struct RunState *run, const char *key,
+                 char *outputFileNames[]);
+
+void printDedupeStats(void);
@@ -6,17 +6,84 @@
 
 /* --- tool functions for file handling ------------------------------------ */
 
+#include <limits.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/avutil.h>
+#include <libavutil/hash.h>
 
+#include "asyncio.h"
+#include "instrument.h"
+#include "tar.h"
 #include "tools.h"
 #include "unpaper.h"
 
+bool imageExists(const char *filename) {
+  struct stat statBuf;
+
+  // the pages of an --input-tar archive are its members, never files
+  if (tarReading())
+    return tarFindMember(filename);
+  return stat(filename, &statBuf) == 0;
+}
+
+/* --- archive members ---------------------------------------------------- */
+
+#define MEMBER_BUFFER_SIZE 65536
+
+// A member of an --input-tar archive, or a file read ahead by --async-io,
+// read for the decoder as a file.
+struct MemberReader {
+  const uint8_t *data;
+  size_t size;
+  size_t position;
+};
+
+static int readMember(void *opaque, uint8_t *buf, int size) {
+  struct MemberReader *reader = opaque;
+  const size_t left = reader->size - reader->position;
+
+  if (left == 0)
+    return AVERROR_EOF;
+  if ((size_t)size > left)
+    size = left;
+  memcpy(buf, reader->data + reader->position, size);
+  reader->position += size;
+  return size;
+}
+
+static int64_t seekMember(void *opaque, int64_t offset, int whence) {
+  struct MemberReader *reader = opaque;
+
+  switch (whence & ~AVSEEK_FORCE) {
+  case AVSEEK_SIZE:
+    return reader->size;
+  case SEEK_SET:
+    break;
+  case SEEK_CUR:
+    offset += reader->position;
+    break;
+  case SEEK_END:
+    offset += reader->size;
+    break;
+  default:
+    return -1;
+  }
+  if (offset < 0 || (size_t)offset > reader->size)
+    return -1;
+  reader->position = offset;
+  return offset;
+}
+
 /**
  * Loads image data from a file in pnm format.
  *
@@ -24,7 +91,8 @@
  * @param image structure to hold loaded image
  * @param type returns the type of the loaded image
  */
-void loadImage(const char *filename, AVFrame **image) {
+void loadImage(const struct Options *options, const char *filename,
+               AVFrame **image) {
   int ret;
   AVFormatContext *s = NULL;
   AVCodecContext *avctx = NULL;
@@ -32,8 +100,24 @@ void loadImage(const char *filename, AVFrame **image) {
   AVPacket pkt;
   AVFrame *frame = av_frame_alloc();
   char errbuff[1024];
+  struct MemberReader member = {NULL, 0, 0};
+  AVIOContext *pb = NULL;
+
+  // members of an archive and files read ahead are decoded from memory, and
+  // their format probed from their content
+  if (tarMember(filename, &member.data, &member.size) ||
+      asyncInput(filename, &member.data, &member.size)) {
+    uint8_t *buffer = av_malloc(MEMBER_BUFFER_SIZE);
+
+    s = avformat_alloc_context();
+    pb = avio_alloc_context(buffer, MEMBER_BUFFER_SIZE, 0, &member,
+                            readMember, NULL, seekMember);
+    if (buffer == NULL || s == NULL || pb == NULL)
+      errOutput("unable to allocate I/O context for %s.", filename);
+    s->pb = pb;
+  }
 
-  ret = avformat_open_input(&s, filename, NULL, NULL);
+  ret = avformat_open_input(&s, (pb != NULL) ? "" : filename, NULL, NULL);
   if (ret < 0) {
     av_strerror(ret, errbuff, sizeof(errbuff));
     errOutput("unable to open file %s: %s", filename, errbuff);
@@ -41,7 +125,7 @@ void loadImage(const char *filename, AVFrame **image) {
 
   avformat_find_stream_info(s, NULL);
 
-  if (verbose >= VERBOSE_MORE)
+  if (options->verbose >= VERBOSE_MORE)
     av_dump_format(s, 0, filename, 0);
 
   if (s->nb_streams < 1)
@@ -95,17 +179,20 @@ void loadImage(const char *filename, AVFrame **image) {
   case AV_PIX_FMT_MONOBLACK:
   case AV_PIX_FMT_MONOWHITE:
     *image = av_frame_clone(frame);
+    accountFrame(*image);
     break;
 
   case AV_PIX_FMT_PAL8:
-    initImage(image, frame->width, frame->height, AV_PIX_FMT_RGB24, -1);
+    initImage(image, frame->width, frame->height, AV_PIX_FMT_RGB24);
+    fillImage(*image, options->sheetBackground, options->absBlackThreshold);
 
     const uint32_t *palette = (const uint32_t *)frame->data[1];
     for (int y = 0; y < frame->height; y++) {
       for (int x = 0; x < frame->width; x++) {
         const uint8_t palette_index =
             frame->data[0][frame->linesize[0] * y + x];
-        setPixel(palette[palette_index], x, y, *image);
+        setPixel(palette[palette_index], x, y, *image,
+                 options->absBlackThreshold);
       }
     }
     break;
@@ -116,6 +203,104 @@ void loadImage(const char *filename, AVFrame **image) {
 
   avcodec_free_context(&avctx);
   avformat_close_input(&s);
+  if (pb != NULL) {
+    av_freep(&pb->buffer);
+    avio_context_free(&pb);
+  }
+}
+
+/**
+ * Selects the codec to save images in the given pixel format with, adjusting
+ * the format to the one the codec accepts.
+ */
+static enum AVCodecID outputCodec(int *outputPixFmt) {
+  switch (*outputPixFmt) {
+  case AV_PIX_FMT_RGB24:
+    return AV_CODEC_ID_PPM;
+  case AV_PIX_FMT_Y400A:
+  case AV_PIX_FMT_GRAY8:
+    *outputPixFmt = AV_PIX_FMT_GRAY8;
+    return AV_CODEC_ID_PGM;
+  case AV_PIX_FMT_MONOBLACK:
+  case AV_PIX_FMT_MONOWHITE:
+    *outputPixFmt = AV_PIX_FMT_MONOWHITE;
+    return AV_CODEC_ID_PBM;
+  default:
+    return -1;
+  }
+}
+
+/**
+ * Gives the image in the pixel format it is saved in: the image itself when
+ * already in that format, or a copy converted to it.
+ */
+AVFrame *outputImage(const struct Options *options, AVFrame *input,
+                     int outputPixFmt) {
+  AVFrame *output = input;
+
+  outputCodec(&outputPixFmt);
+  if (input->format != outputPixFmt) {
+    initImage(&output, input->width, input->height, outputPixFmt);
+    fillImage(output, options->sheetBackground, options->absBlackThreshold);
+    copyImageArea(0, 0, input->width, input->height, input, 0, 0, output,
+                  options->absBlackThreshold);
+  }
+  return output;
+}
+
+/**
+ * Encodes an image, already in the pixel format of the codec, into the
+ * content of its file.
+ */
+static AVPacket *encodeImage(AVFrame *frame, enum AVCodecID output_codec) {
+  const AVCodec *codec;
+  AVCodecContext *codec_ctx;
+  AVPacket *pkt;
+  int ret;
+  char errbuff[1024];
+
+  codec = avcodec_find_encoder(output_codec);
+  if (!codec) {
+    errOutput("output codec not found");
+  }
+
+  codec_ctx = avcodec_alloc_context3(codec);
+  if (!codec_ctx) {
+    errOutput("could not alloc codec context");
+  }
+
+  codec_ctx->width = frame->width;
+  codec_ctx->height = frame->height;
+  codec_ctx->pix_fmt = frame->format;
+  codec_ctx->time_base.den = 1;
+  codec_ctx->time_base.num = 1;
+
+  ret = avcodec_open2(codec_ctx, codec, NULL);
+  if (ret < 0) {
+    av_strerror(ret, errbuff, sizeof(errbuff));
+    errOutput("unable to open codec: %s", errbuff);
+  }
+
+  pkt = av_packet_alloc();
+  if (!pkt) {
+    errOutput("unable to allocate output packet");
+  }
+
+  ret = avcodec_send_frame(codec_ctx, frame);
+  if (ret < 0) {
+    av_strerror(ret, errbuff, sizeof(errbuff));
+    errOutput("unable to send frame to encoder: %s", errbuff);
+  }
+
+  ret = avcodec_receive_packet(codec_ctx, pkt);
+  if (ret < 0) {
+    av_strerror(ret, errbuff, sizeof(errbuff));
+    errOutput("unable to receive packet from encoder: %s", errbuff);
+  }
+
+  avcodec_free_context(&codec_ctx);
+
+  return pkt;
 }
 
 /**
@@ -126,17 +311,23 @@ void loadImage(const char *filename, AVFrame **image) {
  * @param type filetype of the image to save
  * @return true on success, false on failure
  */
-void saveImage(char *filename, AVFrame *input, int outputPixFmt) {
+static void saveImageFile(const struct Options *options, char *filename,
+                          AVFrame *input, int outputPixFmt) {
   const AVOutputFormat *fmt = NULL;
   enum AVCodecID output_codec = -1;
   const AVCodec *codec;
   AVFormatContext *out_ctx;
   AVCodecContext *codec_ctx;
   AVStream *video_st;
-  AVFrame *output = input;
+  AVFrame *output;
   AVPacket *pkt = NULL;
   int ret;
   char errbuff[1024];
+  char tmpFilename[PATH_MAX];
+
+  // write to a temporary file and rename it once complete, so that an
+  // interrupted run never leaves a truncated output file behind.
+  snprintf(tmpFilename, sizeof(tmpFilename), "%s.tmp", filename);
 
   fmt = av_guess_format("image2", NULL, NULL);
 
@@ -150,31 +341,10 @@ void saveImage(char *filename, AVFrame *input, int outputPixFmt) {
   }
 
   out_ctx->oformat = fmt;
-  out_ctx->url = av_strdup(filename);
+  out_ctx->url = av_strdup(tmpFilename);
 
-  switch (outputPixFmt) {
-  case AV_PIX_FMT_RGB24:
-    output_codec = AV_CODEC_ID_PPM;
-    break;
-  case AV_PIX_FMT_Y400A:
-  case AV_PIX_FMT_GRAY8:
-    outputPixFmt = AV_PIX_FMT_GRAY8;
-    output_codec = AV_CODEC_ID_PGM;
-    break;
-  case AV_PIX_FMT_MONOBLACK:
-  case AV_PIX_FMT_MONOWHITE:
-    outputPixFmt = AV_PIX_FMT_MONOWHITE;
-    output_codec = AV_CODEC_ID_PBM;
-    break;
-  default:
-    output_codec = -1;
-    break;
-  }
-
-  if (input->format != outputPixFmt) {
-    initImage(&output, input->width, input->height, outputPixFmt, -1);
-    copyImageArea(0, 0, input->width, input->height, input, 0, 0, output);
-  }
+  output_codec = outputCodec(&outputPixFmt);
+  output = outputImage(options, input, outputPixFmt);
 
   codec = avcodec_find_encoder(output_codec);
   if (!codec) {
@@ -207,10 +377,10 @@ void saveImage(char *filename, AVFrame *input, int outputPixFmt) {
     errOutput("unable to open codec: %s", errbuff);
   }
 
-  if (verbose >= VERBOSE_MORE)
+  if (options->verbose >= VERBOSE_MORE)
     av_dump_format(out_ctx, 0, filename, 1);
 
-  if ((ret = avio_open(&out_ctx->pb, filename, AVIO_FLAG_WRITE)) < 0) {
+  if ((ret = avio_open(&out_ctx->pb, tmpFilename, AVIO_FLAG_WRITE)) < 0) {
     av_strerror(ret, errbuff, sizeof(errbuff));
     errOutput("cannot alloc I/O context for %s: %s", filename, errbuff);
   }
@@ -243,19 +413,184 @@ void saveImage(char *filename, AVFrame *input, int outputPixFmt) {
 
   av_packet_free(&pkt);
   avcodec_free_context(&codec_ctx);
+  avio_closep(&out_ctx->pb);
   avformat_free_context(out_ctx);
 
+  if (rename(tmpFilename, filename) != 0) {
+    unlink(tmpFilename);
+    errOutput("unable to rename %s to %s.", tmpFilename, filename);
+  }
+
   if (output != input)
     av_frame_free(&output);
 }
 
+static void releasePacket(void *opaque) {
+  AVPacket *pkt = opaque;
+
+  av_packet_free(&pkt);
+}
+
+/**
+ * Saves an output image: to the file, written behind with --async-io, or to
+ * the member of the --output-tar archive.
+ */
+void saveImage(const struct Options *options, char *filename, AVFrame *input,
+               int outputPixFmt) {
+  if (tarWriting() || asyncEnabled()) {
+    const enum AVCodecID output_codec = outputCodec(&outputPixFmt);
+    AVFrame *output = outputImage(options, input, outputPixFmt);
+
+    AVPacket *pkt = encodeImage(output, output_codec);
+    if (tarWriting()) {
+      tarWriteMember(filename, pkt->data, pkt->size);
+      av_packet_free(&pkt);
+    } else {
+      asyncWrite(filename, pkt->data, pkt->size, releasePacket, pkt);
+    }
+
+    if (output != input)
+      av_frame_free(&output);
+    return;
+  }
+
+  saveImageFile(options, filename, input, outputPixFmt);
+}
+
+/* --- blank output ------------------------------------------------------- */
+
+#define BLANK_CACHE_SIZE 4
+
+// Blank pages only depend on their size and format, so they are encoded once
+// and the encoded file content is reused for every further blank page.
+static struct {
+  int width;
+  int height;
+  int format;
+  enum AVCodecID codec;
+  AVPacket *pkt;
+} blankImages[BLANK_CACHE_SIZE];
+static int blankImagesNext = 0;
+
+static AVPacket *encodeBlankImage(const struct Options *options, int width,
+                                  int height, int outputPixFmt,
+                                  enum AVCodecID output_codec) {
+  AVFrame *frame = NULL;
+
+  initImage(&frame, width, height, outputPixFmt);
+  fillImage(frame, options->sheetBackground, options->absBlackThreshold);
+  AVPacket *pkt = encodeImage(frame, output_codec);
+  av_frame_free(&frame);
+
+  return pkt;
+}
+
+/**
+ * Saves a page filled with the sheet background, without going through a
+ * full image. The result is the same saveImage() produces for such a page.
+ *
+ * @param filename file name to save image to
+ * @param width width of the page
+ * @param height height of the page
+ * @param outputPixFmt pixel format to save the page in
+ */
+void saveBlankImage(const struct Options *options, char *filename, int width,
+                    int height, int outputPixFmt) {
+  const enum AVCodecID output_codec = outputCodec(&outputPixFmt);
+  AVPacket *pkt = NULL;
+  char tmpFilename[PATH_MAX];
+  FILE *f;
+
+  for (int i = 0; i < BLANK_CACHE_SIZE && pkt == NULL; i++) {
+    if (blankImages[i].pkt != NULL && blankImages[i].width == width &&
+        blankImages[i].height == height &&
+        blankImages[i].format == outputPixFmt &&
+        blankImages[i].codec == output_codec) {
+      pkt = blankImages[i].pkt;
+    }
+  }
+
+  if (pkt == NULL) {
+    pkt = encodeBlankImage(options, width, height, outputPixFmt, output_codec);
+
+    av_packet_free(&blankImages[blankImagesNext].pkt);
+    blankImages[blankImagesNext].width = width;
+    blankImages[blankImagesNext].height = height;
+    blankImages[blankImagesNext].format = outputPixFmt;
+    blankImages[blankImagesNext].codec = output_codec;
+    blankImages[blankImagesNext].pkt = pkt;
+    blankImagesNext = (blankImagesNext + 1) % BLANK_CACHE_SIZE;
+  }
+
+  if (tarWriting()) {
+    tarWriteMember(filename, pkt->data, pkt->size);
+    return;
+  }
+  if (asyncEnabled()) {
+    // the cached packet may be replaced before the write completes
+    AVPacket *ref = av_packet_clone(pkt);
+    if (ref == NULL) {
+      errOutput("unable to allocate output packet");
+    }
+
+    asyncWrite(filename, ref->data, ref->size, releasePacket, ref);
+    return;
+  }
+
+  snprintf(tmpFilename, sizeof(tmpFilename), "%s.tmp", filename);
+  f = fopen(tmpFilename, "wb");
+  if (f == NULL) {
+    errOutput("cannot open %s for writing.", tmpFilename);
+  }
+
+  if (fwrite(pkt->data, 1, pkt->size, f) != (size_t)pkt->size ||
+      fclose(f) != 0 || rename(tmpFilename, filename) != 0) {
+    unlink(tmpFilename);
+    errOutput("unable to write %s.", filename);
+  }
+}
+
+/**
+ * Feeds the raw content of a file into a running hash.
+ *
+ * @param ctx hash context, already initialised by the caller
+ * @param filename file to read
+ */
+void hashFile(struct AVHashContext *ctx, const char *filename) {
+  uint8_t buffer[65536];
+  size_t len;
+  const uint8_t *member;
+  size_t memberSize;
+
+  if (tarMember(filename, &member, &memberSize) ||
+      asyncInput(filename, &member, &memberSize)) {
+    av_hash_update(ctx, member, memberSize);
+    return;
+  }
+
+  FILE *f = fopen(filename, "rb");
+
+  if (f == NULL)
+    errOutput("unable to open file %s for hashing.", filename);
+
+  while ((len = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    av_hash_update(ctx, buffer, len);
+  }
+
+  if (ferror(f))
+    errOutput("unable to read file %s for hashing.", filename);
+
+  fclose(f);
+}
+
 /**
  * Saves the image if full debugging mode is enabled.
  */
-void saveDebug(char *filenameTemplate, int index, AVFrame *image) {
-  if (verbose >= VERBOSE_DEBUG_SAVE) {
+void saveDebug(const struct Options *options, char *filenameTemplate,
+               int index, AVFrame *image) {
+  if (options->verbose >= VERBOSE_DEBUG_SAVE) {
     char debugFilename[100];
     sprintf(debugFilename, filenameTemplate, index);
-    saveImage(debugFilename, image, image->format);
+    saveImageFile(options, debugFilename, image, image->format);
   }
 }
@@ -8,6 +8,7 @@
 /* --- image processing --------------------------------------------------- */
 
 #include <math.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -15,15 +16,22 @@
 #include <string.h>
 
 #include "imageprocess.h"
+#include "instrument.h"
+#include "parallel.h"
 #include "parse.h" //for maksOverlapAny
 #include "tools.h"
 #include "unpaper.h"
 
+#ifdef UNPAPER_REFERENCE
+// the reference kernels run on the calling thread only
+#define parallelBands(rows, function, arg) function(0, (rows)-1, arg)
+#endif
+
 /****************************************************************************
  * image processing functions                                               *
  ****************************************************************************/
 
-static inline bool inMask(int x, int y, Mask mask) {
+static inline bool inMask(int x, int y, const Mask mask) {
   return (x >= mask[LEFT]) && (x <= mask[RIGHT]) && (y >= mask[TOP]) &&
          (y <= mask[BOTTOM]);
 }
@@ -31,15 +39,14 @@ static inline bool inMask(int x, int y, Mask mask) {
 /**
  * Tests if masks a and b overlap.
  */
-static inline bool masksOverlap(Mask a, Mask b) {
+static inline bool masksOverlap(const Mask a, const Mask b) {
   return (inMask(a[LEFT], a[TOP], b) || inMask(a[RIGHT], a[BOTTOM], b));
 }
 
 /**
  * Tests if at least one mask in masks overlaps with m.
  */
-static bool masksOverlapAny(Mask m,
-                            Mask *masks, int masksCount) {
+static bool masksOverlapAny(Mask m, const Mask *masks, int masksCount) {
   for (int i = 0; i < masksCount; i++) {
     if (masksOverlap(m, masks[i])) {
       return true;
@@ -50,6 +57,18 @@ static bool masksOverlapAny(Mask m,
 
 /* --- deskewing ---------------------------------------------------------- */
 
+/**
+ * Limits the number of pixels of the virtual line scanning an edge of length
+ * pixels, taking the whole edge when unset.
+ */
+static void limitScanSize(int *scanSize, int length) {
+  if (*scanSize == -1) {
+    *scanSize = length;
+  }
+  limit(scanSize, MAX_ROTATION_SCAN_SIZE);
+  limit(scanSize, length);
+}
+
 /**
  * Returns the maximum peak value that occurs when shifting a rotated virtual
  * line above the image, starting from one edge of an area and moving towards
@@ -60,8 +79,9 @@ static bool masksOverlapAny(Mask m,
  * @param m ascending slope of the virtually shifted (m=tan(angle)). Mind that
  * this is negative for negative radians.
  */
-static int detectEdgeRotationPeak(float m, int shiftX, int shiftY,
-                                  AVFrame *image, Mask mask) {
+static int detectEdgeRotationPeak(const struct Options *options, float m,
+                                  int shiftX, int shiftY, AVFrame *image,
+                                  Mask mask, int *scanSize) {
   int width = mask[RIGHT] - mask[LEFT] + 1;
   int height = mask[BOTTOM] - mask[TOP] + 1;
   int mid;
@@ -82,19 +102,15 @@ static int detectEdgeRotationPeak(float m, int shiftX, int shiftY,
   int lastBlackness = 0;
   int diff = 0;
   int maxDiff = 0;
-  int maxBlacknessAbs = 255 * deskewScanSize * deskewScanDepth;
+  int maxBlacknessAbs = 255 * *scanSize * options->deskewScanDepth;
   int maxDepth;
   int accumulatedBlackness = 0;
 
   if (shiftY == 0) { // horizontal detection
-    if (deskewScanSize == -1) {
-      deskewScanSize = height;
-    }
-    limit(&deskewScanSize, MAX_ROTATION_SCAN_SIZE);
-    limit(&deskewScanSize, height);
+    limitScanSize(scanSize, height);
 
     maxDepth = width / 2;
-    half = deskewScanSize / 2;
+    half = *scanSize / 2;
     outerOffset = (int)(fabsf(m) * half);
     mid = height / 2;
     sideOffset =
@@ -104,13 +120,9 @@ static int detectEdgeRotationPeak(float m, int shiftX, int shiftY,
     stepX = -m;
     stepY = 1.0;
   } else { // vertical detection
-    if (deskewScanSize == -1) {
-      deskewScanSize = width;
-    }
-    limit(&deskewScanSize, MAX_ROTATION_SCAN_SIZE);
-    limit(&deskewScanSize, width);
+    limitScanSize(scanSize, width);
     maxDepth = height / 2;
-    half = deskewScanSize / 2;
+    half = *scanSize / 2;
     outerOffset = (int)(fabsf(m) * half);
     mid = width / 2;
     sideOffset =
@@ -122,7 +134,7 @@ static int detectEdgeRotationPeak(float m, int shiftX, int shiftY,
   }
 
   // fill buffer with coordinates for rotated line in first unshifted position
-  for (int lineStep = 0; lineStep < deskewScanSize; lineStep++) {
+  for (int lineStep = 0; lineStep < *scanSize; lineStep++) {
     x[lineStep] = (int)X;
     y[lineStep] = (int)Y;
     X += stepX;
@@ -137,7 +149,7 @@ static int detectEdgeRotationPeak(float m, int shiftX, int shiftY,
        dep++) {
     // calculate blackness of virtual line
     blackness = 0;
-    for (int lineStep = 0; lineStep < deskewScanSize; lineStep++) {
+    for (int lineStep = 0; lineStep < *scanSize; lineStep++) {
       xx = x[lineStep];
       x[lineStep] += shiftX;
       yy = y[lineStep];
@@ -166,25 +178,32 @@ static int detectEdgeRotationPeak(float m, int shiftX, int shiftY,
  * bottom. Which of the four edges to take depends on whether shiftX or shiftY
  * is non-zero, and what sign this shifting value has.
  */
-static float detectEdgeRotation(int shiftX, int shiftY, AVFrame *image,
-                                Mask mask) {
+static float detectEdgeRotation(const struct Options *options, int shiftX,
+                                int shiftY, AVFrame *image, Mask mask,
+                                int *scanSize) {
   // either shiftX or shiftY is 0, the other value is -i|+i
   // depending on shiftX/shiftY the start edge for shifting is determined
   int maxPeak = 0;
   float detectedRotation = 0.0;
 
+  TRACE_BEGIN("edge-rotation");
+
   // iteratively increase test angle, alternating between +/- sign while
   // increasing absolute value
-  for (float rotation = 0.0; rotation <= deskewScanRangeRad;
-       rotation = (rotation >= 0.0) ? -(rotation + deskewScanStepRad)
-                                    : -rotation) {
+  for (float rotation = 0.0; rotation <= options->deskewScanRangeRad;
+       rotation = (rotation >= 0.0)
+                      ? -(rotation + options->deskewScanStepRad)
+                      : -rotation) {
     float m = tanf(rotation);
-    int peak = detectEdgeRotationPeak(m, shiftX, shiftY, image, mask);
+    int peak = detectEdgeRotationPeak(options, m, shiftX, shiftY, image, mask,
+                                      scanSize);
     if (peak > maxPeak) {
       detectedRotation = rotation;
       maxPeak = peak;
     }
   }
+
+  TRACE_END();
   return detectedRotation;
 }
 
@@ -193,47 +212,57 @@ static float detectEdgeRotation(int shiftX, int shiftY, AVFrame *image,
  * Angles between -deskewScanRange and +deskewScanRange are scanned, at either
  * the horizontal or vertical edges of the area specified by left, top, right,
  * bottom.
+ *
+ * The scan size is limited to the area through scanSize, and the messages
+ * are written to report.
  */
-float detectRotation(AVFrame *image, Mask mask) {
+float detectRotationReport(const struct Options *options, AVFrame *image,
+                           Mask mask, int *scanSize, FILE *report) {
   float rotation[4];
   int count = 0;
   float total;
   float average;
   float deviation;
 
-  if ((deskewScanEdges & 1 << LEFT) != 0) {
+  if ((options->deskewScanEdges & 1 << LEFT) != 0) {
     // left
-    rotation[count] = detectEdgeRotation(1, 0, image, mask);
-    if (verbose >= VERBOSE_NORMAL) {
-      printf("detected rotation left: [%d,%d,%d,%d]: %f\n", mask[LEFT],
-             mask[TOP], mask[RIGHT], mask[BOTTOM], rotation[count]);
+    rotation[count] = detectEdgeRotation(options, 1, 0, image, mask, scanSize);
+    if (options->verbose >= VERBOSE_NORMAL) {
+      fprintf(report, "detected rotation left: [%d,%d,%d,%d]: %f\n",
+              mask[LEFT], mask[TOP], mask[RIGHT], mask[BOTTOM],
+              rotation[count]);
     }
     count++;
   }
-  if ((deskewScanEdges & 1 << TOP) != 0) {
+  if ((options->deskewScanEdges & 1 << TOP) != 0) {
     // top
-    rotation[count] = -detectEdgeRotation(0, 1, image, mask);
-    if (verbose >= VERBOSE_NORMAL) {
-      printf("detected rotation top: [%d,%d,%d,%d]: %f\n", mask[LEFT],
-             mask[TOP], mask[RIGHT], mask[BOTTOM], rotation[count]);
+    rotation[count] =
+        -detectEdgeRotation(options, 0, 1, image, mask, scanSize);
+    if (options->verbose >= VERBOSE_NORMAL) {
+      fprintf(report, "detected rotation top: [%d,%d,%d,%d]: %f\n",
+              mask[LEFT], mask[TOP], mask[RIGHT], mask[BOTTOM],
+              rotation[count]);
     }
     count++;
   }
-  if ((deskewScanEdges & 1 << RIGHT) != 0) {
+  if ((options->deskewScanEdges & 1 << RIGHT) != 0) {
     // right
-    rotation[count] = detectEdgeRotation(-1, 0, image, mask);
-    if (verbose >= VERBOSE_NORMAL) {
-      printf("detected rotation right: [%d,%d,%d,%d]: %f\n", mask[LEFT],
-             mask[TOP], mask[RIGHT], mask[BOTTOM], rotation[count]);
+    rotation[count] = detectEdgeRotation(options, -1, 0, image, mask, scanSize);
+    if (options->verbose >= VERBOSE_NORMAL) {
+      fprintf(report, "detected rotation right: [%d,%d,%d,%d]: %f\n",
+              mask[LEFT], mask[TOP], mask[RIGHT], mask[BOTTOM],
+              rotation[count]);
     }
     count++;
   }
-  if ((deskewScanEdges & 1 << BOTTOM) != 0) {
+  if ((options->deskewScanEdges & 1 << BOTTOM) != 0) {
     // bottom
-    rotation[count] = -detectEdgeRotation(0, -1, image, mask);
-    if (verbose >= VERBOSE_NORMAL) {
-      printf("detected rotation bottom: [%d,%d,%d,%d]: %f\n", mask[LEFT],
-             mask[TOP], mask[RIGHT], mask[BOTTOM], rotation[count]);
+    rotation[count] =
+        -detectEdgeRotation(options, 0, -1, image, mask, scanSize);
+    if (options->verbose >= VERBOSE_NORMAL) {
+      fprintf(report, "detected rotation bottom: [%d,%d,%d,%d]: %f\n",
+              mask[LEFT], mask[TOP], mask[RIGHT], mask[BOTTOM],
+              rotation[count]);
     }
     count++;
   }
@@ -248,22 +277,48 @@ float detectRotation(AVFrame *image, Mask mask) {
     total += powf(rotation[i] - average, 2);
   }
   deviation = sqrtf(total);
-  if (verbose >= VERBOSE_NORMAL) {
-    printf("rotation average: %f  deviation: %f  rotation-scan-deviation "
-           "(maximum): %f  [%d,%d,%d,%d]\n",
-           average, deviation, deskewScanDeviationRad, mask[LEFT], mask[TOP],
-           mask[RIGHT], mask[BOTTOM]);
+  if (options->verbose >= VERBOSE_NORMAL) {
+    fprintf(report,
+            "rotation average: %f  deviation: %f  rotation-scan-deviation "
+            "(maximum): %f  [%d,%d,%d,%d]\n",
+            average, deviation, options->deskewScanDeviationRad, mask[LEFT],
+            mask[TOP], mask[RIGHT], mask[BOTTOM]);
   }
-  if (deviation <= deskewScanDeviationRad) {
+  if (deviation <= options->deskewScanDeviationRad) {
     return average;
   } else {
-    if (verbose >= VERBOSE_NONE) {
-      printf("out of deviation range - NO ROTATING\n");
+    if (options->verbose >= VERBOSE_NONE) {
+      fprintf(report, "out of deviation range - NO ROTATING\n");
     }
     return 0.0;
   }
 }
 
+float detectRotation(const struct Options *options, AVFrame *image, Mask mask,
+                     int *scanSize) {
+  return detectRotationReport(options, image, mask, scanSize, stdout);
+}
+
+/**
+ * Returns the scan size detectRotation() leaves behind after scanning mask
+ * starting from scanSize, without scanning it.
+ */
+int rotationScanSize(const struct Options *options, Mask mask, int scanSize) {
+  const int width = mask[RIGHT] - mask[LEFT] + 1;
+  const int height = mask[BOTTOM] - mask[TOP] + 1;
+
+  if (options->deskewScanRangeRad < 0.0) {
+    return scanSize; // no angle is scanned
+  }
+  for (int edge = 0; edge < EDGES_COUNT; edge++) {
+    if ((options->deskewScanEdges & 1 << edge) != 0) {
+      limitScanSize(&scanSize,
+                    (edge == LEFT || edge == RIGHT) ? height : width);
+    }
+  }
+  return scanSize;
+}
+
 /**
  * Nearest-neighbour interpolation.
  */
@@ -369,12 +424,13 @@ static int bilinearInterpolate(float x, float y, AVFrame *source) {
 
 /**
  * 2-D bilinear interpolation
- * The method chosen depends on the global interpolateType variable.
+ * The method chosen depends on the interpolateType option.
  */
-static int interpolate(float x, float y, AVFrame *source) {
-  if (interpolateType == INTERP_NN) {
+static int interpolate(const struct Options *options, float x, float y,
+                       AVFrame *source) {
+  if (options->interpolateType == INTERP_NN) {
     return nearest(x, y, source);
-  } else if (interpolateType == INTERP_LINEAR) {
+  } else if (options->interpolateType == INTERP_LINEAR) {
     return bilinearInterpolate(x, y, source);
   } else {
     return bicubicInterpolate(x, y, source);
@@ -386,56 +442,101 @@ static int interpolate(float x, float y, AVFrame *source) {
  * middle-point. (To rotate parts of an image, extract the part with copyBuffer,
  * rotate, and re-paste with copyBuffer.)
  */
-void rotate(const float radians, AVFrame *source, AVFrame *target) {
+struct RotateBand {
+  const struct Options *options;
+  AVFrame *source;
+  AVFrame *target;
+  float sinval;
+  float cosval;
+  float midX;
+  float midY;
+};
+
+static void rotateBand(int first, int last, void *arg) {
+  const struct RotateBand *band = arg;
+
+  for (int y = first; y <= last; y++) {
+    for (int x = 0; x < band->source->width; x++) {
+      const float srcX = band->midX + (x - band->midX) * band->cosval +
+                         (y - band->midY) * band->sinval;
+      const float srcY = band->midY + (y - band->midY) * band->cosval -
+                         (x - band->midX) * band->sinval;
+      const int pixel = interpolate(band->options, srcX, srcY, band->source);
+      setPixel(pixel, x, y, band->target, band->options->absBlackThreshold);
+    }
+  }
+}
+
+void rotate(const struct Options *options, const float radians,
+            AVFrame *source, AVFrame *target) {
   const int w = source->width;
   const int h = source->height;
 
   // create 2D rotation matrix
-  const float sinval = sinf(radians);
-  const float cosval = cosf(radians);
-  const float midX = w / 2.0f;
-  const float midY = h / 2.0f;
-
-  for (int y = 0; y < h; y++) {
-    for (int x = 0; x < w; x++) {
-      const float srcX = midX + (x - midX) * cosval + (y - midY) * sinval;
-      const float srcY = midY + (y - midY) * cosval - (x - midX) * sinval;
-      const int pixel = interpolate(srcX, srcY, source);
-      setPixel(pixel, x, y, target);
-    }
-  }
+  struct RotateBand band = {
+      .options = options,
+      .source = source,
+      .target = target,
+      .sinval = sinf(radians),
+      .cosval = cosf(radians),
+      .midX = w / 2.0f,
+      .midY = h / 2.0f,
+  };
+
+  parallelBands(h, rotateBand, &band);
 }
 
 /* --- stretching / resizing / shifting ------------------------------------ */
 
-static void stretchTo(AVFrame *source, AVFrame *target) {
-  const float xRatio = source->width / (float)target->width;
-  const float yRatio = source->height / (float)target->height;
+struct StretchBand {
+  const struct Options *options;
+  AVFrame *source;
+  AVFrame *target;
+  float xRatio;
+  float yRatio;
+};
 
-  if (verbose >= VERBOSE_MORE) {
-    printf("stretching %dx%d -> %dx%d\n", source->width, source->height,
-           target->width, target->height);
-  }
+static void stretchBand(int first, int last, void *arg) {
+  const struct StretchBand *band = arg;
 
-  for (int y = 0; y < target->height; y++) {
-    for (int x = 0; x < target->width; x++) {
+  for (int y = first; y <= last; y++) {
+    for (int x = 0; x < band->target->width; x++) {
       // calculate average pixel value in source matrix
-      const int pixel = interpolate(x * xRatio, y * yRatio, source);
-      setPixel(pixel, x, y, target);
+      const int pixel = interpolate(band->options, x * band->xRatio,
+                                    y * band->yRatio, band->source);
+      setPixel(pixel, x, y, band->target, band->options->absBlackThreshold);
     }
   }
 }
 
-void stretch(int w, int h, AVFrame **image) {
+static void stretchTo(const struct Options *options, AVFrame *source,
+                      AVFrame *target) {
+  struct StretchBand band = {
+      .options = options,
+      .source = source,
+      .target = target,
+      .xRatio = source->width / (float)target->width,
+      .yRatio = source->height / (float)target->height,
+  };
+
+  if (options->verbose >= VERBOSE_MORE) {
+    printf("stretching %dx%d -> %dx%d\n", source->width, source->height,
+           target->width, target->height);
+  }
+
+  parallelBands(target->height, stretchBand, &band);
+}
+
+void stretch(const struct Options *options, int w, int h, AVFrame **image) {
   AVFrame *newimage;
 
   if ((*image)->width == w && (*image)->height == h)
     return;
 
   // allocate new buffer's memory
-  initImage(&newimage, w, h, (*image)->format, false);
+  initImage(&newimage, w, h, (*image)->format);
 
-  stretchTo(*image, newimage);
+  stretchTo(options, *image, newimage);
 
   replaceImage(image, &newimage);
 }
@@ -448,14 +549,14 @@ void stretch(int w, int h, AVFrame **image) {
  * @param w the new width to resize to
  * @param h the new height to resize to
  */
-void resize(int w, int h, AVFrame **image) {
+void resize(const struct Options *options, int w, int h, AVFrame **image) {
   AVFrame *stretched, *resized;
   int ww;
   int hh;
   float wRat = (float)w / (*image)->width;
   float hRat = (float)h / (*image)->height;
 
-  if (verbose >= VERBOSE_NORMAL) {
+  if (options->verbose >= VERBOSE_NORMAL) {
     printf("resizing %dx%d -> %dx%d\n", (*image)->width, (*image)->height, w,
            h);
   }
@@ -471,8 +572,9 @@ void resize(int w, int h, AVFrame **image) {
     ww = w;
     hh = h;
   }
-  initImage(&stretched, ww, hh, (*image)->format, true);
-  stretchTo(*image, stretched);
+  initImage(&stretched, ww, hh, (*image)->format);
+  fillImage(stretched, options->sheetBackground, options->absBlackThreshold);
+  stretchTo(options, *image, stretched);
 
   // Check if any centering needs to be done, otherwise make a new
   // copy, center and return that.  Check for the stretched
@@ -483,37 +585,156 @@ void resize(int w, int h, AVFrame **image) {
     // don't create one more buffer if the size is the same.
     resized = stretched;
   } else {
-    initImage(&resized, w, h, (*image)->format, true);
-    centerImage(stretched, 0, 0, w, h, resized);
+    initImage(&resized, w, h, (*image)->format);
+    fillImage(resized, options->sheetBackground, options->absBlackThreshold);
+    centerImage(stretched, 0, 0, w, h, resized, options->sheetBackground,
+                options->absBlackThreshold);
     av_frame_free(&stretched);
   }
   replaceImage(image, &resized);
 }
 
+/**
+ * Calculates the size of an image after resize(), without touching any pixel.
+ *
+ * @param w the new width to resize to
+ * @param h the new height to resize to
+ * @param width the width of the image, replaced with the resized width
+ * @param height the height of the image, replaced with the resized height
+ */
+void resizeDimensions(int w, int h, int *width, int *height) {
+  int ww;
+  int hh;
+  float wRat = (float)w / *width;
+  float hRat = (float)h / *height;
+
+  if (wRat < hRat) {
+    ww = w;
+    hh = *height * w / *width;
+  } else if (hRat < wRat) {
+    ww = *width * h / *height;
+    hh = h;
+  } else {
+    ww = w;
+    hh = h;
+  }
+
+  // resize() keeps the stretched image when the width matches, regardless of
+  // its height.
+  if ((ww == w) && (h != 0)) {
+    *width = ww;
+    *height = hh;
+  } else {
+    *width = w;
+    *height = h;
+  }
+}
+
 /**
  * Shifts the image.
  *
  * @param shiftX horizontal shifting
  * @param shiftY vertical shifting
  */
-void shift(int shiftX, int shiftY, AVFrame **image) {
+struct ShiftBand {
+  const struct Options *options;
+  AVFrame *source;
+  AVFrame *target;
+  int shiftX;
+  int shiftY;
+};
+
+static void shiftBand(int first, int last, void *arg) {
+  const struct ShiftBand *band = arg;
+
+  for (int y = first; y <= last; y++) {
+    for (int x = 0; x < band->source->width; x++) {
+      const int pixel = getPixel(x, y, band->source);
+      setPixel(pixel, x + band->shiftX, y + band->shiftY, band->target,
+               band->options->absBlackThreshold);
+    }
+  }
+}
+
+void shift(const struct Options *options, int shiftX, int shiftY,
+           AVFrame **image) {
   AVFrame *newimage;
 
   // allocate new buffer's memory
-  initImage(&newimage, (*image)->width, (*image)->height, (*image)->format,
-            true);
+  initImage(&newimage, (*image)->width, (*image)->height, (*image)->format);
+  fillImage(newimage, options->sheetBackground, options->absBlackThreshold);
+
+  struct ShiftBand band = {
+      .options = options,
+      .source = *image,
+      .target = newimage,
+      .shiftX = shiftX,
+      .shiftY = shiftY,
+  };
+  parallelBands((*image)->height, shiftBand, &band);
 
-  for (int y = 0; y < (*image)->height; y++) {
-    for (int x = 0; x < (*image)->width; x++) {
-      const int pixel = getPixel(x, y, *image);
-      setPixel(pixel, x + shiftX, y + shiftY, newimage);
+  replaceImage(image, &newimage);
+}
+
+/* --- blank detection ---------------------------------------------------- */
+
+/**
+ * Tests whether an image is blank: the ratio of dark pixels, sampled on a
+ * grid of every BLANK_SCAN_STEP-th pixel in both directions, is below
+ * threshold.
+ */
+bool detectBlank(const struct Options *options, AVFrame *image,
+                 float threshold) {
+  const int step = BLANK_SCAN_STEP;
+  unsigned int total = 0;
+  unsigned int dark = 0;
+
+  for (int y = step / 2; y < image->height; y += step) {
+    for (int x = step / 2; x < image->width; x += step) {
+      if (getPixelDarknessInverse(x, y, image) < options->absBlackThreshold) {
+        dark++;
+      }
+      total++;
     }
   }
-  replaceImage(image, &newimage);
+
+  if (options->verbose >= VERBOSE_MORE) {
+    printf("blank detection: %u of %u sampled pixels dark.\n", dark, total);
+  }
+
+  return (total == 0) || ((float)dark / total < threshold);
 }
 
 /* --- mask-detection ----------------------------------------------------- */
 
+/**
+ * The sheet the masks are detected on: an image, or when there is none a sheet
+ * of width x height pixels all of one gray.
+ */
+struct MaskScan {
+  AVFrame *image;
+  int width;
+  int height;
+  uint8_t gray;
+};
+
+/**
+ * Returns the inverse average brightness of a rectangular area of the scanned
+ * sheet, the pixels outside of it being white.
+ */
+static uint8_t scanBrightnessRect(int x1, int y1, int x2, int y2,
+                                  const struct MaskScan *scan) {
+  if (scan->image != NULL) {
+    return inverseBrightnessRect(x1, y1, x2, y2, scan->image);
+  }
+
+  const int count = (x2 - x1 + 1) * (y2 - y1 + 1);
+  const int inside = max(0, min(x2, scan->width - 1) - max(x1, 0) + 1) *
+                     max(0, min(y2, scan->height - 1) - max(y1, 0) + 1);
+  const unsigned int total = WHITE * (count - inside) + scan->gray * inside;
+  return WHITE - (total / count);
+}
+
 /**
  * Finds one edge of non-black pixels heading from one starting point towards
  * edge direction.
@@ -522,7 +743,7 @@ void shift(int shiftX, int shiftY, AVFrame **image) {
  */
 static int detectEdge(int startX, int startY, int shiftX, int shiftY,
                       int maskScanSize, int maskScanDepth,
-                      float maskScanThreshold, AVFrame *image) {
+                      float maskScanThreshold, const struct MaskScan *scan) {
   // either shiftX or shiftY is 0, the other value is -i|+i
   int left;
   int top;
@@ -536,7 +757,7 @@ static int detectEdge(int startX, int startY, int shiftX, int shiftY,
   if (shiftY ==
       0) { // vertical border is to be detected, horizontal shifting of scan-bar
     if (maskScanDepth == -1) {
-      maskScanDepth = image->height;
+      maskScanDepth = scan->height;
     }
     const int halfDepth = maskScanDepth / 2;
     left = startX - half;
@@ -545,7 +766,7 @@ static int detectEdge(int startX, int startY, int shiftX, int shiftY,
     bottom = startY + halfDepth;
   } else { // horizontal border is to be detected, vertical shifting of scan-bar
     if (maskScanDepth == -1) {
-      maskScanDepth = image->width;
+      maskScanDepth = scan->width;
     }
     const int halfDepth = maskScanDepth / 2;
     left = startX - halfDepth;
@@ -556,7 +777,7 @@ static int detectEdge(int startX, int startY, int shiftX, int shiftY,
 
   while (true) { // !
     const uint8_t blackness =
-        inverseBrightnessRect(left, top, right, bottom, image);
+        scanBrightnessRect(left, top, right, bottom, scan);
     total += blackness;
     count++;
     // is blackness below threshold*average?
@@ -584,13 +805,14 @@ static int detectEdge(int startX, int startY, int shiftX, int shiftY,
  * no mask could be detected
  */
 static bool detectMask(int startX, int startY, int maskScanDirections,
-                       int maskScanSize[DIRECTIONS_COUNT],
-                       int maskScanDepth[DIRECTIONS_COUNT],
-                       int maskScanStep[DIRECTIONS_COUNT],
-                       float maskScanThreshold[DIRECTIONS_COUNT],
-                       int maskScanMinimum[DIMENSIONS_COUNT],
-                       int maskScanMaximum[DIMENSIONS_COUNT], int *left,
-                       int *top, int *right, int *bottom, AVFrame *image) {
+                       const int maskScanSize[DIRECTIONS_COUNT],
+                       const int maskScanDepth[DIRECTIONS_COUNT],
+                       const int maskScanStep[DIRECTIONS_COUNT],
+                       const float maskScanThreshold[DIRECTIONS_COUNT],
+                       const int maskScanMinimum[DIMENSIONS_COUNT],
+                       const int maskScanMaximum[DIMENSIONS_COUNT], int *left,
+                       int *top, int *right, int *bottom,
+                       const struct MaskScan *scan) {
   int width;
   int height;
   int half[DIRECTIONS_COUNT];
@@ -603,34 +825,34 @@ static bool detectMask(int startX, int startY, int maskScanDirections,
             maskScanStep[HORIZONTAL] *
                 detectEdge(startX, startY, -maskScanStep[HORIZONTAL], 0,
                            maskScanSize[HORIZONTAL], maskScanDepth[HORIZONTAL],
-                           maskScanThreshold[HORIZONTAL], image) -
+                           maskScanThreshold[HORIZONTAL], scan) -
             half[HORIZONTAL];
     *right = startX +
              maskScanStep[HORIZONTAL] *
                  detectEdge(startX, startY, maskScanStep[HORIZONTAL], 0,
                             maskScanSize[HORIZONTAL], maskScanDepth[HORIZONTAL],
-                            maskScanThreshold[HORIZONTAL], image) +
+                            maskScanThreshold[HORIZONTAL], scan) +
              half[HORIZONTAL];
   } else { // full range of sheet
     *left = 0;
-    *right = image->width - 1;
+    *right = scan->width - 1;
   }
   if ((maskScanDirections & 1 << VERTICAL) != 0) {
     *top = startY -
            maskScanStep[VERTICAL] *
                detectEdge(startX, startY, 0, -maskScanStep[VERTICAL],
                           maskScanSize[VERTICAL], maskScanDepth[VERTICAL],
-                          maskScanThreshold[VERTICAL], image) -
+                          maskScanThreshold[VERTICAL], scan) -
            half[VERTICAL];
     *bottom = startY +
               maskScanStep[VERTICAL] *
                   detectEdge(startX, startY, 0, maskScanStep[VERTICAL],
                              maskScanSize[VERTICAL], maskScanDepth[VERTICAL],
-                             maskScanThreshold[VERTICAL], image) +
+                             maskScanThreshold[VERTICAL], scan) +
               half[VERTICAL];
   } else { // full range of sheet
     *top = 0;
-    *bottom = image->height - 1;
+    *bottom = scan->height - 1;
   }
 
   // if below minimum or above maximum, set to maximum
@@ -656,90 +878,148 @@ static bool detectMask(int startX, int startY, int maskScanDirections,
 }
 
 /**
- * Detects masks around the points specified in point[].
- *
- * @param mask point to array into which detected masks will be stored
- * @return number of masks stored in mask[][]
+ * Detects masks around the points specified in the point option on the
+ * scanned sheet.
  */
-void detectMasks(AVFrame *image) {
+static int scanMasks(const struct Options *options,
+                     const struct MaskScan *scan, Mask *masks, bool *valid) {
   int left;
   int top;
   int right;
   int bottom;
+  int count = 0;
 
-  maskCount = 0;
-  if (maskScanDirections != 0) {
-    for (int i = 0; i < pointCount; i++) {
-      maskValid[i] = detectMask(
-          point[i][X], point[i][Y], maskScanDirections, maskScanSize,
-          maskScanDepth, maskScanStep, maskScanThreshold, maskScanMinimum,
-          maskScanMaximum, &left, &top, &right, &bottom, image);
+  if (options->maskScanDirections != 0) {
+    for (int i = 0; i < options->pointCount; i++) {
+      valid[i] = detectMask(
+          options->point[i][X], options->point[i][Y],
+          options->maskScanDirections, options->maskScanSize,
+          options->maskScanDepth, options->maskScanStep,
+          options->maskScanThreshold, options->maskScanMinimum,
+          options->maskScanMaximum, &left, &top, &right, &bottom, scan);
       if (!(left == -1 || top == -1 || right == -1 || bottom == -1)) {
-        mask[maskCount][LEFT] = left;
-        mask[maskCount][TOP] = top;
-        mask[maskCount][RIGHT] = right;
-        mask[maskCount][BOTTOM] = bottom;
-        maskCount++;
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("auto-masking (%d,%d): %d,%d,%d,%d", point[i][X], point[i][Y],
-                 left, top, right, bottom);
-          if (maskValid[i] ==
-              false) { // (mask had been auto-set to full page size)
+        masks[count][LEFT] = left;
+        masks[count][TOP] = top;
+        masks[count][RIGHT] = right;
+        masks[count][BOTTOM] = bottom;
+        count++;
+        if (options->verbose >= VERBOSE_NORMAL) {
+          printf("auto-masking (%d,%d): %d,%d,%d,%d", options->point[i][X],
+                 options->point[i][Y], left, top, right, bottom);
+          if (valid[i] == false) { // (mask had been auto-set to full page size)
             printf(" (invalid detection, using full page size)");
           }
           printf("\n");
         }
       } else {
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("auto-masking (%d,%d): NO MASK FOUND\n", point[i][X],
-                 point[i][Y]);
+        if (options->verbose >= VERBOSE_NORMAL) {
+          printf("auto-masking (%d,%d): NO MASK FOUND\n", options->point[i][X],
+                 options->point[i][Y]);
         }
       }
     }
   }
+  return count;
+}
+
+/**
+ * Detects masks around the points specified in the point option.
+ *
+ * @param masks array into which detected masks will be stored
+ * @param valid array of flags, cleared for each point whose mask had been
+ * auto-set to full page size
+ * @return number of masks stored in masks[]
+ */
+int detectMasks(const struct Options *options, AVFrame *image, Mask *masks,
+                bool *valid) {
+  const struct MaskScan scan = {
+      .image = image, .width = image->width, .height = image->height};
+
+  return scanMasks(options, &scan, masks, valid);
+}
+
+/**
+ * Detects masks as detectMasks() would on a sheet of width x height pixels
+ * filled with the sheet background, without an image to scan: every pixel
+ * there has the grayscale value of the background.
+ *
+ * @return number of masks stored in masks[]
+ */
+int detectBlankMasks(const struct Options *options, int width, int height,
+                     Mask *masks, bool *valid) {
+  const int background = options->sheetBackground;
+  const struct MaskScan scan = {
+      .width = width,
+      .height = height,
+      .gray = (red(background) + green(background) + blue(background)) / 3};
+
+  return scanMasks(options, &scan, masks, valid);
 }
 
 /**
  * Permanently applies image masks. Each pixel which is not covered by at least
  * one mask is set to maskColor.
  */
-void applyMasks(Mask *masks, const int masksCount,
-                AVFrame *image) {
-  if (masksCount <= 0) {
-    return;
-  }
-  for (int y = 0; y < image->height; y++) {
-    for (int x = 0; x < image->width; x++) {
+struct MasksBand {
+  const struct Options *options;
+  Mask *masks;
+  int masksCount;
+  AVFrame *image;
+};
+
+static void applyMasksBand(int first, int last, void *arg) {
+  const struct MasksBand *band = arg;
+  const struct Options *options = band->options;
+
+  for (int y = first; y <= last; y++) {
+    for (int x = 0; x < band->image->width; x++) {
       // in any mask?
       bool m = false;
-      for (int i = 0; i < masksCount; i++) {
-        m = m || inMask(x, y, masks[i]);
+      for (int i = 0; i < band->masksCount; i++) {
+        m = m || inMask(x, y, band->masks[i]);
       }
       if (m == false) {
-        setPixel(maskColor, x, y, image);
+        setPixel(options->maskColor, x, y, band->image,
+                 options->absBlackThreshold);
       }
     }
   }
 }
 
+void applyMasks(const struct Options *options, Mask *masks,
+                const int masksCount, AVFrame *image) {
+  if (masksCount <= 0) {
+    return;
+  }
+
+  struct MasksBand band = {
+      .options = options,
+      .masks = masks,
+      .masksCount = masksCount,
+      .image = image,
+  };
+  parallelBands(image->height, applyMasksBand, &band);
+}
+
 /* --- wiping ------------------------------------------------------------- */
 
 /**
  * Permanently wipes out areas of an images. Each pixel covered by a wipe-area
  * is set to wipeColor.
  */
-void applyWipes(Mask *area, int areaCount,
+void applyWipes(const struct Options *options, Mask *area, int areaCount,
                 AVFrame *image) {
   for (int i = 0; i < areaCount; i++) {
     int count = 0;
     for (int y = area[i][TOP]; y <= area[i][BOTTOM]; y++) {
       for (int x = area[i][LEFT]; x <= area[i][RIGHT]; x++) {
-        if (setPixel(maskColor, x, y, image)) {
+        if (setPixel(options->maskColor, x, y, image,
+                     options->absBlackThreshold)) {
           count++;
         }
       }
     }
-    if (verbose >= VERBOSE_MORE) {
+    if (options->verbose >= VERBOSE_MORE) {
       printf("wipe [%d,%d,%d,%d]: %d pixels\n", area[i][LEFT], area[i][TOP],
              area[i][RIGHT], area[i][BOTTOM], count);
     }
@@ -751,7 +1031,7 @@ void applyWipes(Mask *area, int areaCount,
 /**
  * Mirrors an image either horizontally, vertically, or both.
  */
-void mirror(int directions, AVFrame *image) {
+void mirror(const struct Options *options, int directions, AVFrame *image) {
   const bool horizontal = !!((directions & 1 << HORIZONTAL) != 0);
   const bool vertical = !!((directions & 1 << VERTICAL) != 0);
   int untilX = ((horizontal == true) && (vertical == false))
@@ -771,8 +1051,8 @@ void mirror(int directions, AVFrame *image) {
       const int xx = (horizontal == true) ? (image->width - x - 1) : x;
       const int pixel1 = getPixel(x, y, image);
       const int pixel2 = getPixel(xx, yy, image);
-      setPixel(pixel2, x, y, image);
-      setPixel(pixel1, xx, yy, image);
+      setPixel(pixel2, x, y, image, options->absBlackThreshold);
+      setPixel(pixel1, xx, yy, image, options->absBlackThreshold);
     }
   }
 }
@@ -784,12 +1064,12 @@ void mirror(int directions, AVFrame *image) {
  *
  * @param direction either -1 (rotate anti-clockwise) or 1 (rotate clockwise)
  */
-void flipRotate(int direction, AVFrame **image) {
+void flipRotate(const struct Options *options, int direction,
+                AVFrame **image) {
   AVFrame *newimage;
 
   // exchanged width and height
-  initImage(&newimage, (*image)->height, (*image)->width, (*image)->format,
-            false);
+  initImage(&newimage, (*image)->height, (*image)->width, (*image)->format);
 
   for (int y = 0; y < (*image)->height; y++) {
     const int xx = ((direction > 0) ? (*image)->height - 1 : 0) - y * direction;
@@ -797,7 +1077,7 @@ void flipRotate(int direction, AVFrame **image) {
       const int yy =
           ((direction < 0) ? (*image)->width - 1 : 0) + x * direction;
       const int pixel = getPixel(x, y, *image);
-      setPixel(pixel, xx, yy, newimage);
+      setPixel(pixel, xx, yy, newimage, options->absBlackThreshold);
     }
   }
   replaceImage(image, &newimage);
@@ -812,10 +1092,11 @@ void flipRotate(int direction, AVFrame **image) {
  * @param stepY is 0 if stepX!=0
  * @see blackfilter()
  */
-static void blackfilterScan(int stepX, int stepY, int size, int dep,
+static void blackfilterScan(const struct Options *options, int stepX,
+                            int stepY, int size, int dep,
                             unsigned int absBlackfilterScanThreshold,
-                            Mask *exclude,
-                            int excludeCount, int intensity, AVFrame *image) {
+                            const Mask *exclude, int excludeCount,
+                            int intensity, AVFrame *image) {
   int left;
   int top;
   int right;
@@ -868,20 +1149,24 @@ static void blackfilterScan(int stepX, int stepY, int size, int dep,
           absBlackfilterScanThreshold) { // found a solidly black area
         Mask mask = {l, t, r, b};
         if (!masksOverlapAny(mask, exclude, excludeCount)) {
-          if (verbose >= VERBOSE_NORMAL) {
+          if (options->verbose >= VERBOSE_NORMAL) {
             printf("black-area flood-fill: [%d,%d,%d,%d]\n", l, t, r, b);
             alreadyExcludedMessage = false;
           }
           // start flood-fill in this area (on each pixel to make sure we get
           // everything, in most cases first flood-fill from first pixel will
           // delete all other black pixels in the area already)
+          TRACE_BEGIN("flood-fill");
           for (int y = t; y <= b; y++) {
             for (int x = l; x <= r; x++) {
-              floodFill(x, y, WHITE24, 0, absBlackThreshold, intensity, image);
+              floodFill(x, y, WHITE24, 0, options->absBlackThreshold,
+                        intensity, image, options->absBlackThreshold);
             }
           }
+          TRACE_END();
         } else {
-          if ((verbose >= VERBOSE_NORMAL) && (!alreadyExcludedMessage)) {
+          if ((options->verbose >= VERBOSE_NORMAL) &&
+              (!alreadyExcludedMessage)) {
             printf("black-area EXCLUDED: [%d,%d,%d,%d]\n", l, t, r, b);
             alreadyExcludedMessage = true; // do this only once per scan-stripe,
                                            // otherwise too many messages
@@ -905,21 +1190,26 @@ static void blackfilterScan(int stepX, int stepY, int size, int dep,
  * A virtual bar of width 'size' and height 'depth' is horizontally moved
  * above the middle of the sheet (or the full sheet, if depth ==-1).
  */
-void blackfilter(AVFrame *image) {
-  if ((blackfilterScanDirections & 1 << HORIZONTAL) !=
+void blackfilter(const struct Options *options, AVFrame *image) {
+  if ((options->blackfilterScanDirections & 1 << HORIZONTAL) !=
       0) { // left-to-right scan
-    blackfilterScan(blackfilterScanStep[HORIZONTAL], 0,
-                    blackfilterScanSize[HORIZONTAL],
-                    blackfilterScanDepth[HORIZONTAL],
-                    absBlackfilterScanThreshold, blackfilterExclude,
-                    blackfilterExcludeCount, blackfilterIntensity, image);
-  }
-  if ((blackfilterScanDirections & 1 << VERTICAL) != 0) { // top-to-bottom scan
-    blackfilterScan(0, blackfilterScanStep[VERTICAL],
-                    blackfilterScanSize[VERTICAL],
-                    blackfilterScanDepth[VERTICAL], absBlackfilterScanThreshold,
-                    blackfilterExclude, blackfilterExcludeCount,
-                    blackfilterIntensity, image);
+    blackfilterScan(options, options->blackfilterScanStep[HORIZONTAL], 0,
+                    options->blackfilterScanSize[HORIZONTAL],
+                    options->blackfilterScanDepth[HORIZONTAL],
+                    options->absBlackfilterScanThreshold,
+                    options->blackfilterExclude,
+                    options->blackfilterExcludeCount,
+                    options->blackfilterIntensity, image);
+  }
+  if ((options->blackfilterScanDirections & 1 << VERTICAL) !=
+      0) { // top-to-bottom scan
+    blackfilterScan(options, 0, options->blackfilterScanStep[VERTICAL],
+                    options->blackfilterScanSize[VERTICAL],
+                    options->blackfilterScanDepth[VERTICAL],
+                    options->absBlackfilterScanThreshold,
+                    options->blackfilterExclude,
+                    options->blackfilterExcludeCount,
+                    options->blackfilterIntensity, image);
   }
 }
 
@@ -930,7 +1220,9 @@ void blackfilter(AVFrame *image) {
  *
  * @param intensity maximum cluster size to delete
  */
-int noisefilter(AVFrame *image) {
+#ifdef UNPAPER_REFERENCE
+
+int noisefilter(const struct Options *options, AVFrame *image) {
   int count;
   int neighbors;
 
@@ -938,13 +1230,14 @@ int noisefilter(AVFrame *image) {
   for (int y = 0; y < image->height; y++) {
     for (int x = 0; x < image->width; x++) {
       uint8_t pixel = getPixelDarknessInverse(x, y, image);
-      if (pixel < absWhiteThreshold) { // one dark pixel found
+      if (pixel < options->absWhiteThreshold) { // one dark pixel found
         neighbors = countPixelNeighbors(
-            x, y, noisefilterIntensity, absWhiteThreshold,
+            x, y, options->noisefilterIntensity, options->absWhiteThreshold,
             image); // get number of non-light pixels in neighborhood
         if (neighbors <=
-            noisefilterIntensity) { // ...not more than 'intensity'?
-          clearPixelNeighbors(x, y, absWhiteThreshold, image); // delete area
+            options->noisefilterIntensity) { // ...not more than 'intensity'?
+          clearPixelNeighbors(x, y, options->absWhiteThreshold,
+                              image); // delete area
           count++;
         }
       }
@@ -953,6 +1246,51 @@ int noisefilter(AVFrame *image) {
   return count;
 }
 
+#else
+
+struct Noisefilter {
+  const struct Options *options;
+  AVFrame *image;
+  atomic_int count;
+};
+
+static void noisefilterRow(int y, struct Wavefront *wavefront, void *arg) {
+  struct Noisefilter *filter = arg;
+  const struct Options *options = filter->options;
+  AVFrame *image = filter->image;
+  const int radius = max(options->noisefilterIntensity, 0);
+  int count = 0;
+
+  for (int x = 0; x < image->width; x++) {
+    // neighbors are counted and cleared up to radius pixels away
+    wavefrontWait(wavefront, y, x - radius, x + radius);
+
+    uint8_t pixel = getPixelDarknessInverse(x, y, image);
+    if (pixel < options->absWhiteThreshold) { // one dark pixel found
+      const int neighbors = countPixelNeighbors(
+          x, y, options->noisefilterIntensity, options->absWhiteThreshold,
+          image); // get number of non-light pixels in neighborhood
+      if (neighbors <=
+          options->noisefilterIntensity) { // ...not more than 'intensity'?
+        clearPixelNeighbors(x, y, options->absWhiteThreshold,
+                            image); // delete area
+        count++;
+      }
+    }
+  }
+  atomic_fetch_add(&filter->count, count);
+}
+
+int noisefilter(const struct Options *options, AVFrame *image) {
+  struct Noisefilter filter = {.options = options, .image = image};
+
+  atomic_init(&filter.count, 0);
+  parallelWavefront(image->height, noisefilterRow, &filter);
+  return atomic_load(&filter.count);
+}
+
+#endif
+
 /* --- blurfilter --------------------------------------------------------- */
 
 /**
@@ -960,15 +1298,19 @@ int noisefilter(AVFrame *image) {
  * filter. This algorithm counts pixels while 'shaking' the area to detect,
  * and clears the area if the amount of white pixels exceeds whiteTreshold.
  */
-int blurfilter(AVFrame *image) {
-  const int blocksPerRow = image->width / blurfilterScanSize[HORIZONTAL];
-  const int total = blurfilterScanSize[HORIZONTAL] *
-                    blurfilterScanSize[VERTICAL]; // Number of pixels in a block
+#ifdef UNPAPER_REFERENCE
+
+int blurfilter(const struct Options *options, AVFrame *image) {
+  const int blocksPerRow =
+      image->width / options->blurfilterScanSize[HORIZONTAL];
+  const int total =
+      options->blurfilterScanSize[HORIZONTAL] *
+      options->blurfilterScanSize[VERTICAL]; // Number of pixels in a block
   int top = 0;
-  int right = blurfilterScanSize[HORIZONTAL] - 1;
-  int bottom = blurfilterScanSize[VERTICAL] - 1;
-  int maxLeft = image->width - blurfilterScanSize[HORIZONTAL];
-  int maxTop = image->height - blurfilterScanSize[VERTICAL];
+  int right = options->blurfilterScanSize[HORIZONTAL] - 1;
+  int bottom = options->blurfilterScanSize[VERTICAL] - 1;
+  int maxLeft = image->width - options->blurfilterScanSize[HORIZONTAL];
+  int maxTop = image->height - options->blurfilterScanSize[VERTICAL];
   int result = 0;
 
   // Number of dark pixels in previous row
@@ -978,13 +1320,15 @@ int blurfilter(AVFrame *image) {
   int *curCounts = calloc(blocksPerRow + 2, sizeof(int));
   // Number of dark pixels in next row
   int *nextCounts = calloc(blocksPerRow + 2, sizeof(int));
+  accountAlloc(3 * (blocksPerRow + 2) * sizeof(int));
 
   for (int left = 0, block = 1; left <= maxLeft;
-       left += blurfilterScanSize[HORIZONTAL]) {
-    curCounts[block] = countPixelsRect(left, top, right, bottom, 0,
-                                       absWhiteThreshold, false, image);
+       left += options->blurfilterScanSize[HORIZONTAL]) {
+    curCounts[block] =
+        countPixelsRect(left, top, right, bottom, 0,
+                        options->absWhiteThreshold, false, image);
     block++;
-    right += blurfilterScanSize[HORIZONTAL];
+    right += options->blurfilterScanSize[HORIZONTAL];
   }
   curCounts[0] = total;
   curCounts[blocksPerRow] = total;
@@ -996,39 +1340,41 @@ int blurfilter(AVFrame *image) {
   // and similarly for the block in the top-right, bottom-left and bottom-right
   // corner. Take the maximum of these values. Clear the block if this number is
   // not large enough compared to the total number of pixels in a block.
-  for (int top = 0; top <= maxTop; top += blurfilterScanSize[HORIZONTAL]) {
-    right = blurfilterScanSize[HORIZONTAL] - 1;
+  for (int top = 0; top <= maxTop;
+       top += options->blurfilterScanSize[HORIZONTAL]) {
+    right = options->blurfilterScanSize[HORIZONTAL] - 1;
     nextCounts[0] =
-        countPixelsRect(0, top + blurfilterScanStep[VERTICAL], right,
-                        bottom + blurfilterScanSize[VERTICAL], 0,
-                        absWhiteThreshold, false, image);
+        countPixelsRect(0, top + options->blurfilterScanStep[VERTICAL], right,
+                        bottom + options->blurfilterScanSize[VERTICAL], 0,
+                        options->absWhiteThreshold, false, image);
 
     for (int left = 0, block = 1; left <= maxLeft;
-         left += blurfilterScanSize[HORIZONTAL]) {
+         left += options->blurfilterScanSize[HORIZONTAL]) {
       // bottom right (has still to be calculated)
       nextCounts[block + 1] =
-          countPixelsRect(left + blurfilterScanSize[HORIZONTAL],
-                          top + blurfilterScanStep[VERTICAL],
-                          right + blurfilterScanSize[HORIZONTAL],
-                          bottom + blurfilterScanSize[VERTICAL], 0,
-                          absWhiteThreshold, false, image);
+          countPixelsRect(left + options->blurfilterScanSize[HORIZONTAL],
+                          top + options->blurfilterScanStep[VERTICAL],
+                          right + options->blurfilterScanSize[HORIZONTAL],
+                          bottom + options->blurfilterScanSize[VERTICAL], 0,
+                          options->absWhiteThreshold, false, image);
 
       int max = max3(
           nextCounts[block - 1], nextCounts[block + 1],
           max3(prevCounts[block - 1], prevCounts[block + 1], curCounts[block]));
 
       if ((((float)max) / total) <=
-          blurfilterIntensity) { // Not enough dark pixels
-        clearRect(left, top, right, bottom, image, WHITE24);
+          options->blurfilterIntensity) { // Not enough dark pixels
+        clearRect(left, top, right, bottom, image, WHITE24,
+                  options->absBlackThreshold);
         result += curCounts[block];
         curCounts[block] = total; // Update information
       }
 
-      right += blurfilterScanSize[HORIZONTAL];
+      right += options->blurfilterScanSize[HORIZONTAL];
       block++;
     }
 
-    bottom += blurfilterScanSize[VERTICAL];
+    bottom += options->blurfilterScanSize[VERTICAL];
     // Switch Buffers
     const int *tmpCounts;
     tmpCounts = prevCounts;
@@ -1039,10 +1385,141 @@ int blurfilter(AVFrame *image) {
   free(prevCounts);
   free(curCounts);
   free(nextCounts);
+  accountFree(3 * (blocksPerRow + 2) * sizeof(int));
 
   return result;
 }
 
+#else
+
+/*
+ * Every row of blocks has its own array of dark pixel counts, where the
+ * serial filter rotates three of them: counts[r + 2] is the current row of
+ * row r, counts[r + 1] its previous row, and counts[r + 3] its next row.
+ * The count at index 1 of the next row is never computed; the serial filter
+ * leaves there what the rotated array held three rows before, and so does
+ * this one.
+ */
+struct Blurfilter {
+  const struct Options *options;
+  AVFrame *image;
+  int blocks;
+  int total;
+  int **counts;
+  atomic_int result;
+};
+
+static void blurfilterRow(int row, struct Wavefront *wavefront, void *arg) {
+  struct Blurfilter *filter = arg;
+  const struct Options *options = filter->options;
+  AVFrame *image = filter->image;
+  int *prevCounts = filter->counts[row + 1];
+  int *curCounts = filter->counts[row + 2];
+  int *nextCounts = filter->counts[row + 3];
+  const int top = row * options->blurfilterScanSize[HORIZONTAL];
+  const int bottom = options->blurfilterScanSize[VERTICAL] - 1 +
+                     row * options->blurfilterScanSize[VERTICAL];
+  int result = 0;
+
+  for (int block = 1; block <= filter->blocks; block++) {
+    const int left = (block - 1) * options->blurfilterScanSize[HORIZONTAL];
+    const int right = left + options->blurfilterScanSize[HORIZONTAL] - 1;
+
+    // the block, and the next row of blocks one block further right
+    wavefrontWait(wavefront, row, left,
+                  right + options->blurfilterScanSize[HORIZONTAL]);
+
+    if (block == 1) {
+      nextCounts[0] = countPixelsRect(
+          0, top + options->blurfilterScanStep[VERTICAL], right,
+          bottom + options->blurfilterScanSize[VERTICAL], 0,
+          options->absWhiteThreshold, false, image);
+      nextCounts[1] = filter->counts[row][1];
+    }
+
+    // bottom right (has still to be calculated)
+    nextCounts[block + 1] =
+        countPixelsRect(left + options->blurfilterScanSize[HORIZONTAL],
+                        top + options->blurfilterScanStep[VERTICAL],
+                        right + options->blurfilterScanSize[HORIZONTAL],
+                        bottom + options->blurfilterScanSize[VERTICAL], 0,
+                        options->absWhiteThreshold, false, image);
+
+    int max = max3(
+        nextCounts[block - 1], nextCounts[block + 1],
+        max3(prevCounts[block - 1], prevCounts[block + 1], curCounts[block]));
+
+    if ((((float)max) / filter->total) <=
+        options->blurfilterIntensity) { // Not enough dark pixels
+      clearRect(left, top, right, bottom, image, WHITE24,
+                options->absBlackThreshold);
+      result += curCounts[block];
+      curCounts[block] = filter->total; // Update information
+    }
+  }
+  atomic_fetch_add(&filter->result, result);
+}
+
+int blurfilter(const struct Options *options, AVFrame *image) {
+  const int blocksPerRow =
+      image->width / options->blurfilterScanSize[HORIZONTAL];
+  const int maxLeft = image->width - options->blurfilterScanSize[HORIZONTAL];
+  const int maxTop = image->height - options->blurfilterScanSize[VERTICAL];
+  const int rows =
+      (maxTop >= 0) ? maxTop / options->blurfilterScanSize[HORIZONTAL] + 1 : 0;
+  struct Blurfilter filter = {
+      .options = options,
+      .image = image,
+      .blocks = (maxLeft >= 0)
+                    ? maxLeft / options->blurfilterScanSize[HORIZONTAL] + 1
+                    : 0,
+      .total =
+          options->blurfilterScanSize[HORIZONTAL] *
+          options->blurfilterScanSize[VERTICAL], // Number of pixels in a block
+  };
+  const size_t arraySize = (blocksPerRow + 2) * sizeof(int);
+
+  // allocate one extra block left and right
+  filter.counts = calloc(rows + 3, sizeof(int *));
+  for (int r = 0; r < rows + 3; r++) {
+    filter.counts[r] = calloc(blocksPerRow + 2, sizeof(int));
+  }
+  accountAlloc((rows + 3) * arraySize);
+  atomic_init(&filter.result, 0);
+
+  // the next row of the first one starts from these
+  filter.counts[0][0] = filter.total;
+  filter.counts[0][blocksPerRow] = filter.total;
+
+  int *firstCounts = filter.counts[2];
+  for (int block = 1; block <= filter.blocks; block++) {
+    const int left = (block - 1) * options->blurfilterScanSize[HORIZONTAL];
+    firstCounts[block] = countPixelsRect(
+        left, 0, left + options->blurfilterScanSize[HORIZONTAL] - 1,
+        options->blurfilterScanSize[VERTICAL] - 1, 0,
+        options->absWhiteThreshold, false, image);
+  }
+  firstCounts[0] = filter.total;
+  firstCounts[blocksPerRow] = filter.total;
+
+  // Loop through all blocks. For a block calculate the number of dark pixels in
+  // this block, the number of dark pixels in the block in the top-left corner
+  // and similarly for the block in the top-right, bottom-left and bottom-right
+  // corner. Take the maximum of these values. Clear the block if this number is
+  // not large enough compared to the total number of pixels in a block.
+  parallelWavefront(rows, blurfilterRow, &filter);
+
+  for (int r = 0; r < rows + 3; r++) {
+    free(filter.counts[r]);
+  }
+  free(filter.counts);
+  accountFree((rows + 3) * arraySize);
+
+  return atomic_load(&filter.result);
+}
+
+#endif
+
 /* --- grayfilter --------------------------------------------------------- */
 
 /**
@@ -1051,81 +1528,187 @@ int blurfilter(AVFrame *image) {
  * single black pixel may be contained, second, a minimum threshold of blackness
  * must not be exceeded.
  */
-int grayfilter(AVFrame *image) {
+#ifdef UNPAPER_REFERENCE
+
+int grayfilter(const struct Options *options, AVFrame *image) {
   int left = 0;
   int top = 0;
-  int right = grayfilterScanSize[HORIZONTAL] - 1;
-  int bottom = grayfilterScanSize[VERTICAL] - 1;
+  int right = options->grayfilterScanSize[HORIZONTAL] - 1;
+  int bottom = options->grayfilterScanSize[VERTICAL] - 1;
   int result = 0;
 
   while (true) {
-    int count = countPixelsRect(left, top, right, bottom, 0, absBlackThreshold,
-                                false, image);
+    int count = countPixelsRect(left, top, right, bottom, 0,
+                                options->absBlackThreshold, false, image);
     if (count == 0) {
       uint8_t lightness = inverseLightnessRect(left, top, right, bottom, image);
       if (lightness <
-          absGrayfilterThreshold) { // (lower threshold->more deletion)
-        result += clearRect(left, top, right, bottom, image, WHITE24);
+          options->absGrayfilterThreshold) { // (lower threshold->more deletion)
+        result += clearRect(left, top, right, bottom, image, WHITE24,
+                            options->absBlackThreshold);
       }
     }
     if (left < image->width) { // not yet at end of row
-      left += grayfilterScanStep[HORIZONTAL];
-      right += grayfilterScanStep[HORIZONTAL];
+      left += options->grayfilterScanStep[HORIZONTAL];
+      right += options->grayfilterScanStep[HORIZONTAL];
     } else {                         // end of row
       if (bottom >= image->height) { // has been last row
         return result;               // exit here
       }
       // next row:
       left = 0;
-      right = grayfilterScanSize[HORIZONTAL] - 1;
-      top += grayfilterScanStep[VERTICAL];
-      bottom += grayfilterScanStep[VERTICAL];
+      right = options->grayfilterScanSize[HORIZONTAL] - 1;
+      top += options->grayfilterScanStep[VERTICAL];
+      bottom += options->grayfilterScanStep[VERTICAL];
     }
   }
 }
 
+#else
+
+struct Grayfilter {
+  const struct Options *options;
+  AVFrame *image;
+  int columns;
+  atomic_int result;
+};
+
+static void grayfilterRow(int row, struct Wavefront *wavefront, void *arg) {
+  struct Grayfilter *filter = arg;
+  const struct Options *options = filter->options;
+  AVFrame *image = filter->image;
+  const int top = row * options->grayfilterScanStep[VERTICAL];
+  const int bottom = top + options->grayfilterScanSize[VERTICAL] - 1;
+  int result = 0;
+
+  for (int column = 0; column < filter->columns; column++) {
+    const int left = column * options->grayfilterScanStep[HORIZONTAL];
+    const int right = left + options->grayfilterScanSize[HORIZONTAL] - 1;
+
+    wavefrontWait(wavefront, row, left, right);
+
+    int count = countPixelsRect(left, top, right, bottom, 0,
+                                options->absBlackThreshold, false, image);
+    if (count == 0) {
+      uint8_t lightness = inverseLightnessRect(left, top, right, bottom, image);
+      if (lightness <
+          options->absGrayfilterThreshold) { // (lower threshold->more deletion)
+        result += clearRect(left, top, right, bottom, image, WHITE24,
+                            options->absBlackThreshold);
+      }
+    }
+  }
+  atomic_fetch_add(&filter->result, result);
+}
+
+int grayfilter(const struct Options *options, AVFrame *image) {
+  // every row of areas goes one step past the right edge, and the last one
+  // past the bottom edge
+  struct Grayfilter filter = {
+      .options = options,
+      .image = image,
+      .columns = (image->width + options->grayfilterScanStep[HORIZONTAL] - 1) /
+                     options->grayfilterScanStep[HORIZONTAL] +
+                 1,
+  };
+  int rows = 1;
+
+  while (options->grayfilterScanSize[VERTICAL] - 1 +
+             (rows - 1) * options->grayfilterScanStep[VERTICAL] <
+         image->height) {
+    rows++;
+  }
+
+  atomic_init(&filter.result, 0);
+  parallelWavefront(rows, grayfilterRow, &filter);
+  return atomic_load(&filter.result);
+}
+
+#endif
+
 /* --- border-detection --------------------------------------------------- */
 
+/**
+ * Finds where centerMask() moves mask to, or returns false if it would move it
+ * outside of the image.
+ */
+static bool centerTarget(AVFrame *image, int center[COORDINATES_COUNT],
+                         Mask mask, int *targetX, int *targetY) {
+  const int width = mask[RIGHT] - mask[LEFT] + 1;
+  const int height = mask[BOTTOM] - mask[TOP] + 1;
+
+  *targetX = center[X] - width / 2;
+  *targetY = center[Y] - height / 2;
+  return (*targetX >= 0) && (*targetY >= 0) &&
+         ((*targetX + width) <= image->width) &&
+         ((*targetY + height) <= image->height);
+}
+
 /**
  * Moves a rectangular area of pixels to be centered above the centerX, centerY
- * coordinates.
+ * coordinates, writing the messages to report.
  */
-void centerMask(AVFrame *image, int center[COORDINATES_COUNT],
-                Mask mask) {
+void centerMaskReport(const struct Options *options, AVFrame *image,
+                      int center[COORDINATES_COUNT], Mask mask, FILE *report) {
   AVFrame *newimage;
+  int targetX;
+  int targetY;
 
   const int width = mask[RIGHT] - mask[LEFT] + 1;
   const int height = mask[BOTTOM] - mask[TOP] + 1;
-  const int targetX = center[X] - width / 2;
-  const int targetY = center[Y] - height / 2;
-  if ((targetX >= 0) && (targetY >= 0) && ((targetX + width) <= image->width) &&
-      ((targetY + height) <= image->height)) {
-    if (verbose >= VERBOSE_NORMAL) {
-      printf("centering mask [%d,%d,%d,%d] (%d,%d): %d, %d\n", mask[LEFT],
-             mask[TOP], mask[RIGHT], mask[BOTTOM], center[X], center[Y],
-             targetX - mask[LEFT], targetY - mask[TOP]);
+  if (centerTarget(image, center, mask, &targetX, &targetY)) {
+    if (options->verbose >= VERBOSE_NORMAL) {
+      fprintf(report, "centering mask [%d,%d,%d,%d] (%d,%d): %d, %d\n",
+              mask[LEFT], mask[TOP], mask[RIGHT], mask[BOTTOM], center[X],
+              center[Y], targetX - mask[LEFT], targetY - mask[TOP]);
     }
-    initImage(&newimage, width, height, image->format, false);
-    copyImageArea(mask[LEFT], mask[TOP], width, height, image, 0, 0, newimage);
+    initImage(&newimage, width, height, image->format);
+    copyImageArea(mask[LEFT], mask[TOP], width, height, image, 0, 0, newimage,
+                  options->absBlackThreshold);
     clearRect(mask[LEFT], mask[TOP], mask[RIGHT], mask[BOTTOM], image,
-              sheetBackground);
-    copyImageArea(0, 0, width, height, newimage, targetX, targetY, image);
+              options->sheetBackground, options->absBlackThreshold);
+    copyImageArea(0, 0, width, height, newimage, targetX, targetY, image,
+                  options->absBlackThreshold);
     av_frame_free(&newimage);
   } else {
-    if (verbose >= VERBOSE_NORMAL) {
-      printf("centering mask [%d,%d,%d,%d] (%d,%d): %d, %d - NO CENTERING "
-             "(would shift area outside visible image)\n",
-             mask[LEFT], mask[TOP], mask[RIGHT], mask[BOTTOM], center[X],
-             center[Y], targetX - mask[LEFT], targetY - mask[TOP]);
+    if (options->verbose >= VERBOSE_NORMAL) {
+      fprintf(report,
+              "centering mask [%d,%d,%d,%d] (%d,%d): %d, %d - NO CENTERING "
+              "(would shift area outside visible image)\n",
+              mask[LEFT], mask[TOP], mask[RIGHT], mask[BOTTOM], center[X],
+              center[Y], targetX - mask[LEFT], targetY - mask[TOP]);
     }
   }
 }
 
+void centerMask(const struct Options *options, AVFrame *image,
+                int center[COORDINATES_COUNT], Mask mask) {
+  centerMaskReport(options, image, center, mask, stdout);
+}
+
+/**
+ * Sets area to the smallest rectangle holding every pixel centerMask() reads
+ * or changes.
+ */
+void centerMaskArea(AVFrame *image, int center[COORDINATES_COUNT],
+                    Mask mask, Mask area) {
+  int targetX;
+  int targetY;
+
+  memcpy(area, mask, sizeof(Mask));
+  if (centerTarget(image, center, mask, &targetX, &targetY)) {
+    area[LEFT] = min(area[LEFT], targetX);
+    area[TOP] = min(area[TOP], targetY);
+    area[RIGHT] = max(area[RIGHT], targetX + mask[RIGHT] - mask[LEFT]);
+    area[BOTTOM] = max(area[BOTTOM], targetY + mask[BOTTOM] - mask[TOP]);
+  }
+}
+
 /**
  * Moves a rectangular area of pixels to be centered inside a specified area
  * coordinates.
  */
-void alignMask(Mask mask, Mask outside,
+void alignMask(const struct Options *options, Mask mask, Mask outside,
                AVFrame *image) {
   AVFrame *newimage;
   int targetX;
@@ -1133,31 +1716,33 @@ void alignMask(Mask mask, Mask outside,
 
   const int width = mask[RIGHT] - mask[LEFT] + 1;
   const int height = mask[BOTTOM] - mask[TOP] + 1;
-  if (borderAlign & 1 << LEFT) {
-    targetX = outside[LEFT] + borderAlignMargin[HORIZONTAL];
-  } else if (borderAlign & 1 << RIGHT) {
-    targetX = outside[RIGHT] - width - borderAlignMargin[HORIZONTAL];
+  if (options->borderAlign & 1 << LEFT) {
+    targetX = outside[LEFT] + options->borderAlignMargin[HORIZONTAL];
+  } else if (options->borderAlign & 1 << RIGHT) {
+    targetX = outside[RIGHT] - width - options->borderAlignMargin[HORIZONTAL];
   } else {
     targetX = (outside[LEFT] + outside[RIGHT] - width) / 2;
   }
-  if (borderAlign & 1 << TOP) {
-    targetY = outside[TOP] + borderAlignMargin[VERTICAL];
-  } else if (borderAlign & 1 << BOTTOM) {
-    targetY = outside[BOTTOM] - height - borderAlignMargin[VERTICAL];
+  if (options->borderAlign & 1 << TOP) {
+    targetY = outside[TOP] + options->borderAlignMargin[VERTICAL];
+  } else if (options->borderAlign & 1 << BOTTOM) {
+    targetY = outside[BOTTOM] - height - options->borderAlignMargin[VERTICAL];
   } else {
     targetY = (outside[TOP] + outside[BOTTOM] - height) / 2;
   }
-  if (verbose >= VERBOSE_NORMAL) {
+  if (options->verbose >= VERBOSE_NORMAL) {
     printf("aligning mask [%d,%d,%d,%d] (%d,%d): %d, %d\n", mask[LEFT],
            mask[TOP], mask[RIGHT], mask[BOTTOM], targetX, targetY,
            targetX - mask[LEFT], targetY - mask[TOP]);
   }
-  initImage(&newimage, width, height, image->format, true);
+  initImage(&newimage, width, height, image->format);
+  fillImage(newimage, options->sheetBackground, options->absBlackThreshold);
   copyImageArea(mask[LEFT], mask[TOP], mask[RIGHT], mask[BOTTOM], image, 0, 0,
-                newimage);
+                newimage, options->absBlackThreshold);
   clearRect(mask[LEFT], mask[TOP], mask[RIGHT], mask[BOTTOM], image,
-            sheetBackground);
-  copyImageArea(0, 0, width, height, newimage, targetX, targetY, image);
+            options->sheetBackground, options->absBlackThreshold);
+  copyImageArea(0, 0, width, height, newimage, targetX, targetY, image,
+                options->absBlackThreshold);
   av_frame_free(&newimage);
 }
 
@@ -1166,8 +1751,9 @@ void alignMask(Mask mask, Mask outside,
  *
  * @param x1..y2 area inside of which border is to be detected
  */
-static int detectBorderEdge(Mask outsideMask, int stepX, int stepY,
-                            int size, int threshold, AVFrame *image) {
+static int detectBorderEdge(const struct Options *options, Mask outsideMask,
+                            int stepX, int stepY, int size, int threshold,
+                            AVFrame *image) {
   int left;
   int top;
   int right;
@@ -1203,11 +1789,13 @@ static int detectBorderEdge(Mask outsideMask, int stepX, int stepY,
     }
     max = (outsideMask[BOTTOM] - outsideMask[TOP]);
   }
+  TRACE_BEGIN("border-edge");
   result = 0;
   while (result < max) {
-    cnt = countPixelsRect(left, top, right, bottom, 0, absBlackThreshold, false,
-                          image);
+    cnt = countPixelsRect(left, top, right, bottom, 0,
+                          options->absBlackThreshold, false, image);
     if (cnt >= threshold) {
+      TRACE_END();
       return result; // border has been found: regular exit here
     }
     left += stepX;
@@ -1216,6 +1804,7 @@ static int detectBorderEdge(Mask outsideMask, int stepX, int stepY,
     bottom += stepY;
     result += abs(stepX + stepY); // (either stepX or stepY is 0)
   }
+  TRACE_END();
   return 0; // no border found between 0..max
 }
 
@@ -1223,30 +1812,34 @@ static int detectBorderEdge(Mask outsideMask, int stepX, int stepY,
  * Detects a border of completely non-black pixels around the area
  * outsideBorder[LEFT],outsideBorder[TOP]-outsideBorder[RIGHT],outsideBorder[BOTTOM].
  */
-void detectBorder(int border[EDGES_COUNT], Mask outsideMask,
-                  AVFrame *image) {
+void detectBorder(const struct Options *options, int border[EDGES_COUNT],
+                  Mask outsideMask, AVFrame *image) {
   border[LEFT] = outsideMask[LEFT];
   border[TOP] = outsideMask[TOP];
   border[RIGHT] = image->width - outsideMask[RIGHT];
   border[BOTTOM] = image->height - outsideMask[BOTTOM];
 
-  if (borderScanDirections & 1 << HORIZONTAL) {
-    border[LEFT] += detectBorderEdge(outsideMask, borderScanStep[HORIZONTAL], 0,
-                                     borderScanSize[HORIZONTAL],
-                                     borderScanThreshold[HORIZONTAL], image);
-    border[RIGHT] += detectBorderEdge(outsideMask, -borderScanStep[HORIZONTAL],
-                                      0, borderScanSize[HORIZONTAL],
-                                      borderScanThreshold[HORIZONTAL], image);
-  }
-  if (borderScanDirections & 1 << VERTICAL) {
-    border[TOP] += detectBorderEdge(outsideMask, 0, borderScanStep[VERTICAL],
-                                    borderScanSize[VERTICAL],
-                                    borderScanThreshold[VERTICAL], image);
+  if (options->borderScanDirections & 1 << HORIZONTAL) {
+    border[LEFT] += detectBorderEdge(
+        options, outsideMask, options->borderScanStep[HORIZONTAL], 0,
+        options->borderScanSize[HORIZONTAL],
+        options->borderScanThreshold[HORIZONTAL], image);
+    border[RIGHT] += detectBorderEdge(
+        options, outsideMask, -options->borderScanStep[HORIZONTAL], 0,
+        options->borderScanSize[HORIZONTAL],
+        options->borderScanThreshold[HORIZONTAL], image);
+  }
+  if (options->borderScanDirections & 1 << VERTICAL) {
+    border[TOP] += detectBorderEdge(
+        options, outsideMask, 0, options->borderScanStep[VERTICAL],
+        options->borderScanSize[VERTICAL],
+        options->borderScanThreshold[VERTICAL], image);
     border[BOTTOM] += detectBorderEdge(
-        outsideMask, 0, -borderScanStep[VERTICAL], borderScanSize[VERTICAL],
-        borderScanThreshold[VERTICAL], image);
+        options, outsideMask, 0, -options->borderScanStep[VERTICAL],
+        options->borderScanSize[VERTICAL],
+        options->borderScanThreshold[VERTICAL], image);
   }
-  if (verbose >= VERBOSE_NORMAL) {
+  if (options->verbose >= VERBOSE_NORMAL) {
     printf("border detected: (%d,%d,%d,%d) in [%d,%d,%d,%d]\n", border[LEFT],
            border[TOP], border[RIGHT], border[BOTTOM], outsideMask[LEFT],
            outsideMask[TOP], outsideMask[RIGHT], outsideMask[BOTTOM]);
@@ -1256,13 +1849,13 @@ void detectBorder(int border[EDGES_COUNT], Mask outsideMask,
 /**
  * Converts a border-tuple to a mask-tuple.
  */
-void borderToMask(int border[EDGES_COUNT], Mask mask,
-                  AVFrame *image) {
+void borderToMask(const struct Options *options, int border[EDGES_COUNT],
+                  Mask mask, AVFrame *image) {
   mask[LEFT] = border[LEFT];
   mask[TOP] = border[TOP];
   mask[RIGHT] = image->width - border[RIGHT] - 1;
   mask[BOTTOM] = image->height - border[BOTTOM] - 1;
-  if (verbose >= VERBOSE_DEBUG) {
+  if (options->verbose >= VERBOSE_DEBUG) {
     printf("border [%d,%d,%d,%d] -> mask [%d,%d,%d,%d]\n", border[LEFT],
            border[TOP], border[RIGHT], border[BOTTOM], mask[LEFT], mask[TOP],
            mask[RIGHT], mask[BOTTOM]);
@@ -1273,17 +1866,18 @@ void borderToMask(int border[EDGES_COUNT], Mask mask,
  * Applies a border to the whole image. All pixels in the border range at the
  * edges of the sheet will be cleared.
  */
-void applyBorder(int border[EDGES_COUNT], AVFrame *image) {
+void applyBorder(const struct Options *options, int border[EDGES_COUNT],
+                 AVFrame *image) {
   Mask mask;
 
   if (border[LEFT] != 0 || border[TOP] != 0 || border[RIGHT] != 0 ||
       border[BOTTOM] != 0) {
-    borderToMask(border, mask, image);
-    if (verbose >= VERBOSE_NORMAL) {
+    borderToMask(options, border, mask, image);
+    if (options->verbose >= VERBOSE_NORMAL) {
       printf("applying border (%d,%d,%d,%d) [%d,%d,%d,%d]\n", border[LEFT],
              border[TOP], border[RIGHT], border[BOTTOM], mask[LEFT], mask[TOP],
              mask[RIGHT], mask[BOTTOM]);
     }
-    applyMasks(&mask, 1, image);
+    applyMasks(options, &mask, 1, image);
   }
 }
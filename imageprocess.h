@@ -6,75 +6,107 @@
 
 #pragma once
 
+#include <stdio.h>
+
 #include <libavutil/frame.h>
 
 #include "constants.h"
 
+struct Options;
+
 /****************************************************************************
  * image processing functions                                               *
  ****************************************************************************/
 
 /* --- deskewing ---------------------------------------------------------- */
 
-float detectRotation(AVFrame *image, Mask mask);
+float detectRotation(const struct Options *options, AVFrame *image, Mask mask,
+                     int *scanSize);
+
+float detectRotationReport(const struct Options *options, AVFrame *image,
+                           Mask mask, int *scanSize, FILE *report);
 
-void rotate(const float radians, AVFrame *source, AVFrame *target);
+int rotationScanSize(const struct Options *options, Mask mask, int scanSize);
+
+void rotate(const struct Options *options, const float radians,
+            AVFrame *source, AVFrame *target);
 
 /* --- stretching / resizing / shifting ------------------------------------ */
 
-void stretch(int w, int h, AVFrame **image);
+void stretch(const struct Options *options, int w, int h, AVFrame **image);
+
+void resize(const struct Options *options, int w, int h, AVFrame **image);
+
+void resizeDimensions(int w, int h, int *width, int *height);
 
-void resize(int w, int h, AVFrame **image);
+void shift(const struct Options *options, int shiftX, int shiftY,
+           AVFrame **image);
 
-void shift(int shiftX, int shiftY, AVFrame **image);
+/* --- blank detection ---------------------------------------------------- */
+
+bool detectBlank(const struct Options *options, AVFrame *image,
+                 float threshold);
 
 /* --- mask-detection ----------------------------------------------------- */
 
-void detectMasks(AVFrame *image);
+int detectMasks(const struct Options *options, AVFrame *image, Mask *masks,
+                bool *valid);
 
-void applyMasks(Mask *masks, const int maskCount,
-                AVFrame *image);
+int detectBlankMasks(const struct Options *options, int width, int height,
+                     Mask *masks, bool *valid);
+
+void applyMasks(const struct Options *options, Mask *masks,
+                const int maskCount, AVFrame *image);
 
 /* --- wiping ------------------------------------------------------------- */
 
-void applyWipes(Mask *area, int areaCount,
+void applyWipes(const struct Options *options, Mask *area, int areaCount,
                 AVFrame *image);
 
 /* --- mirroring ---------------------------------------------------------- */
 
-void mirror(int directions, AVFrame *image);
+void mirror(const struct Options *options, int directions, AVFrame *image);
 
 /* --- flip-rotating ------------------------------------------------------ */
 
-void flipRotate(int direction, AVFrame **image);
+void flipRotate(const struct Options *options, int direction,
+                AVFrame **image);
 
 /* --- blackfilter -------------------------------------------------------- */
 
-void blackfilter(AVFrame *image);
+void blackfilter(const struct Options *options, AVFrame *image);
 
 /* --- noisefilter -------------------------------------------------------- */
 
-int noisefilter(AVFrame *image);
+int noisefilter(const struct Options *options, AVFrame *image);
 
 /* --- blurfilter --------------------------------------------------------- */
 
-int blurfilter(AVFrame *image);
+int blurfilter(const struct Options *options, AVFrame *image);
 
 /* --- grayfilter --------------------------------------------------------- */
 
-int grayfilter(AVFrame *image);
+int grayfilter(const struct Options *options, AVFrame *image);
 
 /* --- border-detection --------------------------------------------------- */
 
-void centerMask(AVFrame *image, int center[COORDINATES_COUNT],
-                Mask mask);
+void centerMask(const struct Options *options, AVFrame *image,
+                int center[COORDINATES_COUNT], Mask mask);
+
+void centerMaskReport(const struct Options *options, AVFrame *image,
+                      int center[COORDINATES_COUNT], Mask mask, FILE *report);
+
+void centerMaskArea(AVFrame *image, int center[COORDINATES_COUNT],
+                    Mask mask, Mask area);
 
-void alignMask(Mask mask, Mask outside, AVFrame *image);
+void alignMask(const struct Options *options, Mask mask, Mask outside,
+               AVFrame *image);
 
-void detectBorder(int border[EDGES_COUNT], Mask outsideMask,
-                  AVFrame *image);
+void detectBorder(const struct Options *options, int border[EDGES_COUNT],
+                  Mask outsideMask, AVFrame *image);
 
-void borderToMask(int border[EDGES_COUNT], Mask mask,
-                  AVFrame *image);
+void borderToMask(const struct Options *options, int border[EDGES_COUNT],
+                  Mask mask, AVFrame *image);
 
-void applyBorder(int border[EDGES_COUNT], AVFrame *image);
+void applyBorder(const struct Options *options, int border[EDGES_COUNT],
+                 AVFrame *image);
@@ -0,0 +1,936 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- pipeline instrumentation ------------------------------------------- */
+
+// needed for syscall()
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef HAVE_PERF_EVENT
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+
+#include <libavutil/buffer.h>
+#include <libavutil/pixdesc.h>
+
+#include "instrument.h"
+#include "unpaper.h"
+
+#define TRACE_MAX_DEPTH 16
+#define TRACE_BUFFER_SIZE 4096
+#define METRICS_INTERVAL 10 // seconds between updates of the metrics file
+
+bool instrumenting = false;
+bool tracing = false;
+bool accounting = false;
+
+static const char *stageNames[STAGES_COUNT] = {
+    [STAGE_LOAD] = "load",
+    [STAGE_PRE_TRANSFORM] = "pre-transform",
+    [STAGE_STRETCH] = "stretch",
+    [STAGE_BLACKFILTER] = "blackfilter",
+    [STAGE_NOISEFILTER] = "noisefilter",
+    [STAGE_BLURFILTER] = "blurfilter",
+    [STAGE_MASK_DETECT] = "mask-detect",
+    [STAGE_MASK_APPLY] = "mask-apply",
+    [STAGE_GRAYFILTER] = "grayfilter",
+    [STAGE_DESKEW_DETECT] = "deskew-detect",
+    [STAGE_ROTATE] = "rotate",
+    [STAGE_CENTER] = "center",
+    [STAGE_WIPE] = "wipe",
+    [STAGE_BORDER_SCAN] = "border-scan",
+    [STAGE_POST_TRANSFORM] = "post-transform",
+    [STAGE_SAVE] = "save",
+};
+
+static FILE *timingsFile = NULL;
+static int currentSheet = 0;
+static bool inSheet = false;
+static struct timespec sheetWallStart;
+static struct timespec sheetCpuStart;
+
+static struct timespec wallStart[STAGES_COUNT];
+static struct timespec cpuStart[STAGES_COUNT];
+
+// A completed span, in microseconds since the start of the trace. sheet is
+// -1 for anything but the spans of whole sheets.
+struct TraceEvent {
+  const char *name;
+  int64_t start;
+  int64_t duration;
+  int sheet;
+};
+
+// Spans are recorded per thread without locking; the buffers of all threads
+// are chained together so that they can be written out at the end of each
+// sheet, when no other thread is working.
+struct TraceBuffer {
+  struct TraceBuffer *next;
+  int tid;
+  int depth;
+  struct TraceEvent open[TRACE_MAX_DEPTH];
+  int count;
+  struct TraceEvent events[TRACE_BUFFER_SIZE];
+};
+
+typedef enum {
+  COUNTER_CYCLES,
+  COUNTER_INSTRUCTIONS,
+  COUNTER_CACHE_REFERENCES,
+  COUNTER_CACHE_MISSES,
+  COUNTER_BRANCH_MISSES,
+  COUNTERS_COUNT
+} COUNTERS;
+
+static const char *counterNames[COUNTERS_COUNT] = {
+    [COUNTER_CYCLES] = "cycles",
+    [COUNTER_INSTRUCTIONS] = "instructions",
+    [COUNTER_CACHE_REFERENCES] = "cache_references",
+    [COUNTER_CACHE_MISSES] = "cache_misses",
+    [COUNTER_BRANCH_MISSES] = "branch_misses",
+};
+
+// Counters only count the thread that opens them: the calling thread opens
+// its own in perfCountersOpen(), and each thread of the pool its own the
+// first time it runs tasks while counting. The counts of all the threads
+// are summed.
+struct CounterSet {
+  struct CounterSet *next;
+  int fds[COUNTERS_COUNT];
+};
+
+static bool counting = false;
+static int counterFds[COUNTERS_COUNT];
+static _Atomic(struct CounterSet *) threadCounters = NULL;
+// incremented every time counting starts, so that the threads of the pool
+// open their counters again
+static atomic_int countingRun = 0;
+static _Thread_local int threadCountingRun = 0;
+static uint64_t counterStart[STAGES_COUNT][COUNTERS_COUNT];
+static uint64_t counterTotal[STAGES_COUNT][COUNTERS_COUNT];
+static int stageCalls[STAGES_COUNT];
+static double stagePixels[STAGES_COUNT];
+static double stageWall[STAGES_COUNT];
+static double stageCpu[STAGES_COUNT];
+static long long stageRemoved[STAGES_COUNT];
+
+// upper bounds of the rotation histogram buckets, in degrees
+static const double rotationBuckets[] = {0.0, 0.1, 0.5, 1.0, 2.0, 5.0};
+#define ROTATION_BUCKETS (sizeof(rotationBuckets) / sizeof(rotationBuckets[0]))
+
+static bool summarizing = false;
+static char *metricsPath = NULL;
+static pid_t metricsPid;
+static struct timespec runStart;
+static struct timespec metricsWritten;
+static int sheetsProcessed = 0;
+static int pagesWritten = 0;
+static int rotationCounts[ROTATION_BUCKETS + 1];
+static double rotationSum = 0.0;
+static int errorCount = 0;
+
+// Bytes of image buffers and other large allocations currently live, and the
+// highest values reached during the current stage, sheet and run.
+static atomic_llong liveBytes = 0;
+static atomic_llong stagePeak = 0;
+static atomic_llong sheetPeak = 0;
+static atomic_llong runPeak = 0;
+static atomic_llong stageAllocated = 0;
+static atomic_llong sheetAllocated = 0;
+static long long runAllocated = 0;
+static long long stageAllocatedTotal[STAGES_COUNT];
+static long long stagePeakMax[STAGES_COUNT];
+static long long stageHeapMax[STAGES_COUNT];
+static long long sheetPeakMax = 0;
+static int sheetPeakNr = 0;
+
+static FILE *traceFile = NULL;
+static struct timespec traceStart;
+static _Atomic(struct TraceBuffer *) traceBuffers = NULL;
+static atomic_int traceThreads = 0;
+static _Thread_local struct TraceBuffer *threadBuffer = NULL;
+static pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static double elapsed(const struct timespec *start, clockid_t clock) {
+  struct timespec now;
+
+  clock_gettime(clock, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void startInstrumenting(void) {
+  if (!instrumenting)
+    clock_gettime(CLOCK_MONOTONIC, &runStart);
+  instrumenting = true;
+}
+
+/**
+ * Starts writing the time spent in every stage of every sheet to filename,
+ * as one JSON object per line.
+ */
+void timingsOpen(const char *filename) {
+  timingsFile = fopen(filename, "w");
+  if (timingsFile == NULL)
+    errOutput("unable to open timings file %s.", filename);
+
+  // every record is written at once, so that processes forked by --sweep
+  // can share the file
+  setvbuf(timingsFile, NULL, _IOLBF, 0);
+  startInstrumenting();
+}
+
+#ifdef HAVE_PERF_EVENT
+static const uint64_t counterConfigs[COUNTERS_COUNT] = {
+    [COUNTER_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+    [COUNTER_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+    [COUNTER_CACHE_REFERENCES] = PERF_COUNT_HW_CACHE_REFERENCES,
+    [COUNTER_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+    [COUNTER_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+/**
+ * Opens a counter of the calling thread only.
+ */
+static int openCounter(COUNTERS counter) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = counterConfigs[counter];
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/**
+ * Starts counting cycles, instructions, cache and branch misses in each
+ * stage. Counters the kernel does not provide, or does not allow access to,
+ * are left out; if none is available, a warning is printed and processing
+ * goes on without them.
+ */
+void perfCountersOpen(VERBOSE_LEVEL verbose) {
+  int available = 0;
+
+  for (int i = 0; i < COUNTERS_COUNT; i++) {
+    counterFds[i] = -1;
+  }
+
+#ifdef HAVE_PERF_EVENT
+  for (int i = 0; i < COUNTERS_COUNT; i++) {
+    counterFds[i] = openCounter(i);
+    if (counterFds[i] >= 0)
+      available++;
+  }
+
+  if (available == 0 && verbose > VERBOSE_QUIET) {
+    fprintf(stderr,
+            "unpaper: warning: hardware performance counters unavailable: "
+            "%s.\n",
+            strerror(errno));
+  }
+#else
+  if (verbose > VERBOSE_QUIET) {
+    fprintf(stderr, "unpaper: warning: hardware performance counters are not "
+                    "supported on this system.\n");
+  }
+#endif
+
+  if (available > 0) {
+    counting = true;
+    atomic_fetch_add(&countingRun, 1);
+    startInstrumenting();
+  }
+}
+
+/**
+ * Reads a counter, extrapolating its value if the kernel had to share the
+ * hardware with other counters.
+ */
+static uint64_t readCounter(int fd) {
+  uint64_t values[3]; // value, time enabled, time running
+
+  if (fd < 0 || read(fd, values, sizeof(values)) != sizeof(values) ||
+      values[2] == 0)
+    return 0;
+
+  if (values[2] < values[1])
+    return (double)values[0] * values[1] / values[2];
+  return values[0];
+}
+
+/**
+ * Opens the counters of a thread of the pool, the first time it runs tasks
+ * while counting.
+ */
+void instrumentThread(void) {
+#ifdef HAVE_PERF_EVENT
+  struct CounterSet *set;
+
+  if (!counting || threadCountingRun == atomic_load(&countingRun))
+    return;
+  threadCountingRun = atomic_load(&countingRun);
+
+  set = malloc(sizeof(*set));
+  if (set == NULL)
+    return;
+  for (int i = 0; i < COUNTERS_COUNT; i++) {
+    set->fds[i] = (counterFds[i] >= 0) ? openCounter(i) : -1;
+  }
+
+  set->next = atomic_load(&threadCounters);
+  while (!atomic_compare_exchange_weak(&threadCounters, &set->next, set))
+    ;
+#endif
+}
+
+/**
+ * Reads the counters summed over all threads. The threads of the pool are
+ * idle whenever a stage begins or ends.
+ */
+static void readCounters(uint64_t counters[COUNTERS_COUNT]) {
+  for (int i = 0; i < COUNTERS_COUNT; i++) {
+    counters[i] = readCounter(counterFds[i]);
+  }
+  for (struct CounterSet *set = atomic_load(&threadCounters); set != NULL;
+       set = set->next) {
+    for (int i = 0; i < COUNTERS_COUNT; i++) {
+      counters[i] += readCounter(set->fds[i]);
+    }
+  }
+}
+
+static void printCell(double value, double divisor, const char *format) {
+  if (divisor > 0) {
+    printf(format, value / divisor);
+  } else {
+    printf(" %11s", "-");
+  }
+}
+
+static void printPerfCounters(void) {
+  printf("\nhardware counters per stage:\n");
+  printf("%-15s %6s %9s %11s %11s %11s %11s\n", "stage", "calls", "Mpixels",
+         "IPC", "cache miss", "misses/Mpx", "br-miss/Mpx");
+
+  for (int stage = 0; stage < STAGES_COUNT; stage++) {
+    const uint64_t *total = counterTotal[stage];
+    const double megapixels = stagePixels[stage] / 1e6;
+
+    if (stageCalls[stage] == 0)
+      continue;
+
+    printf("%-15s %6d %9.2f", stageNames[stage], stageCalls[stage],
+           megapixels);
+    printCell(total[COUNTER_INSTRUCTIONS], total[COUNTER_CYCLES], " %11.2f");
+    printCell(total[COUNTER_CACHE_MISSES] * 100.0,
+              total[COUNTER_CACHE_REFERENCES], " %10.1f%%");
+    printCell(total[COUNTER_CACHE_MISSES], megapixels, " %11.0f");
+    printCell(total[COUNTER_BRANCH_MISSES], megapixels, " %11.0f");
+    printf("\n");
+  }
+}
+
+/**
+ * Starts accounting the memory used for images and by each stage.
+ */
+void memoryAccountingOpen(void) {
+  accounting = true;
+  startInstrumenting();
+}
+
+static void raisePeak(atomic_llong *peak, long long value) {
+  long long current = atomic_load(peak);
+
+  while (value > current &&
+         !atomic_compare_exchange_weak(peak, &current, value))
+    ;
+}
+
+void memoryAllocated(size_t bytes) {
+  const long long live = atomic_fetch_add(&liveBytes, bytes) + bytes;
+
+  atomic_fetch_add(&stageAllocated, bytes);
+  atomic_fetch_add(&sheetAllocated, bytes);
+  raisePeak(&stagePeak, live);
+  raisePeak(&sheetPeak, live);
+  raisePeak(&runPeak, live);
+}
+
+void memoryFreed(size_t bytes) { atomic_fetch_sub(&liveBytes, bytes); }
+
+static void releaseTrackedBuffer(void *opaque, uint8_t *data) {
+  AVBufferRef *buffer = opaque;
+
+  memoryFreed(buffer->size);
+  av_buffer_unref(&buffer);
+}
+
+/**
+ * Accounts the buffers of a frame until they are released. Each buffer is
+ * replaced by a reference whose release is accounted, so frames are freed the
+ * usual way, wherever that happens, and frames whose buffers were allocated
+ * by libav can be accounted the same way.
+ */
+void memoryTrackFrame(AVFrame *frame) {
+  for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i] != NULL; i++) {
+    AVBufferRef *buffer = frame->buf[i];
+    AVBufferRef *tracked = av_buffer_create(
+        buffer->data, buffer->size, releaseTrackedBuffer, buffer, 0);
+
+    if (tracked == NULL)
+      errOutput("unable to allocate buffer reference.");
+
+    frame->buf[i] = tracked;
+    memoryAllocated(buffer->size);
+  }
+}
+
+/**
+ * Returns the bytes allocated from the heap by the whole process, including
+ * libav, or -1 where the C library does not tell.
+ */
+static long long heapBytes(void) {
+#ifdef HAVE_MALLINFO2
+  const struct mallinfo2 info = mallinfo2();
+
+  return info.uordblks + info.hblkhd;
+#else
+  return -1;
+#endif
+}
+
+static void printMegabytes(long long bytes) {
+  if (bytes >= 0) {
+    printf(" %11.1f", bytes / (1024.0 * 1024.0));
+  } else {
+    printf(" %11s", "-");
+  }
+}
+
+static void printMemoryAccounting(void) {
+  printf("\nmemory per stage:\n");
+  printf("%-15s %11s %11s %11s\n", "stage", "alloc MiB", "peak MiB",
+         "heap MiB");
+
+  for (int stage = 0; stage < STAGES_COUNT; stage++) {
+    if (stageCalls[stage] == 0)
+      continue;
+
+    printf("%-15s", stageNames[stage]);
+    printMegabytes(stageAllocatedTotal[stage]);
+    printMegabytes(stagePeakMax[stage]);
+    printMegabytes(stageHeapMax[stage]);
+    printf("\n");
+  }
+
+  printf("peak: %.1f MiB (sheet %d), %.1f MiB allocated in total\n",
+         sheetPeakMax / (1024.0 * 1024.0), sheetPeakNr,
+         runAllocated / (1024.0 * 1024.0));
+}
+
+/**
+ * Collects the totals of the run, printed at the end.
+ */
+void summaryOpen(void) {
+  summarizing = true;
+  startInstrumenting();
+}
+
+/**
+ * Collects the totals of the run, and writes them to filename in the text
+ * format of Prometheus, as read by the textfile collector of node-exporter.
+ * The file is updated every METRICS_INTERVAL seconds during the run.
+ */
+void metricsOpen(const char *filename) {
+  metricsPath = strdup(filename);
+  metricsPid = getpid();
+  startInstrumenting();
+  metricsWritten = runStart;
+}
+
+void instrumentPages(int count) { pagesWritten += count; }
+
+void instrumentRemoved(PIPELINE_STAGES stage, int count) {
+  stageRemoved[stage] += count;
+}
+
+void instrumentRotation(float radians) {
+  const double degrees = fabs(radians * 180.0 / M_PI);
+  size_t bucket = 0;
+
+  while (bucket < ROTATION_BUCKETS && degrees > rotationBuckets[bucket])
+    bucket++;
+  rotationCounts[bucket]++;
+  rotationSum += degrees;
+}
+
+static void metricHeader(FILE *f, const char *name, const char *type,
+                         const char *help) {
+  fprintf(f, "# HELP unpaper_%s %s\n# TYPE unpaper_%s %s\n", name, help, name,
+          type);
+}
+
+/**
+ * Writes the metrics file, replacing it at once so that the collector never
+ * reads a partial file. Failures are only reported, as this also runs while
+ * exiting on an error.
+ */
+static void writeMetrics(void) {
+  char tmpFilename[PATH_MAX];
+  const double seconds = elapsed(&runStart, CLOCK_MONOTONIC);
+  const double megapixels = stagePixels[STAGE_LOAD] / 1e6;
+  FILE *f;
+
+  // processes forked by --sweep only account their own part of the work
+  if (getpid() != metricsPid)
+    return;
+
+  snprintf(tmpFilename, sizeof(tmpFilename), "%s.tmp", metricsPath);
+  f = fopen(tmpFilename, "w");
+  if (f == NULL) {
+    fprintf(stderr, "unpaper: warning: unable to write %s.\n", tmpFilename);
+    return;
+  }
+
+  metricHeader(f, "sheets_processed_total", "counter", "Sheets processed.");
+  fprintf(f, "unpaper_sheets_processed_total %d\n", sheetsProcessed);
+  metricHeader(f, "pages_written_total", "counter", "Output pages written.");
+  fprintf(f, "unpaper_pages_written_total %d\n", pagesWritten);
+  metricHeader(f, "input_megapixels_total", "counter",
+               "Megapixels of input images loaded.");
+  fprintf(f, "unpaper_input_megapixels_total %.3f\n", megapixels);
+  metricHeader(f, "run_seconds", "gauge", "Time since the start of the run.");
+  fprintf(f, "unpaper_run_seconds %.3f\n", seconds);
+  metricHeader(f, "sheets_per_second", "gauge",
+               "Sheets processed per second over the run.");
+  fprintf(f, "unpaper_sheets_per_second %.3f\n",
+          (seconds > 0) ? sheetsProcessed / seconds : 0.0);
+  metricHeader(f, "megapixels_per_second", "gauge",
+               "Input megapixels processed per second over the run.");
+  fprintf(f, "unpaper_megapixels_per_second %.3f\n",
+          (seconds > 0) ? megapixels / seconds : 0.0);
+
+  metricHeader(f, "stage_seconds_total", "counter",
+               "Wall-clock time spent in each processing stage.");
+  for (int stage = 0; stage < STAGES_COUNT; stage++) {
+    fprintf(f, "unpaper_stage_seconds_total{stage=\"%s\"} %.6f\n",
+            stageNames[stage], stageWall[stage]);
+  }
+  metricHeader(f, "stage_calls_total", "counter",
+               "Times each processing stage ran.");
+  for (int stage = 0; stage < STAGES_COUNT; stage++) {
+    fprintf(f, "unpaper_stage_calls_total{stage=\"%s\"} %d\n",
+            stageNames[stage], stageCalls[stage]);
+  }
+  metricHeader(f, "filter_removed_total", "counter",
+               "Clusters (noisefilter) or pixels removed by each filter.");
+  fprintf(f, "unpaper_filter_removed_total{stage=\"noisefilter\"} %lld\n",
+          stageRemoved[STAGE_NOISEFILTER]);
+  fprintf(f, "unpaper_filter_removed_total{stage=\"blurfilter\"} %lld\n",
+          stageRemoved[STAGE_BLURFILTER]);
+  fprintf(f, "unpaper_filter_removed_total{stage=\"grayfilter\"} %lld\n",
+          stageRemoved[STAGE_GRAYFILTER]);
+
+  metricHeader(f, "rotation_degrees", "histogram",
+               "Absolute rotation detected by deskewing, per mask.");
+  int cumulative = 0;
+  for (size_t i = 0; i < ROTATION_BUCKETS; i++) {
+    cumulative += rotationCounts[i];
+    fprintf(f, "unpaper_rotation_degrees_bucket{le=\"%g\"} %d\n",
+            rotationBuckets[i], cumulative);
+  }
+  cumulative += rotationCounts[ROTATION_BUCKETS];
+  fprintf(f, "unpaper_rotation_degrees_bucket{le=\"+Inf\"} %d\n", cumulative);
+  fprintf(f, "unpaper_rotation_degrees_sum %.3f\n", rotationSum);
+  fprintf(f, "unpaper_rotation_degrees_count %d\n", cumulative);
+
+  metricHeader(f, "errors_total", "counter", "Errors that ended the run.");
+  fprintf(f, "unpaper_errors_total %d\n", errorCount);
+  metricHeader(f, "last_update_timestamp_seconds", "gauge",
+               "Time of the last update of these metrics.");
+  fprintf(f, "unpaper_last_update_timestamp_seconds %lld\n",
+          (long long)time(NULL));
+
+  if (fclose(f) != 0 || rename(tmpFilename, metricsPath) != 0)
+    fprintf(stderr, "unpaper: warning: unable to write %s.\n",
+            metricsPath);
+
+  clock_gettime(CLOCK_MONOTONIC, &metricsWritten);
+}
+
+/**
+ * Records the error ending the run in the metrics.
+ */
+void instrumentError(void) {
+  errorCount++;
+  if (metricsPath != NULL)
+    writeMetrics();
+}
+
+static void printSummary(void) {
+  const double seconds = elapsed(&runStart, CLOCK_MONOTONIC);
+  const double megapixels = stagePixels[STAGE_LOAD] / 1e6;
+
+  printf("\nrun summary:\n");
+  printf("%d sheet%s processed, %d page%s written in %.2f s: %.2f sheets/s, "
+         "%.2f megapixels/s\n",
+         sheetsProcessed, pluralS(sheetsProcessed), pagesWritten,
+         pluralS(pagesWritten), seconds,
+         (seconds > 0) ? sheetsProcessed / seconds : 0.0,
+         (seconds > 0) ? megapixels / seconds : 0.0);
+
+  printf("%-15s %6s %11s %11s %11s\n", "stage", "calls", "wall s", "cpu s",
+         "removed");
+  for (int stage = 0; stage < STAGES_COUNT; stage++) {
+    if (stageCalls[stage] == 0)
+      continue;
+
+    printf("%-15s %6d %11.3f %11.3f", stageNames[stage], stageCalls[stage],
+           stageWall[stage], stageCpu[stage]);
+    if (stage == STAGE_NOISEFILTER || stage == STAGE_BLURFILTER ||
+        stage == STAGE_GRAYFILTER) {
+      printf(" %11lld\n", stageRemoved[stage]);
+    } else {
+      printf(" %11s\n", "-");
+    }
+  }
+
+  printf("rotation (degrees):");
+  for (size_t i = 0; i < ROTATION_BUCKETS; i++) {
+    printf(" <=%g: %d,", rotationBuckets[i], rotationCounts[i]);
+  }
+  printf(" >%g: %d\n", rotationBuckets[ROTATION_BUCKETS - 1],
+         rotationCounts[ROTATION_BUCKETS]);
+}
+
+/**
+ * Starts writing the spans of each sheet, stage and step to filename, in the
+ * trace event format of Chrome and Perfetto.
+ */
+void traceOpen(const char *filename) {
+  traceFile = fopen(filename, "w");
+  if (traceFile == NULL)
+    errOutput("unable to open trace file %s.", filename);
+
+  // the closing bracket is optional in this format, so that the file stays
+  // usable if the run is interrupted
+  setvbuf(traceFile, NULL, _IOLBF, 0);
+  fprintf(traceFile, "[\n");
+  clock_gettime(CLOCK_MONOTONIC, &traceStart);
+  tracing = true;
+  startInstrumenting();
+}
+
+static int64_t traceTimestamp(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - traceStart.tv_sec) * 1000000 +
+         (now.tv_nsec - traceStart.tv_nsec) / 1000;
+}
+
+/**
+ * Writes out the spans completed by one thread so far.
+ */
+static void traceFlushBuffer(struct TraceBuffer *buffer) {
+  const int pid = getpid();
+
+  pthread_mutex_lock(&traceMutex);
+  for (int i = 0; i < buffer->count; i++) {
+    const struct TraceEvent *event = &buffer->events[i];
+
+    fprintf(traceFile,
+            "{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %lld, \"dur\": %lld, "
+            "\"pid\": %d, \"tid\": %d",
+            event->name, (long long)event->start, (long long)event->duration,
+            pid, buffer->tid);
+    if (event->sheet != -1)
+      fprintf(traceFile, ", \"args\": {\"sheet\": %d}", event->sheet);
+    fprintf(traceFile, "},\n");
+  }
+  buffer->count = 0;
+  pthread_mutex_unlock(&traceMutex);
+}
+
+static struct TraceBuffer *traceThreadBuffer(void) {
+  struct TraceBuffer *buffer = threadBuffer;
+
+  if (buffer != NULL)
+    return buffer;
+
+  buffer = calloc(1, sizeof(*buffer));
+  if (buffer == NULL)
+    errOutput("unable to allocate trace buffer.");
+  buffer->tid = atomic_fetch_add(&traceThreads, 1) + 1;
+
+  buffer->next = atomic_load(&traceBuffers);
+  while (!atomic_compare_exchange_weak(&traceBuffers, &buffer->next, buffer))
+    ;
+
+  threadBuffer = buffer;
+  return buffer;
+}
+
+/**
+ * Opens a span on the calling thread, nested in the spans it has open.
+ *
+ * @param sheet number of the sheet the span covers, or -1
+ */
+void traceBegin(const char *name, int sheet) {
+  struct TraceBuffer *buffer = traceThreadBuffer();
+
+  if (buffer->depth < TRACE_MAX_DEPTH) {
+    buffer->open[buffer->depth] = (struct TraceEvent){
+        .name = name,
+        .start = traceTimestamp(),
+        .sheet = sheet,
+    };
+  }
+  buffer->depth++;
+}
+
+/**
+ * Closes the innermost span open on the calling thread.
+ */
+void traceEnd(void) {
+  struct TraceBuffer *buffer = traceThreadBuffer();
+
+  if (buffer->depth == 0)
+    return;
+
+  buffer->depth--;
+  if (buffer->depth >= TRACE_MAX_DEPTH)
+    return;
+
+  if (buffer->count == TRACE_BUFFER_SIZE)
+    traceFlushBuffer(buffer);
+
+  struct TraceEvent *event = &buffer->events[buffer->count++];
+  *event = buffer->open[buffer->depth];
+  event->duration = traceTimestamp() - event->start;
+}
+
+/**
+ * Writes out whatever instrumentation output is buffered. Must not be called
+ * while other threads record spans.
+ */
+void instrumentFlush(void) {
+  if (traceFile == NULL)
+    return;
+
+  for (struct TraceBuffer *buffer = atomic_load(&traceBuffers); buffer != NULL;
+       buffer = buffer->next) {
+    traceFlushBuffer(buffer);
+  }
+}
+
+void instrumentSheet(int nr) {
+  currentSheet = nr;
+  inSheet = true;
+  clock_gettime(CLOCK_MONOTONIC, &sheetWallStart);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &sheetCpuStart);
+  atomic_store(&sheetPeak, atomic_load(&liveBytes));
+  atomic_store(&sheetAllocated, 0);
+  if (tracing)
+    traceBegin("sheet", nr);
+}
+
+/**
+ * Ends the measurements of the current sheet, if any.
+ */
+void instrumentSheetEnd(void) {
+  if (!inSheet)
+    return;
+
+  if (tracing)
+    traceEnd();
+  inSheet = false;
+  sheetsProcessed++;
+
+  const long long allocated = atomic_load(&sheetAllocated);
+  const long long peak = atomic_load(&sheetPeak);
+  runAllocated += allocated;
+  if (peak > sheetPeakMax) {
+    sheetPeakMax = peak;
+    sheetPeakNr = currentSheet;
+  }
+
+  if (timingsFile != NULL) {
+    fprintf(timingsFile,
+            "{\"sheet\": %d, \"stage\": \"sheet\", \"wall\": %.6f, "
+            "\"cpu\": %.6f",
+            currentSheet, elapsed(&sheetWallStart, CLOCK_MONOTONIC),
+            elapsed(&sheetCpuStart, CLOCK_PROCESS_CPUTIME_ID));
+    if (accounting)
+      fprintf(timingsFile, ", \"allocated\": %lld, \"peak\": %lld",
+              allocated, peak);
+    fprintf(timingsFile, "}\n");
+  }
+
+  instrumentFlush();
+
+  if (metricsPath != NULL &&
+      elapsed(&metricsWritten, CLOCK_MONOTONIC) >= METRICS_INTERVAL)
+    writeMetrics();
+}
+
+void instrumentBegin(PIPELINE_STAGES stage) {
+  if (tracing)
+    traceBegin(stageNames[stage], -1);
+
+  clock_gettime(CLOCK_MONOTONIC, &wallStart[stage]);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuStart[stage]);
+
+  if (accounting) {
+    atomic_store(&stagePeak, atomic_load(&liveBytes));
+    atomic_store(&stageAllocated, 0);
+  }
+
+  if (counting)
+    readCounters(counterStart[stage]);
+}
+
+void instrumentEnd(PIPELINE_STAGES stage, AVFrame *image) {
+  uint64_t counters[COUNTERS_COUNT];
+  const double cpu = elapsed(&cpuStart[stage], CLOCK_PROCESS_CPUTIME_ID);
+  const double wall = elapsed(&wallStart[stage], CLOCK_MONOTONIC);
+  const char *format = NULL;
+
+  if (counting) {
+    readCounters(counters);
+    for (int i = 0; i < COUNTERS_COUNT; i++) {
+      counters[i] -= counterStart[stage][i];
+      counterTotal[stage][i] += counters[i];
+    }
+  }
+
+  stageCalls[stage]++;
+  stageWall[stage] += wall;
+  stageCpu[stage] += cpu;
+  if (image != NULL)
+    stagePixels[stage] += (double)image->width * image->height;
+
+  const long long allocated = atomic_load(&stageAllocated);
+  const long long peak = atomic_load(&stagePeak);
+  const long long heap = accounting ? heapBytes() : -1;
+  if (accounting) {
+    stageAllocatedTotal[stage] += allocated;
+    if (peak > stagePeakMax[stage])
+      stagePeakMax[stage] = peak;
+    if (heap > stageHeapMax[stage])
+      stageHeapMax[stage] = heap;
+  }
+
+  if (tracing)
+    traceEnd();
+
+  if (timingsFile == NULL)
+    return;
+
+  if (image != NULL)
+    format = av_get_pix_fmt_name(image->format);
+
+  fprintf(timingsFile,
+          "{\"sheet\": %d, \"stage\": \"%s\", \"width\": %d, \"height\": %d, "
+          "\"format\": \"%s\", \"wall\": %.6f, \"cpu\": %.6f",
+          currentSheet, stageNames[stage], (image != NULL) ? image->width : 0,
+          (image != NULL) ? image->height : 0,
+          (format != NULL) ? format : "none", wall, cpu);
+  for (int i = 0; counting && i < COUNTERS_COUNT; i++) {
+    if (counterFds[i] >= 0)
+      fprintf(timingsFile, ", \"%s\": %llu", counterNames[i],
+              (unsigned long long)counters[i]);
+  }
+  if (accounting) {
+    fprintf(timingsFile,
+            ", \"allocated\": %lld, \"live\": %lld, \"peak\": %lld",
+            allocated, (long long)atomic_load(&liveBytes), peak);
+    if (heap >= 0)
+      fprintf(timingsFile, ", \"heap\": %lld", heap);
+  }
+  fprintf(timingsFile, "}\n");
+}
+
+void instrumentClose(VERBOSE_LEVEL verbose) {
+  if (summarizing) {
+    if (verbose > VERBOSE_QUIET)
+      printSummary();
+    summarizing = false;
+  }
+
+  if (metricsPath != NULL) {
+    writeMetrics();
+    free(metricsPath);
+    metricsPath = NULL;
+  }
+
+  if (accounting) {
+    if (verbose > VERBOSE_QUIET)
+      printMemoryAccounting();
+    accounting = false;
+  }
+
+  if (counting) {
+    if (verbose > VERBOSE_QUIET)
+      printPerfCounters();
+    for (int i = 0; i < COUNTERS_COUNT; i++) {
+      if (counterFds[i] >= 0)
+        close(counterFds[i]);
+    }
+    struct CounterSet *set = atomic_exchange(&threadCounters, NULL);
+    while (set != NULL) {
+      struct CounterSet *next = set->next;
+
+      for (int i = 0; i < COUNTERS_COUNT; i++) {
+        if (set->fds[i] >= 0)
+          close(set->fds[i]);
+      }
+      free(set);
+      set = next;
+    }
+    counting = false;
+  }
+
+  if (traceFile != NULL) {
+    instrumentFlush();
+    // metadata event, so that the list does not end with a comma
+    fprintf(traceFile,
+            "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+            "\"args\": {\"name\": \"unpaper\"}}\n]\n",
+            getpid());
+    fclose(traceFile);
+    traceFile = NULL;
+    tracing = false;
+  }
+
+  if (timingsFile != NULL) {
+    fclose(timingsFile);
+    timingsFile = NULL;
+  }
+  instrumenting = false;
+}
@@ -0,0 +1,148 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <libavutil/frame.h>
+
+#include "constants.h"
+
+/* --- pipeline instrumentation ------------------------------------------- */
+
+// Pipeline stages measured by the instrumentation. A stage may be entered
+// several times per sheet, e.g. once per mask or per page, and every entry is
+// recorded separately.
+typedef enum {
+  STAGE_LOAD,
+  STAGE_PRE_TRANSFORM,
+  STAGE_STRETCH,
+  STAGE_BLACKFILTER,
+  STAGE_NOISEFILTER,
+  STAGE_BLURFILTER,
+  STAGE_MASK_DETECT,
+  STAGE_MASK_APPLY,
+  STAGE_GRAYFILTER,
+  STAGE_DESKEW_DETECT,
+  STAGE_ROTATE,
+  STAGE_CENTER,
+  STAGE_WIPE,
+  STAGE_BORDER_SCAN,
+  STAGE_POST_TRANSFORM,
+  STAGE_SAVE,
+  STAGES_COUNT
+} PIPELINE_STAGES;
+
+// true if any instrumentation output is enabled; the stage hooks do nothing
+// otherwise
+extern bool instrumenting;
+
+// true if trace spans are recorded
+extern bool tracing;
+
+// true if memory allocations are accounted
+extern bool accounting;
+
+void timingsOpen(const char *filename);
+
+void traceOpen(const char *filename);
+
+void perfCountersOpen(VERBOSE_LEVEL verbose);
+
+void instrumentThread(void);
+
+void memoryAccountingOpen(void);
+
+void summaryOpen(void);
+
+void metricsOpen(const char *filename);
+
+void instrumentPages(int count);
+
+void instrumentRemoved(PIPELINE_STAGES stage, int count);
+
+void instrumentRotation(float radians);
+
+void instrumentError(void);
+
+void memoryAllocated(size_t bytes);
+
+void memoryFreed(size_t bytes);
+
+void memoryTrackFrame(AVFrame *frame);
+
+void instrumentSheet(int nr);
+
+void instrumentSheetEnd(void);
+
+void instrumentBegin(PIPELINE_STAGES stage);
+
+void instrumentEnd(PIPELINE_STAGES stage, AVFrame *image);
+
+void instrumentFlush(void);
+
+void instrumentClose(VERBOSE_LEVEL verbose);
+
+void traceBegin(const char *name, int sheet);
+
+void traceEnd(void);
+
+// Spans of work inside a stage, shown nested in the trace. name must be a
+// string literal, or otherwise outlive the run.
+#define TRACE_BEGIN(name)                                                      \
+  do {                                                                         \
+    if (tracing)                                                               \
+      traceBegin(name, -1);                                                    \
+  } while (0)
+
+#define TRACE_END()                                                            \
+  do {                                                                         \
+    if (tracing)                                                               \
+      traceEnd();                                                              \
+  } while (0)
+
+static inline void accountAlloc(size_t bytes) {
+  if (accounting)
+    memoryAllocated(bytes);
+}
+
+static inline void accountFree(size_t bytes) {
+  if (accounting)
+    memoryFreed(bytes);
+}
+
+// accounts the image buffers of frame until they are released
+static inline void accountFrame(AVFrame *frame) {
+  if (accounting)
+    memoryTrackFrame(frame);
+}
+
+static inline void countPages(int count) {
+  if (instrumenting)
+    instrumentPages(count);
+}
+
+// count is the number of clusters or pixels removed by a filter stage
+static inline void countRemoved(PIPELINE_STAGES stage, int count) {
+  if (instrumenting)
+    instrumentRemoved(stage, count);
+}
+
+static inline void countRotation(float radians) {
+  if (instrumenting)
+    instrumentRotation(radians);
+}
+
+static inline void beginStage(PIPELINE_STAGES stage) {
+  if (instrumenting)
+    instrumentBegin(stage);
+}
+
+// image is the result of the stage, reported with the measurements
+static inline void endStage(PIPELINE_STAGES stage, AVFrame *image) {
+  if (instrumenting)
+    instrumentEnd(stage, image);
+}
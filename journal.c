@@ -0,0 +1,468 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- batch journal ------------------------------------------------------ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libavutil/hash.h>
+
+#include "journal.h"
+#include "sheet.h"
+#include "unpaper.h"
+
+#define JOURNAL_MAGIC "unpaper-journal 1"
+
+// placeholder for blank input pages, which have neither name nor content
+#define JOURNAL_BLANK "-"
+
+// tag of the entries recording the outputs of a sheet being processed
+#define JOURNAL_STARTED "started"
+
+struct JournalEntry {
+  int nr;
+  char parameters[DETECTION_KEY_SIZE];
+  struct JournalState state;
+  int inputCount;
+  char *inputs[2];
+  char inputHashes[2][DETECTION_KEY_SIZE];
+  int outputCount;
+  char *outputs[2];
+  char outputHashes[2][DETECTION_KEY_SIZE];
+};
+
+// a sheet the earlier run started, but did not complete
+struct JournalStarted {
+  int nr;
+  int outputCount;
+  char *outputs[2];
+};
+
+static FILE *journalFile = NULL;
+static char runParameters[DETECTION_KEY_SIZE];
+static char sheetOptions[DETECTION_KEY_SIZE] = "";
+static struct JournalEntry *entries = NULL;
+static int entryCount = 0;
+static struct JournalStarted *started = NULL;
+static int startedCount = 0;
+
+static struct AVHashContext *newHash(void) {
+  struct AVHashContext *ctx = NULL;
+
+  if (av_hash_alloc(&ctx, "SHA256") < 0)
+    errOutput("unable to allocate hash context.");
+  av_hash_init(ctx);
+
+  return ctx;
+}
+
+static void finalHash(struct AVHashContext **ctx,
+                      char digest[DETECTION_KEY_SIZE]) {
+  av_hash_final_hex(*ctx, (uint8_t *)digest, DETECTION_KEY_SIZE);
+  av_hash_freep(ctx);
+}
+
+static void fileDigest(const char *filename, char digest[DETECTION_KEY_SIZE]) {
+  struct AVHashContext *ctx;
+
+  if (filename == NULL) {
+    strcpy(digest, JOURNAL_BLANK);
+    return;
+  }
+
+  ctx = newHash();
+  hashFile(ctx, filename);
+  finalHash(&ctx, digest);
+}
+
+/**
+ * Calculates the hash of the parameters sheet nr is processed with: the
+ * run-wide parameters, the options of its manifest record and the per-sheet
+ * switches.
+ */
+static void sheetParameters(const struct Options *options, int nr,
+                            char digest[DETECTION_KEY_SIZE]) {
+  struct AVHashContext *ctx = newHash();
+
+  av_hash_update(ctx, (const uint8_t *)runParameters, strlen(runParameters));
+  av_hash_update(ctx, (const uint8_t *)sheetOptions, strlen(sheetOptions));
+  hashSheetSwitches(ctx, options, nr);
+  finalHash(&ctx, digest);
+}
+
+static const char *fileName(const char *filename) {
+  return (filename != NULL) ? filename : JOURNAL_BLANK;
+}
+
+static bool parseEntry(char *line, struct JournalEntry *entry) {
+  char *saveptr = NULL;
+  char *field;
+  int *state[] = {&entry->state.width,          &entry->state.height,
+                  &entry->state.previousWidth,  &entry->state.previousHeight,
+                  &entry->state.outputPixFmt,   &entry->state.deskewScanSize};
+
+#define nextField() (field = strtok_r(NULL, "\t\n", &saveptr))
+
+  memset(entry, 0, sizeof(*entry));
+
+  if ((field = strtok_r(line, "\t\n", &saveptr)) == NULL)
+    return false;
+  entry->nr = atoi(field);
+
+  if (nextField() == NULL || strlen(field) >= DETECTION_KEY_SIZE)
+    return false;
+  strcpy(entry->parameters, field);
+
+  for (size_t i = 0; i < sizeof(state) / sizeof(state[0]); i++) {
+    if (nextField() == NULL)
+      return false;
+    *state[i] = atoi(field);
+  }
+
+  if (nextField() == NULL)
+    return false;
+  entry->inputCount = atoi(field);
+  if (entry->inputCount < 1 || entry->inputCount > 2)
+    return false;
+  for (int i = 0; i < entry->inputCount; i++) {
+    if (nextField() == NULL)
+      return false;
+    entry->inputs[i] = strdup(field);
+    if (nextField() == NULL || strlen(field) >= DETECTION_KEY_SIZE)
+      return false;
+    strcpy(entry->inputHashes[i], field);
+  }
+
+  if (nextField() == NULL)
+    return false;
+  entry->outputCount = atoi(field);
+  if (entry->outputCount < 1 || entry->outputCount > 2)
+    return false;
+  for (int i = 0; i < entry->outputCount; i++) {
+    if (nextField() == NULL)
+      return false;
+    entry->outputs[i] = strdup(field);
+    if (nextField() == NULL || strlen(field) >= DETECTION_KEY_SIZE)
+      return false;
+    strcpy(entry->outputHashes[i], field);
+  }
+
+#undef nextField
+
+  return true;
+}
+
+static void freeEntry(struct JournalEntry *entry) {
+  for (int i = 0; i < 2; i++) {
+    free(entry->inputs[i]);
+    free(entry->outputs[i]);
+  }
+}
+
+static bool parseStarted(char *line, struct JournalStarted *sheet) {
+  char *saveptr = NULL;
+  char *field;
+
+  memset(sheet, 0, sizeof(*sheet));
+
+  if ((field = strtok_r(line, "\t\n", &saveptr)) == NULL ||
+      strcmp(field, JOURNAL_STARTED) != 0)
+    return false;
+  if ((field = strtok_r(NULL, "\t\n", &saveptr)) == NULL)
+    return false;
+  sheet->nr = atoi(field);
+  if ((field = strtok_r(NULL, "\t\n", &saveptr)) == NULL)
+    return false;
+  sheet->outputCount = atoi(field);
+  if (sheet->outputCount < 1 || sheet->outputCount > 2)
+    return false;
+  for (int i = 0; i < sheet->outputCount; i++) {
+    if ((field = strtok_r(NULL, "\t\n", &saveptr)) == NULL)
+      return false;
+    sheet->outputs[i] = strdup(field);
+  }
+
+  return true;
+}
+
+static void freeStarted(struct JournalStarted *sheet) {
+  for (int i = 0; i < 2; i++) {
+    free(sheet->outputs[i]);
+  }
+}
+
+/**
+ * Forgets sheet nr as started, once the journal records it as completed or
+ * started again.
+ */
+static void dropStarted(int nr) {
+  for (int i = 0; i < startedCount; i++) {
+    if (started[i].nr == nr) {
+      freeStarted(&started[i]);
+      started[i--] = started[--startedCount];
+    }
+  }
+}
+
+/**
+ * Reads the sheets started and completed by an earlier run. A trailing
+ * partial line, as left by an interrupted run, is cut off the file, so that
+ * the entries of this run start on a line of their own.
+ */
+static void loadJournal(const char *filename, VERBOSE_LEVEL verbose) {
+  char *line = NULL;
+  size_t lineSize = 0;
+  ssize_t length;
+  off_t complete;
+  int allocated = 0;
+  int startedAllocated = 0;
+  FILE *f = fopen(filename, "r");
+
+  if (f == NULL)
+    return;
+
+  if (getline(&line, &lineSize, f) < 0 ||
+      strncmp(line, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC)) != 0) {
+    errOutput("%s is not an unpaper journal.", filename);
+  }
+  complete = ftello(f);
+
+  while ((length = getline(&line, &lineSize, f)) > 0) {
+    struct JournalEntry entry;
+    struct JournalStarted sheet;
+
+    if (line[length - 1] != '\n')
+      break;
+    complete = ftello(f);
+
+    if (strncmp(line, JOURNAL_STARTED "\t", strlen(JOURNAL_STARTED) + 1) ==
+        0) {
+      if (!parseStarted(line, &sheet)) {
+        freeStarted(&sheet);
+        continue;
+      }
+
+      dropStarted(sheet.nr);
+      if (startedCount == startedAllocated) {
+        startedAllocated = (startedAllocated == 0) ? 8 : startedAllocated * 2;
+        started = realloc(started, startedAllocated * sizeof(started[0]));
+        if (started == NULL)
+          errOutput("unable to allocate journal entries.");
+      }
+      started[startedCount++] = sheet;
+      continue;
+    }
+
+    if (!parseEntry(line, &entry)) {
+      freeEntry(&entry);
+      continue;
+    }
+
+    dropStarted(entry.nr);
+    if (entryCount == allocated) {
+      allocated = (allocated == 0) ? 64 : allocated * 2;
+      entries = realloc(entries, allocated * sizeof(entries[0]));
+      if (entries == NULL)
+        errOutput("unable to allocate journal entries.");
+    }
+    entries[entryCount++] = entry;
+  }
+
+  free(line);
+  fclose(f);
+
+  if (truncate(filename, complete) != 0)
+    errOutput("unable to truncate journal %s.", filename);
+
+  if (verbose >= VERBOSE_NORMAL) {
+    printf("journal %s: %d sheet%s completed previously.\n", filename,
+           entryCount, pluralS(entryCount));
+  }
+}
+
+/**
+ * Sets the options of the manifest record of the next sheet, parsed as
+ * argv[1] on, which apply on top of the run-wide parameters.
+ */
+void journalSheetOptions(int argc, char *argv[]) {
+  struct AVHashContext *ctx = newHash();
+
+  for (int i = 1; i < argc; i++) {
+    av_hash_update(ctx, (const uint8_t *)argv[i], strlen(argv[i]) + 1);
+  }
+  finalHash(&ctx, sheetOptions);
+}
+
+/**
+ * Opens the journal of the run, before its first sheet. Unless resuming, an
+ * existing journal is replaced.
+ */
+void journalOpen(const struct RunState *run) {
+  const struct Options *options = &run->options;
+  const char *filename = options->journalFilename;
+  const bool resume = options->resume;
+  struct AVHashContext *ctx = newHash();
+  struct stat statBuf;
+
+  hashDetectionParameters(ctx, run);
+  hashOutputParameters(ctx, options);
+  hashValue(ctx, options->sheetSize);
+  // the output format forced on the command line, or -1
+  hashValue(ctx, run->outputPixFmt);
+  finalHash(&ctx, runParameters);
+
+  if (resume) {
+    loadJournal(filename, options->verbose);
+  }
+
+  const bool empty = !resume || stat(filename, &statBuf) != 0 ||
+                     statBuf.st_size == 0;
+  journalFile = fopen(filename, resume ? "a" : "w");
+  if (journalFile == NULL)
+    errOutput("unable to open journal %s.", filename);
+
+  if (empty) {
+    fprintf(journalFile, "%s\n", JOURNAL_MAGIC);
+    fflush(journalFile);
+  }
+}
+
+void journalClose(void) {
+  if (journalFile != NULL) {
+    fclose(journalFile);
+    journalFile = NULL;
+  }
+
+  for (int i = 0; i < entryCount; i++) {
+    freeEntry(&entries[i]);
+  }
+  free(entries);
+  entries = NULL;
+  entryCount = 0;
+
+  for (int i = 0; i < startedCount; i++) {
+    freeStarted(&started[i]);
+  }
+  free(started);
+  started = NULL;
+  startedCount = 0;
+}
+
+/**
+ * Tests whether sheet nr was completed by an earlier run with the same input
+ * files, parameters and outputs, none of which has changed since.
+ *
+ * @param state receives the processing state after the sheet
+ */
+bool journalSheetCompleted(const struct Options *options, int nr,
+                           char *inputFileNames[], char *outputFileNames[],
+                           struct JournalState *state) {
+  const struct JournalEntry *entry = NULL;
+  char digest[DETECTION_KEY_SIZE];
+
+  // later entries supersede earlier ones for the same sheet
+  for (int i = entryCount - 1; i >= 0 && entry == NULL; i--) {
+    if (entries[i].nr == nr)
+      entry = &entries[i];
+  }
+
+  if (entry == NULL || entry->inputCount != options->inputCount ||
+      entry->outputCount != options->outputCount)
+    return false;
+
+  sheetParameters(options, nr, digest);
+  if (strcmp(digest, entry->parameters) != 0)
+    return false;
+
+  for (int i = 0; i < options->inputCount; i++) {
+    if (strcmp(entry->inputs[i], fileName(inputFileNames[i])) != 0)
+      return false;
+    fileDigest(inputFileNames[i], digest);
+    if (strcmp(digest, entry->inputHashes[i]) != 0)
+      return false;
+  }
+
+  for (int i = 0; i < options->outputCount; i++) {
+    if (strcmp(entry->outputs[i], outputFileNames[i]) != 0 ||
+        access(outputFileNames[i], R_OK) != 0)
+      return false;
+    fileDigest(outputFileNames[i], digest);
+    if (strcmp(digest, entry->outputHashes[i]) != 0)
+      return false;
+  }
+
+  *state = entry->state;
+  return true;
+}
+
+/**
+ * Tests whether filename is an output of a sheet the earlier run started
+ * but did not complete, which the run may have left behind.
+ */
+bool journalOutputStarted(const char *filename) {
+  for (int i = 0; i < startedCount; i++) {
+    for (int j = 0; j < started[i].outputCount; j++) {
+      if (strcmp(started[i].outputs[j], filename) == 0)
+        return true;
+    }
+  }
+  return false;
+}
+
+static void syncJournal(int nr) {
+  if (fflush(journalFile) != 0 || fsync(fileno(journalFile)) != 0)
+    errOutput("unable to write journal entry for sheet %d.", nr);
+}
+
+/**
+ * Records the outputs of a sheet before they are written, so that a resumed
+ * run knows which of them it may replace.
+ */
+void journalStartSheet(const struct Options *options, int nr,
+                       char *outputFileNames[]) {
+  fprintf(journalFile, "%s\t%d\t%d", JOURNAL_STARTED, nr,
+          options->outputCount);
+  for (int i = 0; i < options->outputCount; i++) {
+    fprintf(journalFile, "\t%s", outputFileNames[i]);
+  }
+  fprintf(journalFile, "\n");
+
+  syncJournal(nr);
+}
+
+/**
+ * Appends a completed sheet to the journal. The entry is flushed to disk
+ * before returning, so it survives a crash on the following sheet.
+ */
+void journalRecordSheet(const struct Options *options, int nr,
+                        char *inputFileNames[], char *outputFileNames[],
+                        const struct JournalState *state) {
+  char digest[DETECTION_KEY_SIZE];
+
+  sheetParameters(options, nr, digest);
+  fprintf(journalFile, "%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d", nr, digest,
+          state->width, state->height, state->previousWidth,
+          state->previousHeight, state->outputPixFmt, state->deskewScanSize);
+
+  fprintf(journalFile, "\t%d", options->inputCount);
+  for (int i = 0; i < options->inputCount; i++) {
+    fileDigest(inputFileNames[i], digest);
+    fprintf(journalFile, "\t%s\t%s", fileName(inputFileNames[i]), digest);
+  }
+
+  fprintf(journalFile, "\t%d", options->outputCount);
+  for (int i = 0; i < options->outputCount; i++) {
+    fileDigest(outputFileNames[i], digest);
+    fprintf(journalFile, "\t%s\t%s", outputFileNames[i], digest);
+  }
+  fprintf(journalFile, "\n");
+
+  syncJournal(nr);
+}
@@ -0,0 +1,44 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "cache.h"
+
+/* --- batch journal ------------------------------------------------------ */
+
+// processing state carried from one sheet to the next, restored when a
+// completed sheet is skipped on resume
+struct JournalState {
+  int width;
+  int height;
+  int previousWidth;
+  int previousHeight;
+  int outputPixFmt;
+  int deskewScanSize;
+};
+
+struct Options;
+struct RunState;
+
+void journalOpen(const struct RunState *run);
+
+void journalClose(void);
+
+void journalSheetOptions(int argc, char *argv[]);
+
+bool journalSheetCompleted(const struct Options *options, int nr,
+                           char *inputFileNames[], char *outputFileNames[],
+                           struct JournalState *state);
+
+bool journalOutputStarted(const char *filename);
+
+void journalStartSheet(const struct Options *options, int nr,
+                       char *outputFileNames[]);
+
+void journalRecordSheet(const struct Options *options, int nr,
+                        char *inputFileNames[], char *outputFileNames[],
+                        const struct JournalState *state);
@@ -0,0 +1,308 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- library ------------------------------------------------------------ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/frame.h>
+
+#include "cpu.h"
+#include "libunpaper.h"
+#include "sheet.h"
+#include "unpaper.h"
+
+struct UnpaperContext {
+  struct RunState run;
+  bool started;
+  int sheet;
+  // the sheet being processed, released when an error stops it
+  AVFrame *frame;
+  char error[sizeof(errorMessage)];
+};
+
+// getopt keeps its state in globals, so options are parsed one context at a
+// time
+static pthread_mutex_t parseLock = PTHREAD_MUTEX_INITIALIZER;
+
+// the kernels are selected for the whole process, by the first context
+// created
+static pthread_mutex_t cpuLock = PTHREAD_MUTEX_INITIALIZER;
+static bool kernelsSelected = false;
+
+/**
+ * Selects the kernels, unless a context did already.
+ *
+ * @return false when UNPAPER_CPU names no level this CPU supports, with the
+ * message in the error of context
+ */
+static bool selectKernels(UnpaperContext *context) {
+  bool selected;
+
+  pthread_mutex_lock(&cpuLock);
+  if (!kernelsSelected) {
+    CPU_LEVEL level;
+
+    if (cpuLevel(&level, context->error, sizeof(context->error))) {
+      cpuSelect(level);
+      kernelsSelected = true;
+    }
+  }
+  selected = kernelsSelected;
+  pthread_mutex_unlock(&cpuLock);
+
+  return selected;
+}
+
+static const int pixelFormats[] = {
+    [UNPAPER_GRAY8] = AV_PIX_FMT_GRAY8,
+    [UNPAPER_RGB24] = AV_PIX_FMT_RGB24,
+    [UNPAPER_MONOWHITE] = AV_PIX_FMT_MONOWHITE,
+    [UNPAPER_MONOBLACK] = AV_PIX_FMT_MONOBLACK,
+};
+
+static bool imageFormat(int pixelFormat, UNPAPER_FORMATS *format) {
+  for (int i = 0; i < (int)(sizeof(pixelFormats) / sizeof(pixelFormats[0]));
+       i++) {
+    if (pixelFormats[i] == pixelFormat) {
+      *format = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Tells how many bytes the pixels of a row of image take.
+ */
+static long long rowBytes(const UnpaperImage *image) {
+  switch (image->format) {
+  case UNPAPER_GRAY8:
+    return image->width;
+  case UNPAPER_RGB24:
+    return 3LL * image->width;
+  default:
+    return (image->width + 7LL) / 8;
+  }
+}
+
+static void setError(UnpaperContext *context, const char *message) {
+  snprintf(context->error, sizeof(context->error), "%s", message);
+}
+
+/**
+ * Tells whether the options use something the library does not provide:
+ * files of their own, processes, or the thread pool, which is shared by the
+ * whole process.
+ */
+static bool libraryOptions(const struct Options *options) {
+  return options->sweepFilename == NULL && options->spoolDirectory == NULL &&
+         options->daemonSocket == NULL && options->watchDirectory == NULL &&
+         options->manifestFilename == NULL &&
+         options->inputTarFilename == NULL &&
+         options->outputTarFilename == NULL && options->asyncSheets == 0 &&
+         options->journalFilename == NULL &&
+         options->detectionCacheDirectory == NULL &&
+         options->dedupeSize == 0 && options->timingsFilename == NULL &&
+         options->traceFilename == NULL && options->metricsFilename == NULL &&
+         !options->perfCounters && !options->memoryStats &&
+         !options->summary && options->shardCount <= 1 &&
+         options->threadCount == 1 && options->writeoutput;
+}
+
+UNPAPER_STATUS unpaperCreate(const UnpaperOptions *options,
+                             UnpaperContext **context) {
+  UnpaperContext *created = calloc(1, sizeof(UnpaperContext));
+  bool valid;
+
+  if (created == NULL)
+    return UNPAPER_FAILED;
+  *context = created;
+  runInit(&created->run);
+
+  // the program name, quiet unless told otherwise, then the options; getopt
+  // reorders the arguments it parses
+  const int argc = 2 + options->argc;
+  char **argv = calloc(argc + 1, sizeof(char *));
+
+  if (argv == NULL) {
+    setError(created, "unable to allocate the options.");
+    return UNPAPER_FAILED;
+  }
+  argv[0] = "unpaper";
+  argv[1] = "--quiet";
+  for (int i = 0; i < options->argc; i++) {
+    argv[2 + i] = (char *)options->argv[i];
+  }
+
+  pthread_mutex_lock(&parseLock);
+  // the message of the error is returned instead
+  opterr = 0;
+  valid = runOptions(&created->run, argc, argv, created->error,
+                     sizeof(created->error));
+  opterr = 1;
+  pthread_mutex_unlock(&parseLock);
+  free(argv);
+
+  if (!valid)
+    return UNPAPER_INVALID_OPTIONS;
+  if (!libraryOptions(&created->run.options)) {
+    setError(created, "option not available in the library.");
+    return UNPAPER_INVALID_OPTIONS;
+  }
+
+  if (!selectKernels(created))
+    return UNPAPER_FAILED;
+
+  runStart(&created->run);
+  created->started = true;
+  return UNPAPER_OK;
+}
+
+int unpaperInputPages(const UnpaperContext *context) {
+  return context->run.options.inputCount;
+}
+
+int unpaperOutputPages(const UnpaperContext *context) {
+  return context->run.options.outputCount;
+}
+
+/**
+ * Runs the sheet of inputs through the filters into outputs. Errors of the
+ * filters go back to unpaperProcess(), which releases the sheet left in the
+ * context.
+ */
+static UNPAPER_STATUS processSheet(UnpaperContext *context,
+                                   const UnpaperImage *inputs, int inputCount,
+                                   UnpaperImage *outputs, int outputCount) {
+  struct RunState *run = &context->run;
+  AVFrame **sheet = &context->frame;
+  const int nr = ++context->sheet;
+
+  for (int i = 0; i < inputCount; i++) {
+    // the frame only points at the pixels of the caller, which it does not
+    // own
+    AVFrame *page = av_frame_alloc();
+
+    if (page == NULL) {
+      setError(context, "unable to allocate an input image.");
+      return UNPAPER_FAILED;
+    }
+    page->width = inputs[i].width;
+    page->height = inputs[i].height;
+    page->format = pixelFormats[inputs[i].format];
+    page->data[0] = inputs[i].data;
+    page->linesize[0] = inputs[i].stride;
+    addSheetPage(run, i, (nr - 1) * inputCount + i + 1, &page, sheet);
+  }
+  if (!finishSheetInput(run, sheet, context->error, sizeof(context->error)))
+    return UNPAPER_FAILED;
+
+  prepareSheet(run, sheet);
+  stretchSheet(run, nr, sheet);
+  preWipeSheet(run, nr, *sheet);
+
+  struct DetectionResult detection = {0};
+  for (SWEEP_STAGES stage = SWEEP_STAGE_BLACKFILTER;
+       stage < SWEEP_STAGE_OUTPUT; stage++) {
+    processStage(run, stage, nr, sheet, &detection, false);
+  }
+
+  if (run->outputPixFmt == -1) {
+    run->outputPixFmt = (*sheet)->format;
+  }
+
+  for (int i = 0; i < outputCount; i++) {
+    AVFrame *page = sheetPage(run, *sheet, i);
+    AVFrame *frame = outputImage(&run->options, page, run->outputPixFmt);
+
+    if (page != *sheet && page != frame) {
+      av_frame_free(&page);
+    }
+    if (frame == *sheet) {
+      *sheet = NULL;
+    }
+    outputs[i].frame = frame;
+    if (!imageFormat(frame->format, &outputs[i].format)) {
+      setError(context, "no output image produced.");
+      return UNPAPER_FAILED;
+    }
+    outputs[i].data = frame->data[0];
+    outputs[i].stride = frame->linesize[0];
+    outputs[i].width = frame->width;
+    outputs[i].height = frame->height;
+  }
+  return UNPAPER_OK;
+}
+
+UNPAPER_STATUS unpaperProcess(UnpaperContext *context,
+                              const UnpaperImage *inputs, int inputCount,
+                              UnpaperImage *outputs, int outputCount) {
+  const struct RunState *run = &context->run;
+
+  if (!context->started) {
+    setError(context, "the context was not created.");
+    return UNPAPER_INVALID_OPTIONS;
+  }
+  if (inputCount != run->options.inputCount ||
+      outputCount != run->options.outputCount) {
+    setError(context, "wrong number of input or output images.");
+    return UNPAPER_INVALID_IMAGE;
+  }
+  for (int i = 0; i < inputCount; i++) {
+    if (inputs[i].data == NULL || inputs[i].width <= 0 ||
+        inputs[i].height <= 0 || inputs[i].format < 0 ||
+        inputs[i].format > UNPAPER_MONOBLACK ||
+        inputs[i].stride < rowBytes(&inputs[i])) {
+      setError(context, "invalid input image.");
+      return UNPAPER_INVALID_IMAGE;
+    }
+  }
+
+  UNPAPER_STATUS status;
+  jmp_buf jump;
+
+  memset(outputs, 0, outputCount * sizeof(outputs[0]));
+  errorJump = &jump;
+  if (setjmp(jump) == 0) {
+    status = processSheet(context, inputs, inputCount, outputs, outputCount);
+  } else {
+    setError(context, errorMessage);
+    status = UNPAPER_FAILED;
+  }
+  errorJump = NULL;
+  av_frame_free(&context->frame);
+
+  if (status != UNPAPER_OK) {
+    for (int i = 0; i < outputCount; i++) {
+      unpaperFreeImage(&outputs[i]);
+    }
+  }
+  return status;
+}
+
+const char *unpaperError(const UnpaperContext *context) {
+  return context->error;
+}
+
+void unpaperFreeImage(UnpaperImage *image) {
+  AVFrame *frame = image->frame;
+
+  av_frame_free(&frame);
+  memset(image, 0, sizeof(*image));
+}
+
+void unpaperDestroy(UnpaperContext *context) {
+  if (context == NULL)
+    return;
+
+  runFree(&context->run);
+  free(context);
+}
@@ -0,0 +1,105 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* --- library ------------------------------------------------------------ */
+
+/*
+ * unpaper as a library: sheets are processed from pixel buffers in memory
+ * into pixel buffers in memory, with the same processing as the unpaper
+ * program, and errors are returned instead of exiting.
+ *
+ * A context carries what a sheet leaves for the next ones, as a run of the
+ * program does, so its sheets are processed one after the other. Contexts
+ * are independent of each other: sheets of different contexts can be
+ * processed at the same time, from different threads. A sheet is processed
+ * on the calling thread; --threads is not available, process sheets with
+ * several contexts instead.
+ */
+
+typedef enum {
+  UNPAPER_OK = 0,
+  UNPAPER_INVALID_OPTIONS,
+  UNPAPER_INVALID_IMAGE,
+  UNPAPER_FAILED,
+} UNPAPER_STATUS;
+
+typedef enum {
+  UNPAPER_GRAY8,     // 8 bits per pixel, 0 is black
+  UNPAPER_RGB24,     // 8 bits per channel, red first
+  UNPAPER_MONOWHITE, // 1 bit per pixel, most significant first, 1 is black
+  UNPAPER_MONOBLACK, // 1 bit per pixel, most significant first, 1 is white
+} UNPAPER_FORMATS;
+
+typedef struct {
+  uint8_t *data;
+  // bytes from the start of a row to the start of the next, no fewer than
+  // the pixels of a row take
+  int stride;
+  int width;
+  int height;
+  UNPAPER_FORMATS format;
+
+  // set on the images returned, to free them with unpaperFreeImage()
+  void *frame;
+} UnpaperImage;
+
+typedef struct {
+  // the options of the unpaper program, as given on its command line,
+  // without input and output files; options reading or writing files of
+  // their own, such as --journal or --sweep, and --threads are not
+  // available
+  int argc;
+  const char *const *argv;
+} UnpaperOptions;
+
+typedef struct UnpaperContext UnpaperContext;
+
+#if defined(__GNUC__)
+#define UNPAPER_API __attribute__((visibility("default")))
+#else
+#define UNPAPER_API
+#endif
+
+// Creates a context processing sheets with the options given. On
+// UNPAPER_INVALID_OPTIONS, or UNPAPER_FAILED when UNPAPER_CPU names no level
+// this CPU supports, *context is still set, for unpaperError().
+UNPAPER_API UNPAPER_STATUS unpaperCreate(const UnpaperOptions *options,
+                                         UnpaperContext **context);
+
+// Number of input images of a sheet, as set by --input-pages.
+UNPAPER_API int unpaperInputPages(const UnpaperContext *context);
+
+// Number of output images of a sheet, as set by --output-pages.
+UNPAPER_API int unpaperOutputPages(const UnpaperContext *context);
+
+// Processes the next sheet, counting from 1 for options taking sheet
+// numbers. The input images are only read during the call, and never
+// copied as a whole. The output images are allocated by the library, in the
+// format of the first input image unless set by --type. Errors of the
+// filters, such as failed allocations, return UNPAPER_FAILED instead of
+// ending the process; the memory the filters held then may be lost.
+UNPAPER_API UNPAPER_STATUS unpaperProcess(UnpaperContext *context,
+                                          const UnpaperImage *inputs,
+                                          int inputCount,
+                                          UnpaperImage *outputs,
+                                          int outputCount);
+
+// Message of the last error of the context.
+UNPAPER_API const char *unpaperError(const UnpaperContext *context);
+
+UNPAPER_API void unpaperFreeImage(UnpaperImage *image);
+
+UNPAPER_API void unpaperDestroy(UnpaperContext *context);
+
+#ifdef __cplusplus
+}
+#endif
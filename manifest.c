@@ -0,0 +1,417 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- batch manifest ----------------------------------------------------- */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "manifest.h"
+#include "parallel.h"
+#include "unpaper.h"
+
+// sheets read ahead of the one processed, whose input files are checked
+// together
+#define MANIFEST_AHEAD 64
+
+/*
+ * A manifest holds one record per line, for one sheet each, and is read as
+ * the sheets are processed, so that it can be of any length. A record is
+ * either a JSON object with "inputs", "outputs" and "options" arrays of
+ * strings, or tab-separated fields: the input files, then the output files,
+ * then the options. Empty lines and lines starting with # are ignored.
+ */
+static FILE *manifest = NULL;
+static int lineNumber = 0;
+static char *line = NULL;
+static size_t lineSize = 0;
+
+// files of a sheet, as set by --input-pages and --output-pages
+static int inputCount = 1;
+static int outputCount = 1;
+
+static struct ManifestSheet ahead[MANIFEST_AHEAD];
+static int aheadCount = 0;
+static int aheadNext = 0;
+
+static void freeSheet(struct ManifestSheet *sheet) {
+  for (int i = 0; i < sheet->inputCount; i++) {
+    free(sheet->inputs[i]);
+  }
+  for (int i = 0; i < sheet->outputCount; i++) {
+    free(sheet->outputs[i]);
+  }
+  for (int i = 1; i < sheet->argc; i++) {
+    free(sheet->argv[i]);
+  }
+  memset(sheet, 0, sizeof(*sheet));
+}
+
+static bool isRecord(const char *text) {
+  text += strspn(text, " \t\r\n");
+  return *text != '\0' && *text != '#';
+}
+
+/* --- JSON records ------------------------------------------------------- */
+
+static void skipSpace(const char **p) { *p += strspn(*p, " \t\r\n"); }
+
+static void jsonError(const char *message) {
+  errOutput("manifest line %d: %s.", lineNumber, message);
+}
+
+static void appendUtf8(char **out, uint32_t c) {
+  if (c < 0x80) {
+    *(*out)++ = c;
+  } else if (c < 0x800) {
+    *(*out)++ = 0xc0 | (c >> 6);
+    *(*out)++ = 0x80 | (c & 0x3f);
+  } else if (c < 0x10000) {
+    *(*out)++ = 0xe0 | (c >> 12);
+    *(*out)++ = 0x80 | ((c >> 6) & 0x3f);
+    *(*out)++ = 0x80 | (c & 0x3f);
+  } else {
+    *(*out)++ = 0xf0 | (c >> 18);
+    *(*out)++ = 0x80 | ((c >> 12) & 0x3f);
+    *(*out)++ = 0x80 | ((c >> 6) & 0x3f);
+    *(*out)++ = 0x80 | (c & 0x3f);
+  }
+}
+
+static uint32_t parseHex4(const char **p) {
+  uint32_t c = 0;
+
+  for (int i = 0; i < 4; i++) {
+    const char d = *(*p)++;
+    c <<= 4;
+    if (d >= '0' && d <= '9')
+      c |= d - '0';
+    else if (d >= 'a' && d <= 'f')
+      c |= d - 'a' + 10;
+    else if (d >= 'A' && d <= 'F')
+      c |= d - 'A' + 10;
+    else
+      jsonError("invalid \\u escape");
+  }
+  return c;
+}
+
+/**
+ * Parses a JSON string at *p, returning it newly allocated. The decoded
+ * string is never longer than its JSON form.
+ */
+static char *parseString(const char **p) {
+  if (**p != '"')
+    jsonError("string expected");
+  (*p)++;
+
+  char *string = malloc(strlen(*p) + 1);
+  char *out = string;
+
+  while (**p != '"') {
+    const char c = *(*p)++;
+
+    if (c == '\0') {
+      jsonError("unterminated string");
+    } else if (c != '\\') {
+      *out++ = c;
+      continue;
+    }
+
+    switch (*(*p)++) {
+    case '"':
+      *out++ = '"';
+      break;
+    case '\\':
+      *out++ = '\\';
+      break;
+    case '/':
+      *out++ = '/';
+      break;
+    case 'b':
+      *out++ = '\b';
+      break;
+    case 'f':
+      *out++ = '\f';
+      break;
+    case 'n':
+      *out++ = '\n';
+      break;
+    case 'r':
+      *out++ = '\r';
+      break;
+    case 't':
+      *out++ = '\t';
+      break;
+    case 'u': {
+      uint32_t u = parseHex4(p);
+
+      if (u >= 0xd800 && u < 0xdc00) {
+        if ((*p)[0] != '\\' || (*p)[1] != 'u')
+          jsonError("invalid surrogate pair");
+        *p += 2;
+        const uint32_t low = parseHex4(p);
+        if (low < 0xdc00 || low >= 0xe000)
+          jsonError("invalid surrogate pair");
+        u = 0x10000 + ((u - 0xd800) << 10) + (low - 0xdc00);
+      } else if (u >= 0xdc00 && u < 0xe000) {
+        jsonError("invalid surrogate pair");
+      } else if (u == 0) {
+        jsonError("NUL in string");
+      }
+      appendUtf8(&out, u);
+      break;
+    }
+    default:
+      jsonError("invalid escape");
+    }
+  }
+  (*p)++;
+  *out = '\0';
+
+  return string;
+}
+
+/**
+ * Parses a JSON array of strings, or a single string, into strings. Nulls
+ * are accepted, as NULL, when nullable.
+ */
+static int parseStrings(const char **p, char *strings[], int max,
+                        bool nullable) {
+  int count = 0;
+
+  if (**p != '[') {
+    strings[0] = parseString(p);
+    return 1;
+  }
+
+  (*p)++;
+  skipSpace(p);
+  while (**p != ']') {
+    if (count == max)
+      jsonError("too many values");
+
+    if (nullable && strncmp(*p, "null", 4) == 0) {
+      strings[count++] = NULL;
+      *p += 4;
+    } else {
+      strings[count++] = parseString(p);
+    }
+
+    skipSpace(p);
+    if (**p == ',') {
+      (*p)++;
+      skipSpace(p);
+      if (**p == ']')
+        jsonError("value expected");
+    } else if (**p != ']') {
+      jsonError("',' or ']' expected");
+    }
+  }
+  (*p)++;
+
+  return count;
+}
+
+static void parseJsonRecord(const char *p, struct ManifestSheet *sheet) {
+  p++; // {
+  skipSpace(&p);
+  while (*p != '}') {
+    char *key = parseString(&p);
+
+    skipSpace(&p);
+    if (*p != ':')
+      jsonError("':' expected");
+    p++;
+    skipSpace(&p);
+
+    if (strcmp(key, "inputs") == 0) {
+      sheet->inputCount = parseStrings(&p, sheet->inputs, 2, true);
+    } else if (strcmp(key, "outputs") == 0) {
+      sheet->outputCount = parseStrings(&p, sheet->outputs, 2, false);
+    } else if (strcmp(key, "options") == 0) {
+      sheet->argc =
+          1 + parseStrings(&p, sheet->argv + 1, MANIFEST_MAX_ARGS, false);
+    } else {
+      errOutput("manifest line %d: unknown key '%s'.", lineNumber, key);
+    }
+    free(key);
+
+    skipSpace(&p);
+    if (*p == ',') {
+      p++;
+      skipSpace(&p);
+      if (*p == '}')
+        jsonError("key expected");
+    } else if (*p != '}') {
+      jsonError("',' or '}' expected");
+    }
+  }
+  p++;
+  skipSpace(&p);
+  if (*p != '\0')
+    jsonError("unexpected text after the record");
+}
+
+/* --- tab-separated records ---------------------------------------------- */
+
+static void parseTabRecord(char *text, struct ManifestSheet *sheet) {
+  text[strcspn(text, "\r\n")] = '\0';
+
+  int field = 0;
+  for (char *next = text; next != NULL; field++) {
+    char *value = next;
+
+    next = strchr(value, '\t');
+    if (next != NULL)
+      *next++ = '\0';
+
+    if (field < inputCount) {
+      sheet->inputs[sheet->inputCount++] =
+          (value[0] == '\0') ? NULL : strdup(value);
+    } else if (field < inputCount + outputCount) {
+      sheet->outputs[sheet->outputCount++] = strdup(value);
+    } else if (value[0] != '\0') {
+      if (sheet->argc > MANIFEST_MAX_ARGS)
+        errOutput("manifest line %d: too many options.", lineNumber);
+      sheet->argv[sheet->argc++] = strdup(value);
+    }
+  }
+}
+
+/* --- reading ahead ------------------------------------------------------ */
+
+static bool readSheet(struct ManifestSheet *sheet) {
+  while (getline(&line, &lineSize, manifest) != -1) {
+    lineNumber++;
+    if (!isRecord(line))
+      continue;
+
+    const char *text = line + strspn(line, " \t\r\n");
+
+    sheet->line = lineNumber;
+    sheet->argc = 1;
+    sheet->argv[0] = "unpaper";
+    if (*text == '{') {
+      parseJsonRecord(text, sheet);
+    } else {
+      parseTabRecord(line, sheet);
+    }
+    sheet->argv[sheet->argc] = NULL;
+
+    if (sheet->inputCount != inputCount ||
+        sheet->outputCount != outputCount) {
+      errOutput("manifest line %d: %d input and %d output files expected.",
+                lineNumber, inputCount, outputCount);
+    }
+    for (int i = 0; i < sheet->outputCount; i++) {
+      if (sheet->outputs[i] == NULL || sheet->outputs[i][0] == '\0')
+        errOutput("manifest line %d: empty output file.", lineNumber);
+    }
+    return true;
+  }
+  return false;
+}
+
+static void checkInputs(int first, int last, void *arg) {
+  for (int i = first; i <= last; i++) {
+    for (int j = 0; j < ahead[i].inputCount; j++) {
+      if (ahead[i].inputs[j] != NULL && !imageExists(ahead[i].inputs[j])) {
+        ahead[i].missing = ahead[i].inputs[j];
+        break;
+      }
+    }
+  }
+}
+
+void manifestOpen(const char *filename, int inputs, int outputs) {
+  inputCount = inputs;
+  outputCount = outputs;
+  if (strcmp(filename, "-") == 0) {
+    manifest = stdin;
+  } else if ((manifest = fopen(filename, "r")) == NULL) {
+    errOutput("unable to open manifest %s.", filename);
+  }
+}
+
+/**
+ * Counts the records of a manifest, reading it through on its own.
+ */
+int manifestCount(const char *filename) {
+  char *text = NULL;
+  size_t textSize = 0;
+  int count = 0;
+
+  if (strcmp(filename, "-") == 0)
+    errOutput("cannot count the sheets of a manifest read from stdin.");
+
+  FILE *f = fopen(filename, "r");
+  if (f == NULL)
+    errOutput("unable to open manifest %s.", filename);
+
+  while (getline(&text, &textSize, f) != -1) {
+    if (isRecord(text))
+      count++;
+  }
+
+  free(text);
+  fclose(f);
+  return count;
+}
+
+/**
+ * Gives the next sheet of the manifest, valid until the next call. Once the
+ * sheets read ahead are used up, the next ones are read, and the existence
+ * of their input files checked all at once, spread over the processing
+ * threads, as checking files one at a time is slow on network file systems.
+ */
+bool manifestNext(struct ManifestSheet **sheet) {
+  if (aheadNext == aheadCount) {
+    for (int i = 0; i < aheadCount; i++) {
+      freeSheet(&ahead[i]);
+    }
+    aheadCount = 0;
+    aheadNext = 0;
+
+    while (aheadCount < MANIFEST_AHEAD && readSheet(&ahead[aheadCount])) {
+      aheadCount++;
+    }
+    parallelBands(aheadCount, checkInputs, NULL);
+  }
+
+  if (aheadNext == aheadCount)
+    return false;
+
+  *sheet = &ahead[aheadNext++];
+  return true;
+}
+
+/**
+ * Gives the sheet count records after the last one given, when already read
+ * ahead, or NULL.
+ */
+const struct ManifestSheet *manifestAhead(int count) {
+  if (aheadNext + count >= aheadCount)
+    return NULL;
+  return &ahead[aheadNext + count];
+}
+
+void manifestClose(void) {
+  for (int i = 0; i < aheadCount; i++) {
+    freeSheet(&ahead[i]);
+  }
+  aheadCount = 0;
+  aheadNext = 0;
+
+  free(line);
+  line = NULL;
+  lineSize = 0;
+
+  if (manifest != NULL && manifest != stdin)
+    fclose(manifest);
+  manifest = NULL;
+}
@@ -0,0 +1,36 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+
+/* --- batch manifest ----------------------------------------------------- */
+
+#define MANIFEST_MAX_ARGS 64
+
+// One sheet of a manifest: its input files, NULL for blank pages, its
+// output files, and the options applying to it alone, parsed as argv[1] on.
+struct ManifestSheet {
+  int line;
+  char *inputs[2];
+  int inputCount;
+  char *outputs[2];
+  int outputCount;
+  int argc;
+  char *argv[MANIFEST_MAX_ARGS + 2];
+
+  // first input file found missing when read ahead, or NULL
+  const char *missing;
+};
+
+void manifestOpen(const char *filename, int inputs, int outputs);
+
+int manifestCount(const char *filename);
+
+bool manifestNext(struct ManifestSheet **sheet);
+
+const struct ManifestSheet *manifestAhead(int count);
+
+void manifestClose(void);
@@ -0,0 +1,358 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- intra-sheet parallelism -------------------------------------------- */
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "instrument.h"
+#include "parallel.h"
+#include "unpaper.h"
+
+// bands each thread gets, so that stealing can even out uneven bands
+#define BANDS_PER_THREAD 4
+
+// columns a wavefront row advances before telling the next row about it
+#define WAVEFRONT_PUBLISH_STEP 32
+
+/*
+ * The pool runs jobs made of numbered tasks. Every worker, including the
+ * calling thread as worker 0, owns a queue of tasks dealt out in turn, and
+ * once it is empty takes the first task left in the queue of another worker.
+ * Tasks are always taken lowest first, which wavefronts rely on: a row is
+ * never started before all the rows above it.
+ */
+
+struct Worker {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  int *tasks;
+  int first;
+  int end;
+};
+
+static struct {
+  int threads;
+  struct Worker *workers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t started;
+  pthread_cond_t finished;
+  unsigned int generation;
+  int pending;
+  bool stopping;
+
+  void (*run)(int task, void *arg);
+  void *arg;
+} pool = {
+    .threads = 1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .started = PTHREAD_COND_INITIALIZER,
+    .finished = PTHREAD_COND_INITIALIZER,
+};
+
+// set on the threads while they run a task: jobs started from a task run on
+// the thread itself, as the pool is already busy
+static _Thread_local bool inTask = false;
+
+static bool takeTask(struct Worker *worker, int *task) {
+  bool found = false;
+
+  pthread_mutex_lock(&worker->lock);
+  if (worker->first < worker->end) {
+    *task = worker->tasks[worker->first++];
+    found = true;
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return found;
+}
+
+/**
+ * Runs the tasks left on the pool, starting with the ones of the worker
+ * self, within a span of the trace for the thread.
+ */
+static void runTasks(int self) {
+  int task;
+  int done = 0;
+
+  while (true) {
+    bool found = takeTask(&pool.workers[self], &task);
+    for (int i = 1; !found && i < pool.threads; i++) {
+      found = takeTask(&pool.workers[(self + i) % pool.threads], &task);
+    }
+    if (!found)
+      break;
+
+    if (done == 0)
+      TRACE_BEGIN("tasks");
+    inTask = true;
+    pool.run(task, pool.arg);
+    inTask = false;
+    done++;
+  }
+  if (done == 0)
+    return;
+
+  // the span ends before the job can be over, which lets the buffers of the
+  // trace be written out
+  TRACE_END();
+  pthread_mutex_lock(&pool.lock);
+  pool.pending -= done;
+  if (pool.pending == 0)
+    pthread_cond_broadcast(&pool.finished);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+static void *workerMain(void *arg) {
+  const int self = (int)(intptr_t)arg;
+  unsigned int generation = 0;
+
+  pthread_mutex_lock(&pool.lock);
+  while (true) {
+    while (pool.generation == generation && !pool.stopping)
+      pthread_cond_wait(&pool.started, &pool.lock);
+    if (pool.stopping)
+      break;
+    generation = pool.generation;
+
+    pthread_mutex_unlock(&pool.lock);
+    instrumentThread();
+    runTasks(self);
+    pthread_mutex_lock(&pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
+
+/**
+ * Runs tasks 0..count-1 on the pool, and waits for all of them.
+ */
+static void runJob(int count, void (*run)(int task, void *arg), void *arg) {
+  const int perWorker = (count + pool.threads - 1) / pool.threads;
+
+  pthread_mutex_lock(&pool.lock);
+  pool.run = run;
+  pool.arg = arg;
+  pool.pending = count;
+  pthread_mutex_unlock(&pool.lock);
+
+  for (int w = 0; w < pool.threads; w++) {
+    struct Worker *worker = &pool.workers[w];
+
+    pthread_mutex_lock(&worker->lock);
+    worker->tasks = realloc(worker->tasks, perWorker * sizeof(int));
+    worker->first = worker->end = 0;
+    for (int task = w; task < count; task += pool.threads) {
+      worker->tasks[worker->end++] = task;
+    }
+    pthread_mutex_unlock(&worker->lock);
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  pool.generation++;
+  pthread_cond_broadcast(&pool.started);
+  pthread_mutex_unlock(&pool.lock);
+
+  runTasks(0);
+
+  pthread_mutex_lock(&pool.lock);
+  while (pool.pending > 0)
+    pthread_cond_wait(&pool.finished, &pool.lock);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+/**
+ * Starts the threads the filters run on; 0 starts one per online processor,
+ * and 1 keeps everything on the calling thread.
+ */
+void parallelInit(int threads, VERBOSE_LEVEL verbose) {
+  if (threads == 0) {
+    threads = max((int)sysconf(_SC_NPROCESSORS_ONLN), 1);
+  }
+  if (threads == 1)
+    return;
+
+  pool.threads = threads;
+  pool.workers = calloc(threads, sizeof(struct Worker));
+  for (int w = 0; w < threads; w++) {
+    pthread_mutex_init(&pool.workers[w].lock, NULL);
+    if (w > 0 && pthread_create(&pool.workers[w].thread, NULL, workerMain,
+                                (void *)(intptr_t)w) != 0) {
+      errOutput("unable to start thread %d of %d.", w, threads);
+    }
+  }
+
+  if (verbose >= VERBOSE_MORE) {
+    printf("filters run on %d threads\n", threads);
+  }
+}
+
+void parallelFinish(void) {
+  if (pool.threads == 1)
+    return;
+
+  pthread_mutex_lock(&pool.lock);
+  pool.stopping = true;
+  pthread_cond_broadcast(&pool.started);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (int w = 0; w < pool.threads; w++) {
+    if (w > 0)
+      pthread_join(pool.workers[w].thread, NULL);
+    pthread_mutex_destroy(&pool.workers[w].lock);
+    free(pool.workers[w].tasks);
+  }
+  free(pool.workers);
+  pool.workers = NULL;
+  pool.threads = 1;
+  pool.stopping = false;
+}
+
+int parallelThreads(void) { return pool.threads; }
+
+/* --- bands -------------------------------------------------------------- */
+
+struct Bands {
+  int rows;
+  int count;
+  BandFunction function;
+  void *arg;
+};
+
+static void runBand(int band, void *arg) {
+  const struct Bands *bands = arg;
+  const int first = (long long)bands->rows * band / bands->count;
+  const int last = (long long)bands->rows * (band + 1) / bands->count - 1;
+
+  if (first <= last)
+    bands->function(first, last, bands->arg);
+}
+
+/**
+ * Splits rows 0..rows-1 in bands of consecutive rows, and runs function over
+ * each of them. The bands must not depend on each other.
+ */
+void parallelBands(int rows, BandFunction function, void *arg) {
+  if (rows <= 0)
+    return;
+  if (pool.threads == 1 || inTask) {
+    function(0, rows - 1, arg);
+    return;
+  }
+
+  struct Bands bands = {
+      .rows = rows,
+      .count = min(rows, pool.threads * BANDS_PER_THREAD),
+      .function = function,
+      .arg = arg,
+  };
+  runJob(bands.count, runBand, &bands);
+}
+
+/* --- wavefronts --------------------------------------------------------- */
+
+/*
+ * Wavefronts run filters that change the image in place while scanning it,
+ * so that every step can see the changes of the previous ones. Each row of
+ * work units only runs as far as the row above it allows: before a unit
+ * touching the columns left..right, the row announces it is done with the
+ * columns before left, and waits until the row above is done with the
+ * columns up to right. Units touching the same pixels then run in the same
+ * order as a serial scan, and the result is the same, whatever the number of
+ * threads.
+ */
+
+struct WavefrontRow {
+  // the row is done with the columns before progress
+  alignas(64) atomic_int progress;
+  // last progress stored, and last progress of the row above loaded, only
+  // used by the thread running the row
+  int published;
+  int above;
+};
+
+struct Wavefront {
+  struct WavefrontRow *rows;
+  WavefrontFunction function;
+  void *arg;
+};
+
+static void runWavefrontRow(int row, void *arg) {
+  struct Wavefront *wavefront = arg;
+
+  wavefront->function(row, wavefront, wavefront->arg);
+  atomic_store_explicit(&wavefront->rows[row].progress, INT_MAX,
+                        memory_order_release);
+}
+
+/**
+ * Runs function over the rows 0..rows-1, each of them behind the rows above
+ * it as told by wavefrontWait().
+ */
+void parallelWavefront(int rows, WavefrontFunction function, void *arg) {
+  struct Wavefront wavefront = {
+      .rows = NULL,
+      .function = function,
+      .arg = arg,
+  };
+
+  if (rows <= 0)
+    return;
+  if (pool.threads == 1 || inTask) {
+    for (int row = 0; row < rows; row++) {
+      function(row, &wavefront, arg);
+    }
+    return;
+  }
+
+  wavefront.rows =
+      aligned_alloc(alignof(struct WavefrontRow),
+                    rows * sizeof(struct WavefrontRow));
+  for (int row = 0; row < rows; row++) {
+    atomic_init(&wavefront.rows[row].progress, INT_MIN);
+    wavefront.rows[row].published = INT_MIN;
+    wavefront.rows[row].above = (row == 0) ? INT_MAX : INT_MIN;
+  }
+
+  runJob(rows, runWavefrontRow, &wavefront);
+
+  free(wavefront.rows);
+}
+
+/**
+ * Called by a wavefront row before a unit touching the columns left..right:
+ * the units left in the row never touch a column before left, and the rows
+ * above must be done with every column up to right.
+ */
+void wavefrontWait(struct Wavefront *wavefront, int row, int left,
+                   int right) {
+  if (wavefront->rows == NULL)
+    return; // serial
+
+  struct WavefrontRow *self = &wavefront->rows[row];
+
+  if (right < self->above) {
+    if (left - WAVEFRONT_PUBLISH_STEP >= self->published) {
+      atomic_store_explicit(&self->progress, left, memory_order_release);
+      self->published = left;
+    }
+    return;
+  }
+
+  atomic_store_explicit(&self->progress, left, memory_order_release);
+  self->published = left;
+  while ((self->above = atomic_load_explicit(&wavefront->rows[row - 1].progress,
+                                             memory_order_acquire)) <= right) {
+    sched_yield();
+  }
+}
@@ -0,0 +1,30 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include "constants.h"
+
+/* --- intra-sheet parallelism -------------------------------------------- */
+
+// Runs over the rows first..last of a band.
+typedef void (*BandFunction)(int first, int last, void *arg);
+
+struct Wavefront;
+
+// Processes one row of a wavefront, a row of work units from left to right.
+typedef void (*WavefrontFunction)(int row, struct Wavefront *wavefront,
+                                  void *arg);
+
+void parallelInit(int threads, VERBOSE_LEVEL verbose);
+
+void parallelFinish(void);
+
+int parallelThreads(void);
+
+void parallelBands(int rows, BandFunction function, void *arg);
+
+void parallelWavefront(int rows, WavefrontFunction function, void *arg);
+
+void wavefrontWait(struct Wavefront *wavefront, int row, int left, int right);
@@ -0,0 +1,1185 @@
+// Copyright © 2005-2007 Jens Gulden
+// Copyright © 2011-2011 Diego Elio Pettenò
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- parameters and options --------------------------------------------- */
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/pixfmt.h>
+
+#include "asyncio.h"
+#include "dedupe.h"
+#include "instrument.h"
+#include "parse.h"
+#include "unpaper.h"
+
+/**
+ * Sets options to the defaults of all parameters.
+ */
+void optionsInit(struct Options *options) {
+  *options = (struct Options){
+      .verbose = VERBOSE_NONE,
+      .interpolateType = INTERP_CUBIC,
+      .layout = LAYOUT_SINGLE,
+      .startSheet = 1,
+      .endSheet = -1,
+      .startInput = -1,
+      .startOutput = -1,
+      .inputCount = 1,
+      .outputCount = 1,
+      .sheetSize = {-1, -1},
+      .sheetBackground = WHITE24,
+      .size = {-1, -1},
+      .postSize = {-1, -1},
+      .stretchSize = {-1, -1},
+      .postStretchSize = {-1, -1},
+      .zoomFactor = 1.0,
+      .postZoomFactor = 1.0,
+      .blackfilterScanDirections = (1 << HORIZONTAL) | (1 << VERTICAL),
+      .blackfilterScanSize = {20, 20},
+      .blackfilterScanDepth = {500, 500},
+      .blackfilterScanStep = {5, 5},
+      .blackfilterScanThreshold = 0.95,
+      .blackfilterIntensity = 20,
+      .noisefilterIntensity = 4,
+      .blurfilterScanSize = {100, 100},
+      .blurfilterScanStep = {50, 50},
+      .blurfilterIntensity = 0.01,
+      .grayfilterScanSize = {50, 50},
+      .grayfilterScanStep = {20, 20},
+      .grayfilterThreshold = 0.5,
+      .maskScanDirections = (1 << HORIZONTAL),
+      .maskScanSize = {50, 50},
+      .maskScanDepth = {-1, -1},
+      .maskScanStep = {5, 5},
+      .maskScanThreshold = {0.1, 0.1},
+      .maskScanMinimum = {100, 100},
+      .maskScanMaximum = {-1, -1}, // set default later
+      .maskColor = WHITE24,
+      .deskewScanEdges = (1 << LEFT) | (1 << RIGHT),
+      .deskewScanSize = 1500,
+      .deskewScanDepth = 0.5,
+      .deskewScanRange = 5.0,
+      .deskewScanStep = 0.1,
+      .deskewScanDeviation = 1.0,
+      .borderScanDirections = (1 << VERTICAL),
+      .borderScanSize = {5, 5},
+      .borderScanStep = {5, 5},
+      .borderScanThreshold = {5, 5},
+      .whiteThreshold = 0.9,
+      .blackThreshold = 0.33,
+      .writeoutput = true,
+      .multisheets = true,
+      .outputPixFmt = -1,
+      .sheetMultiIndex = {-1, NULL},
+      .dpi = 300,
+      .threadCount = 1,
+      .shardIndex = 1,
+      .shardCount = 1,
+      .shardMode = SHARD_CONTIGUOUS,
+      .spoolLease = 600,
+  };
+}
+
+/**
+ * Calculates the constant absolute values based on the relative parameters.
+ */
+void updateAbsoluteParameters(struct Options *options) {
+  options->absBlackThreshold = WHITE * (1.0 - options->blackThreshold);
+  options->absWhiteThreshold = WHITE * (options->whiteThreshold);
+  options->absBlackfilterScanThreshold =
+      WHITE * (options->blackfilterScanThreshold);
+  options->absGrayfilterThreshold = WHITE * (options->grayfilterThreshold);
+  options->deskewScanRangeRad = degreesToRadians(options->deskewScanRange);
+  options->deskewScanStepRad = degreesToRadians(options->deskewScanStep);
+  options->deskewScanDeviationRad =
+      degreesToRadians(options->deskewScanDeviation);
+}
+
+_Thread_local jmp_buf *errorJump = NULL;
+_Thread_local char errorMessage[256];
+
+/**
+ * Print an error and exit process
+ */
+void errOutput(const char *fmt, ...) {
+  va_list vl;
+
+  if (errorJump != NULL) {
+    va_start(vl, fmt);
+    vsnprintf(errorMessage, sizeof(errorMessage), fmt, vl);
+    va_end(vl);
+    longjmp(*errorJump, 1);
+  }
+
+  fprintf(stderr, "unpaper: error: ");
+
+  va_start(vl, fmt);
+  vfprintf(stderr, fmt, vl);
+  va_end(vl);
+
+  fprintf(stderr, "\nTry 'man unpaper' for more information.\n");
+
+  if (instrumenting)
+    instrumentError();
+
+  asyncAbort();
+  exit(1);
+}
+
+static const struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"?", no_argument, NULL, 'h'},
+    {"version", no_argument, NULL, 'V'},
+    {"layout", required_argument, NULL, 'l'},
+    {"#", required_argument, NULL, '#'},
+    {"sheet", required_argument, NULL, '#'},
+    {"start", required_argument, NULL, 0x7e},
+    {"start-sheet", required_argument, NULL, 0x7e},
+    {"end", required_argument, NULL, 0x7f},
+    {"end-sheet", required_argument, NULL, 0x7f},
+    {"start-input", required_argument, NULL, 0x80},
+    {"si", required_argument, NULL, 0x80},
+    {"start-output", required_argument, NULL, 0x81},
+    {"so", required_argument, NULL, 0x81},
+    {"sheet-size", required_argument, NULL, 'S'},
+    {"sheet-background", required_argument, NULL, 0x82},
+    {"exclude", optional_argument, NULL, 'x'},
+    {"no-processing", required_argument, NULL, 'n'},
+    {"pre-rotate", required_argument, NULL, 0x83},
+    {"post-rotate", required_argument, NULL, 0x84},
+    {"pre-mirror", required_argument, NULL, 'M'},
+    {"post-mirror", required_argument, NULL, 0x85},
+    {"pre-shift", required_argument, NULL, 0x86},
+    {"post-shift", required_argument, NULL, 0x87},
+    {"pre-mask", required_argument, NULL, 0x88},
+    {"size", required_argument, NULL, 's'},
+    {"post-size", required_argument, NULL, 0x89},
+    {"stretch", required_argument, NULL, 0x8a},
+    {"post-stretch", required_argument, NULL, 0x8b},
+    {"zoom", required_argument, NULL, 'z'},
+    {"post-zoom", required_argument, NULL, 0x8c},
+    {"mask-scan-point", required_argument, NULL, 'p'},
+    {"mask", required_argument, NULL, 'm'},
+    {"wipe", required_argument, NULL, 'W'},
+    {"pre-wipe", required_argument, NULL, 0x8d},
+    {"post-wipe", required_argument, NULL, 0x8e},
+    {"middle-wipe", required_argument, NULL, 0x8f},
+    {"mw", required_argument, NULL, 0x8f},
+    {"border", required_argument, NULL, 'B'},
+    {"pre-border", required_argument, NULL, 0x90},
+    {"post-border", required_argument, NULL, 0x91},
+    {"no-blackfilter", optional_argument, NULL, 0x92},
+    {"blackfilter-scan-direction", required_argument, NULL, 0x93},
+    {"bn", required_argument, NULL, 0x93},
+    {"blackfilter-scan-size", required_argument, NULL, 0x94},
+    {"bs", required_argument, NULL, 0x94},
+    {"blackfilter-scan-depth", required_argument, NULL, 0x95},
+    {"bd", required_argument, NULL, 0x95},
+    {"blackfilter-scan-step", required_argument, NULL, 0x96},
+    {"bp", required_argument, NULL, 0x96},
+    {"blackfilter-scan-threshold", required_argument, NULL, 0x97},
+    {"bt", required_argument, NULL, 0x97},
+    {"blackfilter-scan-exclude", required_argument, NULL, 0x98},
+    {"bx", required_argument, NULL, 0x98},
+    {"blackfilter-intensity", required_argument, NULL, 0x99},
+    {"bi", required_argument, NULL, 0x99},
+    {"no-noisefilter", optional_argument, NULL, 0x9a},
+    {"noisefilter-intensity", required_argument, NULL, 0x9b},
+    {"ni", required_argument, NULL, 0x9b},
+    {"no-blurfilter", optional_argument, NULL, 0x9c},
+    {"blurfilter-size", required_argument, NULL, 0x9d},
+    {"ls", required_argument, NULL, 0x9d},
+    {"blurfilter-step", required_argument, NULL, 0x9e},
+    {"lp", required_argument, NULL, 0x9e},
+    {"blurfilter-intensity", required_argument, NULL, 0x9f},
+    {"li", required_argument, NULL, 0x9f},
+    {"no-grayfilter", optional_argument, NULL, 0xa0},
+    {"grayfilter-size", required_argument, NULL, 0xa1},
+    {"gs", required_argument, NULL, 0xa1},
+    {"grayfilter-step", required_argument, NULL, 0xa2},
+    {"gp", required_argument, NULL, 0xa2},
+    {"grayfilter-threshold", required_argument, NULL, 0xa3},
+    {"gt", required_argument, NULL, 0xa3},
+    {"no-mask-scan", optional_argument, NULL, 0xa4},
+    {"mask-scan-direction", required_argument, NULL, 0xa5},
+    {"mn", required_argument, NULL, 0xa5},
+    {"mask-scan-size", required_argument, NULL, 0xa6},
+    {"ms", required_argument, NULL, 0xa6},
+    {"mask-scan-depth", required_argument, NULL, 0xa7},
+    {"md", required_argument, NULL, 0xa7},
+    {"mask-scan-step", required_argument, NULL, 0xa8},
+    {"mp", required_argument, NULL, 0xa8},
+    {"mask-scan-threshold", required_argument, NULL, 0xa9},
+    {"mt", required_argument, NULL, 0xa9},
+    {"mask-scan-minimum", required_argument, NULL, 0xaa},
+    {"mm", required_argument, NULL, 0xaa},
+    {"mask-scan-maximum", required_argument, NULL, 0xab},
+    {"mM", required_argument, NULL, 0xab},
+    {"mask-color", required_argument, NULL, 0xac},
+    {"mc", required_argument, NULL, 0xac},
+    {"no-mask-center", optional_argument, NULL, 0xad},
+    {"no-deskew", optional_argument, NULL, 0xae},
+    {"deskew-scan-direction", required_argument, NULL, 0xaf},
+    {"dn", required_argument, NULL, 0xaf},
+    {"deskew-scan-size", required_argument, NULL, 0xb0},
+    {"ds", required_argument, NULL, 0xb0},
+    {"deskew-scan-depth", required_argument, NULL, 0xb1},
+    {"dd", required_argument, NULL, 0xb1},
+    {"deskew-scan-range", required_argument, NULL, 0xb2},
+    {"dr", required_argument, NULL, 0xb2},
+    {"deskew-scan-step", required_argument, NULL, 0xb3},
+    {"dp", required_argument, NULL, 0xb3},
+    {"deskew-scan-deviation", required_argument, NULL, 0xb4},
+    {"dv", required_argument, NULL, 0xb4},
+    {"no-border-scan", optional_argument, NULL, 0xb5},
+    {"border-scan-direction", required_argument, NULL, 0xb6},
+    {"Bn", required_argument, NULL, 0xb6},
+    {"border-scan-size", required_argument, NULL, 0xb7},
+    {"Bs", required_argument, NULL, 0xb7},
+    {"border-scan-step", required_argument, NULL, 0xb8},
+    {"Bp", required_argument, NULL, 0xb8},
+    {"border-scan-threshold", required_argument, NULL, 0xb9},
+    {"Bt", required_argument, NULL, 0xb9},
+    {"border-align", required_argument, NULL, 0xba},
+    {"Ba", required_argument, NULL, 0xba},
+    {"border-margin", required_argument, NULL, 0xbb},
+    {"Bm", required_argument, NULL, 0xbb},
+    {"no-border-align", optional_argument, NULL, 0xbc},
+    {"no-wipe", optional_argument, NULL, 0xbd},
+    {"no-border", optional_argument, NULL, 0xbe},
+    {"white-threshold", required_argument, NULL, 'w'},
+    {"black-threshold", required_argument, NULL, 'b'},
+    {"input-pages", required_argument, NULL, 0xbf},
+    {"ip", required_argument, NULL, 0xbf},
+    {"output-pages", required_argument, NULL, 0xc0},
+    {"op", required_argument, NULL, 0xc0},
+    {"input-file-sequence", required_argument, NULL, 0xc1},
+    {"if", required_argument, NULL, 0xc1},
+    {"output-file-sequence", required_argument, NULL, 0xc2},
+    {"of", required_argument, NULL, 0xc2},
+    {"insert-blank", required_argument, NULL, 0xc3},
+    {"replace-blank", required_argument, NULL, 0xc4},
+    {"test-only", no_argument, NULL, 'T'},
+    {"no-multi-pages", no_argument, NULL, 0xc6},
+    {"dpi", required_argument, NULL, 0xc7},
+    {"type", required_argument, NULL, 't'},
+    {"quiet", no_argument, NULL, 'q'},
+    {"overwrite", no_argument, NULL, 0xc8},
+    {"verbose", no_argument, NULL, 'v'},
+    {"vv", no_argument, NULL, 0xca},
+    {"debug", no_argument, NULL, 0xcb},
+    {"vvv", no_argument, NULL, 0xcb},
+    {"debug-save", no_argument, NULL, 0xcc},
+    {"vvvv", no_argument, NULL, 0xcc},
+    {"interpolate", required_argument, NULL, 0xcd},
+    {"detection-cache", required_argument, NULL, 0xce},
+    {"no-cache", no_argument, NULL, 0xcf},
+    {"journal", required_argument, NULL, 0xd0},
+    {"resume", no_argument, NULL, 0xd1},
+    {"dedupe", optional_argument, NULL, 0xd2},
+    {"blank-threshold", required_argument, NULL, 0xd3},
+    {"sweep", required_argument, NULL, 0xd4},
+    {"timings", required_argument, NULL, 0xd5},
+    {"trace", required_argument, NULL, 0xd6},
+    {"perf-counters", no_argument, NULL, 0xd7},
+    {"memory-stats", no_argument, NULL, 0xd8},
+    {"summary", no_argument, NULL, 0xd9},
+    {"metrics", required_argument, NULL, 0xda},
+    {"threads", required_argument, NULL, 0xdb},
+    {"shard", required_argument, NULL, 0xdc},
+    {"shard-mode", required_argument, NULL, 0xdd},
+    {"spool", required_argument, NULL, 0xde},
+    {"spool-lease", required_argument, NULL, 0xdf},
+    {"watch", required_argument, NULL, 0xe0},
+    {"daemon", required_argument, NULL, 0xe1},
+    {"daemon-jobs", required_argument, NULL, 0xe2},
+    {"manifest", required_argument, NULL, 0xe3},
+    {"input-tar", required_argument, NULL, 0xe4},
+    {"output-tar", required_argument, NULL, 0xe5},
+    {"async-io", required_argument, NULL, 0xe6},
+    {NULL, no_argument, NULL, 0}};
+
+/**
+ * Returns the next option from argv, as getopt_long_only() does, using the
+ * options known to unpaper.
+ */
+int nextOption(int argc, char *argv[]) {
+  int option_index = 0;
+
+  return getopt_long_only(argc, argv, "hVl:S:x::n::M:s:z:p:m:W:B:w:b:Tt:qv",
+                          long_options, &option_index);
+}
+
+/**
+ * Returns the long name of an option returned by nextOption(), or NULL for
+ * an invalid one. Options with several names are known by the first one.
+ */
+const char *optionName(int option) {
+  for (const struct option *o = long_options; o->name != NULL; o++) {
+    if (o->val == option)
+      return o->name;
+  }
+  return NULL;
+}
+
+static OPTIONS_STATUS invalidOption(char *error, size_t errorSize,
+                                    const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static OPTIONS_STATUS invalidOption(char *error, size_t errorSize,
+                                    const char *fmt, ...) {
+  va_list vl;
+
+  va_start(vl, fmt);
+  vsnprintf(error, errorSize, fmt, vl);
+  va_end(vl);
+
+  return OPTIONS_INVALID;
+}
+
+static OPTIONS_STATUS invalidDirections(char *error, size_t errorSize,
+                                        const char *s) {
+  return invalidOption(
+      error, errorSize,
+      "unknown direction name '%s', expected 'h[orizontal]' or 'v[ertical]'.",
+      s);
+}
+
+static OPTIONS_STATUS invalidEdges(char *error, size_t errorSize,
+                                   const char *s) {
+  return invalidOption(
+      error, errorSize,
+      "unknown edge name '%s', expected 'left', 'top', 'right' or 'bottom'.",
+      s);
+}
+
+static OPTIONS_STATUS invalidSize(char *error, size_t errorSize,
+                                  const char *s) {
+  return invalidOption(error, errorSize, "invalid size %s", s);
+}
+
+static OPTIONS_STATUS invalidMultiIndex(char *error, size_t errorSize,
+                                        const char *s) {
+  return invalidOption(error, errorSize, "Invalid multi-index string \"%s\".",
+                       s);
+}
+
+/**
+ * Parses the options in argv into options, until the first argument that is
+ * not an option. On OPTIONS_INVALID, error receives the message.
+ */
+OPTIONS_STATUS parseOptions(struct Options *options, int argc, char *argv[],
+                            char *error, size_t errorSize) {
+  int left;
+  int top;
+  int right;
+  int bottom;
+
+  while (true) {
+    int c = nextOption(argc, argv);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 'h':
+      return OPTIONS_HELP;
+
+    case '?':
+      return OPTIONS_UNKNOWN;
+
+    case 'V':
+      return OPTIONS_VERSION;
+
+    case 'l':
+      if (strcmp(optarg, "single") == 0) {
+        options->layout = LAYOUT_SINGLE;
+      } else if (strcmp(optarg, "double") == 0) {
+        options->layout = LAYOUT_DOUBLE;
+      } else if (strcmp(optarg, "none") == 0) {
+        options->layout = LAYOUT_NONE;
+      } else {
+        return invalidOption(error, errorSize, "unknown layout mode '%s'.",
+                             optarg);
+      }
+      break;
+
+    case '#':
+      if (!parseMultiIndex(optarg, &options->sheetMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      // allow 0 as start sheet, might be overwritten by --start-sheet again
+      if (options->sheetMultiIndex.count > 0 &&
+          options->startSheet > options->sheetMultiIndex.indexes[0])
+        options->startSheet = options->sheetMultiIndex.indexes[0];
+      break;
+
+    case 0x7e:
+      sscanf(optarg, "%d", &options->startSheet);
+      break;
+
+    case 0x7f:
+      sscanf(optarg, "%d", &options->endSheet);
+      break;
+
+    case 0x80:
+      sscanf(optarg, "%d", &options->startInput);
+      break;
+
+    case 0x81:
+      sscanf(optarg, "%d", &options->startOutput);
+      break;
+
+    case 'S':
+      if (!parseSize(optarg, options->sheetSize, options->dpi))
+        return invalidSize(error, errorSize, optarg);
+      break;
+
+    case 0x82:
+      if (!parseColor(optarg, &options->sheetBackground))
+        return invalidOption(error, errorSize, "cannot parse color '%s'.",
+                             optarg);
+      break;
+
+    case 'x':
+      if (!parseMultiIndex(optarg, &options->excludeMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      if (options->excludeMultiIndex.count == -1)
+        options->excludeMultiIndex.count = 0; // 'exclude all' makes no sense
+      break;
+
+    case 'n':
+      if (!parseMultiIndex(optarg, &options->ignoreMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 0x83:
+      sscanf(optarg, "%d", &options->preRotate);
+      if ((options->preRotate != 0) && (abs(options->preRotate) != 90)) {
+        fprintf(
+            stderr,
+            "cannot set --pre-rotate value other than -90 or 90, ignoring.\n");
+        options->preRotate = 0;
+      }
+      break;
+
+    case 0x84:
+      sscanf(optarg, "%d", &options->postRotate);
+      if ((options->postRotate != 0) && (abs(options->postRotate) != 90)) {
+        fprintf(
+            stderr,
+            "cannot set --post-rotate value other than -90 or 90, ignoring.\n");
+        options->postRotate = 0;
+      }
+      break;
+
+    case 'M':
+      // s = "v", "v,h", "vertical,horizontal", ...
+      if (!parseDirections(optarg, &options->preMirror))
+        return invalidDirections(error, errorSize, optarg);
+      break;
+
+    case 0x85:
+      if (!parseDirections(optarg, &options->postMirror))
+        return invalidDirections(error, errorSize, optarg);
+      break;
+
+    case 0x86:
+      if (!parseSize(optarg, options->preShift, options->dpi))
+        return invalidSize(error, errorSize, optarg);
+      break;
+
+    case 0x87:
+      if (!parseSize(optarg, options->postShift, options->dpi))
+        return invalidSize(error, errorSize, optarg);
+      break;
+
+    case 0x88:
+      if (options->preMaskCount < MAX_MASKS) {
+        left = -1;
+        top = -1;
+        right = -1;
+        bottom = -1;
+        sscanf(optarg, "%d,%d,%d,%d", &left, &top, &right,
+               &bottom); // x1, y1, x2, y2
+        options->preMask[options->preMaskCount][LEFT] = left;
+        options->preMask[options->preMaskCount][TOP] = top;
+        options->preMask[options->preMaskCount][RIGHT] = right;
+        options->preMask[options->preMaskCount][BOTTOM] = bottom;
+        options->preMaskCount++;
+      } else {
+        fprintf(stderr,
+                "maximum number of masks (%d) exceeded, ignoring mask %s\n",
+                MAX_MASKS, optarg);
+      }
+      break;
+
+    case 's':
+      if (!parseSize(optarg, options->size, options->dpi))
+        return invalidSize(error, errorSize, optarg);
+      break;
+
+    case 0x89:
+      if (!parseSize(optarg, options->postSize, options->dpi))
+        return invalidSize(error, errorSize, optarg);
+      break;
+
+    case 0x8a:
+      if (!parseSize(optarg, options->stretchSize, options->dpi))
+        return invalidSize(error, errorSize, optarg);
+      break;
+
+    case 0x8b:
+      if (!parseSize(optarg, options->postStretchSize, options->dpi))
+        return invalidSize(error, errorSize, optarg);
+      break;
+
+    case 'z':
+      sscanf(optarg, "%f", &options->zoomFactor);
+      break;
+
+    case 0x8c:
+      sscanf(optarg, "%f", &options->postZoomFactor);
+      break;
+
+    case 'p':
+      if (options->pointCount < MAX_POINTS) {
+        int x = -1;
+        int y = -1;
+        sscanf(optarg, "%d,%d", &x, &y);
+        options->point[options->pointCount][X] = x;
+        options->point[options->pointCount][Y] = y;
+        options->pointCount++;
+      } else {
+        fprintf(stderr,
+                "maximum number of scan points (%d) exceeded, ignoring scan "
+                "point %s\n",
+                MAX_POINTS, optarg);
+      }
+      break;
+
+    case 'm':
+      if (options->maskCount < MAX_MASKS) {
+        left = -1;
+        top = -1;
+        right = -1;
+        bottom = -1;
+        sscanf(optarg, "%d,%d,%d,%d", &left, &top, &right,
+               &bottom); // x1, y1, x2, y2
+        options->mask[options->maskCount][LEFT] = left;
+        options->mask[options->maskCount][TOP] = top;
+        options->mask[options->maskCount][RIGHT] = right;
+        options->mask[options->maskCount][BOTTOM] = bottom;
+        options->maskValid[options->maskCount] = true;
+        options->maskCount++;
+      } else {
+        fprintf(stderr,
+                "maximum number of masks (%d) exceeded, ignoring mask %s\n",
+                MAX_MASKS, optarg);
+      }
+      break;
+
+    case 'W':
+      if (options->wipeCount < MAX_MASKS) {
+        left = -1;
+        top = -1;
+        right = -1;
+        bottom = -1;
+        sscanf(optarg, "%d,%d,%d,%d", &left, &top, &right,
+               &bottom); // x1, y1, x2, y2
+        options->wipe[options->wipeCount][LEFT] = left;
+        options->wipe[options->wipeCount][TOP] = top;
+        options->wipe[options->wipeCount][RIGHT] = right;
+        options->wipe[options->wipeCount][BOTTOM] = bottom;
+        options->wipeCount++;
+      } else {
+        fprintf(stderr,
+                "maximum number of wipes (%d) exceeded, ignoring mask %s\n",
+                MAX_MASKS, optarg);
+      }
+      break;
+
+    case 0x8d:
+      if (options->preWipeCount < MAX_MASKS) {
+        left = -1;
+        top = -1;
+        right = -1;
+        bottom = -1;
+        sscanf(optarg, "%d,%d,%d,%d", &left, &top, &right,
+               &bottom); // x1, y1, x2, y2
+        options->preWipe[options->preWipeCount][LEFT] = left;
+        options->preWipe[options->preWipeCount][TOP] = top;
+        options->preWipe[options->preWipeCount][RIGHT] = right;
+        options->preWipe[options->preWipeCount][BOTTOM] = bottom;
+        options->preWipeCount++;
+      } else {
+        fprintf(stderr,
+                "maximum number of pre-wipes (%d) exceeded, ignoring mask %s\n",
+                MAX_MASKS, optarg);
+      }
+      break;
+
+    case 0x8e:
+      if (options->postWipeCount < MAX_MASKS) {
+        left = -1;
+        top = -1;
+        right = -1;
+        bottom = -1;
+        sscanf(optarg, "%d,%d,%d,%d", &left, &top, &right,
+               &bottom); // x1, y1, x2, y2
+        options->postWipe[options->postWipeCount][LEFT] = left;
+        options->postWipe[options->postWipeCount][TOP] = top;
+        options->postWipe[options->postWipeCount][RIGHT] = right;
+        options->postWipe[options->postWipeCount][BOTTOM] = bottom;
+        options->postWipeCount++;
+      } else {
+        fprintf(
+            stderr,
+            "maximum number of post-wipes (%d) exceeded, ignoring mask %s\n",
+            MAX_MASKS, optarg);
+      }
+      break;
+
+    case 0x8f:
+      parseInts(optarg, options->middleWipe);
+      break;
+
+    case 'B':
+      sscanf(optarg, "%d,%d,%d,%d", &options->border[LEFT],
+             &options->border[TOP], &options->border[RIGHT],
+             &options->border[BOTTOM]);
+      break;
+
+    case 0x90:
+      sscanf(optarg, "%d,%d,%d,%d", &options->preBorder[LEFT],
+             &options->preBorder[TOP], &options->preBorder[RIGHT],
+             &options->preBorder[BOTTOM]);
+      break;
+
+    case 0x91:
+      sscanf(optarg, "%d,%d,%d,%d", &options->postBorder[LEFT],
+             &options->postBorder[TOP], &options->postBorder[RIGHT],
+             &options->postBorder[BOTTOM]);
+      break;
+
+    case 0x92:
+      if (!parseMultiIndex(optarg, &options->noBlackfilterMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 0x93:
+      if (!parseDirections(optarg, &options->blackfilterScanDirections))
+        return invalidDirections(error, errorSize, optarg);
+      break;
+
+    case 0x94:
+      parseInts(optarg, options->blackfilterScanSize);
+      break;
+
+    case 0x95:
+      parseInts(optarg, options->blackfilterScanDepth);
+      break;
+
+    case 0x96:
+      parseInts(optarg, options->blackfilterScanStep);
+      break;
+
+    case 0x97:
+      sscanf(optarg, "%f", &options->blackfilterScanThreshold);
+      break;
+
+    case 0x98:
+      if (options->blackfilterExcludeCount < MAX_MASKS) {
+        left = -1;
+        top = -1;
+        right = -1;
+        bottom = -1;
+        sscanf(optarg, "%d,%d,%d,%d", &left, &top, &right,
+               &bottom); // x1, y1, x2, y2
+        int *exclude =
+            options->blackfilterExclude[options->blackfilterExcludeCount];
+        exclude[LEFT] = left;
+        exclude[TOP] = top;
+        exclude[RIGHT] = right;
+        exclude[BOTTOM] = bottom;
+        options->blackfilterExcludeCount++;
+      } else {
+        fprintf(stderr,
+                "maximum number of blackfilter exclusion (%d) exceeded, "
+                "ignoring mask %s\n",
+                MAX_MASKS, optarg);
+      }
+      break;
+
+    case 0x99:
+      sscanf(optarg, "%d", &options->blackfilterIntensity);
+      break;
+
+    case 0x9a:
+      if (!parseMultiIndex(optarg, &options->noNoisefilterMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 0x9b:
+      sscanf(optarg, "%d", &options->noisefilterIntensity);
+      break;
+
+    case 0x9c:
+      if (!parseMultiIndex(optarg, &options->noBlurfilterMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 0x9d:
+      parseInts(optarg, options->blurfilterScanSize);
+      break;
+
+    case 0x9e:
+      parseInts(optarg, options->blurfilterScanStep);
+      break;
+
+    case 0x9f:
+      sscanf(optarg, "%f", &options->blurfilterIntensity);
+      break;
+
+    case 0xa0:
+      if (!parseMultiIndex(optarg, &options->noGrayfilterMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 0xa1:
+      parseInts(optarg, options->grayfilterScanSize);
+      break;
+
+    case 0xa2:
+      parseInts(optarg, options->grayfilterScanStep);
+      break;
+
+    case 0xa3:
+      sscanf(optarg, "%f", &options->grayfilterThreshold);
+      break;
+
+    case 0xa4:
+      if (!parseMultiIndex(optarg, &options->noMaskScanMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 0xa5:
+      if (!parseDirections(optarg, &options->maskScanDirections))
+        return invalidDirections(error, errorSize, optarg);
+      break;
+
+    case 0xa6:
+      parseInts(optarg, options->maskScanSize);
+      break;
+
+    case 0xa7:
+      parseInts(optarg, options->maskScanDepth);
+      break;
+
+    case 0xa8:
+      parseInts(optarg, options->maskScanStep);
+      break;
+
+    case 0xa9:
+      parseFloats(optarg, options->maskScanThreshold);
+      break;
+
+    case 0xaa:
+      sscanf(optarg, "%d,%d", &options->maskScanMinimum[WIDTH],
+             &options->maskScanMinimum[HEIGHT]);
+      break;
+
+    case 0xab:
+      sscanf(optarg, "%d,%d", &options->maskScanMaximum[WIDTH],
+             &options->maskScanMaximum[HEIGHT]);
+      break;
+
+    case 0xac:
+      sscanf(optarg, "%d", &options->maskColor);
+      break;
+
+    case 0xad:
+      if (!parseMultiIndex(optarg, &options->noMaskCenterMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 0xae:
+      if (!parseMultiIndex(optarg, &options->noDeskewMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 0xaf:
+      if (!parseEdges(optarg, &options->deskewScanEdges))
+        return invalidEdges(error, errorSize, optarg);
+      break;
+
+    case 0xb0:
+      sscanf(optarg, "%d", &options->deskewScanSize);
+      options->deskewScanSizeGiven = true;
+      break;
+
+    case 0xb1:
+      sscanf(optarg, "%f", &options->deskewScanDepth);
+      break;
+
+    case 0xb2:
+      sscanf(optarg, "%f", &options->deskewScanRange);
+      break;
+
+    case 0xb3:
+      sscanf(optarg, "%f", &options->deskewScanStep);
+      break;
+
+    case 0xb4:
+      sscanf(optarg, "%f", &options->deskewScanDeviation);
+      break;
+
+    case 0xb5:
+      if (!parseMultiIndex(optarg, &options->noBorderScanMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 0xb6:
+      if (!parseDirections(optarg, &options->borderScanDirections))
+        return invalidDirections(error, errorSize, optarg);
+      break;
+
+    case 0xb7:
+      parseInts(optarg, options->borderScanSize);
+      break;
+
+    case 0xb8:
+      parseInts(optarg, options->borderScanStep);
+      break;
+
+    case 0xb9:
+      parseInts(optarg, options->borderScanThreshold);
+      break;
+
+    case 0xba:
+      if (!parseEdges(optarg, &options->borderAlign))
+        return invalidEdges(error, errorSize, optarg);
+      break;
+
+    case 0xbb:
+      if (!parseSize(optarg, options->borderAlignMargin, options->dpi))
+        return invalidSize(error, errorSize, optarg);
+      break;
+
+    case 0xbc:
+      if (!parseMultiIndex(optarg, &options->noBorderAlignMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 0xbd:
+      if (!parseMultiIndex(optarg, &options->noWipeMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 0xbe:
+      if (!parseMultiIndex(optarg, &options->noBorderMultiIndex))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 'w':
+      sscanf(optarg, "%f", &options->whiteThreshold);
+      break;
+
+    case 'b':
+      sscanf(optarg, "%f", &options->blackThreshold);
+      break;
+
+    case 0xbf:
+      sscanf(optarg, "%d", &options->inputCount);
+      if (!(options->inputCount >= 1 && options->inputCount <= 2)) {
+        fprintf(
+            stderr,
+            "cannot set --input-pages value other than 1 or 2, ignoring.\n");
+        options->inputCount = 1;
+      }
+
+      break;
+
+    case 0xc0:
+      sscanf(optarg, "%d", &options->outputCount);
+      if (!(options->outputCount >= 1 && options->outputCount <= 2)) {
+        fprintf(
+            stderr,
+            "cannot set --output-pages value other than 1 or 2, ignoring.\n");
+        options->outputCount = 1;
+      }
+
+      break;
+
+    case 0xc1:
+    case 0xc2:
+      return invalidOption(
+          error, errorSize,
+          "--input-file-sequence and --output-file sequence are deprecated and "
+          "unimplemented.\n"
+          "Please pass input output pairs as arguments to unpaper instead.");
+
+    case 0xc3:
+      if (!parseMultiIndex(optarg, &options->insertBlank))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 0xc4:
+      if (!parseMultiIndex(optarg, &options->replaceBlank))
+        return invalidMultiIndex(error, errorSize, optarg);
+      break;
+
+    case 'T':
+      options->writeoutput = false;
+      break;
+
+    case 0xc5:
+      // Deprecated function, ignore.
+      break;
+
+    case 0xc6:
+      options->multisheets = false;
+      break;
+
+    case 0xc7:
+      sscanf(optarg, "%d", &options->dpi);
+      break;
+
+    case 't':
+      if (strcmp(optarg, "pbm") == 0) {
+        options->outputPixFmt = AV_PIX_FMT_MONOWHITE;
+      } else if (strcmp(optarg, "pgm") == 0) {
+        options->outputPixFmt = AV_PIX_FMT_GRAY8;
+      } else if (strcmp(optarg, "ppm") == 0) {
+        options->outputPixFmt = AV_PIX_FMT_RGB24;
+      }
+      break;
+
+    case 'q':
+      options->verbose = VERBOSE_QUIET;
+      break;
+
+    case 0xc8:
+      options->overwrite = true;
+      break;
+
+    case 'v':
+      options->verbose = VERBOSE_NORMAL;
+      break;
+
+    case 0xca:
+      options->verbose = VERBOSE_MORE;
+      break;
+
+    case 0xcb:
+      options->verbose = VERBOSE_DEBUG;
+      break;
+
+    case 0xcc:
+      options->verbose = VERBOSE_DEBUG_SAVE;
+      break;
+
+    case 0xcd:
+      if (strcmp(optarg, "nearest") == 0) {
+        options->interpolateType = INTERP_NN;
+      } else if (strcmp(optarg, "linear") == 0) {
+        options->interpolateType = INTERP_LINEAR;
+      } else if (strcmp(optarg, "cubic") == 0) {
+        options->interpolateType = INTERP_CUBIC;
+      } else {
+        fprintf(stderr,
+                "Could not parse --interpolate, using cubic as default.\n");
+        options->interpolateType = INTERP_CUBIC;
+      }
+      break;
+
+    case 0xce:
+      options->detectionCacheDirectory = optarg;
+      break;
+
+    case 0xcf:
+      options->noCache = true;
+      break;
+
+    case 0xd0:
+      options->journalFilename = optarg;
+      break;
+
+    case 0xd1:
+      options->resume = true;
+      break;
+
+    case 0xd2:
+      options->dedupeSize =
+          (optarg != NULL) ? atoi(optarg) : DEDUPE_DEFAULT_SIZE;
+      if (options->dedupeSize <= 0) {
+        return invalidOption(error, errorSize,
+                             "invalid dedupe cache size '%s'.", optarg);
+      }
+      break;
+
+    case 0xd3:
+      sscanf(optarg, "%f", &options->blankThreshold);
+      break;
+
+    case 0xd4:
+      options->sweepFilename = optarg;
+      break;
+
+    case 0xd5:
+      options->timingsFilename = optarg;
+      break;
+
+    case 0xd6:
+      options->traceFilename = optarg;
+      break;
+
+    case 0xd7:
+      options->perfCounters = true;
+      break;
+
+    case 0xd8:
+      options->memoryStats = true;
+      break;
+
+    case 0xd9:
+      options->summary = true;
+      break;
+
+    case 0xda:
+      options->metricsFilename = optarg;
+      break;
+
+    case 0xdb:
+      if (sscanf(optarg, "%d", &options->threadCount) != 1 ||
+          options->threadCount < 0) {
+        return invalidOption(error, errorSize, "invalid thread count '%s'.",
+                             optarg);
+      }
+      break;
+
+    case 0xdc:
+      if (sscanf(optarg, "%d/%d", &options->shardIndex,
+                 &options->shardCount) != 2 ||
+          options->shardCount < 1 || options->shardIndex < 1 ||
+          options->shardIndex > options->shardCount) {
+        return invalidOption(error, errorSize, "invalid shard '%s'.", optarg);
+      }
+      break;
+
+    case 0xdd:
+      if (strcmp(optarg, "contiguous") == 0) {
+        options->shardMode = SHARD_CONTIGUOUS;
+      } else if (strcmp(optarg, "round-robin") == 0) {
+        options->shardMode = SHARD_ROUND_ROBIN;
+      } else {
+        return invalidOption(error, errorSize, "unknown shard mode '%s'.",
+                             optarg);
+      }
+      break;
+
+    case 0xde:
+      options->spoolDirectory = optarg;
+      break;
+
+    case 0xdf:
+      if (sscanf(optarg, "%d", &options->spoolLease) != 1 ||
+          options->spoolLease < 1) {
+        return invalidOption(error, errorSize, "invalid spool lease '%s'.",
+                             optarg);
+      }
+      break;
+
+    case 0xe0:
+      options->watchDirectory = optarg;
+      break;
+
+    case 0xe1:
+      options->daemonSocket = optarg;
+      break;
+
+    case 0xe2:
+      if (sscanf(optarg, "%d", &options->daemonJobs) != 1 ||
+          options->daemonJobs < 0) {
+        return invalidOption(error, errorSize,
+                             "invalid number of daemon jobs '%s'.", optarg);
+      }
+      break;
+
+    case 0xe3:
+      options->manifestFilename = optarg;
+      break;
+
+    case 0xe4:
+      options->inputTarFilename = optarg;
+      break;
+
+    case 0xe5:
+      options->outputTarFilename = optarg;
+      break;
+
+    case 0xe6:
+      if (sscanf(optarg, "%d", &options->asyncSheets) != 1 ||
+          options->asyncSheets < 0) {
+        return invalidOption(error, errorSize,
+                             "invalid number of sheets to read ahead '%s'.",
+                             optarg);
+      }
+      break;
+    }
+  }
+  return OPTIONS_OK;
+}
+
+#define MULTI_INDEX(field) offsetof(struct Options, field)
+
+// the multi-indexes of the options, which own the memory of their indexes
+static const size_t multiIndexes[] = {
+    MULTI_INDEX(noBlackfilterMultiIndex), MULTI_INDEX(noNoisefilterMultiIndex),
+    MULTI_INDEX(noBlurfilterMultiIndex),  MULTI_INDEX(noGrayfilterMultiIndex),
+    MULTI_INDEX(noMaskScanMultiIndex),    MULTI_INDEX(noMaskCenterMultiIndex),
+    MULTI_INDEX(noDeskewMultiIndex),      MULTI_INDEX(noWipeMultiIndex),
+    MULTI_INDEX(noBorderMultiIndex),      MULTI_INDEX(noBorderScanMultiIndex),
+    MULTI_INDEX(noBorderAlignMultiIndex), MULTI_INDEX(sheetMultiIndex),
+    MULTI_INDEX(excludeMultiIndex),       MULTI_INDEX(ignoreMultiIndex),
+    MULTI_INDEX(insertBlank),             MULTI_INDEX(replaceBlank),
+};
+
+#define MULTI_INDEXES_COUNT (sizeof(multiIndexes) / sizeof(multiIndexes[0]))
+
+static int *multiIndexEntries(const struct Options *options, size_t i) {
+  const struct MultiIndex *multiIndex =
+      (const struct MultiIndex *)((const uint8_t *)options + multiIndexes[i]);
+  return multiIndex->indexes;
+}
+
+/**
+ * Puts options back as saved, before the options of a sweep variant or of a
+ * manifest sheet were parsed on top of them, freeing the multi-indexes
+ * parsed since.
+ */
+void restoreOptions(struct Options *options, const struct Options *saved) {
+  for (size_t i = 0; i < MULTI_INDEXES_COUNT; i++) {
+    if (multiIndexEntries(options, i) != multiIndexEntries(saved, i))
+      free(multiIndexEntries(options, i));
+  }
+  *options = *saved;
+}
+
+/**
+ * Frees the multi-indexes of options.
+ */
+void freeOptions(struct Options *options) {
+  for (size_t i = 0; i < MULTI_INDEXES_COUNT; i++) {
+    free(multiIndexEntries(options, i));
+  }
+}
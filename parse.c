@@ -48,8 +48,10 @@ static const struct {
 
 /**
  * Parses a parameter string on occurrences of 'vertical', 'horizontal' or both.
+ *
+ * @return false if there are none
  */
-int parseDirections(char *s) {
+bool parseDirections(char *s, int *directions) {
   int dir = 0;
   if (strchr(s, 'h') != 0) { // (there is no 'h' in 'vertical'...)
     dir = 1 << HORIZONTAL;
@@ -58,11 +60,10 @@ int parseDirections(char *s) {
     dir |= 1 << VERTICAL;
   }
   if (dir == 0)
-    errOutput(
-        "unknown direction name '%s', expected 'h[orizontal]' or 'v[ertical]'.",
-        s);
+    return false;
 
-  return dir;
+  *directions = dir;
+  return true;
 }
 
 /**
@@ -84,8 +85,10 @@ const char *getDirections(int d) {
 /**
  * Parses a parameter string on occurrences of 'left', 'top', 'right', 'bottom'
  * or combinations.
+ *
+ * @return false if there are none
  */
-int parseEdges(char *s) {
+bool parseEdges(char *s, int *edges) {
   int dir = 0;
   if (strstr(s, "left") != 0) {
     dir = 1 << LEFT;
@@ -100,11 +103,10 @@ int parseEdges(char *s) {
     dir |= 1 << BOTTOM;
   }
   if (dir == 0)
-    errOutput(
-        "unknown edge name '%s', expected 'left', 'top', 'right' or 'bottom'.",
-        s);
+    return false;
 
-  return dir;
+  *edges = dir;
+  return true;
 }
 
 /**
@@ -154,30 +156,36 @@ void parseInts(char *s, int i[2]) {
   }
 }
 
-static int parseSizeSingle(const char *s, int dpi) {
+static bool parseSizeSingle(const char *s, int *i, int dpi) {
   char *valueEnd;
   float value;
 
   value = strtof(s, &valueEnd);
 
   if (fabs(value) == HUGE_VAL || s == valueEnd)
-    errOutput("invalid size %s", s);
+    return false;
 
-  for (int j = 0; j < MEASUREMENTS_COUNT; j++)
-    if (strcmp(valueEnd, MEASUREMENTS[j].unit) == 0)
-      return (int)(value * MEASUREMENTS[j].factor * dpi);
+  for (int j = 0; j < MEASUREMENTS_COUNT; j++) {
+    if (strcmp(valueEnd, MEASUREMENTS[j].unit) == 0) {
+      *i = (int)(value * MEASUREMENTS[j].factor * dpi);
+      return true;
+    }
+  }
 
   /* if no unit is found, then we have a direct pixel value, do not
      multiply for dpi. */
-  return (int)value;
+  *i = (int)value;
+  return true;
 }
 
 /**
  * Parses a pair of size-values and returns it in pixels.
  * Values may be suffixed by MEASUREMENTS such as 'cm', 'in', in that case
  * conversion to pixels is performed based on the dpi-value.
+ *
+ * @return false if a value is not a size
  */
-void parseSize(char *s, int i[2], int dpi) {
+bool parseSize(char *s, int i[2], int dpi) {
   char str[255];
   char *comma;
   int pos;
@@ -187,7 +195,7 @@ void parseSize(char *s, int i[2], int dpi) {
     if (strcmp(s, PAPERSIZES[j].name) == 0) {
       i[0] = PAPERSIZES[j].width * dpi;
       i[1] = PAPERSIZES[j].height * dpi;
-      return;
+      return true;
     }
   }
 
@@ -195,30 +203,39 @@ void parseSize(char *s, int i[2], int dpi) {
   comma = strchr(s, ',');
 
   if (comma == NULL) {
-    i[0] = i[1] = parseSizeSingle(s, dpi);
-    return;
+    if (!parseSizeSingle(s, &i[0], dpi))
+      return false;
+    i[1] = i[0];
+    return true;
   }
 
   pos = comma - s;
   strncpy(str, s, pos);
   str[pos] = 0; // (according to spec of strncpy, no terminating 0 is written)
 
-  i[0] = parseSizeSingle(str, dpi);
+  if (!parseSizeSingle(str, &i[0], dpi))
+    return false;
 
   strcpy(str, &s[pos + 1]); // copy rest after ','
-  i[1] = parseSizeSingle(str, dpi);
+  return parseSizeSingle(str, &i[1], dpi);
 }
 
 /**
  * Parses a color. Currently only "black" and "white".
+ *
+ * @return false for any other color
  */
-int parseColor(char *s) {
-  if (strcmp(s, "black") == 0)
-    return BLACK24;
-  if (strcmp(s, "white") == 0)
-    return WHITE24;
+bool parseColor(char *s, int *color) {
+  if (strcmp(s, "black") == 0) {
+    *color = BLACK24;
+    return true;
+  }
+  if (strcmp(s, "white") == 0) {
+    *color = WHITE24;
+    return true;
+  }
 
-  errOutput("cannot parse color '%s'.", s);
+  return false;
 }
 
 /**
@@ -262,9 +279,10 @@ char *implode(char *buf, const char *s[], int cnt) {
  * string may also be of a different format, in which case
  * *multiIndexCount is set to -1.
  *
+ * @return false if a range has no end
  * @see isInMultiIndex(..)
  */
-void parseMultiIndex(const char *optarg, struct MultiIndex *multiIndex) {
+bool parseMultiIndex(const char *optarg, struct MultiIndex *multiIndex) {
   char *s1;
   int allocated = 0;
 
@@ -272,7 +290,7 @@ void parseMultiIndex(const char *optarg, struct MultiIndex *multiIndex) {
   multiIndex->indexes = NULL;
 
   if (optarg == NULL) {
-    return;
+    return true;
   }
 
   multiIndex->count = 0;
@@ -295,7 +313,9 @@ void parseMultiIndex(const char *optarg, struct MultiIndex *multiIndex) {
       multiIndex->indexes[(multiIndex->count)++] = index;
       if (c == '-') {   // range is specified: get range end
         if (components < 3) {
-          errOutput("Invalid multi-index string \"%s\".", optarg);
+          free(s1);
+          free(s2);
+          return false;
         }
 
         strcpy(s1, s2); // s2 -> s1
@@ -316,7 +336,7 @@ void parseMultiIndex(const char *optarg, struct MultiIndex *multiIndex) {
       multiIndex->count = -1; // disable all
       free(s1);
       free(s2);
-      return;
+      return true;
     }
     if (s2) {
       strcpy(s1, s2); // s2 -> s1
@@ -325,6 +345,7 @@ void parseMultiIndex(const char *optarg, struct MultiIndex *multiIndex) {
   } while ((multiIndex->count < MAX_MULTI_INDEX) && (strlen(s1) > 0));
 
   free(s1);
+  return true;
 }
 
 /**
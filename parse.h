@@ -6,21 +6,23 @@
 
 #pragma once
 
+#include <stdbool.h>
+
 /* --- tool functions for parameter parsing and verbose output ------------ */
 
-int parseDirections(char *s);
+bool parseDirections(char *s, int *directions);
 
 const char *getDirections(int d);
 
-int parseEdges(char *s);
+bool parseEdges(char *s, int *edges);
 
 void printEdges(int d);
 
 void parseInts(char *s, int i[2]);
 
-void parseSize(char *s, int i[2], int dpi);
+bool parseSize(char *s, int i[2], int dpi);
 
-int parseColor(char *s);
+bool parseColor(char *s, int *color);
 
 void parseFloats(char *s, float f[2]);
 
@@ -31,7 +33,7 @@ struct MultiIndex {
   int *indexes;
 };
 
-void parseMultiIndex(const char *optarg, struct MultiIndex *multiIndex);
+bool parseMultiIndex(const char *optarg, struct MultiIndex *multiIndex);
 
 bool isInMultiIndex(int index, struct MultiIndex multiIndex);
 
@@ -0,0 +1,1138 @@
+// Copyright © 2005-2007 Jens Gulden
+// Copyright © 2011-2011 Diego Elio Pettenò
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- processing of a sheet ---------------------------------------------- */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/avutil.h>
+
+#include "cache.h"
+#include "imageprocess.h"
+#include "instrument.h"
+#include "parallel.h"
+#include "parse.h"
+#include "sheet.h"
+#include "tools.h"
+#include "unpaper.h"
+
+/**
+ * Starts a run with the default options; the options given are parsed into
+ * run->options before runStart().
+ */
+void runInit(struct RunState *run) {
+  optionsInit(&run->options);
+  run->deskewScanSize = run->options.deskewScanSize;
+  run->width = -1;
+  run->height = -1;
+  run->previousWidth = -1;
+  run->previousHeight = -1;
+  run->outputPixFmt = -1;
+}
+
+/**
+ * Sets up the run for its first sheet, once its options are parsed.
+ */
+void runStart(struct RunState *run) {
+  const struct Options *options = &run->options;
+
+  updateAbsoluteParameters(&run->options);
+  run->deskewScanSize = options->deskewScanSize;
+  run->outputPixFmt = options->outputPixFmt;
+  run->givenPointCount = options->pointCount;
+  run->givenBlackfilterExcludeCount = options->blackfilterExcludeCount;
+  run->givenWipeCount = options->wipeCount;
+  run->givenOutsideBorderscanMaskCount = options->outsideBorderscanMaskCount;
+  run->givenMaskScanMaximum[WIDTH] = options->maskScanMaximum[WIDTH];
+  run->givenMaskScanMaximum[HEIGHT] = options->maskScanMaximum[HEIGHT];
+}
+
+/**
+ * Parses the options of a sweep variant or of a manifest sheet on top of the
+ * options of the run. The deskew scan size they start from is the one the
+ * previous sheets left, unless they give one.
+ *
+ * @return false on an invalid option, with the message in error
+ */
+bool runOptions(struct RunState *run, int argc, char *argv[], char *error,
+                size_t errorSize) {
+  const int savedOptind = optind;
+  bool valid = true;
+
+  run->options.deskewScanSize = run->deskewScanSize;
+  optind = 0;
+  switch (parseOptions(&run->options, argc, argv, error, errorSize)) {
+  case OPTIONS_OK:
+    if (optind != argc) {
+      snprintf(error, errorSize, "unexpected argument %s.", argv[optind]);
+      valid = false;
+    }
+    break;
+  case OPTIONS_INVALID:
+    valid = false;
+    break;
+  default: // --help, --version or an unknown option
+    snprintf(error, errorSize, "invalid option %s.", argv[optind - 1]);
+    valid = false;
+    break;
+  }
+  optind = savedOptind;
+
+  run->deskewScanSize = run->options.deskewScanSize;
+  updateAbsoluteParameters(&run->options);
+  return valid;
+}
+
+/**
+ * Frees what the options of the run hold.
+ */
+void runFree(struct RunState *run) { freeOptions(&run->options); }
+
+/**
+ * Drops the defaults the layout added to the options for the previous
+ * sheets, before the options of a sweep variant apply: the mask scan points
+ * and blackfilter exclusions the variant gives then replace the defaults, as
+ * on the command line, and the layout adds its defaults again for the sheet
+ * from the options of the variant.
+ */
+void resetLayout(struct RunState *run) {
+  struct Options *options = &run->options;
+
+  options->pointCount = run->givenPointCount;
+  options->blackfilterExcludeCount = run->givenBlackfilterExcludeCount;
+  options->wipeCount = run->givenWipeCount;
+  options->outsideBorderscanMaskCount = run->givenOutsideBorderscanMaskCount;
+  options->maskScanMaximum[WIDTH] = run->givenMaskScanMaximum[WIDTH];
+  options->maskScanMaximum[HEIGHT] = run->givenMaskScanMaximum[HEIGHT];
+}
+
+/**
+ * Sets the layout-dependent defaults (mask detection points, blackfilter
+ * exclusions, border scan areas) that were not given on the command line,
+ * based on the size of the sheet.
+ */
+static void applyLayout(struct Options *options, int width, int height) {
+  // LAYOUT_SINGLE
+  if (options->layout == LAYOUT_SINGLE) {
+    // set middle of sheet as single starting point for mask detection
+    if (options->pointCount == 0) { // no manual settings, use auto-values
+      options->point[options->pointCount][X] = width / 2;
+      options->point[options->pointCount][Y] = height / 2;
+      options->pointCount++;
+    }
+    if (options->maskScanMaximum[WIDTH] == -1) {
+      options->maskScanMaximum[WIDTH] = width;
+    }
+    if (options->maskScanMaximum[HEIGHT] == -1) {
+      options->maskScanMaximum[HEIGHT] = height;
+    }
+    // avoid inner half of the sheet to be blackfilter-detectable
+    if (options->blackfilterExcludeCount ==
+        0) { // no manual settings, use auto-values
+      const int i = options->blackfilterExcludeCount;
+      options->blackfilterExclude[i][LEFT] = width / 4;
+      options->blackfilterExclude[i][TOP] = height / 4;
+      options->blackfilterExclude[i][RIGHT] = width / 2 + width / 4;
+      options->blackfilterExclude[i][BOTTOM] = height / 2 + height / 4;
+      options->blackfilterExcludeCount++;
+    }
+    // set single outside border to start scanning for final border-scan
+    if (options->outsideBorderscanMaskCount ==
+        0) { // no manual settings, use auto-values
+      options->outsideBorderscanMaskCount = 1;
+      options->outsideBorderscanMask[0][LEFT] = 0;
+      options->outsideBorderscanMask[0][RIGHT] = width - 1;
+      options->outsideBorderscanMask[0][TOP] = 0;
+      options->outsideBorderscanMask[0][BOTTOM] = height - 1;
+    }
+
+    // LAYOUT_DOUBLE
+  } else if (options->layout == LAYOUT_DOUBLE) {
+    // set two middle of left/right side of sheet as starting points for
+    // mask detection
+    if (options->pointCount == 0) { // no manual settings, use auto-values
+      options->point[options->pointCount][X] = width / 4;
+      options->point[options->pointCount][Y] = height / 2;
+      options->pointCount++;
+      options->point[options->pointCount][X] = width - width / 4;
+      options->point[options->pointCount][Y] = height / 2;
+      options->pointCount++;
+    }
+    if (options->maskScanMaximum[WIDTH] == -1) {
+      options->maskScanMaximum[WIDTH] = width / 2;
+    }
+    if (options->maskScanMaximum[HEIGHT] == -1) {
+      options->maskScanMaximum[HEIGHT] = height;
+    }
+    if (options->middleWipe[0] > 0 || options->middleWipe[1] > 0) {
+      // left, right
+      const int i = options->wipeCount;
+      options->wipe[i][LEFT] = width / 2 - options->middleWipe[0];
+      options->wipe[i][TOP] = 0;
+      options->wipe[i][RIGHT] = width / 2 + options->middleWipe[1];
+      options->wipe[i][BOTTOM] = height - 1;
+      options->wipeCount++;
+    }
+    // avoid inner half of each page to be blackfilter-detectable
+    if (options->blackfilterExcludeCount ==
+        0) { // no manual settings, use auto-values
+      int i = options->blackfilterExcludeCount;
+      options->blackfilterExclude[i][LEFT] = width / 8;
+      options->blackfilterExclude[i][TOP] = height / 4;
+      options->blackfilterExclude[i][RIGHT] = width / 4 + width / 8;
+      options->blackfilterExclude[i][BOTTOM] = height / 2 + height / 4;
+      options->blackfilterExcludeCount++;
+      i = options->blackfilterExcludeCount;
+      options->blackfilterExclude[i][LEFT] = width / 2 + width / 8;
+      options->blackfilterExclude[i][TOP] = height / 4;
+      options->blackfilterExclude[i][RIGHT] =
+          width / 2 + width / 4 + width / 8;
+      options->blackfilterExclude[i][BOTTOM] = height / 2 + height / 4;
+      options->blackfilterExcludeCount++;
+    }
+    // set two outside borders to start scanning for final border-scan
+    if (options->outsideBorderscanMaskCount ==
+        0) { // no manual settings, use auto-values
+      options->outsideBorderscanMaskCount = 2;
+      options->outsideBorderscanMask[0][LEFT] = 0;
+      options->outsideBorderscanMask[0][RIGHT] = width / 2;
+      options->outsideBorderscanMask[0][TOP] = 0;
+      options->outsideBorderscanMask[0][BOTTOM] = height - 1;
+      options->outsideBorderscanMask[1][LEFT] = width / 2;
+      options->outsideBorderscanMask[1][RIGHT] = width - 1;
+      options->outsideBorderscanMask[1][TOP] = 0;
+      options->outsideBorderscanMask[1][BOTTOM] = height - 1;
+    }
+  }
+  // if maskScanMaximum still unset (no --layout specified), set to full
+  // sheet size now
+  if (options->maskScanMinimum[WIDTH] == -1) {
+    options->maskScanMaximum[WIDTH] = width;
+  }
+  if (options->maskScanMinimum[HEIGHT] == -1) {
+    options->maskScanMaximum[HEIGHT] = height;
+  }
+}
+
+/**
+ * Runs mask detection on the sheet, or replays it from the detection cache.
+ */
+static void detectSheetMasks(struct RunState *run, AVFrame *sheet,
+                             struct DetectionResult *detection, bool cached,
+                             DETECT_MASKS_PHASES phase) {
+  struct Options *options = &run->options;
+
+  beginStage(STAGE_MASK_DETECT);
+  if (cached) {
+    restoreMasks(options, detection, phase);
+  } else {
+    options->maskCount =
+        detectMasks(options, sheet, options->mask, options->maskValid);
+    recordMasks(options, detection, phase);
+  }
+  endStage(STAGE_MASK_DETECT, sheet);
+}
+
+/**
+ * Leaves the masks and the deskew scan size for the next sheets as processing
+ * the blank sheet nr of width x height pixels would: the masks are those of a
+ * sheet filled with the background, as nothing the processing does before
+ * makes it any less blank, and are found from its size alone.
+ */
+static void detectBlankSheet(struct RunState *run, int nr, int width,
+                             int height) {
+  struct Options *options = &run->options;
+
+  if (!isExcluded(nr, options->noMaskScanMultiIndex,
+                  options->ignoreMultiIndex)) {
+    options->maskCount = detectBlankMasks(options, width, height,
+                                          options->mask, options->maskValid);
+  }
+  if (!isExcluded(nr, options->noDeskewMultiIndex,
+                  options->ignoreMultiIndex)) {
+    for (int i = 0; i < options->maskCount; i++) {
+      run->deskewScanSize =
+          rotationScanSize(options, options->mask[i], run->deskewScanSize);
+    }
+  }
+}
+
+/* --- masks of a sheet processed at the same time ------------------------ */
+
+/**
+ * Tests if the areas a and b share at least one pixel.
+ */
+static bool areasOverlap(Mask a, Mask b) {
+  return (a[LEFT] <= b[RIGHT]) && (b[LEFT] <= a[RIGHT]) &&
+         (a[TOP] <= b[BOTTOM]) && (b[TOP] <= a[BOTTOM]);
+}
+
+/**
+ * Tells whether the masks touching the given areas can be worked on at the
+ * same time, giving the same result as one after the other: there must be
+ * threads to share them, no area may overlap another one, and no debug image
+ * may be saved in between.
+ */
+static bool masksConcurrent(const struct Options *options, Mask areas[],
+                            int count) {
+  if (parallelThreads() == 1 || count < 2 ||
+      options->verbose >= VERBOSE_DEBUG_SAVE) {
+    return false;
+  }
+  for (int i = 0; i < count; i++) {
+    for (int j = i + 1; j < count; j++) {
+      if (areasOverlap(areas[i], areas[j])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Messages of the masks worked on at the same time, printed in mask order
+// once all of them are done.
+struct MaskReports {
+  char *text[MAX_MASKS];
+  size_t length[MAX_MASKS];
+};
+
+static FILE *openMaskReport(struct MaskReports *reports, int i) {
+  FILE *report = open_memstream(&reports->text[i], &reports->length[i]);
+  if (report == NULL) {
+    errOutput("unable to buffer messages of mask %d.", i);
+  }
+  return report;
+}
+
+static void printMaskReport(struct MaskReports *reports, int i) {
+  if (reports->text[i] != NULL) {
+    fputs(reports->text[i], stdout);
+    free(reports->text[i]);
+    reports->text[i] = NULL;
+  }
+}
+
+struct RotationJob {
+  struct Options *options;
+  AVFrame *sheet;
+  bool detect[MAX_MASKS];
+  int scanSize[MAX_MASKS];
+  float rotation[MAX_MASKS];
+  struct MaskReports *reports;
+};
+
+static void detectRotationMasks(int first, int last, void *arg) {
+  struct RotationJob *job = arg;
+
+  for (int i = first; i <= last; i++) {
+    if (job->detect[i]) {
+      FILE *report = openMaskReport(job->reports, i);
+      job->rotation[i] =
+          detectRotationReport(job->options, job->sheet, job->options->mask[i],
+                               &job->scanSize[i], report);
+      fclose(report);
+    }
+  }
+}
+
+/**
+ * Detects the rotation of the masks not in the detection cache yet, all at
+ * the same time. Each mask is scanned with the scan size it would have had
+ * one after the other, and the messages wait in reports for the deskewing
+ * loop to print them in order.
+ */
+static void detectRotationsConcurrently(struct RunState *run, AVFrame *sheet,
+                                        struct DetectionResult *detection,
+                                        bool cached,
+                                        struct MaskReports *reports) {
+  struct Options *options = &run->options;
+  struct RotationJob job = {
+      .options = options,
+      .sheet = sheet,
+      .reports = reports,
+  };
+
+  for (int i = 0; i < options->maskCount; i++) {
+    job.detect[i] = !(cached && i < detection->rotationCount);
+    if (job.detect[i]) {
+      job.scanSize[i] = run->deskewScanSize;
+      run->deskewScanSize =
+          rotationScanSize(options, options->mask[i], run->deskewScanSize);
+    }
+  }
+
+  beginStage(STAGE_DESKEW_DETECT);
+  parallelBands(options->maskCount, detectRotationMasks, &job);
+  endStage(STAGE_DESKEW_DETECT, sheet);
+
+  for (int i = 0; i < options->maskCount; i++) {
+    if (job.detect[i]) {
+      detection->rotation[i] = job.rotation[i];
+    }
+  }
+  detection->rotationCount = options->maskCount;
+}
+
+struct CenterJob {
+  struct Options *options;
+  AVFrame *sheet;
+  struct MaskReports reports;
+};
+
+static void centerMasks(int first, int last, void *arg) {
+  struct CenterJob *job = arg;
+
+  for (int i = first; i <= last; i++) {
+    FILE *report = openMaskReport(&job->reports, i);
+    centerMaskReport(job->options, job->sheet, job->options->point[i],
+                     job->options->mask[i], report);
+    fclose(report);
+  }
+}
+
+/**
+ * Centers the masks on the sheet, all at the same time when they do not move
+ * over each other, or one after the other.
+ */
+static void centerSheetMasks(struct Options *options, AVFrame *sheet) {
+  Mask areas[MAX_MASKS];
+
+  for (int i = 0; i < options->maskCount; i++) {
+    centerMaskArea(sheet, options->point[i], options->mask[i], areas[i]);
+  }
+  if (!masksConcurrent(options, areas, options->maskCount)) {
+    for (int i = 0; i < options->maskCount; i++) {
+      centerMask(options, sheet, options->point[i], options->mask[i]);
+    }
+    return;
+  }
+
+  struct CenterJob job = {
+      .options = options,
+      .sheet = sheet,
+  };
+  parallelBands(options->maskCount, centerMasks, &job);
+  for (int i = 0; i < options->maskCount; i++) {
+    printMaskReport(&job.reports, i);
+  }
+}
+
+/* --- the pipeline ------------------------------------------------------- */
+
+/**
+ * Places input page index of the sheet, loaded into *page (NULL for a blank
+ * page), into the sheet buffer, allocating it once its size is known. The
+ * page is freed. debugIndex numbers the debug images of the page.
+ */
+void addSheetPage(struct RunState *run, int index, int debugIndex,
+                  AVFrame **page, AVFrame **sheet) {
+  const struct Options *options = &run->options;
+
+  if (*page != NULL) {
+    if (run->outputPixFmt == -1) {
+      run->outputPixFmt = (*page)->format;
+    }
+
+    // pre-rotate
+    if (options->preRotate != 0) {
+      if (options->verbose >= VERBOSE_NORMAL) {
+        printf("pre-rotating %d degrees.\n", options->preRotate);
+      }
+      beginStage(STAGE_PRE_TRANSFORM);
+      flipRotate(options, options->preRotate / 90, page);
+      endStage(STAGE_PRE_TRANSFORM, *page);
+    }
+
+    // if sheet-size is not known yet (and not forced by --sheet-size),
+    // set now based on size of (first) input image
+    if (run->width == -1) {
+      if (options->sheetSize[WIDTH] != -1) {
+        run->width = options->sheetSize[WIDTH];
+      } else {
+        run->width = (*page)->width * options->inputCount;
+      }
+    }
+    if (run->height == -1) {
+      if (options->sheetSize[HEIGHT] != -1) {
+        run->height = options->sheetSize[HEIGHT];
+      } else {
+        run->height = (*page)->height;
+      }
+    }
+  }
+
+  // place image into sheet buffer
+  // allocate sheet-buffer if not done yet
+  if ((*sheet == NULL) && (run->width != -1) && (run->height != -1)) {
+    initImage(sheet, run->width, run->height, AV_PIX_FMT_RGB24);
+    fillImage(*sheet, options->sheetBackground, options->absBlackThreshold);
+  }
+  if (*page != NULL) {
+    const int w = run->width;
+    const int h = run->height;
+
+    saveDebug(options, "_page%d.pnm", debugIndex, *page);
+    saveDebug(options, "_before_center_page%d.pnm", debugIndex, *sheet);
+
+    centerImage(*page, (w * index / options->inputCount), 0,
+                (w / options->inputCount), h, *sheet,
+                options->sheetBackground, options->absBlackThreshold);
+
+    saveDebug(options, "_after_center_page%d.pnm", debugIndex, *sheet);
+    av_frame_free(page);
+  }
+}
+
+/**
+ * Completes the sheet buffer once all its pages are placed: a sheet of blank
+ * pages only takes the size of the previous sheet.
+ *
+ * @return false when the size of the sheet is unknown, with the message in
+ *         error
+ */
+bool finishSheetInput(struct RunState *run, AVFrame **sheet, char *error,
+                      size_t errorSize) {
+  const struct Options *options = &run->options;
+
+  // the only case that buffer is not yet initialized is if all blank pages
+  // have been inserted
+  if (*sheet == NULL) {
+    // last chance: try to get previous (unstretched/not zoomed) sheet size
+    run->width = run->previousWidth;
+    run->height = run->previousHeight;
+    if (options->verbose >= VERBOSE_NORMAL) {
+      printf("need to guess sheet size from previous sheet: %dx%d\n",
+             run->width, run->height);
+    }
+    if ((run->width == -1) || (run->height == -1)) {
+      snprintf(error, errorSize,
+               "sheet size unknown, use at least one input file per sheet, "
+               "or force using --sheet-size.");
+      return false;
+    }
+    initImage(sheet, run->width, run->height, AV_PIX_FMT_RGB24);
+    fillImage(*sheet, options->sheetBackground, options->absBlackThreshold);
+  }
+
+  run->previousWidth = run->width;
+  run->previousHeight = run->height;
+  return true;
+}
+
+/**
+ * Pre-mirrors, pre-shifts and pre-masks the sheet.
+ */
+void prepareSheet(struct RunState *run, AVFrame **sheet) {
+  struct Options *options = &run->options;
+
+  beginStage(STAGE_PRE_TRANSFORM);
+
+  // pre-mirroring
+  if (options->preMirror != 0) {
+    if (options->verbose >= VERBOSE_NORMAL) {
+      printf("pre-mirroring %s\n", getDirections(options->preMirror));
+    }
+    mirror(options, options->preMirror, *sheet);
+  }
+
+  // pre-shifting
+  if ((options->preShift[WIDTH] != 0) || ((options->preShift[HEIGHT] != 0))) {
+    if (options->verbose >= VERBOSE_NORMAL) {
+      printf("pre-shifting [%d,%d]\n", options->preShift[WIDTH],
+             options->preShift[HEIGHT]);
+    }
+    shift(options, options->preShift[WIDTH], options->preShift[HEIGHT],
+          sheet);
+  }
+
+  // pre-masking
+  if (options->preMaskCount > 0) {
+    if (options->verbose >= VERBOSE_NORMAL) {
+      printf("pre-masking\n ");
+    }
+    applyMasks(options, options->preMask, options->preMaskCount, *sheet);
+  }
+
+  endStage(STAGE_PRE_TRANSFORM, *sheet);
+}
+
+/**
+ * Stretches and resizes sheet nr, and fills in the defaults of the layout for
+ * its size.
+ */
+void stretchSheet(struct RunState *run, int nr, AVFrame **sheet) {
+  struct Options *options = &run->options;
+  int w, h;
+
+  beginStage(STAGE_STRETCH);
+
+  // stretch
+  if (options->stretchSize[WIDTH] != -1) {
+    w = options->stretchSize[WIDTH];
+  } else {
+    w = (*sheet)->width;
+  }
+  if (options->stretchSize[HEIGHT] != -1) {
+    h = options->stretchSize[HEIGHT];
+  } else {
+    h = (*sheet)->height;
+  }
+
+  w *= options->zoomFactor;
+  h *= options->zoomFactor;
+
+  saveDebug(options, "_before-stretch%d.pnm", nr, *sheet);
+  stretch(options, w, h, sheet);
+  saveDebug(options, "_after-stretch%d.pnm", nr, *sheet);
+
+  // size
+  if ((options->size[WIDTH] != -1) || (options->size[HEIGHT] != -1)) {
+    if (options->size[WIDTH] != -1) {
+      w = options->size[WIDTH];
+    } else {
+      w = (*sheet)->width;
+    }
+    if (options->size[HEIGHT] != -1) {
+      h = options->size[HEIGHT];
+    } else {
+      h = (*sheet)->height;
+    }
+    saveDebug(options, "_before-resize%d.pnm", nr, *sheet);
+    resize(options, w, h, sheet);
+    saveDebug(options, "_after-resize%d.pnm", nr, *sheet);
+  }
+
+  endStage(STAGE_STRETCH, *sheet);
+
+  run->width = w;
+  run->height = h;
+
+  // handle sheet layout
+  applyLayout(options, (*sheet)->width, (*sheet)->height);
+}
+
+/**
+ * Pre-wipes sheet nr and applies its pre-border.
+ */
+void preWipeSheet(struct RunState *run, int nr, AVFrame *sheet) {
+  struct Options *options = &run->options;
+
+  beginStage(STAGE_PRE_TRANSFORM);
+
+  // pre-wipe
+  if (!isExcluded(nr, options->noWipeMultiIndex, options->ignoreMultiIndex)) {
+    applyWipes(options, options->preWipe, options->preWipeCount, sheet);
+  }
+
+  // pre-border
+  if (!isExcluded(nr, options->noBorderMultiIndex,
+                  options->ignoreMultiIndex)) {
+    applyBorder(options, options->preBorder, sheet);
+  }
+
+  endStage(STAGE_PRE_TRANSFORM, sheet);
+}
+
+/**
+ * Runs the deskewing of sheet nr: detects the rotation of each mask, or
+ * replays it from the detection results, and rotates it back.
+ */
+static void deskewSheet(struct RunState *run, int nr, AVFrame *sheet,
+                        struct DetectionResult *detection, bool cached) {
+  struct Options *options = &run->options;
+
+  saveDebug(options, "_before-deskew%d.pnm", nr, sheet);
+
+  // detect masks again, we may get more precise results now after first
+  // masking and grayfilter
+  if (!isExcluded(nr, options->noMaskScanMultiIndex,
+                  options->ignoreMultiIndex)) {
+    detectSheetMasks(run, sheet, detection, cached, DETECT_MASKS_DESKEW);
+  } else {
+    if (options->verbose >= VERBOSE_MORE) {
+      printf("(mask-scan before deskewing disabled)\n");
+    }
+  }
+
+  // auto-deskew each mask; the rotation of masks that do not overlap
+  // can be detected all at the same time beforehand, as detecting only
+  // looks inside the mask
+  struct MaskReports reports = {0};
+  const bool concurrent =
+      masksConcurrent(options, options->mask, options->maskCount);
+  if (concurrent) {
+    detectRotationsConcurrently(run, sheet, detection, cached, &reports);
+  }
+  for (int i = 0; i < options->maskCount; i++) {
+    int *mask = options->mask[i];
+
+    saveDebug(options, "_before-deskew-detect%d.pnm",
+              nr * options->maskCount + i, sheet);
+    float rotation;
+    if ((cached || concurrent) && i < detection->rotationCount) {
+      rotation = detection->rotation[i];
+      printMaskReport(&reports, i);
+    } else {
+      beginStage(STAGE_DESKEW_DETECT);
+      rotation = detectRotation(options, sheet, mask, &run->deskewScanSize);
+      endStage(STAGE_DESKEW_DETECT, sheet);
+      detection->rotation[i] = rotation;
+      detection->rotationCount = i + 1;
+    }
+    saveDebug(options, "_after-deskew-detect%d.pnm",
+              nr * options->maskCount + i, sheet);
+    countRotation(rotation);
+
+    if (options->verbose >= VERBOSE_NORMAL) {
+      printf("rotate (%d,%d): %f\n", options->point[i][X],
+             options->point[i][Y], rotation);
+    }
+
+    if (rotation != 0.0) {
+      AVFrame *rect;
+      AVFrame *rectTarget;
+      beginStage(STAGE_ROTATE);
+      initImage(&rect, (mask[RIGHT] - mask[LEFT] + 1),
+                (mask[BOTTOM] - mask[TOP] + 1), sheet->format);
+      initImage(&rectTarget, rect->width, rect->height, sheet->format);
+      fillImage(rectTarget, options->sheetBackground,
+                options->absBlackThreshold);
+
+      // copy area to rotate into rSource
+      copyImageArea(mask[LEFT], mask[TOP], rect->width, rect->height, sheet, 0,
+                    0, rect, options->absBlackThreshold);
+
+      // rotate
+      rotate(options, -rotation, rect, rectTarget);
+
+      // copy result back into whole image
+      copyImageArea(0, 0, rectTarget->width, rectTarget->height, rectTarget,
+                    mask[LEFT], mask[TOP], sheet, options->absBlackThreshold);
+
+      av_frame_free(&rect);
+      av_frame_free(&rectTarget);
+      endStage(STAGE_ROTATE, sheet);
+    }
+  }
+
+  saveDebug(options, "_after-deskew%d.pnm", nr, sheet);
+}
+
+/**
+ * Detects the border of sheet nr, or replays it from the detection results,
+ * masks what lies outside of it and aligns it.
+ */
+static void borderScanSheet(struct RunState *run, int nr, AVFrame *sheet,
+                            struct DetectionResult *detection, bool cached) {
+  struct Options *options = &run->options;
+  int autoborder[MAX_MASKS][EDGES_COUNT];
+  int autoborderMask[MAX_MASKS][EDGES_COUNT];
+
+  saveDebug(options, "_before-border%d.pnm", nr, sheet);
+  beginStage(STAGE_BORDER_SCAN);
+  for (int i = 0; i < options->outsideBorderscanMaskCount; i++) {
+    if (cached && i < detection->borderCount) {
+      memcpy(autoborder[i], detection->border[i], sizeof(autoborder[i]));
+    } else {
+      detectBorder(options, autoborder[i], options->outsideBorderscanMask[i],
+                   sheet);
+      memcpy(detection->border[i], autoborder[i], sizeof(autoborder[i]));
+      detection->borderCount = i + 1;
+    }
+    borderToMask(options, autoborder[i], autoborderMask[i], sheet);
+  }
+  applyMasks(options, autoborderMask, options->outsideBorderscanMaskCount,
+             sheet);
+  for (int i = 0; i < options->outsideBorderscanMaskCount; i++) {
+    // border-centering
+    if (!isExcluded(nr, options->noBorderAlignMultiIndex,
+                    options->ignoreMultiIndex)) {
+      alignMask(options, autoborderMask[i], options->outsideBorderscanMask[i],
+                sheet);
+    } else {
+      if (options->verbose >= VERBOSE_MORE) {
+        printf("+ border-centering DISABLED for sheet %d\n", nr);
+      }
+    }
+  }
+  endStage(STAGE_BORDER_SCAN, sheet);
+  saveDebug(options, "_after-border%d.pnm", nr, sheet);
+}
+
+/**
+ * Post-processes sheet nr: post-wipe, post-border, post-mirror, post-shift,
+ * post-rotate, post-stretch and post-size.
+ */
+static void postProcessSheet(struct RunState *run, int nr, AVFrame **sheet) {
+  struct Options *options = &run->options;
+  int w, h;
+
+  beginStage(STAGE_POST_TRANSFORM);
+
+  // post-wipe
+  if (!isExcluded(nr, options->noWipeMultiIndex, options->ignoreMultiIndex)) {
+    applyWipes(options, options->postWipe, options->postWipeCount, *sheet);
+  }
+
+  // post-border
+  if (!isExcluded(nr, options->noBorderMultiIndex,
+                  options->ignoreMultiIndex)) {
+    applyBorder(options, options->postBorder, *sheet);
+  }
+
+  // post-mirroring
+  if (options->postMirror != 0) {
+    if (options->verbose >= VERBOSE_NORMAL) {
+      printf("post-mirroring %s\n", getDirections(options->postMirror));
+    }
+    mirror(options, options->postMirror, *sheet);
+  }
+
+  // post-shifting
+  if ((options->postShift[WIDTH] != 0) ||
+      ((options->postShift[HEIGHT] != 0))) {
+    if (options->verbose >= VERBOSE_NORMAL) {
+      printf("post-shifting [%d,%d]\n", options->postShift[WIDTH],
+             options->postShift[HEIGHT]);
+    }
+    shift(options, options->postShift[WIDTH], options->postShift[HEIGHT],
+          sheet);
+  }
+
+  // post-rotating
+  if (options->postRotate != 0) {
+    if (options->verbose >= VERBOSE_NORMAL) {
+      printf("post-rotating %d degrees.\n", options->postRotate);
+    }
+    flipRotate(options, options->postRotate / 90, sheet);
+  }
+
+  // post-stretch
+  if (options->postStretchSize[WIDTH] != -1) {
+    w = options->postStretchSize[WIDTH];
+  } else {
+    w = (*sheet)->width;
+  }
+  if (options->postStretchSize[HEIGHT] != -1) {
+    h = options->postStretchSize[HEIGHT];
+  } else {
+    h = (*sheet)->height;
+  }
+
+  w *= options->postZoomFactor;
+  h *= options->postZoomFactor;
+
+  stretch(options, w, h, sheet);
+
+  // post-size
+  if ((options->postSize[WIDTH] != -1) || (options->postSize[HEIGHT] != -1)) {
+    if (options->postSize[WIDTH] != -1) {
+      w = options->postSize[WIDTH];
+    } else {
+      w = (*sheet)->width;
+    }
+    if (options->postSize[HEIGHT] != -1) {
+      h = options->postSize[HEIGHT];
+    } else {
+      h = (*sheet)->height;
+    }
+    resize(options, w, h, sheet);
+  }
+
+  endStage(STAGE_POST_TRANSFORM, *sheet);
+
+  run->width = w;
+  run->height = h;
+}
+
+/**
+ * Runs a stage of the processing of sheet nr, from the black area filter to
+ * the post-processing. The masks, rotations and borders detected go into
+ * detection, or come from it when cached.
+ */
+void processStage(struct RunState *run, SWEEP_STAGES stage, int nr,
+                  AVFrame **sheet, struct DetectionResult *detection,
+                  bool cached) {
+  struct Options *options = &run->options;
+  int filterResult;
+
+  switch (stage) {
+  case SWEEP_STAGE_BLACKFILTER:
+    // black area filter
+    if (!isExcluded(nr, options->noBlackfilterMultiIndex,
+                    options->ignoreMultiIndex)) {
+      saveDebug(options, "_before-blackfilter%d.pnm", nr, *sheet);
+      beginStage(STAGE_BLACKFILTER);
+      blackfilter(options, *sheet);
+      endStage(STAGE_BLACKFILTER, *sheet);
+      saveDebug(options, "_after-blackfilter%d.pnm", nr, *sheet);
+    } else {
+      if (options->verbose >= VERBOSE_MORE) {
+        printf("+ blackfilter DISABLED for sheet %d\n", nr);
+      }
+    }
+    break;
+
+  case SWEEP_STAGE_NOISEFILTER:
+    // noise filter
+    if (!isExcluded(nr, options->noNoisefilterMultiIndex,
+                    options->ignoreMultiIndex)) {
+      if (options->verbose >= VERBOSE_NORMAL) {
+        printf("noise-filter ...");
+      }
+      saveDebug(options, "_before-noisefilter%d.pnm", nr, *sheet);
+      beginStage(STAGE_NOISEFILTER);
+      filterResult = noisefilter(options, *sheet);
+      endStage(STAGE_NOISEFILTER, *sheet);
+      countRemoved(STAGE_NOISEFILTER, filterResult);
+      saveDebug(options, "_after-noisefilter%d.pnm", nr, *sheet);
+      if (options->verbose >= VERBOSE_NORMAL) {
+        printf(" deleted %d clusters.\n", filterResult);
+      }
+    } else {
+      if (options->verbose >= VERBOSE_MORE) {
+        printf("+ noisefilter DISABLED for sheet %d\n", nr);
+      }
+    }
+    break;
+
+  case SWEEP_STAGE_BLURFILTER:
+    // blur filter
+    if (!isExcluded(nr, options->noBlurfilterMultiIndex,
+                    options->ignoreMultiIndex)) {
+      if (options->verbose >= VERBOSE_NORMAL) {
+        printf("blur-filter...");
+      }
+      saveDebug(options, "_before-blurfilter%d.pnm", nr, *sheet);
+      beginStage(STAGE_BLURFILTER);
+      filterResult = blurfilter(options, *sheet);
+      endStage(STAGE_BLURFILTER, *sheet);
+      countRemoved(STAGE_BLURFILTER, filterResult);
+      saveDebug(options, "_after-blurfilter%d.pnm", nr, *sheet);
+      if (options->verbose >= VERBOSE_NORMAL) {
+        printf(" deleted %d pixels.\n", filterResult);
+      }
+    } else {
+      if (options->verbose >= VERBOSE_MORE) {
+        printf("+ blurfilter DISABLED for sheet %d\n", nr);
+      }
+    }
+    break;
+
+  case SWEEP_STAGE_MASKS:
+    // mask-detection
+    if (!isExcluded(nr, options->noMaskScanMultiIndex,
+                    options->ignoreMultiIndex)) {
+      detectSheetMasks(run, *sheet, detection, cached, DETECT_MASKS_INITIAL);
+    } else {
+      if (options->verbose >= VERBOSE_MORE) {
+        printf("+ mask-scan DISABLED for sheet %d\n", nr);
+      }
+    }
+
+    // permanently apply masks
+    if (options->maskCount > 0) {
+      saveDebug(options, "_before-masking%d.pnm", nr, *sheet);
+      beginStage(STAGE_MASK_APPLY);
+      applyMasks(options, options->mask, options->maskCount, *sheet);
+      endStage(STAGE_MASK_APPLY, *sheet);
+      saveDebug(options, "_after-masking%d.pnm", nr, *sheet);
+    }
+    break;
+
+  case SWEEP_STAGE_GRAYFILTER:
+    // gray filter
+    if (!isExcluded(nr, options->noGrayfilterMultiIndex,
+                    options->ignoreMultiIndex)) {
+      if (options->verbose >= VERBOSE_NORMAL) {
+        printf("gray-filter...");
+      }
+      saveDebug(options, "_before-grayfilter%d.pnm", nr, *sheet);
+      beginStage(STAGE_GRAYFILTER);
+      filterResult = grayfilter(options, *sheet);
+      endStage(STAGE_GRAYFILTER, *sheet);
+      countRemoved(STAGE_GRAYFILTER, filterResult);
+      saveDebug(options, "_after-grayfilter%d.pnm", nr, *sheet);
+      if (options->verbose >= VERBOSE_NORMAL) {
+        printf(" deleted %d pixels.\n", filterResult);
+      }
+    } else {
+      if (options->verbose >= VERBOSE_MORE) {
+        printf("+ grayfilter DISABLED for sheet %d\n", nr);
+      }
+    }
+    break;
+
+  case SWEEP_STAGE_DESKEW:
+    // rotation-detection
+    if ((!isExcluded(nr, options->noDeskewMultiIndex,
+                     options->ignoreMultiIndex))) {
+      deskewSheet(run, nr, *sheet, detection, cached);
+    } else {
+      if (options->verbose >= VERBOSE_MORE) {
+        printf("+ deskewing DISABLED for sheet %d\n", nr);
+      }
+    }
+    break;
+
+  case SWEEP_STAGE_CENTER:
+    // auto-center masks on either single-page or double-page layout
+    if (!isExcluded(nr, options->noMaskCenterMultiIndex,
+                    options->ignoreMultiIndex)) {
+      // perform auto-masking again to get more precise masks after rotation
+      if (!isExcluded(nr, options->noMaskScanMultiIndex,
+                      options->ignoreMultiIndex)) {
+        detectSheetMasks(run, *sheet, detection, cached, DETECT_MASKS_CENTER);
+      } else {
+        if (options->verbose >= VERBOSE_MORE) {
+          printf("(mask-scan before centering disabled)\n");
+        }
+      }
+
+      saveDebug(options, "_before-centering%d.pnm", nr, *sheet);
+      // center masks on the sheet, according to their page position
+      beginStage(STAGE_CENTER);
+      centerSheetMasks(options, *sheet);
+      endStage(STAGE_CENTER, *sheet);
+      saveDebug(options, "_after-centering%d.pnm", nr, *sheet);
+    } else {
+      if (options->verbose >= VERBOSE_MORE) {
+        printf("+ auto-centering DISABLED for sheet %d\n", nr);
+      }
+    }
+    break;
+
+  case SWEEP_STAGE_WIPE:
+    beginStage(STAGE_WIPE);
+
+    // explicit wipe
+    if (!isExcluded(nr, options->noWipeMultiIndex,
+                    options->ignoreMultiIndex)) {
+      applyWipes(options, options->wipe, options->wipeCount, *sheet);
+    } else {
+      if (options->verbose >= VERBOSE_MORE) {
+        printf("+ wipe DISABLED for sheet %d\n", nr);
+      }
+    }
+
+    // explicit border
+    if (!isExcluded(nr, options->noBorderMultiIndex,
+                    options->ignoreMultiIndex)) {
+      applyBorder(options, options->border, *sheet);
+    } else {
+      if (options->verbose >= VERBOSE_MORE) {
+        printf("+ border DISABLED for sheet %d\n", nr);
+      }
+    }
+
+    endStage(STAGE_WIPE, *sheet);
+    break;
+
+  case SWEEP_STAGE_BORDER:
+    // border-detection
+    if (!isExcluded(nr, options->noBorderScanMultiIndex,
+                    options->ignoreMultiIndex)) {
+      borderScanSheet(run, nr, *sheet, detection, cached);
+    } else {
+      if (options->verbose >= VERBOSE_MORE) {
+        printf("+ border-scan DISABLED for sheet %d\n", nr);
+      }
+    }
+    break;
+
+  case SWEEP_STAGE_POST:
+    postProcessSheet(run, nr, sheet);
+    break;
+
+  default: // loading and saving are up to the caller
+    break;
+  }
+}
+
+/**
+ * Copies output page index out of the processed sheet, or returns the sheet
+ * itself when it makes a single page.
+ */
+AVFrame *sheetPage(const struct RunState *run, AVFrame *sheet, int index) {
+  const struct Options *options = &run->options;
+  AVFrame *page;
+
+  if (options->outputCount == 1) {
+    return sheet;
+  }
+  initImage(&page, sheet->width / options->outputCount, sheet->height,
+            sheet->format);
+  copyImageArea(page->width * index, 0, page->width, page->height, sheet, 0, 0,
+                page, options->absBlackThreshold);
+  return page;
+}
+
+/**
+ * Works out the size a sheet of width x height pixels has at the end of the
+ * processing, as stretching, resizing and post-rotating change it, without
+ * processing it. The size of the sheet buffer is left as the processing
+ * leaves it. The state a blank sheet leaves for the next sheets is updated
+ * too.
+ */
+void processedSheetSize(struct RunState *run, int nr, bool blank, int *width,
+                        int *height) {
+  struct Options *options = &run->options;
+  int *w = &run->width;
+  int *h = &run->height;
+
+  // stretch
+  *w = (options->stretchSize[WIDTH] != -1) ? options->stretchSize[WIDTH]
+                                           : *width;
+  *h = (options->stretchSize[HEIGHT] != -1) ? options->stretchSize[HEIGHT]
+                                            : *height;
+  *w *= options->zoomFactor;
+  *h *= options->zoomFactor;
+  *width = *w;
+  *height = *h;
+
+  // size
+  if ((options->size[WIDTH] != -1) || (options->size[HEIGHT] != -1)) {
+    *w = (options->size[WIDTH] != -1) ? options->size[WIDTH] : *width;
+    *h = (options->size[HEIGHT] != -1) ? options->size[HEIGHT] : *height;
+    resizeDimensions(*w, *h, width, height);
+  }
+
+  applyLayout(options, *width, *height);
+  if (blank) {
+    detectBlankSheet(run, nr, *width, *height);
+  }
+
+  // post-rotating
+  if (options->postRotate != 0) {
+    const int tmp = *width;
+    *width = *height;
+    *height = tmp;
+  }
+
+  // post-stretch
+  *w = (options->postStretchSize[WIDTH] != -1)
+           ? options->postStretchSize[WIDTH]
+           : *width;
+  *h = (options->postStretchSize[HEIGHT] != -1)
+           ? options->postStretchSize[HEIGHT]
+           : *height;
+  *w *= options->postZoomFactor;
+  *h *= options->postZoomFactor;
+  *width = *w;
+  *height = *h;
+
+  // post-size
+  if ((options->postSize[WIDTH] != -1) || (options->postSize[HEIGHT] != -1)) {
+    *w = (options->postSize[WIDTH] != -1) ? options->postSize[WIDTH] : *width;
+    *h = (options->postSize[HEIGHT] != -1) ? options->postSize[HEIGHT]
+                                           : *height;
+    resizeDimensions(*w, *h, width, height);
+  }
+}
@@ -0,0 +1,73 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <libavutil/frame.h>
+
+#include "cache.h"
+#include "sweep.h"
+#include "unpaper.h"
+
+/* --- processing of a sheet ---------------------------------------------- */
+
+// A run of sheets processed one after the other, with what the processing
+// of a sheet leaves for the next ones.
+struct RunState {
+  // the options, with the masks found and the defaults of the layout, and
+  // the options of a sweep variant or of a manifest sheet applied
+  struct Options options;
+  // limited by the rotation detection, for the next sheets
+  int deskewScanSize;
+  // size of the sheet buffer, -1 until known
+  int width;
+  int height;
+  // size of the previous sheet buffer, for sheets of blank pages only
+  int previousWidth;
+  int previousHeight;
+  // format the pages are saved in, -1 until known
+  int outputPixFmt;
+  // the options read by the layout as given, before the first sheet added
+  // its defaults
+  int givenPointCount;
+  int givenBlackfilterExcludeCount;
+  int givenWipeCount;
+  int givenOutsideBorderscanMaskCount;
+  int givenMaskScanMaximum[DIMENSIONS_COUNT];
+};
+
+void runInit(struct RunState *run);
+
+void runStart(struct RunState *run);
+
+bool runOptions(struct RunState *run, int argc, char *argv[], char *error,
+                size_t errorSize);
+
+void runFree(struct RunState *run);
+
+void resetLayout(struct RunState *run);
+
+void addSheetPage(struct RunState *run, int index, int debugIndex,
+                  AVFrame **page, AVFrame **sheet);
+
+bool finishSheetInput(struct RunState *run, AVFrame **sheet, char *error,
+                      size_t errorSize);
+
+void prepareSheet(struct RunState *run, AVFrame **sheet);
+
+void stretchSheet(struct RunState *run, int nr, AVFrame **sheet);
+
+void preWipeSheet(struct RunState *run, int nr, AVFrame *sheet);
+
+void processStage(struct RunState *run, SWEEP_STAGES stage, int nr,
+                  AVFrame **sheet, struct DetectionResult *detection,
+                  bool cached);
+
+AVFrame *sheetPage(const struct RunState *run, AVFrame *sheet, int index);
+
+void processedSheetSize(struct RunState *run, int nr, bool blank, int *width,
+                        int *height);
@@ -0,0 +1,387 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- spool directory ---------------------------------------------------- */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "spool.h"
+#include "unpaper.h"
+
+#define SPOOL_MAX_ARGS 256
+
+#define SPOOL_JOB_SUFFIX ".job"
+#define SPOOL_RESULT_SUFFIX ".result"
+
+// how often a worker checks on the job it runs
+#define SPOOL_POLL_MS 100
+
+/*
+ * A spool directory holds one job file per sheet, moving through these
+ * directories: workers claim jobs by renaming them from queue/ to claimed/,
+ * which only one of them can do, and move them on to done/ or failed/ with a
+ * result record next to them. While a worker runs a job, it touches the
+ * claimed file; claims not touched for longer than the lease are left by a
+ * worker that died, and go back to queue/.
+ */
+typedef enum {
+  SPOOL_QUEUE,
+  SPOOL_CLAIMED,
+  SPOOL_DONE,
+  SPOOL_FAILED,
+  SPOOL_DIRECTORIES_COUNT
+} SPOOL_DIRECTORIES;
+
+static const char *spoolDirectoryNames[SPOOL_DIRECTORIES_COUNT] = {
+    [SPOOL_QUEUE] = "queue",
+    [SPOOL_CLAIMED] = "claimed",
+    [SPOOL_DONE] = "done",
+    [SPOOL_FAILED] = "failed",
+};
+
+static void spoolPath(const struct Options *options, char *buf, size_t len,
+                      SPOOL_DIRECTORIES dir, const char *name) {
+  snprintf(buf, len, "%s/%s/%s", options->spoolDirectory,
+           spoolDirectoryNames[dir], name);
+}
+
+static bool isJobName(const char *name) {
+  const size_t length = strlen(name);
+  const size_t suffixLength = strlen(SPOOL_JOB_SUFFIX);
+
+  return name[0] != '.' && length > suffixLength &&
+         strcmp(name + length - suffixLength, SPOOL_JOB_SUFFIX) == 0;
+}
+
+static int compareNames(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Lists the jobs in one of the spool directories, sorted by name.
+ */
+static int listJobs(const struct Options *options, SPOOL_DIRECTORIES dir,
+                    char ***names) {
+  char path[PATH_MAX];
+  struct dirent *entry;
+  int count = 0;
+  int allocated = 0;
+  DIR *d;
+
+  snprintf(path, sizeof(path), "%s/%s", options->spoolDirectory,
+           spoolDirectoryNames[dir]);
+  d = opendir(path);
+  if (d == NULL)
+    errOutput("unable to read spool directory %s.", path);
+
+  *names = NULL;
+  while ((entry = readdir(d)) != NULL) {
+    if (!isJobName(entry->d_name))
+      continue;
+    if (count == allocated) {
+      allocated = (allocated == 0) ? 64 : allocated * 2;
+      *names = realloc(*names, allocated * sizeof(char *));
+    }
+    (*names)[count++] = strdup(entry->d_name);
+  }
+  closedir(d);
+
+  if (count > 0)
+    qsort(*names, count, sizeof(char *), compareNames);
+  return count;
+}
+
+static void freeJobs(char **names, int count) {
+  for (int i = 0; i < count; i++) {
+    free(names[i]);
+  }
+  free(names);
+}
+
+/**
+ * Moves the claims that have not been touched for longer than the lease back
+ * to the queue, and returns how many claims are left.
+ *
+ * A claim is first renamed to a name of this worker, which only one worker
+ * can do, and its lease checked again there: the claim may have been
+ * touched, or reclaimed and claimed again, since it was listed. A claim
+ * found alive goes back under its own name.
+ */
+static int reclaimStale(const struct Options *options) {
+  char **names;
+  const int count = listJobs(options, SPOOL_CLAIMED, &names);
+  int claims = 0;
+  char host[256] = "";
+
+  gethostname(host, sizeof(host) - 1);
+
+  for (int i = 0; i < count; i++) {
+    char claimed[PATH_MAX];
+    char reclaiming[PATH_MAX];
+    char queued[PATH_MAX];
+    char owned[NAME_MAX + 1];
+    struct stat statBuf;
+
+    spoolPath(options, claimed, sizeof(claimed), SPOOL_CLAIMED, names[i]);
+    if (stat(claimed, &statBuf) != 0)
+      continue; // finished in the meantime
+
+    if (time(NULL) - statBuf.st_mtime <= options->spoolLease) {
+      claims++;
+      continue;
+    }
+
+    // hidden from listJobs() while this worker holds it
+    snprintf(owned, sizeof(owned), ".%s.%s.%d", names[i], host, (int)getpid());
+    spoolPath(options, reclaiming, sizeof(reclaiming), SPOOL_CLAIMED, owned);
+    if (rename(claimed, reclaiming) != 0)
+      continue; // finished or reclaimed by another worker in the meantime
+
+    if (stat(reclaiming, &statBuf) != 0)
+      errOutput("unable to reclaim spool job %s.", names[i]);
+    if (time(NULL) - statBuf.st_mtime <= options->spoolLease) {
+      if (rename(reclaiming, claimed) != 0)
+        errOutput("unable to reclaim spool job %s.", names[i]);
+      claims++;
+      continue;
+    }
+
+    spoolPath(options, queued, sizeof(queued), SPOOL_QUEUE, names[i]);
+    if (rename(reclaiming, queued) != 0)
+      errOutput("unable to reclaim spool job %s.", names[i]);
+    if (options->verbose >= VERBOSE_NORMAL) {
+      printf("job %s: claim expired, queued again.\n", names[i]);
+    }
+  }
+
+  freeJobs(names, count);
+  return claims;
+}
+
+/**
+ * Claims the first job of the queue another worker does not claim first.
+ * The job is touched before it is renamed, so that its lease starts with the
+ * claim.
+ */
+static char *claimJob(const struct Options *options) {
+  char **names;
+  const int count = listJobs(options, SPOOL_QUEUE, &names);
+  char *claim = NULL;
+
+  for (int i = 0; i < count && claim == NULL; i++) {
+    char queued[PATH_MAX];
+    char claimed[PATH_MAX];
+
+    spoolPath(options, queued, sizeof(queued), SPOOL_QUEUE, names[i]);
+    spoolPath(options, claimed, sizeof(claimed), SPOOL_CLAIMED, names[i]);
+    if (utimensat(AT_FDCWD, queued, NULL, 0) == 0 &&
+        rename(queued, claimed) == 0) {
+      claim = strdup(names[i]);
+    }
+  }
+
+  freeJobs(names, count);
+  return claim;
+}
+
+/**
+ * Reads the arguments of a job: options followed by the input and output
+ * files of one sheet, separated by blanks over any number of lines. Lines
+ * starting with # are ignored.
+ */
+static void loadJob(const char *filename, char *program, int *argc,
+                    char ***argv) {
+  char line[4096];
+  FILE *f = fopen(filename, "r");
+
+  if (f == NULL)
+    errOutput("unable to open spool job %s.", filename);
+
+  *argv = calloc(SPOOL_MAX_ARGS + 2, sizeof(char *));
+  (*argv)[0] = program;
+  *argc = 1;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char *saveptr = NULL;
+    char *token = strtok_r(line, " \t\r\n", &saveptr);
+
+    if (token == NULL || token[0] == '#')
+      continue;
+
+    for (; token != NULL; token = strtok_r(NULL, " \t\r\n", &saveptr)) {
+      if (*argc > SPOOL_MAX_ARGS)
+        errOutput("too many arguments in spool job %s.", filename);
+      (*argv)[(*argc)++] = strdup(token);
+    }
+  }
+  (*argv)[*argc] = NULL;
+
+  fclose(f);
+}
+
+/**
+ * Waits for the process running a job, touching its claim every quarter of
+ * the lease.
+ */
+static int waitJob(const struct Options *options, pid_t pid,
+                   const char *claimed) {
+  const struct timespec poll = {.tv_sec = 0,
+                                .tv_nsec = SPOOL_POLL_MS * 1000000L};
+  const int touchPolls = max(options->spoolLease * 1000 / 4 / SPOOL_POLL_MS, 1);
+  int status;
+
+  for (int polls = 1;; polls++) {
+    const pid_t done = waitpid(pid, &status, WNOHANG);
+    if (done == pid)
+      return status;
+    if (done < 0 && errno != EINTR)
+      errOutput("unable to wait for spool job %s.", claimed);
+
+    nanosleep(&poll, NULL);
+    if (polls % touchPolls == 0) {
+      utimensat(AT_FDCWD, claimed, NULL, 0);
+    }
+  }
+}
+
+/**
+ * Writes the result record of a job next to where the job goes, and moves
+ * the job there. The record is renamed in place, so that it is complete once
+ * it shows up.
+ */
+static bool finishJob(const struct Options *options, const char *name,
+                      int status, double seconds) {
+  const bool succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  const SPOOL_DIRECTORIES dir = succeeded ? SPOOL_DONE : SPOOL_FAILED;
+  char claimed[PATH_MAX];
+  char finished[PATH_MAX];
+  char result[PATH_MAX];
+  char tmpResult[PATH_MAX];
+  char host[256] = "";
+  FILE *f;
+
+  spoolPath(options, claimed, sizeof(claimed), SPOOL_CLAIMED, name);
+  spoolPath(options, finished, sizeof(finished), dir, name);
+  snprintf(result, sizeof(result), "%.*s%s",
+           (int)(strlen(finished) - strlen(SPOOL_JOB_SUFFIX)), finished,
+           SPOOL_RESULT_SUFFIX);
+  snprintf(tmpResult, sizeof(tmpResult), "%s.%d.tmp", result, (int)getpid());
+
+  gethostname(host, sizeof(host) - 1);
+
+  f = fopen(tmpResult, "w");
+  if (f == NULL)
+    errOutput("unable to write spool result %s.", tmpResult);
+  fprintf(f, "status %s\n", succeeded ? "done" : "failed");
+  if (WIFEXITED(status)) {
+    fprintf(f, "exit %d\n", WEXITSTATUS(status));
+  } else if (WIFSIGNALED(status)) {
+    fprintf(f, "signal %d\n", WTERMSIG(status));
+  }
+  fprintf(f, "host %s\n", host);
+  fprintf(f, "pid %d\n", (int)getpid());
+  fprintf(f, "seconds %.3f\n", seconds);
+  if (fclose(f) != 0 || rename(tmpResult, result) != 0)
+    errOutput("unable to write spool result %s.", result);
+
+  // a worker too slow to touch its claim may have lost it to another one
+  if (rename(claimed, finished) != 0) {
+    fprintf(stderr,
+            "unpaper: warning: spool job %s was claimed again while it "
+            "ran.\n",
+            name);
+  }
+  return succeeded;
+}
+
+/**
+ * Works through the jobs of a spool directory, together with any number of
+ * other workers, until there are none left queued or claimed. Each job runs
+ * in a process of its own: the function only returns in that process, with
+ * argc and argv set to the arguments of the job. The worker itself exits.
+ */
+void spoolRun(const struct Options *options, int *argc, char ***argv) {
+  int done = 0;
+  int failed = 0;
+
+  if (mkdir(options->spoolDirectory, 0777) != 0 && errno != EEXIST)
+    errOutput("unable to create spool directory %s.", options->spoolDirectory);
+  for (int dir = 0; dir < SPOOL_DIRECTORIES_COUNT; dir++) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", options->spoolDirectory,
+             spoolDirectoryNames[dir]);
+    if (mkdir(path, 0777) != 0 && errno != EEXIST)
+      errOutput("unable to create spool directory %s.", path);
+  }
+
+  while (true) {
+    const int claims = reclaimStale(options);
+    char *name = claimJob(options);
+
+    if (name == NULL) {
+      if (claims == 0)
+        break;
+      // the claims of other workers may still expire
+      sleep(1);
+      continue;
+    }
+
+    char claimed[PATH_MAX];
+    struct timespec start;
+    struct timespec end;
+
+    spoolPath(options, claimed, sizeof(claimed), SPOOL_CLAIMED, name);
+    if (options->verbose >= VERBOSE_NORMAL) {
+      printf("job %s: claimed.\n", name);
+    }
+
+    fflush(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const pid_t pid = fork();
+    if (pid < 0)
+      errOutput("unable to fork spool job %s.", name);
+
+    if (pid == 0) {
+      loadJob(claimed, (*argv)[0], argc, argv);
+      free(name);
+      return;
+    }
+
+    const int status = waitJob(options, pid, claimed);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds =
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    const bool succeeded = finishJob(options, name, status, seconds);
+    if (succeeded) {
+      done++;
+    } else {
+      failed++;
+    }
+    if (options->verbose >= VERBOSE_NORMAL) {
+      printf("job %s: %s in %.3f seconds.\n", name,
+             succeeded ? "done" : "failed", seconds);
+    }
+    free(name);
+  }
+
+  if (options->verbose > VERBOSE_QUIET) {
+    printf("spool %s: %d jobs done, %d failed.\n", options->spoolDirectory,
+           done, failed);
+  }
+  exit(failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,385 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- parameter sweep ---------------------------------------------------- */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "instrument.h"
+#include "sweep.h"
+#include "unpaper.h"
+
+#define SWEEP_MAX_VARIANTS 64
+#define SWEEP_MAX_ARGS 64
+
+// A set of options processed in addition to the command line ones. Variants
+// share the processing of each sheet up to the first stage their options
+// affect, and then continue in a forked process of their own, so that the
+// sheet processed so far is shared copy-on-write.
+struct SweepVariant {
+  char *label;
+  int argc;
+  char *argv[SWEEP_MAX_ARGS + 2];
+  SWEEP_STAGES stage;
+};
+
+static struct SweepVariant variants[SWEEP_MAX_VARIANTS];
+static int variantCount = 0;
+
+// variant processed by this process, or -1 for the main process
+static int currentVariant = -1;
+
+// variant without options, processed by the main process itself, or -1
+static int baseVariant = -1;
+
+// the main process stops processing a sheet after this stage, unless it
+// processes the base variant
+static SWEEP_STAGES lastStage = SWEEP_STAGE_INPUT;
+
+// processes of the variants still running, at most maxChildren at a time
+static pid_t children[SWEEP_MAX_VARIANTS];
+static int childCount = 0;
+static int maxChildren = 1;
+static int failedCount = 0;
+
+// verbosity of the main process, before any variant applies its options
+static VERBOSE_LEVEL sweepVerbose = VERBOSE_NORMAL;
+
+// First processing stage affected by each option, by its long name. Options
+// not listed select the sheets, the files or the way the batch is run, and
+// apply to the whole sweep.
+static const struct {
+  const char *option;
+  SWEEP_STAGES stage;
+} optionStages[] = {
+    {"sheet-size", SWEEP_STAGE_INPUT},
+    {"sheet-background", SWEEP_STAGE_INPUT},
+    {"pre-rotate", SWEEP_STAGE_INPUT},
+
+    {"layout", SWEEP_STAGE_PREPROCESS},
+    {"no-processing", SWEEP_STAGE_PREPROCESS},
+    {"pre-mirror", SWEEP_STAGE_PREPROCESS},
+    {"pre-shift", SWEEP_STAGE_PREPROCESS},
+    {"pre-mask", SWEEP_STAGE_PREPROCESS},
+    {"size", SWEEP_STAGE_PREPROCESS},
+    {"stretch", SWEEP_STAGE_PREPROCESS},
+    {"zoom", SWEEP_STAGE_PREPROCESS},
+    {"pre-wipe", SWEEP_STAGE_PREPROCESS},
+    {"pre-border", SWEEP_STAGE_PREPROCESS},
+    {"mask-color", SWEEP_STAGE_PREPROCESS},
+    {"interpolate", SWEEP_STAGE_PREPROCESS},
+    {"white-threshold", SWEEP_STAGE_PREPROCESS},
+    {"black-threshold", SWEEP_STAGE_PREPROCESS},
+    // read by the layout, which applies its defaults before the filters
+    {"mask-scan-point", SWEEP_STAGE_PREPROCESS},
+    {"blackfilter-scan-exclude", SWEEP_STAGE_PREPROCESS},
+    {"middle-wipe", SWEEP_STAGE_PREPROCESS},
+
+    {"no-blackfilter", SWEEP_STAGE_BLACKFILTER},
+    {"blackfilter-scan-direction", SWEEP_STAGE_BLACKFILTER},
+    {"blackfilter-scan-size", SWEEP_STAGE_BLACKFILTER},
+    {"blackfilter-scan-depth", SWEEP_STAGE_BLACKFILTER},
+    {"blackfilter-scan-step", SWEEP_STAGE_BLACKFILTER},
+    {"blackfilter-scan-threshold", SWEEP_STAGE_BLACKFILTER},
+    {"blackfilter-intensity", SWEEP_STAGE_BLACKFILTER},
+
+    {"no-noisefilter", SWEEP_STAGE_NOISEFILTER},
+    {"noisefilter-intensity", SWEEP_STAGE_NOISEFILTER},
+
+    {"no-blurfilter", SWEEP_STAGE_BLURFILTER},
+    {"blurfilter-size", SWEEP_STAGE_BLURFILTER},
+    {"blurfilter-step", SWEEP_STAGE_BLURFILTER},
+    {"blurfilter-intensity", SWEEP_STAGE_BLURFILTER},
+
+    {"mask", SWEEP_STAGE_MASKS},
+    {"no-mask-scan", SWEEP_STAGE_MASKS},
+    {"mask-scan-direction", SWEEP_STAGE_MASKS},
+    {"mask-scan-size", SWEEP_STAGE_MASKS},
+    {"mask-scan-depth", SWEEP_STAGE_MASKS},
+    {"mask-scan-step", SWEEP_STAGE_MASKS},
+    {"mask-scan-threshold", SWEEP_STAGE_MASKS},
+    {"mask-scan-minimum", SWEEP_STAGE_MASKS},
+    {"mask-scan-maximum", SWEEP_STAGE_MASKS},
+
+    {"no-grayfilter", SWEEP_STAGE_GRAYFILTER},
+    {"grayfilter-size", SWEEP_STAGE_GRAYFILTER},
+    {"grayfilter-step", SWEEP_STAGE_GRAYFILTER},
+    {"grayfilter-threshold", SWEEP_STAGE_GRAYFILTER},
+
+    {"no-deskew", SWEEP_STAGE_DESKEW},
+    {"deskew-scan-direction", SWEEP_STAGE_DESKEW},
+    {"deskew-scan-size", SWEEP_STAGE_DESKEW},
+    {"deskew-scan-depth", SWEEP_STAGE_DESKEW},
+    {"deskew-scan-range", SWEEP_STAGE_DESKEW},
+    {"deskew-scan-step", SWEEP_STAGE_DESKEW},
+    {"deskew-scan-deviation", SWEEP_STAGE_DESKEW},
+
+    {"no-mask-center", SWEEP_STAGE_CENTER},
+
+    {"wipe", SWEEP_STAGE_WIPE},
+    {"border", SWEEP_STAGE_WIPE},
+    {"no-wipe", SWEEP_STAGE_WIPE},
+    {"no-border", SWEEP_STAGE_WIPE},
+
+    {"no-border-scan", SWEEP_STAGE_BORDER},
+    {"border-scan-direction", SWEEP_STAGE_BORDER},
+    {"border-scan-size", SWEEP_STAGE_BORDER},
+    {"border-scan-step", SWEEP_STAGE_BORDER},
+    {"border-scan-threshold", SWEEP_STAGE_BORDER},
+    {"border-align", SWEEP_STAGE_BORDER},
+    {"border-margin", SWEEP_STAGE_BORDER},
+    {"no-border-align", SWEEP_STAGE_BORDER},
+
+    {"post-rotate", SWEEP_STAGE_POST},
+    {"post-mirror", SWEEP_STAGE_POST},
+    {"post-shift", SWEEP_STAGE_POST},
+    {"post-size", SWEEP_STAGE_POST},
+    {"post-stretch", SWEEP_STAGE_POST},
+    {"post-zoom", SWEEP_STAGE_POST},
+    {"post-wipe", SWEEP_STAGE_POST},
+    {"post-border", SWEEP_STAGE_POST},
+
+    {"quiet", SWEEP_STAGE_OUTPUT},
+    {"verbose", SWEEP_STAGE_OUTPUT},
+    {"vv", SWEEP_STAGE_OUTPUT},
+    {"debug", SWEEP_STAGE_OUTPUT},
+    {"debug-save", SWEEP_STAGE_OUTPUT},
+    // only used while parsing the options
+    {"dpi", SWEEP_STAGE_OUTPUT},
+    {"overwrite", SWEEP_STAGE_OUTPUT},
+};
+
+/**
+ * Returns the first processing stage affected by an option, as returned by
+ * nextOption().
+ */
+static SWEEP_STAGES optionStage(int option, const char *label) {
+  const char *name = optionName(option);
+
+  if (name == NULL)
+    errOutput("invalid option in sweep variant '%s'.", label);
+
+  for (size_t i = 0; i < sizeof(optionStages) / sizeof(optionStages[0]);
+       i++) {
+    if (strcmp(optionStages[i].option, name) == 0)
+      return optionStages[i].stage;
+  }
+
+  errOutput("sweep variant '%s' uses an option that cannot be swept.", label);
+}
+
+/**
+ * Finds the first stage affected by the options of a variant, by parsing
+ * them the same way as the command line.
+ */
+static SWEEP_STAGES variantStage(struct SweepVariant *variant) {
+  const int savedOptind = optind;
+  SWEEP_STAGES stage = SWEEP_STAGES_COUNT;
+  int c;
+
+  optind = 0;
+  while ((c = nextOption(variant->argc, variant->argv)) != -1) {
+    const SWEEP_STAGES s = optionStage(c, variant->label);
+    if (s < stage)
+      stage = s;
+  }
+  if (optind < variant->argc) {
+    errOutput("unexpected argument '%s' in sweep variant '%s'.",
+              variant->argv[optind], variant->label);
+  }
+  optind = savedOptind;
+
+  return stage;
+}
+
+/**
+ * Reads the variants to sweep: one per line, made of a label followed by
+ * options. Empty lines and lines starting with # are ignored.
+ *
+ * @param processes how many variant processes may run at a time; 0 runs one
+ * per online processor
+ */
+void sweepLoad(const char *filename, int processes, VERBOSE_LEVEL verbose) {
+  char line[4096];
+  FILE *f = fopen(filename, "r");
+
+  if (f == NULL)
+    errOutput("unable to open sweep file %s.", filename);
+
+  sweepVerbose = verbose;
+  maxChildren = (processes > 0)
+                    ? processes
+                    : max((int)sysconf(_SC_NPROCESSORS_ONLN), 1);
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    struct SweepVariant *variant = &variants[variantCount];
+    char *saveptr = NULL;
+    char *token = strtok_r(line, " \t\r\n", &saveptr);
+
+    if (token == NULL || token[0] == '#')
+      continue;
+
+    if (variantCount == SWEEP_MAX_VARIANTS)
+      errOutput("too many sweep variants, at most %d allowed.",
+                SWEEP_MAX_VARIANTS);
+
+    if (strspn(token, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                      "0123456789_-+=,") != strlen(token))
+      errOutput("invalid sweep variant label '%s'.", token);
+    for (int i = 0; i < variantCount; i++) {
+      if (strcmp(variants[i].label, token) == 0)
+        errOutput("duplicate sweep variant label '%s'.", token);
+    }
+
+    variant->label = strdup(token);
+    variant->argv[0] = "unpaper";
+    variant->argc = 1;
+    while ((token = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL) {
+      if (variant->argc > SWEEP_MAX_ARGS)
+        errOutput("too many options in sweep variant '%s'.", variant->label);
+      variant->argv[variant->argc++] = strdup(token);
+    }
+    variant->argv[variant->argc] = NULL;
+    variant->stage = variantStage(variant);
+
+    if (variant->stage == SWEEP_STAGES_COUNT) {
+      if (baseVariant != -1)
+        errOutput("sweep variants '%s' and '%s' both have no options.",
+                  variants[baseVariant].label, variant->label);
+      baseVariant = variantCount;
+    } else if (variant->stage > lastStage) {
+      lastStage = variant->stage;
+    }
+
+    if (sweepVerbose >= VERBOSE_MORE) {
+      printf("sweep variant %s branches at stage %d.\n", variant->label,
+             variant->stage);
+    }
+    variantCount++;
+  }
+
+  fclose(f);
+
+  if (variantCount == 0)
+    errOutput("no sweep variants in %s.", filename);
+}
+
+/**
+ * Waits for one of the variant processes to exit.
+ */
+static void reapChild(void) {
+  int status;
+  pid_t pid;
+
+  // the variant processes are the only children of the main process
+  while ((pid = waitpid(-1, &status, 0)) < 0) {
+    if (errno != EINTR)
+      errOutput("unable to wait for sweep variants.");
+  }
+
+  for (int i = 0; i < childCount; i++) {
+    if (children[i] == pid) {
+      children[i] = children[--childCount];
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        failedCount++;
+      return;
+    }
+  }
+}
+
+/**
+ * Forks a process for each variant branching at stage, which applies the
+ * options of the variant and continues processing the sheet. Does nothing in
+ * the forked processes themselves. apply gets arg along with the options.
+ *
+ * @return true if the main process is done with the sheet, because all
+ * variants have branched off and none of them uses the base parameters
+ */
+bool sweepBranch(SWEEP_STAGES stage, SweepApplyFunction apply, void *arg) {
+  if (variantCount == 0 || currentVariant != -1)
+    return false;
+
+  for (int i = 0; i < variantCount; i++) {
+    if (variants[i].stage != stage)
+      continue;
+
+    while (childCount >= maxChildren)
+      reapChild();
+
+    // don't let the forked process repeat buffered output
+    instrumentFlush();
+    fflush(NULL);
+
+    const pid_t pid = fork();
+    if (pid < 0)
+      errOutput("unable to fork sweep variant '%s'.", variants[i].label);
+
+    if (pid == 0) {
+      currentVariant = i;
+      childCount = 0;
+      if (sweepVerbose >= VERBOSE_NORMAL) {
+        printf("sweep variant %s.\n", variants[i].label);
+      }
+      apply(variants[i].argc, variants[i].argv, arg);
+      return false;
+    }
+
+    children[childCount++] = pid;
+  }
+
+  return stage == lastStage && baseVariant == -1;
+}
+
+/**
+ * Builds the name of an output file for the variant processed by this
+ * process, by inserting its label before the file extension.
+ */
+void sweepOutputName(char *buf, size_t len, const char *filename) {
+  const int variant = (currentVariant != -1) ? currentVariant : baseVariant;
+  const char *basename = strrchr(filename, '/');
+  const char *extension;
+
+  if (variant == -1) {
+    snprintf(buf, len, "%s", filename);
+    return;
+  }
+
+  basename = (basename != NULL) ? basename + 1 : filename;
+  extension = strrchr(basename, '.');
+  if (extension == NULL || extension == basename)
+    extension = filename + strlen(filename);
+
+  if (snprintf(buf, len, "%.*s.%s%s", (int)(extension - filename), filename,
+               variants[variant].label, extension) >= (int)len)
+    errOutput("output file name too long for sweep variant '%s'.",
+              variants[variant].label);
+}
+
+/**
+ * Ends the processing of a sheet: forked processes exit, the main process
+ * waits for them.
+ */
+void sweepEndSheet(void) {
+  if (currentVariant != -1) {
+    exit(0);
+  }
+
+  while (childCount > 0)
+    reapChild();
+}
+
+void sweepFinish(void) {
+  if (failedCount > 0) {
+    errOutput("%d sweep variant process%s failed.", failedCount,
+              (failedCount > 1) ? "es" : "");
+  }
+}
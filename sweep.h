@@ -0,0 +1,45 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "constants.h"
+
+/* --- parameter sweep ---------------------------------------------------- */
+
+// Processing stages in pipeline order. Each sweep variant branches off the
+// sheet at the first stage affected by one of its options.
+typedef enum {
+  SWEEP_STAGE_INPUT,
+  SWEEP_STAGE_PREPROCESS,
+  SWEEP_STAGE_BLACKFILTER,
+  SWEEP_STAGE_NOISEFILTER,
+  SWEEP_STAGE_BLURFILTER,
+  SWEEP_STAGE_MASKS,
+  SWEEP_STAGE_GRAYFILTER,
+  SWEEP_STAGE_DESKEW,
+  SWEEP_STAGE_CENTER,
+  SWEEP_STAGE_WIPE,
+  SWEEP_STAGE_BORDER,
+  SWEEP_STAGE_POST,
+  SWEEP_STAGE_OUTPUT,
+  SWEEP_STAGES_COUNT
+} SWEEP_STAGES;
+
+// applies the options of a variant on top of the options of the run, given
+// as arg
+typedef void (*SweepApplyFunction)(int argc, char *argv[], void *arg);
+
+void sweepLoad(const char *filename, int processes, VERBOSE_LEVEL verbose);
+
+bool sweepBranch(SWEEP_STAGES stage, SweepApplyFunction apply, void *arg);
+
+void sweepOutputName(char *buf, size_t len, const char *filename);
+
+void sweepEndSheet(void);
+
+void sweepFinish(void);
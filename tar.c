@@ -0,0 +1,407 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- tar archives ------------------------------------------------------- */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tar.h"
+#include "unpaper.h"
+
+#define TAR_BLOCK 512
+
+// members of the input archive kept in memory once read, one per page of a
+// sheet
+#define TAR_KEPT 2
+
+/*
+ * Archives are read and written strictly in order, one block after the
+ * other, so that they can be pipes, and so that pages cost a single open of
+ * the archive rather than opening, probing and closing a file each.
+ */
+struct TarHeader {
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char mtime[12];
+  char chksum[8];
+  char typeflag;
+  char linkname[100];
+  char magic[6];
+  char version[2];
+  char uname[32];
+  char gname[32];
+  char devmajor[8];
+  char devminor[8];
+  char prefix[155];
+  char padding[12];
+};
+
+static FILE *input = NULL;
+static const char *inputFilename = NULL;
+static bool inputEnded = false;
+
+static struct {
+  char *name;
+  uint8_t *data;
+  size_t size;
+} kept[TAR_KEPT];
+static int keptNext = 0;
+
+static FILE *output = NULL;
+static const char *outputFilename = NULL;
+
+/* --- reading ------------------------------------------------------------ */
+
+static uint64_t parseNumber(const char *field, size_t length) {
+  uint64_t value = 0;
+
+  // GNU base-256 encoding, for sizes that do not fit in octal
+  if ((uint8_t)field[0] & 0x80) {
+    value = (uint8_t)field[0] & 0x3f;
+    for (size_t i = 1; i < length; i++) {
+      value = (value << 8) | (uint8_t)field[i];
+    }
+    return value;
+  }
+
+  for (size_t i = 0; i < length && field[i] != '\0'; i++) {
+    if (field[i] >= '0' && field[i] <= '7') {
+      value = (value << 3) | (field[i] - '0');
+    } else if (field[i] != ' ') {
+      errOutput("invalid header in tar archive %s.", inputFilename);
+    }
+  }
+  return value;
+}
+
+static unsigned headerChecksum(const uint8_t block[TAR_BLOCK]) {
+  const size_t offset = offsetof(struct TarHeader, chksum);
+  unsigned sum = 0;
+
+  for (size_t i = 0; i < TAR_BLOCK; i++) {
+    sum += (i >= offset && i < offset + 8) ? ' ' : block[i];
+  }
+  return sum;
+}
+
+static void readBytes(void *buffer, size_t size) {
+  if (fread(buffer, 1, size, input) != size)
+    errOutput("tar archive %s is truncated.", inputFilename);
+}
+
+/**
+ * Reads the data of a member and the padding after it into a newly
+ * allocated buffer, NUL-terminated so that it can hold names as well.
+ */
+static uint8_t *readData(uint64_t size) {
+  uint8_t padding[TAR_BLOCK];
+  uint8_t *data = malloc(size + 1);
+
+  if (data == NULL)
+    errOutput("tar archive %s: member too large.", inputFilename);
+  readBytes(data, size);
+  data[size] = '\0';
+  readBytes(padding, (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+
+  return data;
+}
+
+static void skipData(uint64_t size) {
+  uint8_t block[TAR_BLOCK];
+
+  for (uint64_t blocks = (size + TAR_BLOCK - 1) / TAR_BLOCK; blocks > 0;
+       blocks--) {
+    readBytes(block, TAR_BLOCK);
+  }
+}
+
+/**
+ * Takes the path out of the records of a pax extended header.
+ */
+static char *paxPath(const char *records, uint64_t size) {
+  char *path = NULL;
+
+  for (uint64_t offset = 0; offset < size;) {
+    char *end;
+    const unsigned long length = strtoul(records + offset, &end, 10);
+    const char *keyword = end + 1;
+
+    if (length == 0 || *end != ' ' || offset + length > size)
+      errOutput("invalid pax header in tar archive %s.", inputFilename);
+    if (strncmp(keyword, "path=", 5) == 0) {
+      const char *value = keyword + 5;
+
+      free(path);
+      path = strndup(value, records + offset + length - 1 - value);
+    }
+    offset += length;
+  }
+  return path;
+}
+
+/**
+ * Reads on up to the next regular file of the archive, named wanted when
+ * not NULL, and keeps it in memory; the members before it are skipped.
+ * Returns false at the end of the archive.
+ */
+static bool readMember(const char *wanted) {
+  uint8_t block[TAR_BLOCK];
+  const struct TarHeader *header = (const struct TarHeader *)block;
+  char *longName = NULL;
+
+  while (!inputEnded) {
+    const size_t read = fread(block, 1, TAR_BLOCK, input);
+    if (read == 0) {
+      inputEnded = true; // some writers leave out the end blocks
+      break;
+    } else if (read != TAR_BLOCK) {
+      errOutput("tar archive %s is truncated.", inputFilename);
+    }
+
+    bool zero = true;
+    for (int i = 0; i < TAR_BLOCK && zero; i++) {
+      zero = (block[i] == 0);
+    }
+    if (zero) {
+      inputEnded = true;
+      break;
+    }
+
+    if (parseNumber(header->chksum, sizeof(header->chksum)) !=
+        headerChecksum(block)) {
+      errOutput("invalid header in tar archive %s.", inputFilename);
+    }
+    const uint64_t size = parseNumber(header->size, sizeof(header->size));
+
+    if (header->typeflag == 'L' || header->typeflag == 'x') {
+      // the name of the next member, as a GNU long name or in pax records
+      uint8_t *data = readData(size);
+
+      free(longName);
+      longName = (header->typeflag == 'L')
+                     ? (char *)data
+                     : paxPath((const char *)data, size);
+      if (header->typeflag == 'x')
+        free(data);
+      continue;
+    }
+    if (header->typeflag != '0' && header->typeflag != '\0' &&
+        header->typeflag != '7') {
+      // directories, links and other entries hold no pages
+      free(longName);
+      longName = NULL;
+      skipData(size);
+      continue;
+    }
+
+    char *name = longName;
+    if (name == NULL) {
+      const int nameLength = strnlen(header->name, sizeof(header->name));
+      const int prefixLength = (memcmp(header->magic, "ustar", 5) == 0)
+                                   ? strnlen(header->prefix,
+                                             sizeof(header->prefix))
+                                   : 0;
+
+      name = malloc(prefixLength + nameLength + 2);
+      if (prefixLength > 0) {
+        sprintf(name, "%.*s/%.*s", prefixLength, header->prefix, nameLength,
+                header->name);
+      } else {
+        sprintf(name, "%.*s", nameLength, header->name);
+      }
+    }
+    longName = NULL;
+
+    if (wanted != NULL && strcmp(name, wanted) != 0) {
+      free(name);
+      skipData(size);
+      continue;
+    }
+
+    free(kept[keptNext].name);
+    free(kept[keptNext].data);
+    kept[keptNext].name = name;
+    kept[keptNext].data = readData(size);
+    kept[keptNext].size = size;
+    keptNext = (keptNext + 1) % TAR_KEPT;
+    return true;
+  }
+
+  free(longName);
+  return false;
+}
+
+void tarOpenInput(const char *filename) {
+  inputFilename = filename;
+  if (strcmp(filename, "-") == 0) {
+    input = stdin;
+  } else if ((input = fopen(filename, "rb")) == NULL) {
+    errOutput("unable to open tar archive %s.", filename);
+  }
+}
+
+bool tarReading(void) { return input != NULL; }
+
+/**
+ * Reads the next page of the archive, in the order of its members, and
+ * gives its name.
+ */
+bool tarNextMember(char *name, size_t size) {
+  if (!readMember(NULL))
+    return false;
+
+  const char *read = kept[(keptNext + TAR_KEPT - 1) % TAR_KEPT].name;
+  if (strlen(read) >= size)
+    errOutput("name of tar member %s too long.", read);
+  strcpy(name, read);
+  return true;
+}
+
+/**
+ * Reads on up to the member named name, unless already read. Members are
+ * only read forward, so pages must come in the order of the sheets.
+ */
+bool tarFindMember(const char *name) {
+  const uint8_t *data;
+  size_t size;
+
+  return tarMember(name, &data, &size) || readMember(name);
+}
+
+/**
+ * Gives the content of a member already read.
+ */
+bool tarMember(const char *name, const uint8_t **data, size_t *size) {
+  if (input == NULL)
+    return false;
+
+  for (int i = 0; i < TAR_KEPT; i++) {
+    if (kept[i].name != NULL && strcmp(kept[i].name, name) == 0) {
+      *data = kept[i].data;
+      *size = kept[i].size;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* --- writing ------------------------------------------------------------ */
+
+static void writeBytes(const void *data, size_t size) {
+  if (fwrite(data, 1, size, output) != size)
+    errOutput("unable to write tar archive %s.", outputFilename);
+}
+
+static void writeHeader(const char *name, const char *prefix, uint64_t size,
+                        char typeflag) {
+  uint8_t block[TAR_BLOCK] = {0};
+  struct TarHeader *header = (struct TarHeader *)block;
+
+  if (size >= (1ull << 33))
+    errOutput("tar member %s too large.", name);
+
+  strncpy(header->name, name, sizeof(header->name));
+  strncpy(header->prefix, prefix, sizeof(header->prefix));
+  snprintf(header->mode, sizeof(header->mode), "%07o", 0644);
+  snprintf(header->uid, sizeof(header->uid), "%07o", 0);
+  snprintf(header->gid, sizeof(header->gid), "%07o", 0);
+  snprintf(header->size, sizeof(header->size), "%011llo",
+           (unsigned long long)size);
+  snprintf(header->mtime, sizeof(header->mtime), "%011llo",
+           (unsigned long long)time(NULL));
+  header->typeflag = typeflag;
+  memcpy(header->magic, "ustar", 6);
+  memcpy(header->version, "00", 2);
+  snprintf(header->chksum, sizeof(header->chksum), "%06o",
+           headerChecksum(block));
+  header->chksum[7] = ' ';
+
+  writeBytes(block, TAR_BLOCK);
+}
+
+static void writeData(const void *data, size_t size) {
+  const uint8_t padding[TAR_BLOCK] = {0};
+
+  writeBytes(data, size);
+  writeBytes(padding, (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+}
+
+void tarOpenOutput(const char *filename) {
+  outputFilename = filename;
+  if (strcmp(filename, "-") == 0) {
+    output = stdout;
+  } else if ((output = fopen(filename, "wb")) == NULL) {
+    errOutput("unable to create tar archive %s.", filename);
+  }
+}
+
+bool tarWriting(void) { return output != NULL; }
+
+/**
+ * Appends a member to the archive, and flushes it out at once, so that the
+ * archive can be read while it is written.
+ */
+void tarWriteMember(const char *name, const uint8_t *data, size_t size) {
+  const size_t length = strlen(name);
+  const char *split = NULL;
+
+  // names longer than the header holds are split in prefix and name at a
+  // slash, or else written as a GNU long name first
+  if (length > 100) {
+    for (const char *s = strchr(name, '/'); s != NULL && split == NULL;
+         s = strchr(s + 1, '/')) {
+      if (s - name <= 155 && length - (s - name) - 1 <= 100)
+        split = s;
+    }
+  }
+
+  if (length <= 100) {
+    writeHeader(name, "", size, '0');
+  } else if (split != NULL) {
+    char prefix[156];
+
+    snprintf(prefix, sizeof(prefix), "%.*s", (int)(split - name), name);
+    writeHeader(split + 1, prefix, size, '0');
+  } else {
+    writeHeader("././@LongLink", "", length + 1, 'L');
+    writeData(name, length + 1);
+    writeHeader(name, "", size, '0');
+  }
+  writeData(data, size);
+
+  if (fflush(output) != 0)
+    errOutput("unable to write tar archive %s.", outputFilename);
+}
+
+void tarClose(void) {
+  if (output != NULL) {
+    const uint8_t end[2 * TAR_BLOCK] = {0};
+
+    writeBytes(end, sizeof(end));
+    if ((output == stdout ? fflush(output) : fclose(output)) != 0)
+      errOutput("unable to write tar archive %s.", outputFilename);
+    output = NULL;
+  }
+
+  if (input != NULL) {
+    for (int i = 0; i < TAR_KEPT; i++) {
+      free(kept[i].name);
+      free(kept[i].data);
+      kept[i].name = NULL;
+      kept[i].data = NULL;
+    }
+    if (input != stdin)
+      fclose(input);
+    input = NULL;
+  }
+}
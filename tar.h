@@ -0,0 +1,29 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* --- tar archives ------------------------------------------------------- */
+
+void tarOpenInput(const char *filename);
+
+bool tarReading(void);
+
+bool tarNextMember(char *name, size_t size);
+
+bool tarFindMember(const char *name);
+
+bool tarMember(const char *name, const uint8_t **data, size_t *size);
+
+void tarOpenOutput(const char *filename);
+
+bool tarWriting(void);
+
+void tarWriteMember(const char *name, const uint8_t *data, size_t size);
+
+void tarClose(void);
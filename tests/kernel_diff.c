@@ -0,0 +1,886 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- differential test of the image kernels ----------------------------- */
+
+// Runs the reference and the optimized kernels on the same randomized images,
+// in every pixel format, over a range of sizes and parameters, and reports
+// the pixels on which they disagree beyond the tolerance of each kernel.
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+
+#include "../cpu.h"
+#include "../imageprocess.h"
+#include "../parallel.h"
+#include "../tools.h"
+#include "../unpaper.h"
+#include "kernels.h"
+
+const struct KernelTable optimizedKernels = {KERNELS(KERNEL_ENTRY)};
+
+#define DIFF_DEFAULT_SEEDS 3
+
+// threads the optimized kernels run on
+#define DIFF_DEFAULT_THREADS 4
+#define DIFF_MAX_VALUES 8
+
+static const int diffFormats[] = {
+    AV_PIX_FMT_GRAY8,     AV_PIX_FMT_Y400A,     AV_PIX_FMT_RGB24,
+    AV_PIX_FMT_MONOWHITE, AV_PIX_FMT_MONOBLACK,
+};
+#define DIFF_FORMATS_COUNT (sizeof(diffFormats) / sizeof(diffFormats[0]))
+
+// odd widths and heights, and widths around the 8 pixels of a 1-bit byte
+static const int diffSizes[][DIMENSIONS_COUNT] = {
+    {1, 1},   {1, 13},  {13, 1},  {7, 5},    {8, 8},    {9, 9},
+    {15, 17}, {31, 33}, {64, 64}, {65, 63},  {127, 97}, {203, 301},
+};
+#define DIFF_SIZES_COUNT (sizeof(diffSizes) / sizeof(diffSizes[0]))
+
+// A pixel differs when any of its components differs by more than delta;
+// a kernel fails when more than fraction of its pixels differ, or when one
+// of its results differs by more than value.
+struct Tolerance {
+  int delta;
+  double fraction;
+  double value;
+};
+
+// The outcome of a kernel: the resulting image, plus any value it returns.
+struct Outcome {
+  AVFrame *image;
+  double values[DIFF_MAX_VALUES];
+  int valueCount;
+};
+
+struct Variant {
+  const char *label;
+  int p[4];
+  float f;
+};
+
+struct Kernel {
+  const char *name;
+  // runs the kernel on image, which it may replace, on its own copy of the
+  // input; sets every parameter it depends on before the call
+  void (*run)(const struct KernelTable *k, const struct Variant *variant,
+              uint32_t seed, struct Outcome *outcome);
+  struct Tolerance tolerance;
+  const struct Variant *variants;
+  int variantCount;
+  // kernels that only work on images of at least this size
+  int minimumSize;
+};
+
+static uint32_t diffRandom(uint32_t *state) {
+  // xorshift32, so that every run tests the same images
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+static int randomRange(uint32_t *state, int low, int high) {
+  return low + (int)(diffRandom(state) % (uint32_t)(high - low + 1));
+}
+
+static int randomColor(uint32_t *state) {
+  switch (diffRandom(state) % 4) {
+  case 0:
+    return BLACK24;
+  case 1:
+    return GRAY24;
+  case 2: {
+    const int gray = randomRange(state, 0, 255);
+    return pixelValue(gray, gray, gray);
+  }
+  default:
+    return diffRandom(state) & WHITE24;
+  }
+}
+
+// the options the kernels run with, set up by setDefaults()
+static struct Options options;
+
+/**
+ * Creates an image of random content: blots of solid color, specks of
+ * noise, and a few lines and areas of random pixels, on white or gray.
+ */
+static AVFrame *createImage(const struct KernelTable *k, int format, int width,
+                            int height, uint32_t seed) {
+  AVFrame *image = NULL;
+  uint32_t state = seed * 2654435761u + 1;
+  const int area = width * height;
+
+  k->initImage(&image, width, height, format);
+  k->clearRect(0, 0, width - 1, height - 1, image,
+               (diffRandom(&state) % 4) ? WHITE24 : 0xe0e0e0,
+               options.absBlackThreshold);
+
+  for (int i = randomRange(&state, 0, 1 + area / 400); i > 0; i--) {
+    const int left = randomRange(&state, -4, width);
+    const int top = randomRange(&state, -4, height);
+    k->clearRect(left, top, left + randomRange(&state, 0, width / 3),
+                 top + randomRange(&state, 0, height / 3), image,
+                 randomColor(&state), options.absBlackThreshold);
+  }
+
+  for (int i = randomRange(&state, 0, area / 20); i > 0; i--) {
+    k->setPixel(randomColor(&state), randomRange(&state, 0, width - 1),
+                randomRange(&state, 0, height - 1), image,
+                options.absBlackThreshold);
+  }
+
+  if (diffRandom(&state) % 2) {
+    const int left = randomRange(&state, 0, width - 1);
+    const int top = randomRange(&state, 0, height - 1);
+    const int right = randomRange(&state, left, width - 1);
+    const int bottom = randomRange(&state, top, height - 1);
+    for (int y = top; y <= bottom; y++) {
+      for (int x = left; x <= right; x++) {
+        k->setPixel(diffRandom(&state) & WHITE24, x, y, image,
+                    options.absBlackThreshold);
+      }
+    }
+  }
+
+  return image;
+}
+
+/* --- kernels ------------------------------------------------------------ */
+
+static AVFrame *testImage;
+
+static void setDefaults(void) {
+  optionsInit(&options);
+  options.verbose = VERBOSE_QUIET;
+  options.blackThreshold = 0.33;
+  options.whiteThreshold = 0.9;
+  options.maskColor = WHITE24;
+  options.sheetBackground = WHITE24;
+  options.interpolateType = INTERP_CUBIC;
+  updateAbsoluteParameters(&options);
+}
+
+static AVFrame *copyImage(const struct KernelTable *k, AVFrame *source) {
+  AVFrame *image = NULL;
+
+  k->initImage(&image, source->width, source->height, source->format);
+  av_frame_copy(image, source);
+  return image;
+}
+
+static void randomRect(uint32_t *state, AVFrame *image, Mask rect) {
+  // may extend beyond the edges
+  rect[LEFT] = randomRange(state, -3, image->width);
+  rect[TOP] = randomRange(state, -3, image->height);
+  rect[RIGHT] = randomRange(state, rect[LEFT], image->width + 3);
+  rect[BOTTOM] = randomRange(state, rect[TOP], image->height + 3);
+}
+
+static void runPixels(const struct KernelTable *k,
+                      const struct Variant *variant, uint32_t seed,
+                      struct Outcome *outcome) {
+  uint32_t state = seed;
+  AVFrame *image = copyImage(k, testImage);
+
+  setDefaults();
+  for (int y = -1; y <= image->height; y++) {
+    for (int x = -1; x <= image->width; x++) {
+      const int pixel = k->getPixel(x, y, image);
+      if (diffRandom(&state) % 3 == 0)
+        k->setPixel(randomColor(&state), x, y, image,
+                    options.absBlackThreshold);
+      else
+        k->setPixel(pixel ^ variant->p[0], x, y, image,
+                    options.absBlackThreshold);
+    }
+  }
+  outcome->image = image;
+}
+
+static void runRects(const struct KernelTable *k, const struct Variant *variant,
+                     uint32_t seed, struct Outcome *outcome) {
+  uint32_t state = seed;
+  AVFrame *image = copyImage(k, testImage);
+  Mask rect;
+
+  setDefaults();
+  randomRect(&state, image, rect);
+  outcome->values[0] = k->inverseBrightnessRect(rect[LEFT], rect[TOP],
+                                                rect[RIGHT], rect[BOTTOM],
+                                                image);
+  outcome->values[1] = k->inverseLightnessRect(rect[LEFT], rect[TOP],
+                                               rect[RIGHT], rect[BOTTOM],
+                                               image);
+  outcome->values[2] =
+      k->darknessRect(rect[LEFT], rect[TOP], rect[RIGHT], rect[BOTTOM], image);
+  outcome->values[3] = k->countPixelsRect(
+      rect[LEFT], rect[TOP], rect[RIGHT], rect[BOTTOM], variant->p[0],
+      variant->p[1], variant->p[2], image);
+  outcome->values[4] =
+      k->clearRect(rect[LEFT], rect[TOP], rect[RIGHT], rect[BOTTOM], image,
+                   variant->p[3], options.absBlackThreshold);
+  outcome->valueCount = 5;
+  outcome->image = image;
+}
+
+static void runNeighbors(const struct KernelTable *k,
+                         const struct Variant *variant, uint32_t seed,
+                         struct Outcome *outcome) {
+  AVFrame *image = copyImage(k, testImage);
+  double sum = 0;
+
+  setDefaults();
+  for (int y = 0; y < image->height; y += 3) {
+    for (int x = 0; x < image->width; x += 3) {
+      sum += k->countPixelNeighbors(x, y, variant->p[0], variant->p[1], image);
+    }
+  }
+  outcome->values[0] = sum;
+  outcome->valueCount = 1;
+  outcome->image = image;
+}
+
+static void runFloodFill(const struct KernelTable *k,
+                         const struct Variant *variant, uint32_t seed,
+                         struct Outcome *outcome) {
+  uint32_t state = seed;
+  AVFrame *image = copyImage(k, testImage);
+
+  setDefaults();
+  for (int i = 0; i < 4; i++) {
+    // start from the corners as well as from inside the image
+    const int x = (i == 0) ? 0 : randomRange(&state, 0, image->width - 1);
+    const int y = (i == 1) ? image->height - 1
+                           : randomRange(&state, 0, image->height - 1);
+    k->floodFill(x, y, WHITE24, variant->p[0], variant->p[1], variant->p[2],
+                 image, options.absBlackThreshold);
+  }
+  outcome->image = image;
+}
+
+static void runCopyImageArea(const struct KernelTable *k,
+                             const struct Variant *variant, uint32_t seed,
+                             struct Outcome *outcome) {
+  uint32_t state = seed;
+  AVFrame *target = NULL;
+
+  setDefaults();
+  k->initImage(&target, testImage->width + variant->p[1],
+               testImage->height + variant->p[1], diffFormats[variant->p[0]]);
+  k->fillImage(target, options.sheetBackground, options.absBlackThreshold);
+  k->copyImageArea(randomRange(&state, 0, testImage->width - 1),
+                   randomRange(&state, 0, testImage->height - 1),
+                   randomRange(&state, 1, testImage->width),
+                   randomRange(&state, 1, testImage->height), testImage,
+                   randomRange(&state, -2, target->width - 1),
+                   randomRange(&state, -2, target->height - 1), target,
+                   options.absBlackThreshold);
+  outcome->image = target;
+}
+
+static void runRotate(const struct KernelTable *k,
+                      const struct Variant *variant, uint32_t seed,
+                      struct Outcome *outcome) {
+  AVFrame *target = NULL;
+
+  setDefaults();
+  options.interpolateType = variant->p[0];
+  k->initImage(&target, testImage->width, testImage->height,
+               testImage->format);
+  k->fillImage(target, options.sheetBackground, options.absBlackThreshold);
+  k->rotate(&options, degreesToRadians(variant->f), testImage, target);
+  outcome->image = target;
+}
+
+static void runStretch(const struct KernelTable *k,
+                       const struct Variant *variant, uint32_t seed,
+                       struct Outcome *outcome) {
+  AVFrame *image = copyImage(k, testImage);
+
+  setDefaults();
+  options.interpolateType = variant->p[0];
+  k->stretch(&options,
+             max(1, (int)(image->width * variant->f) + variant->p[1]),
+             max(1, (int)(image->height * variant->f) - variant->p[1]),
+             &image);
+  outcome->image = image;
+}
+
+static void runShift(const struct KernelTable *k,
+                     const struct Variant *variant, uint32_t seed,
+                     struct Outcome *outcome) {
+  AVFrame *image = copyImage(k, testImage);
+
+  setDefaults();
+  k->shift(&options, variant->p[0] * image->width / 2 + variant->p[1],
+           variant->p[2] * image->height / 2 + variant->p[3], &image);
+  outcome->image = image;
+}
+
+static void runMirror(const struct KernelTable *k,
+                      const struct Variant *variant, uint32_t seed,
+                      struct Outcome *outcome) {
+  AVFrame *image = copyImage(k, testImage);
+
+  setDefaults();
+  if (variant->p[1] != 0)
+    k->flipRotate(&options, variant->p[1], &image);
+  else
+    k->mirror(&options, variant->p[0], image);
+  outcome->image = image;
+}
+
+static void runMasks(const struct KernelTable *k, const struct Variant *variant,
+                     uint32_t seed, struct Outcome *outcome) {
+  uint32_t state = seed;
+  AVFrame *image = copyImage(k, testImage);
+  Mask areas[3];
+  const int count = variant->p[0];
+
+  setDefaults();
+  options.maskColor = variant->p[1];
+  for (int i = 0; i < count; i++) {
+    randomRect(&state, image, areas[i]);
+  }
+  if (variant->p[2])
+    k->applyWipes(&options, areas, count, image);
+  else
+    k->applyMasks(&options, areas, count, image);
+  outcome->image = image;
+}
+
+/**
+ * Sets up the mask scan of a variant, around the center of an image of width
+ * x height pixels and a random point on its top or bottom edge.
+ */
+static void setMaskScan(const struct Variant *variant, int width, int height,
+                        uint32_t seed) {
+  uint32_t state = seed;
+
+  setDefaults();
+  options.maskScanDirections = variant->p[0];
+  options.maskScanSize[HORIZONTAL] = options.maskScanSize[VERTICAL] =
+      variant->p[1];
+  options.maskScanDepth[HORIZONTAL] = options.maskScanDepth[VERTICAL] = -1;
+  options.maskScanStep[HORIZONTAL] = options.maskScanStep[VERTICAL] =
+      variant->p[2];
+  options.maskScanThreshold[HORIZONTAL] = options.maskScanThreshold[VERTICAL] =
+      variant->f;
+  options.maskScanMinimum[WIDTH] = options.maskScanMinimum[HEIGHT] = 1;
+  options.maskScanMaximum[WIDTH] = width;
+  options.maskScanMaximum[HEIGHT] = height;
+  options.pointCount = 2;
+  options.point[0][X] = width / 2;
+  options.point[0][Y] = height / 2;
+  options.point[1][X] = randomRange(&state, 0, width - 1);
+  options.point[1][Y] = (diffRandom(&state) % 2) ? 0 : height - 1;
+}
+
+static void maskValues(Mask *masks, int count, struct Outcome *outcome) {
+  outcome->valueCount = 0;
+  for (int i = 0; i < count && i < 2; i++) {
+    for (int edge = LEFT; edge < EDGES_COUNT; edge++) {
+      outcome->values[outcome->valueCount++] = masks[i][edge];
+    }
+  }
+}
+
+static void runDetectMasks(const struct KernelTable *k,
+                           const struct Variant *variant, uint32_t seed,
+                           struct Outcome *outcome) {
+  AVFrame *image = copyImage(k, testImage);
+  Mask masks[MAX_MASKS];
+  bool valid[MAX_MASKS];
+
+  setMaskScan(variant, image->width, image->height, seed);
+  maskValues(masks, k->detectMasks(&options, image, masks, valid), outcome);
+  outcome->image = image;
+}
+
+// The reference detects the masks of a blank sheet on a frame filled with the
+// background, the optimized code from the size of the sheet alone.
+static void runDetectBlankMasks(const struct KernelTable *k,
+                                const struct Variant *variant, uint32_t seed,
+                                struct Outcome *outcome) {
+  const int width = testImage->width;
+  const int height = testImage->height;
+  Mask masks[MAX_MASKS];
+  bool valid[MAX_MASKS];
+  int count;
+
+  setMaskScan(variant, width, height, seed);
+  options.sheetBackground = variant->p[3];
+  if (k == &referenceKernels) {
+    AVFrame *blank = NULL;
+
+    k->initImage(&blank, width, height, AV_PIX_FMT_GRAY8);
+    k->fillImage(blank, options.sheetBackground, options.absBlackThreshold);
+    count = k->detectMasks(&options, blank, masks, valid);
+    av_frame_free(&blank);
+  } else {
+    count = detectBlankMasks(&options, width, height, masks, valid);
+  }
+  maskValues(masks, count, outcome);
+  outcome->image = copyImage(k, testImage);
+}
+
+static void runDetectRotation(const struct KernelTable *k,
+                              const struct Variant *variant, uint32_t seed,
+                              struct Outcome *outcome) {
+  AVFrame *image = copyImage(k, testImage);
+  Mask area = {0, 0, image->width - 1, image->height - 1};
+
+  setDefaults();
+  options.deskewScanEdges = variant->p[0];
+  options.deskewScanSize = variant->p[1];
+  options.deskewScanDepth = 0.5;
+  options.deskewScanRange = variant->f;
+  options.deskewScanStep = 0.1;
+  options.deskewScanDeviation = 1.0;
+  updateAbsoluteParameters(&options);
+
+  int scanSize = options.deskewScanSize;
+  outcome->values[0] = k->detectRotation(&options, image, area, &scanSize);
+  outcome->valueCount = 1;
+  outcome->image = image;
+}
+
+static void runBlackfilter(const struct KernelTable *k,
+                           const struct Variant *variant, uint32_t seed,
+                           struct Outcome *outcome) {
+  uint32_t state = seed;
+  AVFrame *image = copyImage(k, testImage);
+
+  setDefaults();
+  options.blackfilterScanDirections = variant->p[0];
+  options.blackfilterScanSize[HORIZONTAL] =
+      options.blackfilterScanSize[VERTICAL] = variant->p[1];
+  options.blackfilterScanDepth[HORIZONTAL] =
+      options.blackfilterScanDepth[VERTICAL] = variant->p[2];
+  options.blackfilterScanStep[HORIZONTAL] =
+      options.blackfilterScanStep[VERTICAL] = variant->p[3];
+  options.blackfilterScanThreshold = variant->f;
+  options.blackfilterIntensity = 20;
+  options.blackfilterExcludeCount = diffRandom(&state) % 2;
+  if (options.blackfilterExcludeCount > 0)
+    randomRect(&state, image, options.blackfilterExclude[0]);
+  updateAbsoluteParameters(&options);
+
+  k->blackfilter(&options, image);
+  outcome->image = image;
+}
+
+static void runNoisefilter(const struct KernelTable *k,
+                           const struct Variant *variant, uint32_t seed,
+                           struct Outcome *outcome) {
+  AVFrame *image = copyImage(k, testImage);
+
+  setDefaults();
+  options.noisefilterIntensity = variant->p[0];
+  options.whiteThreshold = variant->f;
+  updateAbsoluteParameters(&options);
+
+  outcome->values[0] = k->noisefilter(&options, image);
+  outcome->valueCount = 1;
+  outcome->image = image;
+}
+
+static void runBlurfilter(const struct KernelTable *k,
+                          const struct Variant *variant, uint32_t seed,
+                          struct Outcome *outcome) {
+  AVFrame *image = copyImage(k, testImage);
+
+  setDefaults();
+  options.blurfilterScanSize[HORIZONTAL] =
+      options.blurfilterScanSize[VERTICAL] = variant->p[0];
+  options.blurfilterScanStep[HORIZONTAL] =
+      options.blurfilterScanStep[VERTICAL] = variant->p[1];
+  options.blurfilterIntensity = variant->f;
+
+  outcome->values[0] = k->blurfilter(&options, image);
+  outcome->valueCount = 1;
+  outcome->image = image;
+}
+
+static void runGrayfilter(const struct KernelTable *k,
+                          const struct Variant *variant, uint32_t seed,
+                          struct Outcome *outcome) {
+  AVFrame *image = copyImage(k, testImage);
+
+  setDefaults();
+  options.grayfilterScanSize[HORIZONTAL] =
+      options.grayfilterScanSize[VERTICAL] = variant->p[0];
+  options.grayfilterScanStep[HORIZONTAL] =
+      options.grayfilterScanStep[VERTICAL] = variant->p[1];
+  options.grayfilterThreshold = variant->f;
+  updateAbsoluteParameters(&options);
+
+  outcome->values[0] = k->grayfilter(&options, image);
+  outcome->valueCount = 1;
+  outcome->image = image;
+}
+
+static void runDetectBorder(const struct KernelTable *k,
+                            const struct Variant *variant, uint32_t seed,
+                            struct Outcome *outcome) {
+  AVFrame *image = copyImage(k, testImage);
+  Mask outside = {0, 0, image->width - 1, image->height - 1};
+  int borders[EDGES_COUNT];
+
+  setDefaults();
+  options.borderScanDirections = variant->p[0];
+  options.borderScanSize[HORIZONTAL] = options.borderScanSize[VERTICAL] =
+      variant->p[1];
+  options.borderScanStep[HORIZONTAL] = options.borderScanStep[VERTICAL] =
+      variant->p[2];
+  options.borderScanThreshold[HORIZONTAL] =
+      options.borderScanThreshold[VERTICAL] = variant->p[3];
+  if (variant->f > 0) {
+    // an outside mask reaching to the edges on one side only
+    outside[LEFT] = image->width / 3;
+    outside[BOTTOM] = image->height * 2 / 3;
+  }
+
+  k->detectBorder(&options, borders, outside, image);
+  for (int edge = LEFT; edge < EDGES_COUNT; edge++) {
+    outcome->values[edge] = borders[edge];
+  }
+  outcome->valueCount = EDGES_COUNT;
+  outcome->image = image;
+}
+
+#define VARIANTS(v) v, sizeof(v) / sizeof(v[0])
+
+static const struct Variant pixelsVariants[] = {
+    {"same", {0}},
+    {"inverted", {WHITE24}},
+};
+
+static const struct Variant rectsVariants[] = {
+    {"dark", {0, 170, false, WHITE24}},
+    {"clear", {0, 230, true, BLACK24}},
+    {"range", {30, 200, true, GRAY24}},
+};
+
+static const struct Variant neighborsVariants[] = {
+    {"low", {1, 230}},
+    {"default", {4, 230}},
+    {"high", {12, 128}},
+};
+
+static const struct Variant floodFillVariants[] = {
+    {"dark", {0, 170, 20}},
+    {"wide", {0, 250, 2}},
+    {"gray", {20, 200, 0}},
+};
+
+static const struct Variant copyVariants[] = {
+    {"gray8", {0, 0}},  {"ya8", {0, 3}},   {"rgb24", {2, -1}},
+    {"monow", {3, 5}},  {"monob", {4, 0}}, {"ya8-2", {1, 0}},
+};
+
+static const struct Variant rotateVariants[] = {
+    {"nearest", {INTERP_NN}, 1.5},   {"linear", {INTERP_LINEAR}, -0.7},
+    {"cubic", {INTERP_CUBIC}, 2.3},  {"nearest-90", {INTERP_NN}, 90.0},
+    {"linear-45", {INTERP_LINEAR}, 45.0},
+    {"cubic-small", {INTERP_CUBIC}, 0.05},
+};
+
+static const struct Variant stretchVariants[] = {
+    {"nearest-up", {INTERP_NN, 1}, 1.7},
+    {"linear-down", {INTERP_LINEAR, 0}, 0.6},
+    {"cubic-up", {INTERP_CUBIC, -1}, 1.3},
+    {"cubic-down", {INTERP_CUBIC, 2}, 0.45},
+    {"linear-same", {INTERP_LINEAR, 0}, 1.0},
+};
+
+static const struct Variant shiftVariants[] = {
+    {"small", {0, 3, 0, -2}},
+    {"half", {1, 0, -1, 1}},
+    {"out", {2, 1, 2, 1}},
+};
+
+static const struct Variant mirrorVariants[] = {
+    {"horizontal", {1 << HORIZONTAL, 0}},
+    {"vertical", {1 << VERTICAL, 0}},
+    {"both", {(1 << HORIZONTAL) | (1 << VERTICAL), 0}},
+    {"rotate-cw", {0, 1}},
+    {"rotate-ccw", {0, -1}},
+};
+
+static const struct Variant masksVariants[] = {
+    {"one", {1, WHITE24, false}},
+    {"three-gray", {3, GRAY24, false}},
+    {"wipe", {2, WHITE24, true}},
+    {"wipe-black", {3, BLACK24, true}},
+};
+
+static const struct Variant detectMasksVariants[] = {
+    {"horizontal", {1 << HORIZONTAL, 5, 1}, 0.1},
+    {"both", {(1 << HORIZONTAL) | (1 << VERTICAL), 3, 2}, 0.3},
+    {"coarse", {1 << VERTICAL, 20, 5}, 0.05},
+};
+
+static const struct Variant detectBlankMasksVariants[] = {
+    {"white", {(1 << HORIZONTAL) | (1 << VERTICAL), 3, 2, WHITE24}, 0.3},
+    {"black", {(1 << HORIZONTAL) | (1 << VERTICAL), 5, 1, BLACK24}, 0.1},
+    {"black-coarse", {1 << VERTICAL, 20, 5, BLACK24}, 0.05},
+};
+
+static const struct Variant detectRotationVariants[] = {
+    {"sides", {(1 << LEFT) | (1 << RIGHT), -1}, 5.0},
+    {"all", {(1 << LEFT) | (1 << TOP) | (1 << RIGHT) | (1 << BOTTOM), 20},
+     2.0},
+    {"top", {1 << TOP, 1500}, 1.0},
+};
+
+static const struct Variant blackfilterVariants[] = {
+    {"default", {(1 << HORIZONTAL) | (1 << VERTICAL), 20, 500, 5}, 0.95},
+    {"small", {(1 << HORIZONTAL) | (1 << VERTICAL), 4, 8, 1}, 0.9},
+    {"horizontal", {1 << HORIZONTAL, 7, 50, 3}, 0.5},
+    {"vertical", {1 << VERTICAL, 3, 3, 2}, 0.7},
+};
+
+static const struct Variant noisefilterVariants[] = {
+    {"default", {4}, 0.9},
+    {"low", {1}, 0.9},
+    {"high", {12}, 0.6},
+};
+
+static const struct Variant blurfilterVariants[] = {
+    {"default", {100, 50}, 0.01},
+    {"small", {8, 4}, 0.1},
+    {"tiny", {3, 1}, 0.3},
+};
+
+static const struct Variant grayfilterVariants[] = {
+    {"default", {50, 20}, 0.5},
+    {"small", {6, 3}, 0.5},
+    {"tiny", {3, 1}, 0.1},
+};
+
+static const struct Variant detectBorderVariants[] = {
+    {"vertical", {1 << VERTICAL, 5, 5, 5}, 0},
+    {"both", {(1 << HORIZONTAL) | (1 << VERTICAL), 2, 1, 1}, 0},
+    {"inside", {(1 << HORIZONTAL) | (1 << VERTICAL), 3, 2, 3}, 1},
+};
+
+// interpolated pixels may round differently in vectorized code
+static const struct Kernel diffKernels[] = {
+    {"pixels", runPixels, {0, 0, 0}, VARIANTS(pixelsVariants), 1},
+    {"rects", runRects, {0, 0, 0}, VARIANTS(rectsVariants), 1},
+    {"countPixelNeighbors", runNeighbors, {0, 0, 0},
+     VARIANTS(neighborsVariants), 1},
+    {"floodFill", runFloodFill, {0, 0, 0}, VARIANTS(floodFillVariants), 1},
+    {"copyImageArea", runCopyImageArea, {0, 0, 0}, VARIANTS(copyVariants), 1},
+    {"rotate", runRotate, {1, 0, 0}, VARIANTS(rotateVariants), 1},
+    {"stretch", runStretch, {1, 0, 0}, VARIANTS(stretchVariants), 1},
+    {"shift", runShift, {0, 0, 0}, VARIANTS(shiftVariants), 1},
+    {"mirror", runMirror, {0, 0, 0}, VARIANTS(mirrorVariants), 1},
+    {"masks", runMasks, {0, 0, 0}, VARIANTS(masksVariants), 1},
+    {"detectMasks", runDetectMasks, {0, 0, 0}, VARIANTS(detectMasksVariants),
+     2},
+    {"detectBlankMasks", runDetectBlankMasks, {0, 0, 0},
+     VARIANTS(detectBlankMasksVariants), 2},
+    {"detectRotation", runDetectRotation, {0, 0, 1e-4},
+     VARIANTS(detectRotationVariants), 2},
+    {"blackfilter", runBlackfilter, {0, 0, 0}, VARIANTS(blackfilterVariants),
+     1},
+    {"noisefilter", runNoisefilter, {0, 0, 0}, VARIANTS(noisefilterVariants),
+     1},
+    {"blurfilter", runBlurfilter, {0, 0, 0}, VARIANTS(blurfilterVariants), 1},
+    {"grayfilter", runGrayfilter, {0, 0, 0}, VARIANTS(grayfilterVariants), 1},
+    {"detectBorder", runDetectBorder, {0, 0, 0},
+     VARIANTS(detectBorderVariants), 2},
+};
+#define DIFF_KERNELS_COUNT (sizeof(diffKernels) / sizeof(diffKernels[0]))
+
+/* --- comparison --------------------------------------------------------- */
+
+static int componentDelta(int a, int b) {
+  return max3(abs(red(a) - red(b)), abs(green(a) - green(b)),
+              abs(blue(a) - blue(b)));
+}
+
+/**
+ * Compares the outcomes of the two implementations of a kernel.
+ *
+ * @return true if they agree within the tolerance of the kernel
+ */
+static bool compareOutcomes(const struct Kernel *kernel, const char *label,
+                            struct Outcome *reference,
+                            struct Outcome *optimized, bool verboseReport) {
+  AVFrame *a = reference->image;
+  AVFrame *b = optimized->image;
+  long long differing = 0;
+  int maxDelta = 0;
+  int firstX = -1;
+  int firstY = -1;
+  bool agree = true;
+
+  if (a->width != b->width || a->height != b->height ||
+      a->format != b->format) {
+    printf("FAIL %s: image %dx%d %s != %dx%d %s\n", label, a->width,
+           a->height, av_get_pix_fmt_name(a->format), b->width, b->height,
+           av_get_pix_fmt_name(b->format));
+    return false;
+  }
+
+  for (int y = 0; y < a->height; y++) {
+    for (int x = 0; x < a->width; x++) {
+      const int delta = componentDelta(referenceKernels.getPixel(x, y, a),
+                                       referenceKernels.getPixel(x, y, b));
+      if (delta > maxDelta)
+        maxDelta = delta;
+      if (delta > kernel->tolerance.delta) {
+        if (differing++ == 0) {
+          firstX = x;
+          firstY = y;
+        }
+      }
+    }
+  }
+
+  if (differing > kernel->tolerance.fraction * a->width * a->height) {
+    printf("FAIL %s: %lld of %d pixels differ, max delta %d, first at "
+           "(%d,%d): %06x != %06x\n",
+           label, differing, a->width * a->height, maxDelta, firstX, firstY,
+           referenceKernels.getPixel(firstX, firstY, a),
+           referenceKernels.getPixel(firstX, firstY, b));
+    agree = false;
+  }
+
+  if (reference->valueCount != optimized->valueCount) {
+    printf("FAIL %s: %d results != %d results\n", label,
+           reference->valueCount, optimized->valueCount);
+    return false;
+  }
+  for (int i = 0; i < reference->valueCount; i++) {
+    if (fabs(reference->values[i] - optimized->values[i]) >
+        kernel->tolerance.value) {
+      printf("FAIL %s: result %d is %g != %g\n", label, i,
+             reference->values[i], optimized->values[i]);
+      agree = false;
+    }
+  }
+
+  if (agree && verboseReport) {
+    printf("ok %s: max delta %d, %lld pixels within tolerance\n", label,
+           maxDelta, differing);
+  }
+  return agree;
+}
+
+static const struct option diffOptions[] = {
+    {"filter", required_argument, NULL, 'f'},
+    {"seeds", required_argument, NULL, 's'},
+    {"threads", required_argument, NULL, 't'},
+    {"verbose", no_argument, NULL, 'v'},
+    {NULL, no_argument, NULL, 0},
+};
+
+int main(int argc, char *argv[]) {
+  const char *filter = NULL;
+  int seeds = DIFF_DEFAULT_SEEDS;
+  int threads = DIFF_DEFAULT_THREADS;
+  bool verboseReport = false;
+  int cases = 0;
+  int failures = 0;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "f:s:t:v", diffOptions, NULL)) != -1) {
+    switch (c) {
+    case 'f':
+      filter = optarg;
+      break;
+    case 's':
+      seeds = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'v':
+      verboseReport = true;
+      break;
+    default:
+      fprintf(stderr,
+              "Usage: %s [--filter KERNEL] [--seeds N] [--threads N] "
+              "[--verbose]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  parallelInit(threads, VERBOSE_QUIET);
+
+  // the optimized kernels are checked with the row kernels of every level
+  // the CPU supports
+  for (CPU_LEVEL level = CPU_SCALAR; level < CPU_LEVELS_COUNT; level++) {
+    if (!cpuSupported(level))
+      continue;
+    cpuSelect(level);
+
+    for (size_t k = 0; k < DIFF_KERNELS_COUNT; k++) {
+      const struct Kernel *kernel = &diffKernels[k];
+
+      if (filter != NULL && strstr(kernel->name, filter) == NULL)
+        continue;
+
+      for (size_t f = 0; f < DIFF_FORMATS_COUNT; f++) {
+        for (size_t s = 0; s < DIFF_SIZES_COUNT; s++) {
+          const int width = diffSizes[s][WIDTH];
+          const int height = diffSizes[s][HEIGHT];
+
+          if (width < kernel->minimumSize || height < kernel->minimumSize)
+            continue;
+
+          for (uint32_t seed = 1; seed <= (uint32_t)seeds; seed++) {
+            setDefaults();
+            testImage = createImage(&referenceKernels, diffFormats[f], width,
+                                    height, seed);
+
+            for (int v = 0; v < kernel->variantCount; v++) {
+              const struct Variant *variant = &kernel->variants[v];
+              struct Outcome reference = {0};
+              struct Outcome optimized = {0};
+              char label[256];
+
+              snprintf(label, sizeof(label), "%s/%s %s %dx%d seed %u %s",
+                       kernel->name, variant->label,
+                       av_get_pix_fmt_name(diffFormats[f]), width, height,
+                       seed, cpuLevelName(level));
+
+              kernel->run(&referenceKernels, variant, seed, &reference);
+              kernel->run(&optimizedKernels, variant, seed, &optimized);
+
+              cases++;
+              if (!compareOutcomes(kernel, label, &reference, &optimized,
+                                   verboseReport))
+                failures++;
+
+              av_frame_free(&reference.image);
+              av_frame_free(&optimized.image);
+            }
+
+            av_frame_free(&testImage);
+          }
+        }
+      }
+    }
+  }
+
+  parallelFinish();
+
+  printf("%d cases, %d failed.\n", cases, failures);
+  return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+
+#include "constants.h"
+
+struct Options;
+
+/* --- image kernels under differential test ------------------------------ */
+
+// One implementation of the image kernels. The members are listed in the
+// same order as KERNELS(), which initializes them.
+struct KernelTable {
+  void (*initImage)(AVFrame **image, int width, int height, int pixel_format);
+  void (*fillImage)(AVFrame *image, int color, unsigned int blackThreshold);
+  bool (*setPixel)(int pixel, int x, int y, AVFrame *image,
+                   unsigned int blackThreshold);
+  int (*getPixel)(int x, int y, AVFrame *image);
+  int (*clearRect)(int left, int top, int right, int bottom, AVFrame *image,
+                   int blackwhite, unsigned int blackThreshold);
+  void (*copyImageArea)(int x, int y, int width, int height, AVFrame *source,
+                        int toX, int toY, AVFrame *target,
+                        unsigned int blackThreshold);
+  uint8_t (*inverseBrightnessRect)(int x1, int y1, int x2, int y2,
+                                   AVFrame *image);
+  uint8_t (*inverseLightnessRect)(int x1, int y1, int x2, int y2,
+                                  AVFrame *image);
+  uint8_t (*darknessRect)(int x1, int y1, int x2, int y2, AVFrame *image);
+  int (*countPixelsRect)(int left, int top, int right, int bottom,
+                         int minColor, int maxBrightness, bool clear,
+                         AVFrame *image);
+  int (*countPixelNeighbors)(int x, int y, int intensity, int whiteMin,
+                             AVFrame *image);
+  void (*floodFill)(int x, int y, int color, int maskMin, int maskMax,
+                    int intensity, AVFrame *image, unsigned int blackThreshold);
+  float (*detectRotation)(const struct Options *options, AVFrame *image,
+                          Mask mask, int *scanSize);
+  void (*rotate)(const struct Options *options, float radians,
+                 AVFrame *source, AVFrame *target);
+  void (*stretch)(const struct Options *options, int w, int h,
+                  AVFrame **image);
+  void (*shift)(const struct Options *options, int shiftX, int shiftY,
+                AVFrame **image);
+  int (*detectMasks)(const struct Options *options, AVFrame *image,
+                     Mask *masks, bool *valid);
+  void (*applyMasks)(const struct Options *options, Mask *masks, int maskCount,
+                     AVFrame *image);
+  void (*applyWipes)(const struct Options *options, Mask *area, int areaCount,
+                     AVFrame *image);
+  void (*mirror)(const struct Options *options, int directions,
+                 AVFrame *image);
+  void (*flipRotate)(const struct Options *options, int direction,
+                     AVFrame **image);
+  void (*blackfilter)(const struct Options *options, AVFrame *image);
+  int (*noisefilter)(const struct Options *options, AVFrame *image);
+  int (*blurfilter)(const struct Options *options, AVFrame *image);
+  int (*grayfilter)(const struct Options *options, AVFrame *image);
+  void (*detectBorder)(const struct Options *options, int border[EDGES_COUNT],
+                       Mask outsideMask, AVFrame *image);
+};
+
+#define KERNELS(K)                                                             \
+  K(initImage)                                                                 \
+  K(fillImage)                                                                 \
+  K(setPixel)                                                                  \
+  K(getPixel)                                                                  \
+  K(clearRect)                                                                 \
+  K(copyImageArea)                                                             \
+  K(inverseBrightnessRect)                                                     \
+  K(inverseLightnessRect)                                                      \
+  K(darknessRect)                                                              \
+  K(countPixelsRect)                                                           \
+  K(countPixelNeighbors)                                                       \
+  K(floodFill)                                                                 \
+  K(detectRotation)                                                            \
+  K(rotate)                                                                    \
+  K(stretch)                                                                   \
+  K(shift)                                                                     \
+  K(detectMasks)                                                               \
+  K(applyMasks)                                                                \
+  K(applyWipes)                                                                \
+  K(mirror)                                                                    \
+  K(flipRotate)                                                                \
+  K(blackfilter)                                                               \
+  K(noisefilter)                                                               \
+  K(blurfilter)                                                                \
+  K(grayfilter)                                                                \
+  K(detectBorder)
+
+#define KERNEL_ENTRY(name) name,
+
+// the kernels as built in the program
+extern const struct KernelTable optimizedKernels;
+
+// the plain implementations, built with UNPAPER_REFERENCE
+extern const struct KernelTable referenceKernels;
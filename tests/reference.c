@@ -0,0 +1,61 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- reference implementations of the image kernels --------------------- */
+
+// The kernels are built a second time, under other names, with every
+// optimized variant compiled out, to serve as the reference the optimized
+// build is compared against.
+
+#include "kernels.h"
+
+#define UNPAPER_REFERENCE
+
+#define initImage reference_initImage
+#define fillImage reference_fillImage
+#define setPixel reference_setPixel
+#define getPixel reference_getPixel
+#define getPixelDarknessInverse reference_getPixelDarknessInverse
+#define clearRect reference_clearRect
+#define copyImageArea reference_copyImageArea
+#define centerImage reference_centerImage
+#define inverseBrightnessRect reference_inverseBrightnessRect
+#define inverseLightnessRect reference_inverseLightnessRect
+#define darknessRect reference_darknessRect
+#define countPixelsRect reference_countPixelsRect
+#define countPixelNeighbors reference_countPixelNeighbors
+#define clearPixelNeighbors reference_clearPixelNeighbors
+#define floodFill reference_floodFill
+#define detectRotation reference_detectRotation
+#define detectRotationReport reference_detectRotationReport
+#define rotationScanSize reference_rotationScanSize
+#define rotate reference_rotate
+#define stretch reference_stretch
+#define resize reference_resize
+#define resizeDimensions reference_resizeDimensions
+#define shift reference_shift
+#define detectBlank reference_detectBlank
+#define detectMasks reference_detectMasks
+#define detectBlankMasks reference_detectBlankMasks
+#define applyMasks reference_applyMasks
+#define applyWipes reference_applyWipes
+#define mirror reference_mirror
+#define flipRotate reference_flipRotate
+#define blackfilter reference_blackfilter
+#define noisefilter reference_noisefilter
+#define blurfilter reference_blurfilter
+#define grayfilter reference_grayfilter
+#define centerMask reference_centerMask
+#define centerMaskReport reference_centerMaskReport
+#define centerMaskArea reference_centerMaskArea
+#define alignMask reference_alignMask
+#define detectBorder reference_detectBorder
+#define borderToMask reference_borderToMask
+#define applyBorder reference_applyBorder
+
+#include "../tools.c"
+
+#include "../imageprocess.c"
+
+const struct KernelTable referenceKernels = {KERNELS(KERNEL_ENTRY)};
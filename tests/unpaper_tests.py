@@ -3,12 +3,19 @@
 # SPDX-License-Identifier: GPL-2.0-only
 # SPDX-License-Identifier: MIT
 
+import ctypes
+import json
 import logging
 import os
 import pathlib
 import re
+import shutil
+import socket
+import struct
 import subprocess
 import sys
+import tarfile
+import time
 from typing import Sequence
 
 import pytest
@@ -433,3 +440,923 @@ def test_invalid_multi_index(imgsrc_path, tmp_path):
         "--no-processing", "1-", str(source_path), str(result_path), check=False
     )
     assert unpaper_result.returncode != 0
+
+
+def test_detection_cache(imgsrc_path, goldendir_path, tmp_path, capfd):
+    source_path = imgsrc_path / "imgsrc001.png"
+    golden_path = goldendir_path / "goldenA1.pbm"
+    cache_path = tmp_path / "cache"
+
+    # The second run replays the detection of the first one.
+    for result_name, stats in (
+        ("result1.pbm", "0 hits, 1 misses"),
+        ("result2.pbm", "1 hits, 0 misses"),
+    ):
+        result_path = tmp_path / result_name
+        run_unpaper(
+            "--detection-cache", str(cache_path), str(source_path), str(result_path)
+        )
+        assert f"detection cache: {stats}" in capfd.readouterr().out
+        assert compare_images(golden=golden_path, result=result_path) < 0.05
+
+    assert len(list(cache_path.glob("*.detect"))) == 1
+    assert (
+        compare_images(
+            golden=tmp_path / "result1.pbm", result=tmp_path / "result2.pbm"
+        )
+        == 0
+    )
+
+
+def test_journal_resume(imgsrc_path, tmp_path):
+    source_path = imgsrc_path / "imgsrc001.png"
+    result_path = tmp_path / "result.pbm"
+    journal_path = tmp_path / "journal"
+
+    run_unpaper("--journal", str(journal_path), str(source_path), str(result_path))
+    first_mtime = result_path.stat().st_mtime_ns
+
+    # Resuming does not trip over the existing output, nor rewrite it.
+    run_unpaper(
+        "--journal",
+        str(journal_path),
+        "--resume",
+        str(source_path),
+        str(result_path),
+    )
+    assert result_path.stat().st_mtime_ns == first_mtime
+
+    # Only the outputs the journal records as started may be replaced.
+    other_path = tmp_path / "other.pbm"
+    other_path.touch()
+    unpaper_result = run_unpaper(
+        "--journal",
+        str(journal_path),
+        "--resume",
+        str(source_path),
+        str(other_path),
+        check=False,
+    )
+    assert unpaper_result.returncode != 0
+    assert other_path.stat().st_size == 0
+
+
+def test_dedupe(imgsrc_path, tmp_path):
+    source_path = imgsrc_path / "imgsrc001.png"
+    result_paths = [tmp_path / f"result{i}.pbm" for i in range(1, 4)]
+
+    # The first sheet leaves different state behind for the second one than
+    # the second for the third, so only the third sheet reuses an output.
+    run_unpaper(
+        "--dedupe",
+        *[
+            str(path)
+            for result_path in result_paths
+            for path in (source_path, result_path)
+        ],
+    )
+
+    assert not result_paths[1].samefile(result_paths[0])
+    assert result_paths[2].samefile(result_paths[1])
+    assert compare_images(golden=result_paths[0], result=result_paths[1]) == 0
+
+
+def test_sweep(imgsrc_path, tmp_path):
+    source_path = imgsrc_path / "imgsrc001.png"
+    sweep_path = tmp_path / "sweep.txt"
+    sweep_path.write_text("base\nnoisy --noisefilter-intensity 8\n")
+
+    run_unpaper(str(source_path), str(tmp_path / "golden-base.pbm"))
+    run_unpaper(
+        "--noisefilter-intensity",
+        "8",
+        str(source_path),
+        str(tmp_path / "golden-noisy.pbm"),
+    )
+    run_unpaper(
+        "--sweep",
+        str(sweep_path),
+        str(source_path),
+        str(tmp_path / "result.pbm"),
+    )
+
+    for label in ("base", "noisy"):
+        assert (
+            compare_images(
+                golden=tmp_path / f"golden-{label}.pbm",
+                result=tmp_path / f"result.{label}.pbm",
+            )
+            == 0
+        )
+    assert not (tmp_path / "result.pbm").exists()
+
+
+def test_sweep_layout(imgsrc_path, tmp_path):
+    """Variants changing what the layout reads give the same output as runs
+    with their options alone, on the later sheets as well."""
+    source_path = imgsrc_path / "imgsrcE%03d.png"
+    variants = {
+        "wiped": ["--middle-wipe", "40,40"],
+        "points": ["--mask-scan-point", "900,1240", "--mask-scan-point", "2600,1240"],
+    }
+    sweep_path = tmp_path / "sweep.txt"
+    sweep_path.write_text(
+        "".join(f"{label} {' '.join(options)}\n" for label, options in variants.items())
+    )
+
+    for label, options in variants.items():
+        run_unpaper(
+            "--layout",
+            "double",
+            "--end-sheet",
+            "2",
+            *options,
+            str(source_path),
+            str(tmp_path / f"golden-{label}-%d.pbm"),
+        )
+    run_unpaper(
+        "--layout",
+        "double",
+        "--end-sheet",
+        "2",
+        "--sweep",
+        str(sweep_path),
+        str(source_path),
+        str(tmp_path / "result-%d.pbm"),
+    )
+
+    for label in variants:
+        for sheet in (1, 2):
+            assert (tmp_path / f"golden-{label}-{sheet}.pbm").read_bytes() == (
+                tmp_path / f"result-{sheet}.{label}.pbm"
+            ).read_bytes()
+
+
+def test_timings(imgsrc_path, tmp_path):
+    source_path = imgsrc_path / "imgsrc001.png"
+    timings_path = tmp_path / "timings.jsonl"
+
+    run_unpaper(
+        "--timings",
+        str(timings_path),
+        str(source_path),
+        str(tmp_path / "result.pbm"),
+    )
+
+    records = [
+        json.loads(line) for line in timings_path.read_text().splitlines()
+    ]
+    stages = {record["stage"] for record in records}
+    assert {"load", "noisefilter", "mask-detect", "save"} <= stages
+    assert all(record["sheet"] == 1 for record in records)
+    assert all(record["wall"] >= 0 for record in records)
+
+
+def test_trace(imgsrc_path, tmp_path):
+    source_path = imgsrc_path / "imgsrc001.png"
+    trace_path = tmp_path / "trace.json"
+
+    run_unpaper(
+        "--trace",
+        str(trace_path),
+        str(source_path),
+        str(tmp_path / "result.pbm"),
+    )
+
+    events = json.loads(trace_path.read_text())
+    spans = {event["name"]: event for event in events if event["ph"] == "X"}
+    assert spans["sheet"]["args"] == {"sheet": 1}
+    assert "edge-rotation" in spans
+    sheet = spans["sheet"]
+    deskew = spans["deskew-detect"]
+    assert sheet["ts"] <= deskew["ts"]
+    assert deskew["ts"] + deskew["dur"] <= sheet["ts"] + sheet["dur"]
+
+
+def test_perf_counters(imgsrc_path, tmp_path, capfd):
+    """Counters may not be available, but the run must succeed regardless."""
+    source_path = imgsrc_path / "imgsrc001.png"
+    result_path = tmp_path / "result.pbm"
+
+    run_unpaper("--perf-counters", str(source_path), str(result_path))
+
+    assert result_path.exists()
+    out, err = capfd.readouterr()
+    if "hardware performance counters" in err:
+        assert "hardware counters per stage:" not in out
+    else:
+        assert "hardware counters per stage:" in out
+        assert re.search(r"^noisefilter +1 ", out, re.MULTILINE)
+
+
+def test_memory_stats(imgsrc_path, tmp_path):
+    source_path = imgsrc_path / "imgsrc001.png"
+    timings_path = tmp_path / "timings.jsonl"
+
+    run_unpaper(
+        "--memory-stats",
+        "--timings",
+        str(timings_path),
+        str(source_path),
+        str(tmp_path / "result.pbm"),
+    )
+
+    records = [
+        json.loads(line) for line in timings_path.read_text().splitlines()
+    ]
+    sheet = next(record for record in records if record["stage"] == "sheet")
+    load = next(record for record in records if record["stage"] == "load")
+    assert load["allocated"] > 0
+    assert sheet["peak"] >= load["peak"]
+
+
+def test_metrics(imgsrc_path, tmp_path):
+    source_path = imgsrc_path / "imgsrc001.png"
+    metrics_path = tmp_path / "unpaper.prom"
+
+    run_unpaper(
+        "--metrics",
+        str(metrics_path),
+        str(source_path),
+        str(tmp_path / "result.pbm"),
+    )
+
+    metrics = dict(
+        line.rsplit(" ", 1)
+        for line in metrics_path.read_text().splitlines()
+        if not line.startswith("#")
+    )
+    assert metrics["unpaper_sheets_processed_total"] == "1"
+    assert metrics["unpaper_pages_written_total"] == "1"
+    assert metrics["unpaper_errors_total"] == "0"
+    assert metrics['unpaper_rotation_degrees_bucket{le="+Inf"}'] == "1"
+
+
+def test_summary(imgsrc_path, tmp_path, capfd):
+    run_unpaper(
+        "--summary",
+        str(imgsrc_path / "imgsrc001.png"),
+        str(tmp_path / "result-1.pbm"),
+        str(imgsrc_path / "imgsrc002.png"),
+        str(tmp_path / "result-2.pbm"),
+    )
+
+    out = capfd.readouterr().out
+    summary = out[out.index("run summary:") :]
+    assert "\n2 sheets processed, 2 pages written in " in summary
+    stages = {
+        match.group(1): (int(match.group(2)), match.group(3))
+        for match in re.finditer(
+            r"^([a-z-]+) +([0-9]+) +[0-9.]+ +[0-9.]+ +([0-9]+|-)$",
+            summary,
+            re.MULTILINE,
+        )
+    }
+    assert stages["load"] == (2, "-")
+    assert stages["save"] == (2, "-")
+    # the totals add up what each sheet printed
+    for stage, message in (
+        ("noisefilter", r"noise-filter \.\.\. deleted ([0-9]+) clusters\."),
+        ("blurfilter", r"blur-filter\.\.\. deleted ([0-9]+) pixels\."),
+        ("grayfilter", r"gray-filter\.\.\. deleted ([0-9]+) pixels\."),
+    ):
+        removed = [int(count) for count in re.findall(message, out)]
+        assert len(removed) == 2
+        assert stages[stage] == (2, str(sum(removed)))
+    rotations = re.search(r"^rotation \(degrees\):(.*)$", summary, re.MULTILINE)
+    assert sum(int(count) for count in re.findall(r": ([0-9]+)", rotations[1])) == 2
+
+
+def test_threads(imgsrc_path, tmp_path):
+    for source_name, result_name in (
+        ("imgsrc001.png", "result.pbm"),
+        ("imgsrc003.png", "result.ppm"),
+    ):
+        source_path = imgsrc_path / source_name
+        serial_path = tmp_path / f"serial-{result_name}"
+        threaded_path = tmp_path / f"threaded-{result_name}"
+
+        trace_path = tmp_path / "trace.json"
+
+        run_unpaper(str(source_path), str(serial_path))
+        run_unpaper(
+            "--threads",
+            "4",
+            "--trace",
+            str(trace_path),
+            str(source_path),
+            str(threaded_path),
+        )
+
+        assert compare_images(golden=serial_path, result=threaded_path) == 0
+        # The tasks of the filters ran on more than the calling thread.
+        events = json.loads(trace_path.read_text())
+        threads = {event["tid"] for event in events if event["name"] == "tasks"}
+        assert len(threads) > 1
+
+
+def test_threads_double_layout(imgsrc_path, tmp_path):
+    source_path = imgsrc_path / "imgsrcE001.png"
+
+    run_unpaper(
+        "--layout",
+        "double",
+        "--output-pages",
+        "2",
+        str(source_path),
+        str(tmp_path / "serial-%d.pbm"),
+    )
+    run_unpaper(
+        "--threads",
+        "2",
+        "--layout",
+        "double",
+        "--output-pages",
+        "2",
+        str(source_path),
+        str(tmp_path / "threaded-%d.pbm"),
+    )
+
+    for page in (1, 2):
+        assert (
+            compare_images(
+                golden=tmp_path / f"serial-{page}.pbm",
+                result=tmp_path / f"threaded-{page}.pbm",
+            )
+            == 0
+        )
+
+
+def test_shard(imgsrc_path, tmp_path):
+    source_path = imgsrc_path / "imgsrcE%03d.png"
+
+    run_unpaper(
+        "--deskew-scan-size",
+        "100",
+        str(source_path),
+        str(tmp_path / "serial-%d.pbm"),
+    )
+    for mode, first in (("contiguous", {1, 2}), ("round-robin", {1, 3})):
+        # Each shard only writes the sheets it owns.
+        for shard, written in (("1/2", first), ("2/2", {1, 2, 3})):
+            run_unpaper(
+                "--deskew-scan-size",
+                "100",
+                "--shard",
+                shard,
+                "--shard-mode",
+                mode,
+                str(source_path),
+                str(tmp_path / f"{mode}-%d.pbm"),
+            )
+            assert {
+                sheet
+                for sheet in (1, 2, 3)
+                if (tmp_path / f"{mode}-{sheet}.pbm").exists()
+            } == written
+
+        for sheet in (1, 2, 3):
+            assert (
+                compare_images(
+                    golden=tmp_path / f"serial-{sheet}.pbm",
+                    result=tmp_path / f"{mode}-{sheet}.pbm",
+                )
+                == 0
+            )
+
+
+def test_shard_deskew_scan_size(imgsrc_path, tmp_path, capfd):
+    source_path = imgsrc_path / "imgsrcE%03d.png"
+
+    # The deskew scan size the sheets of the other shards leave is unknown.
+    unpaper_result = run_unpaper(
+        "--shard",
+        "1/2",
+        str(source_path),
+        str(tmp_path / "default-%d.pbm"),
+        check=False,
+    )
+    assert unpaper_result.returncode != 0
+    assert "--shard requires --deskew-scan-size" in capfd.readouterr().err
+
+    # A scan size longer than the edges of the masks is narrowed by the first
+    # sheet deskewed, which stops the shard before saving it.
+    unpaper_result = run_unpaper(
+        "--deskew-scan-size",
+        "100000",
+        "--shard",
+        "1/2",
+        str(source_path),
+        str(tmp_path / "narrowed-%d.pbm"),
+        check=False,
+    )
+    assert unpaper_result.returncode != 0
+    assert "narrowed the deskew scan size" in capfd.readouterr().err
+    assert not (tmp_path / "narrowed-1.pbm").exists()
+
+
+def test_spool(imgsrc_path, tmp_path):
+    spool_path = tmp_path / "spool"
+    (spool_path / "queue").mkdir(parents=True)
+    for sheet in (1, 2, 3):
+        source_path = imgsrc_path / f"imgsrc00{sheet}.png"
+        run_unpaper(str(source_path), str(tmp_path / f"serial-{sheet}.pbm"))
+        (spool_path / "queue" / f"sheet{sheet}.job").write_text(
+            f"# sheet {sheet}\n{source_path} {tmp_path / f'spool-{sheet}.pbm'}\n"
+        )
+
+    # The claim of a worker that died long ago is taken over.
+    (spool_path / "claimed").mkdir()
+    (spool_path / "queue" / "sheet3.job").rename(
+        spool_path / "claimed" / "sheet3.job"
+    )
+    os.utime(spool_path / "claimed" / "sheet3.job", (0, 0))
+
+    unpaper_path = os.getenv("TEST_UNPAPER_BINARY", "unpaper")
+    workers = [
+        subprocess.Popen(
+            [unpaper_path, "--spool", str(spool_path), "--spool-lease", "1"]
+        )
+        for _ in range(2)
+    ]
+    assert [worker.wait() for worker in workers] == [0, 0]
+
+    assert not list((spool_path / "queue").iterdir())
+    assert not list((spool_path / "claimed").iterdir())
+    for sheet in (1, 2, 3):
+        result = (spool_path / "done" / f"sheet{sheet}.result").read_text()
+        assert result.startswith("status done\n")
+        assert (
+            compare_images(
+                golden=tmp_path / f"serial-{sheet}.pbm",
+                result=tmp_path / f"spool-{sheet}.pbm",
+            )
+            == 0
+        )
+
+
+def test_watch(imgsrc_path, tmp_path, capfd):
+    watch_path = tmp_path / "incoming"
+    watch_path.mkdir()
+    result_path = tmp_path / "result1.pbm"
+    golden_path = tmp_path / "golden.pbm"
+
+    run_unpaper(str(imgsrc_path / "imgsrc001.png"), str(golden_path))
+    # Files already there when unpaper starts are not processed.
+    shutil.copyfile(imgsrc_path / "imgsrc002.png", watch_path / "old.png")
+    capfd.readouterr()
+
+    unpaper_path = os.getenv("TEST_UNPAPER_BINARY", "unpaper")
+    watcher = subprocess.Popen(
+        [unpaper_path, "--watch", str(watch_path), str(tmp_path / "result%d.pbm")]
+    )
+    try:
+        time.sleep(1)
+        shutil.copyfile(imgsrc_path / "imgsrc001.png", watch_path / ".partial")
+        (watch_path / ".partial").rename(watch_path / "scan.png")
+
+        for _ in range(600):
+            if result_path.exists() or watcher.poll() is not None:
+                break
+            time.sleep(0.1)
+    finally:
+        watcher.terminate()
+    assert watcher.wait() == 0
+
+    assert compare_images(golden=golden_path, result=result_path) == 0
+    # The hidden file the copy went to is not taken for an input file.
+    out, _ = capfd.readouterr()
+    assert re.findall(r"Processing sheet #\d+: (\S+)", out) == [
+        str(watch_path / "scan.png")
+    ]
+
+
+def test_daemon(imgsrc_path, tmp_path):
+    socket_path = tmp_path / "unpaper.sock"
+
+    unpaper_path = os.getenv("TEST_UNPAPER_BINARY", "unpaper")
+    daemon = subprocess.Popen(
+        [unpaper_path, "--daemon", str(socket_path), "--daemon-jobs", "2"]
+    )
+    try:
+        for _ in range(100):
+            if socket_path.exists():
+                break
+            time.sleep(0.1)
+
+        client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        client.connect(str(socket_path))
+        # The third request fails, which only ends its own job.
+        for options, sheet in (([], 1), ([], 2), (["--layout", "invalid"], 1)):
+            request = b"".join(
+                argument.encode() + b"\0"
+                for argument in (
+                    *options,
+                    str(imgsrc_path / f"imgsrc00{sheet}.png"),
+                    str(tmp_path / f"daemon-{sheet}.pbm"),
+                )
+            )
+            client.sendall(struct.pack("!I", len(request)) + request)
+
+        answers = {}
+        stream = client.makefile("rb")
+        for _ in (1, 2, 3):
+            (length,) = struct.unpack("!I", stream.read(4))
+            answer = stream.read(length).decode()
+            answers[answer.split("\n")[0]] = answer
+        client.close()
+    finally:
+        daemon.terminate()
+    assert daemon.wait() == 0
+
+    assert sorted(answer.split("\n")[1] for answer in answers.values()) == [
+        "status done",
+        "status done",
+        "status failed",
+    ]
+    # The answer carries what the job printed.
+    assert (
+        f"{imgsrc_path / 'imgsrc001.png'} -> {tmp_path / 'daemon-1.pbm'}"
+        in answers["request 1"]
+    )
+    assert "unknown layout mode 'invalid'" in answers["request 3"]
+    for sheet in (1, 2):
+        run_unpaper(
+            str(imgsrc_path / f"imgsrc00{sheet}.png"),
+            str(tmp_path / f"golden-{sheet}.pbm"),
+        )
+        assert (
+            compare_images(
+                golden=tmp_path / f"golden-{sheet}.pbm",
+                result=tmp_path / f"daemon-{sheet}.pbm",
+            )
+            == 0
+        )
+
+
+class UnpaperImage(ctypes.Structure):
+    _fields_ = [
+        ("data", ctypes.c_void_p),
+        ("stride", ctypes.c_int),
+        ("width", ctypes.c_int),
+        ("height", ctypes.c_int),
+        ("format", ctypes.c_int),
+        ("frame", ctypes.c_void_p),
+    ]
+
+
+class UnpaperOptions(ctypes.Structure):
+    _fields_ = [("argc", ctypes.c_int), ("argv", ctypes.POINTER(ctypes.c_char_p))]
+
+
+@pytest.mark.skipif(
+    os.getenv("TEST_LIBUNPAPER") is None, reason="library not built"
+)
+def test_library(imgsrc_path, tmp_path, monkeypatch):
+    library = ctypes.CDLL(os.getenv("TEST_LIBUNPAPER"))
+    library.unpaperError.restype = ctypes.c_char_p
+
+    def create(*args):
+        argv = (ctypes.c_char_p * len(args))(*(arg.encode() for arg in args))
+        context = ctypes.c_void_p()
+        status = library.unpaperCreate(
+            ctypes.byref(UnpaperOptions(len(args), argv)), ctypes.byref(context)
+        )
+        return status, context
+
+    status, context = create("--journal", str(tmp_path / "journal"))
+    assert status == 1
+    assert library.unpaperError(context) == b"option not available in the library."
+    library.unpaperDestroy(context)
+
+    monkeypatch.setenv("UNPAPER_CPU", "invalid")
+    status, context = create("--no-blackfilter")
+    assert status == 3
+    assert library.unpaperError(context).startswith(b"unknown CPU level")
+    library.unpaperDestroy(context)
+    monkeypatch.delenv("UNPAPER_CPU")
+
+    status, context = create("--no-blackfilter")
+    assert status == 0
+
+    source = PIL.Image.open(imgsrc_path / "imgsrc001.png").convert("RGB")
+    source.save(tmp_path / "source.ppm")
+    pixels = ctypes.create_string_buffer(source.tobytes())
+    source_image = UnpaperImage(
+        ctypes.cast(pixels, ctypes.c_void_p),
+        source.width * 3,
+        source.width,
+        source.height,
+        1,
+        None,
+    )
+    result_image = UnpaperImage()
+    source_image.stride -= 1
+    assert (
+        library.unpaperProcess(
+            context, ctypes.byref(source_image), 1, ctypes.byref(result_image), 1
+        )
+        == 2
+    )
+    source_image.stride += 1
+    assert (
+        library.unpaperProcess(
+            context, ctypes.byref(source_image), 1, ctypes.byref(result_image), 1
+        )
+        == 0
+    )
+    assert result_image.format == 1
+    data = ctypes.string_at(result_image.data, result_image.stride * result_image.height)
+    PIL.Image.frombytes(
+        "RGB",
+        (result_image.width, result_image.height),
+        b"".join(
+            data[y * result_image.stride :][: result_image.width * 3]
+            for y in range(result_image.height)
+        ),
+    ).save(tmp_path / "result.ppm")
+    library.unpaperFreeImage(ctypes.byref(result_image))
+    library.unpaperDestroy(context)
+
+    # a sheet too large to allocate fails the call, not the process
+    status, context = create("--sheet-size", "1000000,1000000")
+    assert status == 0
+    assert (
+        library.unpaperProcess(
+            context, ctypes.byref(source_image), 1, ctypes.byref(result_image), 1
+        )
+        == 3
+    )
+    assert library.unpaperError(context).startswith(b"unable to allocate buffer")
+    assert result_image.frame is None
+    library.unpaperDestroy(context)
+
+    run_unpaper(
+        "--no-blackfilter", str(tmp_path / "source.ppm"), str(tmp_path / "golden.ppm")
+    )
+    assert (
+        compare_images(golden=tmp_path / "golden.ppm", result=tmp_path / "result.ppm")
+        == 0
+    )
+
+
+def test_manifest(imgsrc_path, tmp_path, capfd):
+    manifest_path = tmp_path / "manifest"
+    manifest_path.write_text(
+        "# sheets\n"
+        + "\t".join(
+            [
+                str(imgsrc_path / "imgsrc001.png"),
+                str(tmp_path / "manifest-1.pbm"),
+                "--no-deskew",
+            ]
+        )
+        + "\n"
+        + json.dumps(
+            {
+                "inputs": [str(imgsrc_path / "imgsrc002.png")],
+                "outputs": [str(tmp_path / "manifest-2.pbm")],
+            }
+        )
+        + "\n"
+    )
+
+    run_unpaper("--manifest", str(manifest_path))
+
+    run_unpaper(
+        "--no-deskew",
+        str(imgsrc_path / "imgsrc001.png"),
+        str(tmp_path / "golden-1.pbm"),
+    )
+    run_unpaper(
+        str(imgsrc_path / "imgsrc002.png"),
+        str(tmp_path / "golden-2.pbm"),
+    )
+    for sheet in (1, 2):
+        assert (
+            compare_images(
+                golden=tmp_path / f"golden-{sheet}.pbm",
+                result=tmp_path / f"manifest-{sheet}.pbm",
+            )
+            == 0
+        )
+
+    manifest_path.write_text(
+        "\t".join(
+            [
+                str(imgsrc_path / "imgsrc001.png"),
+                str(tmp_path / "invalid.pbm"),
+                "--output-pages",
+                "2",
+            ]
+        )
+        + "\n"
+    )
+    capfd.readouterr()
+    assert run_unpaper("--manifest", str(manifest_path), check=False).returncode != 0
+    assert not (tmp_path / "invalid.pbm").exists()
+    _, err = capfd.readouterr()
+    assert "manifest line 1: options of the whole run" in err
+
+    # The options of a record are part of the keys of --dedupe and
+    # --journal: the third sheet is the same as the second but for them.
+    def write_records(options):
+        manifest_path.write_text(
+            "".join(
+                "\t".join(
+                    [
+                        str(imgsrc_path / "imgsrc001.png"),
+                        str(tmp_path / f"keyed-{sheet}.pbm"),
+                        *(options if sheet == 3 else []),
+                    ]
+                )
+                + "\n"
+                for sheet in (1, 2, 3)
+            )
+        )
+
+    journal_path = tmp_path / "journal"
+    write_records(["--noisefilter-intensity", "8"])
+    run_unpaper(
+        "--dedupe",
+        "--journal",
+        str(journal_path),
+        "--manifest",
+        str(manifest_path),
+    )
+    assert not (tmp_path / "keyed-3.pbm").samefile(tmp_path / "keyed-2.pbm")
+
+    write_records(["--noisefilter-intensity", "9"])
+    capfd.readouterr()
+    run_unpaper(
+        "--overwrite",
+        "--journal",
+        str(journal_path),
+        "--resume",
+        "--manifest",
+        str(manifest_path),
+    )
+    out, _ = capfd.readouterr()
+    assert "Skipping sheet #2" in out
+    assert "Skipping sheet #3" not in out
+
+
+def test_tar(imgsrc_path, tmp_path):
+    input_path = tmp_path / "input.tar"
+    output_path = tmp_path / "output.tar"
+
+    with tarfile.open(input_path, "w") as archive:
+        for sheet in (1, 2):
+            archive.add(imgsrc_path / f"imgsrc00{sheet}.png", f"scan{sheet}.png")
+
+    run_unpaper(
+        "--input-tar",
+        str(input_path),
+        "--output-tar",
+        str(output_path),
+        "page%d.pbm",
+    )
+
+    with tarfile.open(output_path) as archive:
+        assert archive.getnames() == ["page1.pbm", "page2.pbm"]
+        archive.extractall(tmp_path / "extracted")
+
+    # The input archive is read in a single pass, so a pipe does as well.
+    unpaper_path = os.getenv("TEST_UNPAPER_BINARY", "unpaper")
+    subprocess.run(
+        [unpaper_path, "--input-tar", "-", str(tmp_path / "piped%d.pbm")],
+        input=input_path.read_bytes(),
+        check=True,
+    )
+    for sheet in (1, 2):
+        assert (tmp_path / f"piped{sheet}.pbm").read_bytes() == (
+            tmp_path / "extracted" / f"page{sheet}.pbm"
+        ).read_bytes()
+
+    for sheet in (1, 2):
+        run_unpaper(
+            str(imgsrc_path / f"imgsrc00{sheet}.png"),
+            str(tmp_path / f"golden-{sheet}.pbm"),
+        )
+        assert (
+            compare_images(
+                golden=tmp_path / f"golden-{sheet}.pbm",
+                result=tmp_path / "extracted" / f"page{sheet}.pbm",
+            )
+            == 0
+        )
+
+
+def test_async_io(imgsrc_path, tmp_path, capfd):
+    run_unpaper(
+        "--async-io",
+        "2",
+        str(imgsrc_path / "imgsrc001.png"),
+        str(tmp_path / "result-1.pbm"),
+        str(imgsrc_path / "imgsrc002.png"),
+        str(tmp_path / "result-2.pbm"),
+    )
+
+    assert not list(tmp_path.glob("*.tmp"))
+    for sheet in (1, 2):
+        run_unpaper(
+            str(imgsrc_path / f"imgsrc00{sheet}.png"),
+            str(tmp_path / f"golden-{sheet}.pbm"),
+        )
+        assert (
+            compare_images(
+                golden=tmp_path / f"golden-{sheet}.pbm",
+                result=tmp_path / f"result-{sheet}.pbm",
+            )
+            == 0
+        )
+
+    # An error on the second sheet still leaves the output of the first one,
+    # written behind, complete.
+    capfd.readouterr()
+    unpaper_result = run_unpaper(
+        "--async-io",
+        "2",
+        str(imgsrc_path / "imgsrc001.png"),
+        str(tmp_path / "stopped-1.pbm"),
+        str(imgsrc_path / "imgsrc002.png"),
+        str(tmp_path / "missing" / "stopped-2.pbm"),
+        check=False,
+    )
+    assert unpaper_result.returncode != 0
+    assert "cannot open" in capfd.readouterr().err
+    assert not list(tmp_path.glob("*.tmp"))
+    assert (
+        compare_images(
+            golden=tmp_path / "golden-1.pbm", result=tmp_path / "stopped-1.pbm"
+        )
+        == 0
+    )
+
+
+def test_insert_blank_sheet(imgsrc_path, tmp_path):
+    # blank sheets are inserted between numbered input files
+    shutil.copy(imgsrc_path / "imgsrc001.png", tmp_path / "source-1.png")
+    result1_path = tmp_path / "result-1.pbm"
+    result2_path = tmp_path / "result-2.pbm"
+
+    run_unpaper(
+        "--insert-blank",
+        "2",
+        "--end-sheet",
+        "2",
+        str(tmp_path / "source-%d.png"),
+        str(tmp_path / "result-%d.pbm"),
+    )
+
+    result1_image = PIL.Image.open(result1_path)
+    result2_image = PIL.Image.open(result2_path)
+    assert result2_image.size == result1_image.size
+    assert result2_image.convert("L").getextrema() == (255, 255)
+
+
+def speckled_page(path: pathlib.Path, specks: int) -> None:
+    """Save a white page of 400x400 pixels with a number of single black
+    pixels, each on one of the 10000 points the blank detection samples."""
+
+    page = PIL.Image.new("L", (400, 400), 255)
+    for i in range(specks):
+        page.putpixel((10 + 16 * (i % 24), 10 + 16 * (i // 24)), 0)
+    page.save(path)
+
+
+def test_blank_threshold(tmp_path, capfd):
+    source_path = tmp_path / "source.pgm"
+    speckled_page(source_path, 5)
+
+    run_unpaper(str(source_path), str(tmp_path / "golden.pbm"))
+    capfd.readouterr()
+    run_unpaper(
+        "--blank-threshold",
+        "0.001",
+        str(source_path),
+        str(tmp_path / "result.pbm"),
+    )
+
+    assert "blank sheet, skipping processing." in capfd.readouterr().out
+    assert (
+        compare_images(golden=tmp_path / "golden.pbm", result=tmp_path / "result.pbm")
+        == 0
+    )
+
+
+def test_blank_threshold_exceeded(tmp_path, capfd):
+    source_path = tmp_path / "source.pgm"
+    speckled_page(source_path, 20)
+
+    capfd.readouterr()
+    run_unpaper(
+        "--blank-threshold",
+        "0.001",
+        str(source_path),
+        str(tmp_path / "result.pbm"),
+    )
+
+    out = capfd.readouterr().out
+    assert "blank sheet, skipping processing." not in out
+    assert "noise-filter ... deleted 20 clusters." in out
@@ -11,6 +11,8 @@
 #include <libavutil/avutil.h>
 #include <libavutil/pixfmt.h>
 
+#include "cpu.h"
+#include "instrument.h"
 #include "tools.h"
 #include "unpaper.h"
 
@@ -73,8 +75,7 @@ static void getPixelComponents(AVFrame *image, int x, int y, uint8_t *r,
  * Allocates a memory block for storing image data and fills the IMAGE-struct
  * with the specified values.
  */
-void initImage(AVFrame **image, int width, int height, int pixel_format,
-               bool fill) {
+void initImage(AVFrame **image, int width, int height, int pixel_format) {
   int ret;
 
   (*image) = av_frame_alloc();
@@ -88,23 +89,38 @@ void initImage(AVFrame **image, int width, int height, int pixel_format,
     av_strerror(ret, errbuff, sizeof(errbuff));
     errOutput("unable to allocate buffer: %s", errbuff);
   }
+  accountFrame(*image);
+}
 
-  if (fill) {
-    for (int y = 0; y < (*image)->height; y++) {
-      for (int x = 0; x < (*image)->width; x++) {
-        setPixel(sheetBackground, x, y, *image);
-      }
-    }
+/**
+ * Fills a whole image with a color, including the padding bytes of the rows.
+ */
+void fillImage(AVFrame *image, int color, unsigned int blackThreshold) {
+  if (image->height <= 0)
+    return;
+
+  // fill the first row pixel by pixel, then replicate it, as every row has
+  // the same content.
+  for (int x = 0; x < image->width; x++) {
+    setPixel(color, x, 0, image, blackThreshold);
+  }
+  for (int y = 1; y < image->height; y++) {
+    memcpy(image->data[0] + y * image->linesize[0], image->data[0],
+           image->linesize[0]);
   }
 }
 
 /**
  * Sets the color/grayscale value of a single pixel.
  *
+ * Colors are written to black-and-white images as black when their grayscale
+ * value is below blackThreshold.
+ *
  * @return true if the pixel has been changed, false if the original color was
  * the one to set
  */
-bool setPixel(int pixel, int x, int y, AVFrame *image) {
+bool setPixel(int pixel, int x, int y, AVFrame *image,
+              unsigned int blackThreshold) {
   uint8_t *pix;
 
   if ((x < 0) || (x >= image->width) || (y < 0) || (y >= image->height)) {
@@ -115,7 +131,7 @@ bool setPixel(int pixel, int x, int y, AVFrame *image) {
   uint8_t g = (pixel >> 8) & 0xff;
   uint8_t b = pixel & 0xff;
 
-  uint8_t pixelbw = pixelGrayscale(r, g, b) < absBlackThreshold ? BLACK : WHITE;
+  uint8_t pixelbw = pixelGrayscale(r, g, b) < blackThreshold ? BLACK : WHITE;
 
   switch (image->format) {
   case AV_PIX_FMT_GRAY8:
@@ -211,6 +227,153 @@ uint8_t getPixelDarknessInverse(int x, int y, AVFrame *image) {
   return max3(r, g, b);
 }
 
+#ifndef UNPAPER_REFERENCE
+
+/* --- row kernel fast paths ---------------------------------------------- */
+
+// pixels converted at a time when a row needs converting to grayscale
+#define GRAY_CHUNK 1024
+
+/**
+ * Whether the rectangle functions can work on whole rows of image with the
+ * row kernels.
+ */
+static bool hasRowKernels(AVFrame *image) {
+  return image->format == AV_PIX_FMT_GRAY8 ||
+         image->format == AV_PIX_FMT_RGB24;
+}
+
+/**
+ * Clips a non-empty rectangle to the image.
+ *
+ * @return the number of pixels of the rectangle outside the image.
+ */
+static unsigned int clipRect(int *left, int *top, int *right, int *bottom,
+                             AVFrame *image) {
+  const unsigned int area =
+      (unsigned int)(*right - *left + 1) * (unsigned int)(*bottom - *top + 1);
+
+  *left = max(*left, 0);
+  *top = max(*top, 0);
+  *right = min(*right, image->width - 1);
+  *bottom = min(*bottom, image->height - 1);
+  if (*left > *right || *top > *bottom)
+    return area;
+  return area -
+         (unsigned int)(*right - *left + 1) * (unsigned int)(*bottom - *top + 1);
+}
+
+/**
+ * Returns the grayscale values of n pixels of a row, starting at (x,y):
+ * pointing into the image for GRAY8, or converted into buffer for RGB24, in
+ * which case n must not exceed GRAY_CHUNK.
+ */
+static const uint8_t *grayRow(int x, int y, int n, AVFrame *image,
+                              uint8_t *buffer) {
+  const uint8_t *row = image->data[0] + y * image->linesize[0];
+
+  if (image->format == AV_PIX_FMT_GRAY8)
+    return row + x;
+
+  rowKernels.grayRGB24(row + x * 3, buffer, n);
+  return buffer;
+}
+
+/**
+ * Sums the grayscale values of a rectangular area inside the image.
+ */
+static uint64_t sumGrayRect(int left, int top, int right, int bottom,
+                            AVFrame *image) {
+  uint8_t buffer[GRAY_CHUNK];
+  uint64_t total = 0;
+
+  for (int y = top; y <= bottom; y++) {
+    for (int x = left; x <= right; x += GRAY_CHUNK) {
+      const int n = min(right - x + 1, GRAY_CHUNK);
+      total += rowKernels.sum(grayRow(x, y, n, image, buffer), n);
+    }
+  }
+  return total;
+}
+
+/**
+ * The average brightness of a rectangular area, as inverseBrightnessRect, of
+ * a GRAY8 or RGB24 image.
+ */
+static uint8_t inverseBrightnessRows(int x1, int y1, int x2, int y2,
+                                     AVFrame *image) {
+  const int count = (x2 - x1 + 1) * (y2 - y1 + 1);
+  const unsigned int outside = clipRect(&x1, &y1, &x2, &y2, image);
+  // wraps around like the per-pixel sum
+  unsigned int total = WHITE * outside;
+
+  if (outside < (unsigned int)count)
+    total += (unsigned int)sumGrayRect(x1, y1, x2, y2, image);
+  return WHITE - (total / count);
+}
+
+/**
+ * Counts the pixels of a rectangular area of a GRAY8 or RGB24 image with
+ * grayscale values between minColor and maxBrightness, as countPixelsRect
+ * without clearing.
+ */
+static int countPixelsRows(int left, int top, int right, int bottom,
+                           int minColor, int maxBrightness, AVFrame *image) {
+  const unsigned int outside = clipRect(&left, &top, &right, &bottom, image);
+  const int area = (right - left + 1) * (bottom - top + 1);
+  uint8_t buffer[GRAY_CHUNK];
+  int count = 0;
+
+  if (minColor > maxBrightness || maxBrightness < 0 || minColor > WHITE)
+    return 0;
+  if (maxBrightness >= WHITE)
+    count += outside;
+  if (left > right || top > bottom)
+    return count;
+
+  const uint8_t low = max(minColor, 0);
+  const uint8_t high = min(maxBrightness, WHITE);
+  if (low == 0 && high == WHITE)
+    return count + area;
+
+  for (int y = top; y <= bottom; y++) {
+    for (int x = left; x <= right; x += GRAY_CHUNK) {
+      const int n = min(right - x + 1, GRAY_CHUNK);
+      count +=
+          rowKernels.countRange(grayRow(x, y, n, image, buffer), n, low, high);
+    }
+  }
+  return count;
+}
+
+/**
+ * Fills a rectangular area of a GRAY8 or RGB24 image with a color, as
+ * clearRect.
+ */
+static int clearRows(int left, int top, int right, int bottom, AVFrame *image,
+                     int color) {
+  const uint8_t r = (color >> 16) & 0xff;
+  const uint8_t g = (color >> 8) & 0xff;
+  const uint8_t b = color & 0xff;
+
+  clipRect(&left, &top, &right, &bottom, image);
+  if (left > right || top > bottom)
+    return 0;
+
+  const int n = right - left + 1;
+  for (int y = top; y <= bottom; y++) {
+    uint8_t *row = image->data[0] + y * image->linesize[0];
+    if (image->format == AV_PIX_FMT_GRAY8) {
+      memset(row + left, pixelGrayscale(r, g, b), n);
+    } else {
+      rowKernels.fillRGB24(row + left * 3, n, r, g, b);
+    }
+  }
+  return n * (bottom - top + 1);
+}
+
+#endif
+
 /**
  * Sets the color/grayscale value of a single pixel to white.
  *
@@ -218,7 +381,8 @@ uint8_t getPixelDarknessInverse(int x, int y, AVFrame *image) {
  * the one to set
  */
 static bool clearPixel(int x, int y, AVFrame *image) {
-  return setPixel(WHITE24, x, y, image);
+  // white is never below the black threshold.
+  return setPixel(WHITE24, x, y, image, 0);
 }
 
 /**
@@ -226,12 +390,18 @@ static bool clearPixel(int x, int y, AVFrame *image) {
  * @return The number of pixels actually changed from black (dark) to white.
  */
 int clearRect(const int left, const int top, const int right, const int bottom,
-              AVFrame *image, const int blackwhite) {
+              AVFrame *image, const int blackwhite,
+              unsigned int blackThreshold) {
   int count = 0;
 
+#ifndef UNPAPER_REFERENCE
+  if (hasRowKernels(image) && left <= right && top <= bottom)
+    return clearRows(left, top, right, bottom, image, blackwhite);
+#endif
+
   for (int y = top; y <= bottom; y++) {
     for (int x = left; x <= right; x++) {
-      if (setPixel(blackwhite, x, y, image)) {
+      if (setPixel(blackwhite, x, y, image, blackThreshold)) {
         count++;
       }
     }
@@ -244,13 +414,13 @@ int clearRect(const int left, const int top, const int right, const int bottom,
  */
 void copyImageArea(const int x, const int y, const int width, const int height,
                    AVFrame *source, const int toX, const int toY,
-                   AVFrame *target) {
+                   AVFrame *target, unsigned int blackThreshold) {
 
   // naive but generic implementation
   for (int row = 0; row < height; row++) {
     for (int col = 0; col < width; col++) {
       const int pixel = getPixel(x + col, y + row, source);
-      setPixel(pixel, toX + col, toY + row, target);
+      setPixel(pixel, toX + col, toY + row, target, blackThreshold);
     }
   }
 }
@@ -262,9 +432,11 @@ void copyImageArea(const int x, const int y, const int width, const int height,
  * at the edges.
  */
 static void centerImageArea(int x, int y, int w, int h, AVFrame *source,
-                            int toX, int toY, int ww, int hh, AVFrame *target) {
+                            int toX, int toY, int ww, int hh, AVFrame *target,
+                            int background, unsigned int blackThreshold) {
   if ((w < ww) || (h < hh)) { // white rest-border will remain, so clear first
-    clearRect(toX, toY, toX + ww - 1, toY + hh - 1, target, sheetBackground);
+    clearRect(toX, toY, toX + ww - 1, toY + hh - 1, target, background,
+              blackThreshold);
   }
   if (w < ww) {
     toX += (ww - w) / 2;
@@ -280,16 +452,18 @@ static void centerImageArea(int x, int y, int w, int h, AVFrame *source,
     y += (h - hh) / 2;
     h = hh;
   }
-  copyImageArea(x, y, w, h, source, toX, toY, target);
+  copyImageArea(x, y, w, h, source, toX, toY, target, blackThreshold);
 }
 
 /**
- * Centers a whole image inside an area of another image.
+ * Centers a whole image inside an area of another image, filling the rest of
+ * the area with the background color.
  */
 void centerImage(AVFrame *source, int toX, int toY, int ww, int hh,
-                 AVFrame *target) {
+                 AVFrame *target, int background,
+                 unsigned int blackThreshold) {
   centerImageArea(0, 0, source->width, source->height, source, toX, toY, ww, hh,
-                  target);
+                  target, background, blackThreshold);
 }
 
 /**
@@ -300,6 +474,11 @@ uint8_t inverseBrightnessRect(const int x1, const int y1, const int x2,
   unsigned int total = 0;
   const int count = (x2 - x1 + 1) * (y2 - y1 + 1);
 
+#ifndef UNPAPER_REFERENCE
+  if (hasRowKernels(image) && x1 <= x2 && y1 <= y2)
+    return inverseBrightnessRows(x1, y1, x2, y2, image);
+#endif
+
   for (int y = y1; y <= y2; y++) {
     for (int x = x1; x <= x2; x++) {
       total += getPixelGrayscale(x, y, image);
@@ -316,6 +495,12 @@ uint8_t inverseLightnessRect(const int x1, const int y1, const int x2,
   unsigned int total = 0;
   const int count = (x2 - x1 + 1) * (y2 - y1 + 1);
 
+#ifndef UNPAPER_REFERENCE
+  // lightness and darkness are the brightness for grayscale
+  if (image->format == AV_PIX_FMT_GRAY8 && x1 <= x2 && y1 <= y2)
+    return inverseBrightnessRows(x1, y1, x2, y2, image);
+#endif
+
   for (int y = y1; y <= y2; y++) {
     for (int x = x1; x <= x2; x++) {
       total += getPixelLightness(x, y, image);
@@ -332,6 +517,12 @@ uint8_t darknessRect(const int x1, const int y1, const int x2, const int y2,
   unsigned int total = 0;
   const int count = (x2 - x1 + 1) * (y2 - y1 + 1);
 
+#ifndef UNPAPER_REFERENCE
+  // lightness and darkness are the brightness for grayscale
+  if (image->format == AV_PIX_FMT_GRAY8 && x1 <= x2 && y1 <= y2)
+    return inverseBrightnessRows(x1, y1, x2, y2, image);
+#endif
+
   for (int y = y1; y <= y2; y++) {
     for (int x = x1; x <= x2; x++) {
       total += getPixelDarknessInverse(x, y, image);
@@ -349,6 +540,12 @@ int countPixelsRect(int left, int top, int right, int bottom, int minColor,
                     int maxBrightness, bool clear, AVFrame *image) {
   int count = 0;
 
+#ifndef UNPAPER_REFERENCE
+  if (!clear && hasRowKernels(image) && left <= right && top <= bottom)
+    return countPixelsRows(left, top, right, bottom, minColor, maxBrightness,
+                           image);
+#endif
+
   for (int y = top; y <= bottom; y++) {
     for (int x = left; x <= right; x++) {
       const int pixel = getPixelGrayscale(x, y, image);
@@ -473,7 +670,7 @@ void clearPixelNeighbors(int x, int y, int whiteMin, AVFrame *image) {
  */
 static int fillLine(int x, int y, int stepX, int stepY, int color,
                     uint8_t maskMin, uint8_t maskMax, int intensity,
-                    AVFrame *image) {
+                    AVFrame *image, unsigned int blackThreshold) {
   int distance = 0;
   int intensityCount = 1; // first pixel must match, otherwise directly exit
   const int w = image->width;
@@ -490,7 +687,7 @@ static int fillLine(int x, int y, int stepX, int stepY, int color,
                         // until stop
     }
     if ((intensityCount > 0) && (x >= 0) && (x < w) && (y >= 0) && (y < h)) {
-      setPixel(color, x, y, image);
+      setPixel(color, x, y, image, blackThreshold);
       distance++;
     } else {
       return distance; // exit here
@@ -509,20 +706,21 @@ static int fillLine(int x, int y, int stepX, int stepY, int color,
  */
 static void floodFillAroundLine(int x, int y, int stepX, int stepY,
                                 int distance, int color, int maskMin,
-                                int maskMax, int intensity, AVFrame *image) {
+                                int maskMax, int intensity, AVFrame *image,
+                                unsigned int blackThreshold) {
   for (int d = 0; d < distance; d++) {
     if (stepX != 0) {
       x += stepX;
-      floodFill(x, y + 1, color, maskMin, maskMax, intensity,
-                image); // indirect recursion
-      floodFill(x, y - 1, color, maskMin, maskMax, intensity,
-                image); // indirect recursion
+      floodFill(x, y + 1, color, maskMin, maskMax, intensity, image,
+                blackThreshold); // indirect recursion
+      floodFill(x, y - 1, color, maskMin, maskMax, intensity, image,
+                blackThreshold); // indirect recursion
     } else {            // stepY != 0
       y += stepY;
-      floodFill(x + 1, y, color, maskMin, maskMax, intensity,
-                image); // indirect recursion
-      floodFill(x - 1, y, color, maskMin, maskMax, intensity,
-                image); // indirect recursion
+      floodFill(x + 1, y, color, maskMin, maskMax, intensity, image,
+                blackThreshold); // indirect recursion
+      floodFill(x - 1, y, color, maskMin, maskMax, intensity, image,
+                blackThreshold); // indirect recursion
     }
   }
 }
@@ -533,29 +731,33 @@ static void floodFillAroundLine(int x, int y, int stepX, int stepY,
  * @see earlier header-declaration to enable indirect recursive calls
  */
 void floodFill(int x, int y, int color, int maskMin, int maskMax, int intensity,
-               AVFrame *image) {
+               AVFrame *image, unsigned int blackThreshold) {
   // is current pixel to be filled?
   const int pixel = getPixelGrayscale(x, y, image);
   if ((pixel >= maskMin) && (pixel <= maskMax)) {
     // first, fill a 'cross' (both vertical, horizontal line)
-    setPixel(color, x, y, image);
+    setPixel(color, x, y, image, blackThreshold);
     const int left =
-        fillLine(x, y, -1, 0, color, maskMin, maskMax, intensity, image);
+        fillLine(x, y, -1, 0, color, maskMin, maskMax, intensity, image,
+                 blackThreshold);
     const int top =
-        fillLine(x, y, 0, -1, color, maskMin, maskMax, intensity, image);
+        fillLine(x, y, 0, -1, color, maskMin, maskMax, intensity, image,
+                 blackThreshold);
     const int right =
-        fillLine(x, y, 1, 0, color, maskMin, maskMax, intensity, image);
+        fillLine(x, y, 1, 0, color, maskMin, maskMax, intensity, image,
+                 blackThreshold);
     const int bottom =
-        fillLine(x, y, 0, 1, color, maskMin, maskMax, intensity, image);
+        fillLine(x, y, 0, 1, color, maskMin, maskMax, intensity, image,
+                 blackThreshold);
     // now recurse on each neighborhood-pixel of the cross (most recursions will
     // immediately return)
     floodFillAroundLine(x, y, -1, 0, left, color, maskMin, maskMax, intensity,
-                        image);
+                        image, blackThreshold);
     floodFillAroundLine(x, y, 0, -1, top, color, maskMin, maskMax, intensity,
-                        image);
+                        image, blackThreshold);
     floodFillAroundLine(x, y, 1, 0, right, color, maskMin, maskMax, intensity,
-                        image);
+                        image, blackThreshold);
     floodFillAroundLine(x, y, 0, 1, bottom, color, maskMin, maskMax, intensity,
-                        image);
+                        image, blackThreshold);
   }
 }
@@ -12,29 +12,32 @@
 
 /* --- tool functions for image handling ---------------------------------- */
 
-void initImage(AVFrame **image, int width, int height, int pixel_format,
-               bool fill);
+void initImage(AVFrame **image, int width, int height, int pixel_format);
+
+void fillImage(AVFrame *image, int color, unsigned int blackThreshold);
 
 static inline void replaceImage(AVFrame **image, AVFrame **newimage) {
   av_frame_free(image);
   *image = *newimage;
 }
 
-bool setPixel(int pixel, const int x, const int y, AVFrame *image);
+bool setPixel(int pixel, const int x, const int y, AVFrame *image,
+              unsigned int blackThreshold);
 
 int getPixel(int x, int y, AVFrame *image);
 
 uint8_t getPixelDarknessInverse(int x, int y, AVFrame *image);
 
 int clearRect(const int left, const int top, const int right, const int bottom,
-              AVFrame *image, const int blackwhite);
+              AVFrame *image, const int blackwhite,
+              unsigned int blackThreshold);
 
 void copyImageArea(const int x, const int y, const int width, const int height,
                    AVFrame *source, const int toX, const int toY,
-                   AVFrame *target);
+                   AVFrame *target, unsigned int blackThreshold);
 
 void centerImage(AVFrame *source, int toX, int toY, int ww, int hh,
-                 AVFrame *target);
+                 AVFrame *target, int background, unsigned int blackThreshold);
 
 uint8_t inverseBrightnessRect(const int x1, const int y1, const int x2,
                               const int y2, AVFrame *image);
@@ -54,4 +57,4 @@ int countPixelNeighbors(int x, int y, int intensity, int whiteMin,
 void clearPixelNeighbors(int x, int y, int whiteMin, AVFrame *image);
 
 void floodFill(int x, int y, int color, int maskMin, int maskMax, int intensity,
-               AVFrame *image);
+               AVFrame *image, unsigned int blackThreshold);
@@ -7,22 +7,37 @@
 /* --- The main program  -------------------------------------------------- */
 
 #include <getopt.h>
-#include <stdarg.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <libavutil/avutil.h>
 
+#include "asyncio.h"
+#include "cache.h"
+#include "cpu.h"
+#include "daemon.h"
+#include "dedupe.h"
+#include "instrument.h"
 #include "imageprocess.h"
+#include "journal.h"
+#include "manifest.h"
+#include "parallel.h"
+#include "sweep.h"
 #include "parse.h"
-#include "tools.h"
+#include "sheet.h"
+#include "spool.h"
+#include "tar.h"
 #include "unpaper.h"
 #include "version.h"
+#include "watch.h"
 
 #define WELCOME                                                                \
   "unpaper " VERSION_STR                                                              \
@@ -44,990 +59,711 @@
           "See 'man unpaper' for options details\n"                            \
           "Report bugs at https://github.com/unpaper/unpaper/issues\n"
 
-/* --- global variable ---------------------------------------------------- */
-
-VERBOSE_LEVEL verbose = VERBOSE_NONE;
-
-INTERP_FUNCTIONS interpolateType = INTERP_CUBIC;
-
-unsigned int absBlackThreshold;
-unsigned int absWhiteThreshold;
-unsigned int absBlackfilterScanThreshold;
-unsigned int absGrayfilterThreshold;
-float deskewScanRangeRad;
-float deskewScanStepRad;
-float deskewScanDeviationRad;
-
-int layout = LAYOUT_SINGLE;
-int startSheet = 1;
-int endSheet = -1;
-int startInput = -1;
-int startOutput = -1;
-int inputCount = 1;
-int outputCount = 1;
-int sheetSize[DIMENSIONS_COUNT] = {-1, -1};
-int sheetBackground = WHITE24;
-int preRotate = 0;
-int postRotate = 0;
-int preMirror = 0;
-int postMirror = 0;
-int preShift[DIRECTIONS_COUNT] = {0, 0};
-int postShift[DIRECTIONS_COUNT] = {0, 0};
-int size[DIRECTIONS_COUNT] = {-1, -1};
-int postSize[DIRECTIONS_COUNT] = {-1, -1};
-int stretchSize[DIRECTIONS_COUNT] = {-1, -1};
-int postStretchSize[DIRECTIONS_COUNT] = {-1, -1};
-float zoomFactor = 1.0;
-float postZoomFactor = 1.0;
-int pointCount = 0;
-int point[MAX_POINTS][COORDINATES_COUNT];
-int maskCount = 0;
-int mask[MAX_MASKS][EDGES_COUNT];
-int wipeCount = 0;
-int wipe[MAX_MASKS][EDGES_COUNT];
-int middleWipe[2] = {0, 0};
-int preWipeCount = 0;
-int preWipe[MAX_MASKS][EDGES_COUNT];
-int postWipeCount = 0;
-int postWipe[MAX_MASKS][EDGES_COUNT];
-int preBorder[EDGES_COUNT] = {0, 0, 0, 0};
-int postBorder[EDGES_COUNT] = {0, 0, 0, 0};
-int border[EDGES_COUNT] = {0, 0, 0, 0};
-bool maskValid[MAX_MASKS];
-int preMaskCount = 0;
-int preMask[MAX_MASKS][EDGES_COUNT];
-int blackfilterScanDirections = (1 << HORIZONTAL) | (1 << VERTICAL);
-int blackfilterScanSize[DIRECTIONS_COUNT] = {20, 20};
-int blackfilterScanDepth[DIRECTIONS_COUNT] = {500, 500};
-int blackfilterScanStep[DIRECTIONS_COUNT] = {5, 5};
-float blackfilterScanThreshold = 0.95;
-int blackfilterExcludeCount = 0;
-int blackfilterExclude[MAX_MASKS][EDGES_COUNT];
-int blackfilterIntensity = 20;
-int noisefilterIntensity = 4;
-int blurfilterScanSize[DIRECTIONS_COUNT] = {100, 100};
-int blurfilterScanStep[DIRECTIONS_COUNT] = {50, 50};
-float blurfilterIntensity = 0.01;
-int grayfilterScanSize[DIRECTIONS_COUNT] = {50, 50};
-int grayfilterScanStep[DIRECTIONS_COUNT] = {20, 20};
-float grayfilterThreshold = 0.5;
-int maskScanDirections = (1 << HORIZONTAL);
-int maskScanSize[DIRECTIONS_COUNT] = {50, 50};
-int maskScanDepth[DIRECTIONS_COUNT] = {-1, -1};
-int maskScanStep[DIRECTIONS_COUNT] = {5, 5};
-float maskScanThreshold[DIRECTIONS_COUNT] = {0.1, 0.1};
-int maskScanMinimum[DIMENSIONS_COUNT] = {100, 100};
-int maskScanMaximum[DIMENSIONS_COUNT] = {-1, -1}; // set default later
-int maskColor = WHITE24;
-int deskewScanEdges = (1 << LEFT) | (1 << RIGHT);
-int deskewScanSize = 1500;
-float deskewScanDepth = 0.5;
-float deskewScanRange = 5.0;
-float deskewScanStep = 0.1;
-float deskewScanDeviation = 1.0;
-int borderScanDirections = (1 << VERTICAL);
-int borderScanSize[DIRECTIONS_COUNT] = {5, 5};
-int borderScanStep[DIRECTIONS_COUNT] = {5, 5};
-int borderScanThreshold[DIRECTIONS_COUNT] = {5, 5};
-int borderAlign = 0;                               // center
-int borderAlignMargin[DIRECTIONS_COUNT] = {0, 0};  // center
-int outsideBorderscanMask[MAX_PAGES][EDGES_COUNT]; // set by --layout
-int outsideBorderscanMaskCount = 0;
-float whiteThreshold = 0.9;
-float blackThreshold = 0.33;
-bool writeoutput = true;
-bool multisheets = true;
-
-// 0: allow all, -1: disable all, n: individual entries
-struct MultiIndex noBlackfilterMultiIndex = {0, NULL};
-struct MultiIndex noNoisefilterMultiIndex = {0, NULL};
-struct MultiIndex noBlurfilterMultiIndex = {0, NULL};
-struct MultiIndex noGrayfilterMultiIndex = {0, NULL};
-struct MultiIndex noMaskScanMultiIndex = {0, NULL};
-struct MultiIndex noMaskCenterMultiIndex = {0, NULL};
-struct MultiIndex noDeskewMultiIndex = {0, NULL};
-struct MultiIndex noWipeMultiIndex = {0, NULL};
-struct MultiIndex noBorderMultiIndex = {0, NULL};
-struct MultiIndex noBorderScanMultiIndex = {0, NULL};
-struct MultiIndex noBorderAlignMultiIndex = {0, NULL};
-
-// default: process all between start-sheet and end-sheet
-struct MultiIndex sheetMultiIndex = {-1, NULL};
-struct MultiIndex excludeMultiIndex = {0, NULL};
-struct MultiIndex ignoreMultiIndex = {0, NULL};
-struct MultiIndex insertBlank = {0, NULL};
-struct MultiIndex replaceBlank = {0, NULL};
-
-bool overwrite = false;
-int dpi = 300;
-
 /**
- * Print an error and exit process
+ * Parses the options of the command line into options, printing the usage or
+ * the version and exiting on --help, --version or an option unpaper does not
+ * know.
  */
-void errOutput(const char *fmt, ...) {
-  va_list vl;
-
-  fprintf(stderr, "unpaper: error: ");
+static void parseCommandLine(struct Options *options, int argc,
+                             char *argv[]) {
+  char error[256];
+
+  switch (parseOptions(options, argc, argv, error, sizeof(error))) {
+  case OPTIONS_OK:
+    break;
+  case OPTIONS_HELP:
+    puts(USAGE);
+    exit(0);
+  case OPTIONS_UNKNOWN:
+    puts(USAGE);
+    exit(1);
+  case OPTIONS_VERSION:
+    puts(VERSION_STR);
+    exit(0);
+  case OPTIONS_INVALID:
+    errOutput("%s", error);
+  }
+}
 
-  va_start(vl, fmt);
-  vfprintf(stderr, fmt, vl);
-  va_end(vl);
+/**
+ * Records a completed sheet in the journal, together with the state carried
+ * over to the next sheet.
+ */
+static void journalSheet(const struct RunState *run, int nr,
+                         char *inputFileNames[], char *outputFileNames[]) {
+  const struct JournalState state = {
+      .width = run->width,
+      .height = run->height,
+      .previousWidth = run->previousWidth,
+      .previousHeight = run->previousHeight,
+      .outputPixFmt = run->outputPixFmt,
+      .deskewScanSize = run->deskewScanSize,
+  };
+
+  // the output files written behind are complete once recorded
+  asyncFlush();
+  journalRecordSheet(&run->options, nr, inputFileNames, outputFileNames,
+                     &state);
+}
 
-  fprintf(stderr, "\nTry 'man unpaper' for more information.\n");
+/**
+ * Applies the options of a sweep variant on top of the command line ones.
+ */
+static void applySweepVariant(int argc, char *argv[], void *arg) {
+  char error[256];
 
-  exit(1);
+  if (!runOptions(arg, argc, argv, error, sizeof(error))) {
+    errOutput("%s", error);
+  }
 }
 
-/****************************************************************************
- * MAIN()                                                                   *
- ****************************************************************************/
-
 /**
- * The main program.
+ * Applies the options of a sweep variant branching before the layout of the
+ * sheet, which then adds its defaults from the options of the variant.
  */
-int main(int argc, char *argv[]) {
-  // --- local variables ---
-  int w = -1;
-  int h = -1;
-  int left;
-  int top;
-  int right;
-  int bottom;
-  int previousWidth = -1;
-  int previousHeight = -1;
-  AVFrame *sheet = NULL;
-  AVFrame *page = NULL;
-  int inputNr;
-  int outputNr;
-  int option_index = 0;
-  int outputPixFmt = -1;
-
-  // -------------------------------------------------------------------
-  // --- parse parameters                                            ---
-  // -------------------------------------------------------------------
+static void applySweepVariantLayout(int argc, char *argv[], void *arg) {
+  resetLayout(arg);
+  applySweepVariant(argc, argv, arg);
+}
 
-  while (true) {
-    int c;
-
-    static const struct option long_options[] = {
-        {"help", no_argument, NULL, 'h'},
-        {"?", no_argument, NULL, 'h'},
-        {"version", no_argument, NULL, 'V'},
-        {"layout", required_argument, NULL, 'l'},
-        {"#", required_argument, NULL, '#'},
-        {"sheet", required_argument, NULL, '#'},
-        {"start", required_argument, NULL, 0x7e},
-        {"start-sheet", required_argument, NULL, 0x7e},
-        {"end", required_argument, NULL, 0x7f},
-        {"end-sheet", required_argument, NULL, 0x7f},
-        {"start-input", required_argument, NULL, 0x80},
-        {"si", required_argument, NULL, 0x80},
-        {"start-output", required_argument, NULL, 0x81},
-        {"so", required_argument, NULL, 0x81},
-        {"sheet-size", required_argument, NULL, 'S'},
-        {"sheet-background", required_argument, NULL, 0x82},
-        {"exclude", optional_argument, NULL, 'x'},
-        {"no-processing", required_argument, NULL, 'n'},
-        {"pre-rotate", required_argument, NULL, 0x83},
-        {"post-rotate", required_argument, NULL, 0x84},
-        {"pre-mirror", required_argument, NULL, 'M'},
-        {"post-mirror", required_argument, NULL, 0x85},
-        {"pre-shift", required_argument, NULL, 0x86},
-        {"post-shift", required_argument, NULL, 0x87},
-        {"pre-mask", required_argument, NULL, 0x88},
-        {"size", required_argument, NULL, 's'},
-        {"post-size", required_argument, NULL, 0x89},
-        {"stretch", required_argument, NULL, 0x8a},
-        {"post-stretch", required_argument, NULL, 0x8b},
-        {"zoom", required_argument, NULL, 'z'},
-        {"post-zoom", required_argument, NULL, 0x8c},
-        {"mask-scan-point", required_argument, NULL, 'p'},
-        {"mask", required_argument, NULL, 'm'},
-        {"wipe", required_argument, NULL, 'W'},
-        {"pre-wipe", required_argument, NULL, 0x8d},
-        {"post-wipe", required_argument, NULL, 0x8e},
-        {"middle-wipe", required_argument, NULL, 0x8f},
-        {"mw", required_argument, NULL, 0x8f},
-        {"border", required_argument, NULL, 'B'},
-        {"pre-border", required_argument, NULL, 0x90},
-        {"post-border", required_argument, NULL, 0x91},
-        {"no-blackfilter", optional_argument, NULL, 0x92},
-        {"blackfilter-scan-direction", required_argument, NULL, 0x93},
-        {"bn", required_argument, NULL, 0x93},
-        {"blackfilter-scan-size", required_argument, NULL, 0x94},
-        {"bs", required_argument, NULL, 0x94},
-        {"blackfilter-scan-depth", required_argument, NULL, 0x95},
-        {"bd", required_argument, NULL, 0x95},
-        {"blackfilter-scan-step", required_argument, NULL, 0x96},
-        {"bp", required_argument, NULL, 0x96},
-        {"blackfilter-scan-threshold", required_argument, NULL, 0x97},
-        {"bt", required_argument, NULL, 0x97},
-        {"blackfilter-scan-exclude", required_argument, NULL, 0x98},
-        {"bx", required_argument, NULL, 0x98},
-        {"blackfilter-intensity", required_argument, NULL, 0x99},
-        {"bi", required_argument, NULL, 0x99},
-        {"no-noisefilter", optional_argument, NULL, 0x9a},
-        {"noisefilter-intensity", required_argument, NULL, 0x9b},
-        {"ni", required_argument, NULL, 0x9b},
-        {"no-blurfilter", optional_argument, NULL, 0x9c},
-        {"blurfilter-size", required_argument, NULL, 0x9d},
-        {"ls", required_argument, NULL, 0x9d},
-        {"blurfilter-step", required_argument, NULL, 0x9e},
-        {"lp", required_argument, NULL, 0x9e},
-        {"blurfilter-intensity", required_argument, NULL, 0x9f},
-        {"li", required_argument, NULL, 0x9f},
-        {"no-grayfilter", optional_argument, NULL, 0xa0},
-        {"grayfilter-size", required_argument, NULL, 0xa1},
-        {"gs", required_argument, NULL, 0xa1},
-        {"grayfilter-step", required_argument, NULL, 0xa2},
-        {"gp", required_argument, NULL, 0xa2},
-        {"grayfilter-threshold", required_argument, NULL, 0xa3},
-        {"gt", required_argument, NULL, 0xa3},
-        {"no-mask-scan", optional_argument, NULL, 0xa4},
-        {"mask-scan-direction", required_argument, NULL, 0xa5},
-        {"mn", required_argument, NULL, 0xa5},
-        {"mask-scan-size", required_argument, NULL, 0xa6},
-        {"ms", required_argument, NULL, 0xa6},
-        {"mask-scan-depth", required_argument, NULL, 0xa7},
-        {"md", required_argument, NULL, 0xa7},
-        {"mask-scan-step", required_argument, NULL, 0xa8},
-        {"mp", required_argument, NULL, 0xa8},
-        {"mask-scan-threshold", required_argument, NULL, 0xa9},
-        {"mt", required_argument, NULL, 0xa9},
-        {"mask-scan-minimum", required_argument, NULL, 0xaa},
-        {"mm", required_argument, NULL, 0xaa},
-        {"mask-scan-maximum", required_argument, NULL, 0xab},
-        {"mM", required_argument, NULL, 0xab},
-        {"mask-color", required_argument, NULL, 0xac},
-        {"mc", required_argument, NULL, 0xac},
-        {"no-mask-center", optional_argument, NULL, 0xad},
-        {"no-deskew", optional_argument, NULL, 0xae},
-        {"deskew-scan-direction", required_argument, NULL, 0xaf},
-        {"dn", required_argument, NULL, 0xaf},
-        {"deskew-scan-size", required_argument, NULL, 0xb0},
-        {"ds", required_argument, NULL, 0xb0},
-        {"deskew-scan-depth", required_argument, NULL, 0xb1},
-        {"dd", required_argument, NULL, 0xb1},
-        {"deskew-scan-range", required_argument, NULL, 0xb2},
-        {"dr", required_argument, NULL, 0xb2},
-        {"deskew-scan-step", required_argument, NULL, 0xb3},
-        {"dp", required_argument, NULL, 0xb3},
-        {"deskew-scan-deviation", required_argument, NULL, 0xb4},
-        {"dv", required_argument, NULL, 0xb4},
-        {"no-border-scan", optional_argument, NULL, 0xb5},
-        {"border-scan-direction", required_argument, NULL, 0xb6},
-        {"Bn", required_argument, NULL, 0xb6},
-        {"border-scan-size", required_argument, NULL, 0xb7},
-        {"Bs", required_argument, NULL, 0xb7},
-        {"border-scan-step", required_argument, NULL, 0xb8},
-        {"Bp", required_argument, NULL, 0xb8},
-        {"border-scan-threshold", required_argument, NULL, 0xb9},
-        {"Bt", required_argument, NULL, 0xb9},
-        {"border-align", required_argument, NULL, 0xba},
-        {"Ba", required_argument, NULL, 0xba},
-        {"border-margin", required_argument, NULL, 0xbb},
-        {"Bm", required_argument, NULL, 0xbb},
-        {"no-border-align", optional_argument, NULL, 0xbc},
-        {"no-wipe", optional_argument, NULL, 0xbd},
-        {"no-border", optional_argument, NULL, 0xbe},
-        {"white-threshold", required_argument, NULL, 'w'},
-        {"black-threshold", required_argument, NULL, 'b'},
-        {"input-pages", required_argument, NULL, 0xbf},
-        {"ip", required_argument, NULL, 0xbf},
-        {"output-pages", required_argument, NULL, 0xc0},
-        {"op", required_argument, NULL, 0xc0},
-        {"input-file-sequence", required_argument, NULL, 0xc1},
-        {"if", required_argument, NULL, 0xc1},
-        {"output-file-sequence", required_argument, NULL, 0xc2},
-        {"of", required_argument, NULL, 0xc2},
-        {"insert-blank", required_argument, NULL, 0xc3},
-        {"replace-blank", required_argument, NULL, 0xc4},
-        {"test-only", no_argument, NULL, 'T'},
-        {"no-multi-pages", no_argument, NULL, 0xc6},
-        {"dpi", required_argument, NULL, 0xc7},
-        {"type", required_argument, NULL, 't'},
-        {"quiet", no_argument, NULL, 'q'},
-        {"overwrite", no_argument, NULL, 0xc8},
-        {"verbose", no_argument, NULL, 'v'},
-        {"vv", no_argument, NULL, 0xca},
-        {"debug", no_argument, NULL, 0xcb},
-        {"vvv", no_argument, NULL, 0xcb},
-        {"debug-save", no_argument, NULL, 0xcc},
-        {"vvvv", no_argument, NULL, 0xcc},
-        {"interpolate", required_argument, NULL, 0xcd},
-        {NULL, no_argument, NULL, 0}};
-
-    c = getopt_long_only(argc, argv, "hVl:S:x::n::M:s:z:p:m:W:B:w:b:Tt:qv",
-                         long_options, &option_index);
-    if (c == -1)
-      break;
+// with --input-tar and only the output files given, the pages are the
+// members of the archive, in order
+static bool inputTarMembers = false;
 
-    switch (c) {
-    case 'h':
-    case '?':
-      puts(USAGE);
-      return c == '?' ? 1 : 0;
-
-    case 'V':
-      puts(VERSION_STR);
-      return 0;
-
-    case 'l':
-      if (strcmp(optarg, "single") == 0) {
-        layout = LAYOUT_SINGLE;
-      } else if (strcmp(optarg, "double") == 0) {
-        layout = LAYOUT_DOUBLE;
-      } else if (strcmp(optarg, "none") == 0) {
-        layout = LAYOUT_NONE;
+/**
+ * Picks the input files of sheet nr: none for the blank sheets of
+ * --insert-blank and --replace-blank, the next file landing in the --watch
+ * directory, the next member of the --input-tar archive, the next number of
+ * the input wildcard, or the next file given.
+ * Returns false when the input files run out and no end sheet is set, or
+ * when watching stops. Unless check is set, the files are only named, to
+ * read them ahead, and running out of them is never an error.
+ */
+static bool sheetInputFiles(const struct Options *options, int nr, int argc,
+                            char *argv[], bool inputWildcard, int *inputNr,
+                            char buffers[][255], char *inputFileNames[],
+                            bool check) {
+  for (int i = 0; i < options->inputCount; i++) {
+    bool ins = isInMultiIndex(*inputNr, options->insertBlank);
+    bool repl = isInMultiIndex(*inputNr, options->replaceBlank);
+
+    if (repl) {
+      inputFileNames[i] = NULL;
+      (*inputNr)++; /* replace */
+    } else if (ins) {
+      inputFileNames[i] = NULL; /* insert */
+    } else if (options->watchDirectory != NULL) {
+      if (!watchNext(options, buffers[i], sizeof(buffers[i])))
+        return false;
+      inputFileNames[i] = buffers[i];
+    } else if (inputTarMembers) {
+      if (!tarNextMember(buffers[i], sizeof(buffers[i])))
+        return false;
+      inputFileNames[i] = buffers[i];
+    } else if (inputWildcard) {
+      sprintf(buffers[i], argv[optind], (*inputNr)++);
+      inputFileNames[i] = buffers[i];
+    } else if (optind >= argc) {
+      if (options->endSheet == -1 || !check) {
+        return false;
       } else {
-        errOutput("unknown layout mode '%s'.", optarg);
+        errOutput("not enough input files given.");
       }
-      break;
-
-    case '#':
-      parseMultiIndex(optarg, &sheetMultiIndex);
-      // allow 0 as start sheet, might be overwritten by --start-sheet again
-      if (sheetMultiIndex.count > 0 && startSheet > sheetMultiIndex.indexes[0])
-        startSheet = sheetMultiIndex.indexes[0];
-      break;
-
-    case 0x7e:
-      sscanf(optarg, "%d", &startSheet);
-      break;
-
-    case 0x7f:
-      sscanf(optarg, "%d", &endSheet);
-      break;
-
-    case 0x80:
-      sscanf(optarg, "%d", &startInput);
-      break;
-
-    case 0x81:
-      sscanf(optarg, "%d", &startOutput);
-      break;
+    } else {
+      inputFileNames[i] = argv[optind++];
+    }
 
-    case 'S':
-      parseSize(optarg, sheetSize, dpi);
-      break;
+    if (inputFileNames[i] != NULL && check) {
+      if (!imageExists(inputFileNames[i])) {
+        if (options->endSheet == -1) {
+          return false;
+        } else {
+          errOutput("unable to open file %s.", inputFileNames[i]);
+        }
+      }
+    }
+  }
+  return true;
+}
 
-    case 0x82:
-      sheetBackground = parseColor(optarg);
-      break;
+/**
+ * Counts the sheets the run processes, going through the numbering of the
+ * input and output files, or the records of the manifest, the same way as
+ * the main loop does.
+ */
+static int countSheets(const struct Options *options, int argc, char *argv[],
+                       int inputNr) {
+  const int savedOptind = optind;
+  int count = 0;
+
+  if (options->manifestFilename != NULL) {
+    const int records = manifestCount(options->manifestFilename);
+
+    for (int nr = options->startSheet;
+         nr < options->startSheet + records && (
+             (options->endSheet == -1) || (nr <= options->endSheet));
+         nr++) {
+      if (isInMultiIndex(nr, options->sheetMultiIndex) &&
+          (!isInMultiIndex(nr, options->excludeMultiIndex))) {
+        count++;
+      }
+    }
+    return count;
+  }
 
-    case 'x':
-      parseMultiIndex(optarg, &excludeMultiIndex);
-      if (excludeMultiIndex.count == -1)
-        excludeMultiIndex.count = 0; // 'exclude all' makes no sense
-      break;
+  for (int nr = options->startSheet;
+       (options->endSheet == -1) || (nr <= options->endSheet); nr++) {
+    char inputFilesBuffer[2][255];
+    char *inputFileNames[2];
 
-    case 'n':
-      parseMultiIndex(optarg, &ignoreMultiIndex);
+    bool inputWildcard = options->multisheets && (
+        strchr(argv[optind], '%') != NULL);
+    if (!sheetInputFiles(options, nr, argc, argv, inputWildcard, &inputNr,
+                         inputFilesBuffer, inputFileNames, true)) {
       break;
+    }
+    if (inputWildcard)
+      optind++;
 
-    case 0x83:
-      sscanf(optarg, "%d", &preRotate);
-      if ((preRotate != 0) && (abs(preRotate) != 90)) {
-        fprintf(
-            stderr,
-            "cannot set --pre-rotate value other than -90 or 90, ignoring.\n");
-        preRotate = 0;
-      }
+    if (optind >= argc)
       break;
+    bool outputWildcard = options->multisheets && (
+        strchr(argv[optind], '%') != NULL);
+    optind += outputWildcard ? 1 : options->outputCount;
 
-    case 0x84:
-      sscanf(optarg, "%d", &postRotate);
-      if ((postRotate != 0) && (abs(postRotate) != 90)) {
-        fprintf(
-            stderr,
-            "cannot set --post-rotate value other than -90 or 90, ignoring.\n");
-        postRotate = 0;
-      }
-      break;
+    if (isInMultiIndex(nr, options->sheetMultiIndex) &&
+        (!isInMultiIndex(nr, options->excludeMultiIndex))) {
+      count++;
+    }
 
-    case 'M':
-      preMirror =
-          parseDirections(optarg); // s = "v", "v,h", "vertical,horizontal", ...
+    if (optind >= argc && !inputWildcard)
       break;
+    else if (inputWildcard && outputWildcard)
+      optind -= 2;
+  }
 
-    case 0x85:
-      postMirror = parseDirections(optarg);
-      break;
+  optind = savedOptind;
+  return count;
+}
 
-    case 0x86:
-      parseSize(optarg, preShift, dpi);
-      break;
+/**
+ * Reads ahead the input files of the --async-io sheets from sheet nr on, or
+ * of the next records of the manifest, going through the files the same way
+ * as the main loop does. Sheets left out by --sheet or --exclude are not
+ * read.
+ */
+static void readAheadSheets(const struct Options *options, int nr, int argc,
+                            char *argv[], int inputNr) {
+  const int savedOptind = optind;
+
+  for (int ahead = nr; ahead < nr + options->asyncSheets &&
+                       ((options->endSheet == -1) ||
+                        (ahead <= options->endSheet));
+       ahead++) {
+    char inputFilesBuffer[2][255];
+    char *inputFileNames[2];
+    const bool wanted = isInMultiIndex(ahead, options->sheetMultiIndex) &&
+                        (!isInMultiIndex(ahead, options->excludeMultiIndex));
 
-    case 0x87:
-      parseSize(optarg, postShift, dpi);
-      break;
+    if (options->manifestFilename != NULL) {
+      const struct ManifestSheet *record = manifestAhead(ahead - nr);
 
-    case 0x88:
-      if (preMaskCount < MAX_MASKS) {
-        left = -1;
-        top = -1;
-        right = -1;
-        bottom = -1;
-        sscanf(optarg, "%d,%d,%d,%d", &left, &top, &right,
-               &bottom); // x1, y1, x2, y2
-        preMask[preMaskCount][LEFT] = left;
-        preMask[preMaskCount][TOP] = top;
-        preMask[preMaskCount][RIGHT] = right;
-        preMask[preMaskCount][BOTTOM] = bottom;
-        preMaskCount++;
-      } else {
-        fprintf(stderr,
-                "maximum number of masks (%d) exceeded, ignoring mask %s\n",
-                MAX_MASKS, optarg);
+      for (int i = 0; record != NULL && wanted && i < record->inputCount;
+           i++) {
+        if (record->inputs[i] != NULL)
+          asyncReadAhead(record->inputs[i]);
       }
-      break;
-
-    case 's':
-      parseSize(optarg, size, dpi);
-      break;
-
-    case 0x89:
-      parseSize(optarg, postSize, dpi);
-      break;
+      continue;
+    }
 
-    case 0x8a:
-      parseSize(optarg, stretchSize, dpi);
+    bool inputWildcard = options->multisheets && (
+        strchr(argv[optind], '%') != NULL);
+    if (!sheetInputFiles(options, ahead, argc, argv, inputWildcard, &inputNr,
+                         inputFilesBuffer, inputFileNames, false)) {
       break;
+    }
+    for (int i = 0; wanted && i < options->inputCount; i++) {
+      if (inputFileNames[i] != NULL)
+        asyncReadAhead(inputFileNames[i]);
+    }
+    if (inputWildcard)
+      optind++;
 
-    case 0x8b:
-      parseSize(optarg, postStretchSize, dpi);
+    if (optind >= argc)
       break;
+    bool outputWildcard = options->multisheets && (
+        strchr(argv[optind], '%') != NULL);
+    optind += outputWildcard ? 1 : options->outputCount;
 
-    case 'z':
-      sscanf(optarg, "%f", &zoomFactor);
+    if (optind >= argc && !inputWildcard)
       break;
+    else if (inputWildcard && outputWildcard)
+      optind -= 2;
+  }
 
-    case 0x8c:
-      sscanf(optarg, "%f", &postZoomFactor);
-      break;
+  optind = savedOptind;
+}
 
-    case 'p':
-      if (pointCount < MAX_POINTS) {
-        int x = -1;
-        int y = -1;
-        sscanf(optarg, "%d,%d", &x, &y);
-        point[pointCount][X] = x;
-        point[pointCount][Y] = y;
-        pointCount++;
-      } else {
-        fprintf(stderr,
-                "maximum number of scan points (%d) exceeded, ignoring scan "
-                "point %s\n",
-                MAX_POINTS, optarg);
-      }
-      break;
+/**
+ * Tells whether the sheet-th of the total sheets the run processes, counting
+ * from 0, belongs to this shard.
+ */
+static bool inShard(const struct Options *options, int sheet, int total) {
+  if (options->shardCount == 1) {
+    return true;
+  }
+  if (options->shardMode == SHARD_ROUND_ROBIN) {
+    return sheet % options->shardCount == options->shardIndex - 1;
+  }
+  return (
+      long long)sheet * options->shardCount / total == options->shardIndex - 1;
+}
 
-    case 'm':
-      if (maskCount < MAX_MASKS) {
-        left = -1;
-        top = -1;
-        right = -1;
-        bottom = -1;
-        sscanf(optarg, "%d,%d,%d,%d", &left, &top, &right,
-               &bottom); // x1, y1, x2, y2
-        mask[maskCount][LEFT] = left;
-        mask[maskCount][TOP] = top;
-        mask[maskCount][RIGHT] = right;
-        mask[maskCount][BOTTOM] = bottom;
-        maskValid[maskCount] = true;
-        maskCount++;
-      } else {
-        fprintf(stderr,
-                "maximum number of masks (%d) exceeded, ignoring mask %s\n",
-                MAX_MASKS, optarg);
-      }
-      break;
+/**
+ * Carries a sheet of another shard over: leaves the sheet size and output
+ * format for the next sheets as processing the sheet would, without
+ * processing it. Only the first input is loaded, and only when they are not
+ * known yet; a blank sheet also leaves the masks and deskew scan size.
+ */
+static void carrySheet(struct RunState *run, int nr, char *inputFileNames[]) {
+  const struct Options *options = &run->options;
+  bool blank = options->sheetBackground == WHITE24 &&
+               options->maskColor == WHITE24;
+
+  for (int j = 0; j < options->inputCount; j++) {
+    if (inputFileNames[j] == NULL) {
+      continue;
+    }
+    blank = false;
+    if (run->width == -1 || run->height == -1 || run->outputPixFmt == -1) {
+      AVFrame *page = NULL;
 
-    case 'W':
-      if (wipeCount < MAX_MASKS) {
-        left = -1;
-        top = -1;
-        right = -1;
-        bottom = -1;
-        sscanf(optarg, "%d,%d,%d,%d", &left, &top, &right,
-               &bottom); // x1, y1, x2, y2
-        wipe[wipeCount][LEFT] = left;
-        wipe[wipeCount][TOP] = top;
-        wipe[wipeCount][RIGHT] = right;
-        wipe[wipeCount][BOTTOM] = bottom;
-        wipeCount++;
-      } else {
-        fprintf(stderr,
-                "maximum number of wipes (%d) exceeded, ignoring mask %s\n",
-                MAX_MASKS, optarg);
+      loadImage(options, inputFileNames[j], &page);
+      if (run->outputPixFmt == -1) {
+        run->outputPixFmt = page->format;
       }
-      break;
-
-    case 0x8d:
-      if (preWipeCount < MAX_MASKS) {
-        left = -1;
-        top = -1;
-        right = -1;
-        bottom = -1;
-        sscanf(optarg, "%d,%d,%d,%d", &left, &top, &right,
-               &bottom); // x1, y1, x2, y2
-        preWipe[preWipeCount][LEFT] = left;
-        preWipe[preWipeCount][TOP] = top;
-        preWipe[preWipeCount][RIGHT] = right;
-        preWipe[preWipeCount][BOTTOM] = bottom;
-        preWipeCount++;
-      } else {
-        fprintf(stderr,
-                "maximum number of pre-wipes (%d) exceeded, ignoring mask %s\n",
-                MAX_MASKS, optarg);
+      if (options->preRotate != 0) {
+        flipRotate(options, options->preRotate / 90, &page);
       }
-      break;
-
-    case 0x8e:
-      if (postWipeCount < MAX_MASKS) {
-        left = -1;
-        top = -1;
-        right = -1;
-        bottom = -1;
-        sscanf(optarg, "%d,%d,%d,%d", &left, &top, &right,
-               &bottom); // x1, y1, x2, y2
-        postWipe[postWipeCount][LEFT] = left;
-        postWipe[postWipeCount][TOP] = top;
-        postWipe[postWipeCount][RIGHT] = right;
-        postWipe[postWipeCount][BOTTOM] = bottom;
-        postWipeCount++;
-      } else {
-        fprintf(
-            stderr,
-            "maximum number of post-wipes (%d) exceeded, ignoring mask %s\n",
-            MAX_MASKS, optarg);
+      if (run->width == -1) {
+        run->width = (options->sheetSize[WIDTH] != -1)
+                         ? options->sheetSize[WIDTH]
+                         : page->width * options->inputCount;
       }
-      break;
-
-    case 0x8f:
-      parseInts(optarg, middleWipe);
-      break;
-
-    case 'B':
-      sscanf(optarg, "%d,%d,%d,%d", &border[LEFT], &border[TOP], &border[RIGHT],
-             &border[BOTTOM]);
-      break;
-
-    case 0x90:
-      sscanf(optarg, "%d,%d,%d,%d", &preBorder[LEFT], &preBorder[TOP],
-             &preBorder[RIGHT], &preBorder[BOTTOM]);
-      break;
-
-    case 0x91:
-      sscanf(optarg, "%d,%d,%d,%d", &postBorder[LEFT], &postBorder[TOP],
-             &postBorder[RIGHT], &postBorder[BOTTOM]);
-      break;
-
-    case 0x92:
-      parseMultiIndex(optarg, &noBlackfilterMultiIndex);
-      break;
-
-    case 0x93:
-      blackfilterScanDirections = parseDirections(optarg);
-      break;
-
-    case 0x94:
-      parseInts(optarg, blackfilterScanSize);
-      break;
-
-    case 0x95:
-      parseInts(optarg, blackfilterScanDepth);
-      break;
-
-    case 0x96:
-      parseInts(optarg, blackfilterScanStep);
-      break;
-
-    case 0x97:
-      sscanf(optarg, "%f", &blackfilterScanThreshold);
-      break;
-
-    case 0x98:
-      if (blackfilterExcludeCount < MAX_MASKS) {
-        left = -1;
-        top = -1;
-        right = -1;
-        bottom = -1;
-        sscanf(optarg, "%d,%d,%d,%d", &left, &top, &right,
-               &bottom); // x1, y1, x2, y2
-        blackfilterExclude[blackfilterExcludeCount][LEFT] = left;
-        blackfilterExclude[blackfilterExcludeCount][TOP] = top;
-        blackfilterExclude[blackfilterExcludeCount][RIGHT] = right;
-        blackfilterExclude[blackfilterExcludeCount][BOTTOM] = bottom;
-        blackfilterExcludeCount++;
-      } else {
-        fprintf(stderr,
-                "maximum number of blackfilter exclusion (%d) exceeded, "
-                "ignoring mask %s\n",
-                MAX_MASKS, optarg);
+      if (run->height == -1) {
+        run->height = (options->sheetSize[HEIGHT] != -1)
+                          ? options->sheetSize[HEIGHT]
+                          : page->height;
       }
-      break;
-
-    case 0x99:
-      sscanf(optarg, "%d", &blackfilterIntensity);
-      break;
-
-    case 0x9a:
-      parseMultiIndex(optarg, &noNoisefilterMultiIndex);
-      break;
-
-    case 0x9b:
-      sscanf(optarg, "%d", &noisefilterIntensity);
-      break;
-
-    case 0x9c:
-      parseMultiIndex(optarg, &noBlurfilterMultiIndex);
-      break;
-
-    case 0x9d:
-      parseInts(optarg, blurfilterScanSize);
-      break;
-
-    case 0x9e:
-      parseInts(optarg, blurfilterScanStep);
-      break;
-
-    case 0x9f:
-      sscanf(optarg, "%f", &blurfilterIntensity);
-      break;
-
-    case 0xa0:
-      parseMultiIndex(optarg, &noGrayfilterMultiIndex);
-      break;
-
-    case 0xa1:
-      parseInts(optarg, grayfilterScanSize);
-      break;
-
-    case 0xa2:
-      parseInts(optarg, grayfilterScanStep);
-      break;
-
-    case 0xa3:
-      sscanf(optarg, "%f", &grayfilterThreshold);
-      break;
-
-    case 0xa4:
-      parseMultiIndex(optarg, &noMaskScanMultiIndex);
-      break;
-
-    case 0xa5:
-      maskScanDirections = parseDirections(optarg);
-      break;
-
-    case 0xa6:
-      parseInts(optarg, maskScanSize);
-      break;
-
-    case 0xa7:
-      parseInts(optarg, maskScanDepth);
-      break;
-
-    case 0xa8:
-      parseInts(optarg, maskScanStep);
-      break;
-
-    case 0xa9:
-      parseFloats(optarg, maskScanThreshold);
-      break;
-
-    case 0xaa:
-      sscanf(optarg, "%d,%d", &maskScanMinimum[WIDTH],
-             &maskScanMinimum[HEIGHT]);
-      break;
-
-    case 0xab:
-      sscanf(optarg, "%d,%d", &maskScanMaximum[WIDTH],
-             &maskScanMaximum[HEIGHT]);
-      break;
-
-    case 0xac:
-      sscanf(optarg, "%d", &maskColor);
-      break;
-
-    case 0xad:
-      parseMultiIndex(optarg, &noMaskCenterMultiIndex);
-      break;
-
-    case 0xae:
-      parseMultiIndex(optarg, &noDeskewMultiIndex);
-      break;
-
-    case 0xaf:
-      deskewScanEdges = parseEdges(optarg);
-      break;
-
-    case 0xb0:
-      sscanf(optarg, "%d", &deskewScanSize);
-      break;
-
-    case 0xb1:
-      sscanf(optarg, "%f", &deskewScanDepth);
-      break;
-
-    case 0xb2:
-      sscanf(optarg, "%f", &deskewScanRange);
-      break;
-
-    case 0xb3:
-      sscanf(optarg, "%f", &deskewScanStep);
-      break;
-
-    case 0xb4:
-      sscanf(optarg, "%f", &deskewScanDeviation);
-      break;
-
-    case 0xb5:
-      parseMultiIndex(optarg, &noBorderScanMultiIndex);
-      break;
-
-    case 0xb6:
-      borderScanDirections = parseDirections(optarg);
-      break;
-
-    case 0xb7:
-      parseInts(optarg, borderScanSize);
-      break;
-
-    case 0xb8:
-      parseInts(optarg, borderScanStep);
-      break;
-
-    case 0xb9:
-      parseInts(optarg, borderScanThreshold);
-      break;
-
-    case 0xba:
-      borderAlign = parseEdges(optarg);
-      break;
-
-    case 0xbb:
-      parseSize(optarg, borderAlignMargin, dpi);
-      break;
-
-    case 0xbc:
-      parseMultiIndex(optarg, &noBorderAlignMultiIndex);
-      break;
-
-    case 0xbd:
-      parseMultiIndex(optarg, &noWipeMultiIndex);
-      break;
-
-    case 0xbe:
-      parseMultiIndex(optarg, &noBorderMultiIndex);
-      break;
+      av_frame_free(&page);
+    }
+    break;
+  }
 
-    case 'w':
-      sscanf(optarg, "%f", &whiteThreshold);
-      break;
+  if ((run->width == -1) || (run->height == -1)) {
+    run->width = run->previousWidth;
+    run->height = run->previousHeight;
+    if ((run->width == -1) || (run->height == -1)) {
+      errOutput("sheet size unknown, use at least one input file per "
+                "sheet, or force using --sheet-size.");
+    }
+  }
+  run->previousWidth = run->width;
+  run->previousHeight = run->height;
+
+  int width = run->width;
+  int height = run->height;
+  processedSheetSize(run, nr, blank, &width, &height);
+  if (options->writeoutput && run->outputPixFmt == -1) {
+    run->outputPixFmt = AV_PIX_FMT_RGB24;
+  }
+}
 
-    case 'b':
-      sscanf(optarg, "%f", &blackThreshold);
-      break;
+#define RUN_OPTION(field)                                                      \
+  {offsetof(struct Options, field), sizeof(((struct Options *)NULL)->field)}
+
+// options of the whole run, which the options of a manifest sheet cannot
+// change
+static const struct {
+  size_t offset;
+  size_t size;
+} runOptionFields[] = {
+    RUN_OPTION(startSheet),
+    RUN_OPTION(endSheet),
+    RUN_OPTION(startInput),
+    RUN_OPTION(startOutput),
+    RUN_OPTION(inputCount),
+    RUN_OPTION(outputCount),
+    RUN_OPTION(writeoutput),
+    RUN_OPTION(multisheets),
+    RUN_OPTION(outputPixFmt),
+    RUN_OPTION(detectionCacheDirectory),
+    RUN_OPTION(noCache),
+    RUN_OPTION(journalFilename),
+    RUN_OPTION(resume),
+    RUN_OPTION(dedupeSize),
+    RUN_OPTION(sweepFilename),
+    RUN_OPTION(timingsFilename),
+    RUN_OPTION(traceFilename),
+    RUN_OPTION(perfCounters),
+    RUN_OPTION(memoryStats),
+    RUN_OPTION(summary),
+    RUN_OPTION(metricsFilename),
+    RUN_OPTION(threadCount),
+    RUN_OPTION(shardIndex),
+    RUN_OPTION(shardCount),
+    RUN_OPTION(shardMode),
+    RUN_OPTION(spoolDirectory),
+    RUN_OPTION(spoolLease),
+    RUN_OPTION(watchDirectory),
+    RUN_OPTION(daemonSocket),
+    RUN_OPTION(daemonJobs),
+    RUN_OPTION(manifestFilename),
+    RUN_OPTION(inputTarFilename),
+    RUN_OPTION(outputTarFilename),
+    RUN_OPTION(asyncSheets),
+};
 
-    case 0xbf:
-      sscanf(optarg, "%d", &inputCount);
-      if (!(inputCount >= 1 && inputCount <= 2)) {
-        fprintf(
-            stderr,
-            "cannot set --input-pages value other than 1 or 2, ignoring.\n");
-        inputCount = 1;
-      }
+/**
+ * Tells whether options differ from saved in an option of the whole run.
+ */
+static bool runOptionsChanged(const struct Options *saved,
+                              const struct Options *options) {
+  for (size_t i = 0; i < sizeof(runOptionFields) / sizeof(runOptionFields[0]);
+       i++) {
+    if (memcmp((const uint8_t *)saved + runOptionFields[i].offset,
+               (const uint8_t *)options + runOptionFields[i].offset,
+               runOptionFields[i].size) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
 
-      break;
+/**
+ * Picks the input and output files of a sheet from the next record of the
+ * manifest, and applies the options of the record on top of the options of
+ * the run, saving them into a newly allocated *saved first. Returns false
+ * once the manifest runs out.
+ */
+static bool sheetManifestFiles(struct RunState *run, char *inputFileNames[],
+                               char *outputFileNames[],
+                               struct Options **saved) {
+  struct Options *options = &run->options;
+  struct ManifestSheet *sheet;
+
+  if (!manifestNext(&sheet))
+    return false;
+
+  if (sheet->missing != NULL)
+    errOutput("unable to open file %s.", sheet->missing);
+  for (int i = 0; i < options->inputCount; i++) {
+    inputFileNames[i] = sheet->inputs[i];
+  }
+  for (int i = 0; i < options->outputCount; i++) {
+    outputFileNames[i] = sheet->outputs[i];
+  }
+  if (options->journalFilename != NULL) {
+    journalSheetOptions(sheet->argc, sheet->argv);
+  }
 
-    case 0xc0:
-      sscanf(optarg, "%d", &outputCount);
-      if (!(outputCount >= 1 && outputCount <= 2)) {
-        fprintf(
-            stderr,
-            "cannot set --output-pages value other than 1 or 2, ignoring.\n");
-        outputCount = 1;
-      }
+  if (sheet->argc > 1) {
+    char error[256];
 
-      break;
+    *saved = malloc(sizeof(**saved));
+    if (*saved == NULL)
+      errOutput("unable to allocate the options of a sheet.");
+    **saved = *options;
+    if (!runOptions(run, sheet->argc, sheet->argv, error, sizeof(error))) {
+      errOutput("manifest line %d: %s", sheet->line, error);
+    }
+    if (runOptionsChanged(*saved, options)) {
+      errOutput("manifest line %d: options of the whole run cannot be given "
+                "for a single sheet.",
+                sheet->line);
+    }
+  }
+  return true;
+}
 
-    case 0xc1:
-    case 0xc2:
-      errOutput(
-          "--input-file-sequence and --output-file sequence are deprecated and "
-          "unimplemented.\n"
-          "Please pass input output pairs as arguments to unpaper instead.");
-      break;
+/****************************************************************************
+ * MAIN()                                                                   *
+ ****************************************************************************/
 
-    case 0xc3:
-      parseMultiIndex(optarg, &insertBlank);
-      break;
+/**
+ * The main program.
+ */
+int main(int argc, char *argv[]) {
+  // --- local variables ---
+  struct RunState run;
+  struct Options *options = &run.options;
+  AVFrame *sheet = NULL;
+  AVFrame *page = NULL;
+  int inputNr;
+  int outputNr;
+  char error[256];
 
-    case 0xc4:
-      parseMultiIndex(optarg, &replaceBlank);
-      break;
+  // -------------------------------------------------------------------
+  // --- parse parameters                                            ---
+  // -------------------------------------------------------------------
 
-    case 'T':
-      writeoutput = false;
-      break;
+  runInit(&run);
+  parseCommandLine(options, argc, argv);
+
+  /* a spool worker only comes back in the process running a job, with the
+     arguments of the job, which apply on top of the command line ones as
+     sweep variants do. A job retried after its worker died replaces the
+     output it left. */
+  if (options->spoolDirectory != NULL) {
+    spoolRun(options, &argc, &argv);
+    optind = 0;
+    parseCommandLine(options, argc, argv);
+    options->overwrite = true;
+  }
 
-    case 0xc5:
-      // Deprecated function, ignore.
-      break;
+  /* the same goes for the jobs of a daemon, which come with their own input
+     and output files. */
+  if (options->daemonSocket != NULL) {
+    daemonRun(options, &argc, &argv);
+    optind = 0;
+    parseCommandLine(options, argc, argv);
+  }
 
-    case 0xc6:
-      multisheets = false;
-      break;
+  /* make sure we have at least two arguments after the options, as
+     that's the minimum amount of parameters we need (one input and
+     one output, or a wildcard of inputs and a wildcard of
+     outputs. With --watch, the input files are the ones landing in the
+     watched directory, and only the wildcard of outputs is given.
+  */
+  const bool watching = (options->watchDirectory != NULL);
+  const bool manifesting = (options->manifestFilename != NULL);
+  if (manifesting) {
+    if (watching) {
+      errOutput("--manifest cannot be combined with --watch.");
+    }
+    if (optind != argc) {
+      errOutput("--manifest replaces the input and output files given.");
+    }
+  } else if (watching) {
+    if (optind + 1 != argc || !options->multisheets ||
+        strchr(argv[optind], '%') == NULL) {
+      errOutput("--watch requires a single wildcard of output files.");
+    }
+  } else if (options->inputTarFilename != NULL && optind + 1 == argc) {
+    if (!options->multisheets || strchr(argv[optind], '%') == NULL) {
+      errOutput("--input-tar without input files requires a wildcard of "
+                "output files.");
+    }
+    inputTarMembers = true;
+  } else if (optind + 2 > argc) {
+    errOutput("no input or output files given.\n");
+  }
 
-    case 0xc7:
-      sscanf(optarg, "%d", &dpi);
-      break;
+  /* pages in archives are read and written in a single pass, which the
+     options going back to files, or writing them from several processes,
+     cannot do with. */
+  if (options->inputTarFilename != NULL || options->outputTarFilename != NULL) {
+    if (watching || manifesting || options->sweepFilename != NULL ||
+        options->journalFilename != NULL || options->dedupeSize > 0) {
+      errOutput("--input-tar and --output-tar cannot be combined with "
+                "--watch, --manifest, --sweep, --journal or --dedupe.");
+    }
+    if (options->inputTarFilename != NULL && options->shardCount > 1 &&
+        options->shardMode == SHARD_CONTIGUOUS) {
+      errOutput("--input-tar requires --shard-mode round-robin.");
+    }
+    if (options->outputTarFilename != NULL &&
+        strcmp(options->outputTarFilename, "-") == 0 &&
+        options->verbose > VERBOSE_QUIET) {
+      errOutput("--output-tar - requires --quiet.");
+    }
+  }
 
-    case 't':
-      if (strcmp(optarg, "pbm") == 0) {
-        outputPixFmt = AV_PIX_FMT_MONOWHITE;
-      } else if (strcmp(optarg, "pgm") == 0) {
-        outputPixFmt = AV_PIX_FMT_GRAY8;
-      } else if (strcmp(optarg, "ppm") == 0) {
-        outputPixFmt = AV_PIX_FMT_RGB24;
-      }
-      break;
+  /* the files of the processes --sweep starts are their own, and archives
+     are read and written in order already. */
+  if (options->asyncSheets > 0 && (options->sweepFilename != NULL ||
+                                   options->inputTarFilename != NULL ||
+                                   options->outputTarFilename != NULL)) {
+    errOutput("--async-io cannot be combined with --sweep, --input-tar or "
+              "--output-tar.");
+  }
 
-    case 'q':
-      verbose = VERBOSE_QUIET;
-      break;
+  /* deskewing a sheet can narrow the deskew scan size for the sheets after
+     it, which the other shards do not know about: the shards only give the
+     same output as a single run with a size no sheet narrows. */
+  if (options->shardCount > 1 && !options->deskewScanSizeGiven &&
+      options->noDeskewMultiIndex.count != -1) {
+    errOutput("--shard requires --deskew-scan-size.");
+  }
 
-    case 0xc8:
-      overwrite = true;
-      break;
+  if (options->verbose >= VERBOSE_NORMAL)
+    printf(WELCOME); // welcome message
 
-    case 'v':
-      verbose = VERBOSE_NORMAL;
-      break;
+  if (options->startInput == -1)
+    options->startInput = (options->startSheet - 1) * options->inputCount + 1;
+  if (options->startOutput == -1)
+    options->startOutput = (options->startSheet - 1) * options->outputCount + 1;
+
+  inputNr = options->startInput;
+  outputNr = options->startOutput;
+
+  if (!options->multisheets && options->endSheet == -1)
+    options->endSheet = options->startSheet;
+
+  runStart(&run);
+  cpuInit(options->verbose);
+  // the threads of the filters would not carry over to the processes of
+  // sweep variants, which --threads counts instead
+  parallelInit((options->sweepFilename != NULL) ? 1 : options->threadCount,
+               options->verbose);
+  if (options->asyncSheets > 0) {
+    asyncInit(options->asyncSheets, options->verbose);
+  }
 
-    case 0xca:
-      verbose = VERBOSE_MORE;
-      break;
+  const bool useDetectionCache = (
+      options->detectionCacheDirectory != NULL) && !options->noCache;
 
-    case 0xcb:
-      verbose = VERBOSE_DEBUG;
-      break;
+  if (options->resume && options->journalFilename == NULL) {
+    errOutput("--resume requires --journal.");
+  }
+  if (options->journalFilename != NULL) {
+    journalOpen(&run);
+  }
 
-    case 0xcc:
-      verbose = VERBOSE_DEBUG_SAVE;
-      break;
+  const bool useDedupe = (options->dedupeSize > 0) && options->writeoutput;
+  if (useDedupe) {
+    dedupeInit(options->dedupeSize);
+  }
 
-    case 0xcd:
-      if (strcmp(optarg, "nearest") == 0) {
-        interpolateType = INTERP_NN;
-      } else if (strcmp(optarg, "linear") == 0) {
-        interpolateType = INTERP_LINEAR;
-      } else if (strcmp(optarg, "cubic") == 0) {
-        interpolateType = INTERP_CUBIC;
-      } else {
-        fprintf(stderr,
-                "Could not parse --interpolate, using cubic as default.\n");
-        interpolateType = INTERP_CUBIC;
-      }
-      break;
+  const bool sweeping = (options->sweepFilename != NULL);
+  if (sweeping) {
+    if (!options->writeoutput || useDetectionCache ||
+        options->journalFilename != NULL || useDedupe) {
+      errOutput("--sweep cannot be combined with --test-only, "
+                "--detection-cache, --journal or --dedupe.");
     }
+    sweepLoad(options->sweepFilename, options->threadCount, options->verbose);
   }
 
-  /* make sure we have at least two arguments after the options, as
-     that's the minimum amount of parameters we need (one input and
-     one output, or a wildcard of inputs and a wildcard of
-     outputs.
-  */
-  if (optind + 2 > argc)
-    errOutput("no input or output files given.\n");
-
-  if (verbose >= VERBOSE_NORMAL)
-    printf(WELCOME); // welcome message
-
-  if (startInput == -1)
-    startInput = (startSheet - 1) * inputCount + 1;
-  if (startOutput == -1)
-    startOutput = (startSheet - 1) * outputCount + 1;
+  if (options->timingsFilename != NULL) {
+    timingsOpen(options->timingsFilename);
+  }
+  if (options->traceFilename != NULL) {
+    traceOpen(options->traceFilename);
+  }
+  if (options->perfCounters) {
+    perfCountersOpen(options->verbose);
+  }
+  if (options->memoryStats) {
+    memoryAccountingOpen();
+  }
+  if (options->summary) {
+    summaryOpen();
+  }
+  if (options->metricsFilename != NULL) {
+    metricsOpen(options->metricsFilename);
+  }
 
-  inputNr = startInput;
-  outputNr = startOutput;
+  if (watching) {
+    if (options->shardCount > 1) {
+      errOutput("--watch cannot be combined with --shard.");
+    }
+    if (watchContains(options, argv[optind])) {
+      errOutput("--watch output files cannot go to the watched directory.");
+    }
+    watchOpen(options);
+  }
+  if (manifesting) {
+    manifestOpen(options->manifestFilename, options->inputCount,
+                 options->outputCount);
+  }
+  if (options->inputTarFilename != NULL) {
+    tarOpenInput(options->inputTarFilename);
+  }
+  if (options->outputTarFilename != NULL) {
+    struct stat statbuf;
 
-  if (!multisheets && endSheet == -1)
-    endSheet = startSheet;
+    if (!options->overwrite && strcmp(options->outputTarFilename, "-") != 0 &&
+        stat(options->outputTarFilename, &statbuf) == 0) {
+      errOutput("output file '%s' already present.\n",
+                options->outputTarFilename);
+    }
+    tarOpenOutput(options->outputTarFilename);
+  }
 
-  // Calculate the constant absolute values based on the relative parameters.
-  absBlackThreshold = WHITE * (1.0 - blackThreshold);
-  absWhiteThreshold = WHITE * (whiteThreshold);
-  absBlackfilterScanThreshold = WHITE * (blackfilterScanThreshold);
-  absGrayfilterThreshold = WHITE * (grayfilterThreshold);
-  deskewScanRangeRad = degreesToRadians(deskewScanRange);
-  deskewScanStepRad = degreesToRadians(deskewScanStep);
-  deskewScanDeviationRad = degreesToRadians(deskewScanDeviation);
+  // with --shard, the sheets the run processes are numbered from 0 in order,
+  // and only some of them belong to this shard
+  const int shardTotal = (
+      options->shardCount > 1 && options->shardMode == SHARD_CONTIGUOUS)
+                             ? countSheets(options, argc, argv, inputNr)
+                             : 0;
+  int shardSheet = 0;
 
-  for (int nr = startSheet; (endSheet == -1) || (nr <= endSheet); nr++) {
+  for (int nr = options->startSheet;
+       (options->endSheet == -1) || (nr <= options->endSheet); nr++) {
     char inputFilesBuffer[2][255];
     char outputFilesBuffer[2][255];
     char *inputFileNames[2];
     char *outputFileNames[2];
+    // options before the options of a manifest sheet, and the deskew scan
+    // size with them
+    struct Options *sheetOptions = NULL;
+    const int savedScanSize = run.deskewScanSize;
+    int sheetScanSize = run.deskewScanSize;
 
     // -------------------------------------------------------------------
     // --- begin processing                                            ---
     // -------------------------------------------------------------------
 
-    bool inputWildcard = multisheets && (strchr(argv[optind], '%') != NULL);
-    for (int i = 0; i < inputCount; i++) {
-      bool ins = isInMultiIndex(inputNr, insertBlank);
-      bool repl = isInMultiIndex(inputNr, replaceBlank);
-
-      if (repl) {
-        inputFileNames[i] = NULL;
-        inputNr++; /* replace */
-      } else if (ins) {
-        inputFileNames[i] = NULL; /* insert */
-      } else if (inputWildcard) {
-        sprintf(inputFilesBuffer[i], argv[optind], inputNr++);
-        inputFileNames[i] = inputFilesBuffer[i];
-      } else if (optind >= argc) {
-        if (endSheet == -1) {
-          endSheet = nr - 1;
-          goto sheet_end;
-        } else {
-          errOutput("not enough input files given.");
-        }
-      } else {
-        inputFileNames[i] = argv[optind++];
+    bool inputWildcard = !watching && !manifesting && !inputTarMembers &&
+                         options->multisheets && (
+                             strchr(argv[optind], '%') != NULL);
+    bool outputWildcard = false;
+    // the files of the next manifest records are known once this sheet's is
+    // read, and the files landing in the --watch directory only as they land
+    if (asyncEnabled() && !manifesting && !watching) {
+      readAheadSheets(options, nr, argc, argv, inputNr);
+    }
+    if (manifesting) {
+      if (!sheetManifestFiles(&run, inputFileNames, outputFileNames,
+                              &sheetOptions)) {
+        options->endSheet = nr - 1;
+        goto sheet_end;
+      }
+      sheetScanSize = run.deskewScanSize;
+      if (asyncEnabled()) {
+        readAheadSheets(options, nr + 1, argc, argv, inputNr);
       }
-      if (verbose >= VERBOSE_DEBUG) {
+    } else if (!sheetInputFiles(options, nr, argc, argv, inputWildcard,
+                                &inputNr, inputFilesBuffer, inputFileNames,
+                                true)) {
+      options->endSheet = nr - 1;
+      goto sheet_end;
+    }
+    if (options->verbose >= VERBOSE_DEBUG) {
+      for (int i = 0; i < options->inputCount; i++) {
         if (inputFileNames[i] == NULL) {
           printf("added blank input file\n");
         } else {
           printf("added input file %s\n", inputFileNames[i]);
         }
       }
-
-      if (inputFileNames[i] != NULL) {
-        struct stat statBuf;
-        if (stat(inputFileNames[i], &statBuf) != 0) {
-          if (endSheet == -1) {
-            endSheet = nr - 1;
-            goto sheet_end;
-          } else {
-            errOutput("unable to open file %s.", inputFileNames[i]);
-          }
-        }
-      }
     }
     if (inputWildcard)
       optind++;
 
-    if (optind >= argc) { // see if any one of the last two optind++ has pushed
-                          // it over the array boundary
-      errOutput("not enough output files given.");
+    if (!manifesting) {
+      if (optind >= argc) { // see if any one of the last two optind++ has
+                            // pushed it over the array boundary
+        errOutput("not enough output files given.");
+      }
+      outputWildcard = options->multisheets && (
+          strchr(argv[optind], '%') != NULL);
     }
-    bool outputWildcard = multisheets && (strchr(argv[optind], '%') != NULL);
-    for (int i = 0; i < outputCount; i++) {
-      if (outputWildcard) {
+    for (int i = 0; i < options->outputCount; i++) {
+      if (manifesting) {
+        // given by the manifest
+      } else if (outputWildcard) {
         sprintf(outputFilesBuffer[i], argv[optind], outputNr++);
         outputFileNames[i] = outputFilesBuffer[i];
       } else if (optind >= argc) {
@@ -1035,157 +771,194 @@ int main(int argc, char *argv[]) {
       } else {
         outputFileNames[i] = argv[optind++];
       }
-      if (verbose >= VERBOSE_DEBUG) {
+      if (options->verbose >= VERBOSE_DEBUG) {
         printf("added output file %s\n", outputFileNames[i]);
       }
+    }
+    if (outputWildcard)
+      optind++;
+
+    // sheets of other shards are only carried over to the next sheets
+    if (isInMultiIndex(nr, options->sheetMultiIndex) &&
+        (!isInMultiIndex(nr, options->excludeMultiIndex)) &&
+        !inShard(options, shardSheet++, shardTotal)) {
+      carrySheet(&run, nr, inputFileNames);
+      goto sheet_end;
+    }
+
+    // skip sheets completed by an earlier, interrupted run
+    if (options->resume && isInMultiIndex(nr, options->sheetMultiIndex) &&
+        (!isInMultiIndex(nr, options->excludeMultiIndex))) {
+      struct JournalState state;
+
+      if (journalSheetCompleted(options, nr, inputFileNames, outputFileNames,
+                                &state)) {
+        if (options->verbose > VERBOSE_QUIET) {
+          printf("Skipping sheet #%d: already completed.\n", nr);
+        }
+        run.width = state.width;
+        run.height = state.height;
+        run.previousWidth = state.previousWidth;
+        run.previousHeight = state.previousHeight;
+        run.outputPixFmt = state.outputPixFmt;
+        run.deskewScanSize = state.deskewScanSize;
+        goto sheet_end;
+      }
+    }
 
-      if (!overwrite) {
+    // when resuming, outputs of the sheets the interrupted run was still
+    // processing are its leftovers and get replaced
+    // with --sweep, the output files are only known once the variant is
+    // known, and are checked when saving; members of --output-tar are
+    // appended to the archive
+    if (!options->overwrite && !sweeping &&
+        options->outputTarFilename == NULL) {
+      for (int i = 0; i < options->outputCount; i++) {
         struct stat statbuf;
-        if (stat(outputFileNames[i], &statbuf) == 0) {
+        if (stat(outputFileNames[i], &statbuf) == 0 &&
+            !(options->resume && journalOutputStarted(outputFileNames[i]))) {
           errOutput("output file '%s' already present.\n", outputFileNames[i]);
         }
       }
     }
-    if (outputWildcard)
-      optind++;
 
     // ---------------------------------------------------------------
     // --- process single sheet                                    ---
     // ---------------------------------------------------------------
 
-    if (isInMultiIndex(nr, sheetMultiIndex) &&
-        (!isInMultiIndex(nr, excludeMultiIndex))) {
+    if (isInMultiIndex(nr, options->sheetMultiIndex) &&
+        (!isInMultiIndex(nr, options->excludeMultiIndex))) {
       char s1[1023]; // buffers for result of implode()
       char s2[1023];
 
-      if (verbose >= VERBOSE_NORMAL) {
+      instrumentSheet(nr);
+
+      if (options->journalFilename != NULL) {
+        journalStartSheet(options, nr, outputFileNames);
+      }
+
+      if (options->verbose >= VERBOSE_NORMAL) {
         printf("\n-------------------------------------------------------------"
                "------------------\n");
       }
-      if (verbose > VERBOSE_QUIET) {
-        if (multisheets) {
+      if (options->verbose > VERBOSE_QUIET) {
+        if (options->multisheets) {
           printf("Processing sheet #%d: %s -> %s\n", nr,
-                 implode(s1, (const char **)inputFileNames, inputCount),
-                 implode(s2, (const char **)outputFileNames, outputCount));
+                 implode(s1, (const char **)inputFileNames,
+                         options->inputCount),
+                 implode(s2, (const char **)outputFileNames,
+                         options->outputCount));
         } else {
           printf("Processing sheet: %s -> %s\n",
-                 implode(s1, (const char **)inputFileNames, inputCount),
-                 implode(s2, (const char **)outputFileNames, outputCount));
+                 implode(s1, (const char **)inputFileNames,
+                         options->inputCount),
+                 implode(s2, (const char **)outputFileNames,
+                         options->outputCount));
         }
       }
 
+      if (sweepBranch(SWEEP_STAGE_INPUT, applySweepVariantLayout, &run))
+        goto sheet_processed;
       // load input image(s)
-      for (int j = 0; j < inputCount; j++) {
+      for (int j = 0; j < options->inputCount; j++) {
+        const int debugIndex = inputNr - options->inputCount + j;
+
+        page = NULL;
         if (inputFileNames[j] !=
             NULL) { // may be null if --insert-blank or --replace-blank
-          if (verbose >= VERBOSE_MORE)
+          if (options->verbose >= VERBOSE_MORE)
             printf("loading file %s.\n", inputFileNames[j]);
 
-          loadImage(inputFileNames[j], &page);
-          saveDebug("_loaded_%d.pnm", inputNr - inputCount + j, page);
-
-          if (outputPixFmt == -1 && page != NULL) {
-            outputPixFmt = page->format;
-          }
-
-          // pre-rotate
-          if (preRotate != 0) {
-            if (verbose >= VERBOSE_NORMAL) {
-              printf("pre-rotating %d degrees.\n", preRotate);
-            }
-            flipRotate(preRotate / 90, &page);
-          }
-
-          // if sheet-size is not known yet (and not forced by --sheet-size),
-          // set now based on size of (first) input image
-          if (w == -1) {
-            if (sheetSize[WIDTH] != -1) {
-              w = sheetSize[WIDTH];
-            } else {
-              w = page->width * inputCount;
-            }
-          }
-          if (h == -1) {
-            if (sheetSize[HEIGHT] != -1) {
-              h = sheetSize[HEIGHT];
-            } else {
-              h = page->height;
-            }
-          }
-        } else { // inputFiles[j] == NULL
-          page = NULL;
+          beginStage(STAGE_LOAD);
+          loadImage(options, inputFileNames[j], &page);
+          endStage(STAGE_LOAD, page);
+          saveDebug(options, "_loaded_%d.pnm", debugIndex, page);
         }
 
         // place image into sheet buffer
-        // allocate sheet-buffer if not done yet
-        if ((sheet == NULL) && (w != -1) && (h != -1)) {
-          initImage(&sheet, w, h, AV_PIX_FMT_RGB24, true);
-        }
-        if (page != NULL) {
-          saveDebug("_page%d.pnm", inputNr - inputCount + j, page);
-          saveDebug("_before_center_page%d.pnm", inputNr - inputCount + j,
-                    sheet);
+        addSheetPage(&run, j, debugIndex, &page, &sheet);
+      }
 
-          centerImage(page, (w * j / inputCount), 0, (w / inputCount), h,
-                      sheet);
+      if (!finishSheetInput(&run, &sheet, error, sizeof(error))) {
+        errOutput("%s", error);
+      }
 
-          saveDebug("_after_center_page%d.pnm", inputNr - inputCount + j,
-                    sheet);
-        }
+      if (sweepBranch(SWEEP_STAGE_PREPROCESS, applySweepVariantLayout,
+                      &run))
+        goto sheet_processed;
+
+      // blank sheets come out of the whole pipeline as blank pages, as long
+      // as both background and mask color are white: skip straight to the
+      // output size and write pre-encoded blank pages
+      bool blankSheet = true;
+      for (int j = 0; j < options->inputCount; j++) {
+        blankSheet = blankSheet && (inputFileNames[j] == NULL);
+      }
+      if (!blankSheet && options->blankThreshold > 0.0 && !sweeping) {
+        blankSheet = detectBlank(options, sheet, options->blankThreshold);
       }
+      if (blankSheet && options->writeoutput && !sweeping &&
+          options->sheetBackground == WHITE24 &&
+          options->maskColor == WHITE24) {
+        int width = sheet->width;
+        int height = sheet->height;
 
-      // the only case that buffer is not yet initialized is if all blank pages
-      // have been inserted
-      if (sheet == NULL) {
-        // last chance: try to get previous (unstretched/not zoomed) sheet size
-        w = previousWidth;
-        h = previousHeight;
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("need to guess sheet size from previous sheet: %dx%d\n", w, h);
+        if (options->verbose >= VERBOSE_NORMAL) {
+          printf("blank sheet, skipping processing.\n");
         }
-        if ((w == -1) || (h == -1)) {
-          errOutput("sheet size unknown, use at least one input file per "
-                    "sheet, or force using --sheet-size.");
-        } else {
-          initImage(&sheet, w, h, AV_PIX_FMT_RGB24, true);
-        }
-      }
+        av_frame_free(&sheet);
+        sheet = NULL;
 
-      previousWidth = w;
-      previousHeight = h;
+        processedSheetSize(&run, nr, true, &width, &height);
 
-      // pre-mirroring
-      if (preMirror != 0) {
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("pre-mirroring %s\n", getDirections(preMirror));
+        if (run.outputPixFmt == -1) {
+          run.outputPixFmt = AV_PIX_FMT_RGB24;
         }
-        mirror(preMirror, sheet);
-      }
 
-      // pre-shifting
-      if ((preShift[WIDTH] != 0) || ((preShift[HEIGHT] != 0))) {
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("pre-shifting [%d,%d]\n", preShift[WIDTH], preShift[HEIGHT]);
+        for (int j = 0; j < options->outputCount; j++) {
+          if (options->verbose >= VERBOSE_MORE) {
+            printf("saving blank file %s.\n", outputFileNames[j]);
+          }
+          saveBlankImage(options, outputFileNames[j],
+                         width / options->outputCount, height,
+                         run.outputPixFmt);
+        }
+        countPages(options->outputCount);
+
+        if (options->journalFilename != NULL) {
+          journalSheet(&run, nr, inputFileNames, outputFileNames);
         }
-        shift(preShift[WIDTH], preShift[HEIGHT], &sheet);
+        goto sheet_end;
       }
 
-      // pre-masking
-      if (preMaskCount > 0) {
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("pre-masking\n ");
+      // reuse the output of an identical earlier sheet
+      char dedupeKey[DETECTION_KEY_SIZE];
+      if (useDedupe) {
+        dedupeSheetKey(&run, dedupeKey, sheet, nr);
+        if (dedupeLookup(&run, dedupeKey, outputFileNames)) {
+          if (options->verbose >= VERBOSE_NORMAL) {
+            printf("sheet is identical to an earlier one, output reused.\n");
+          }
+          countPages(options->outputCount);
+          if (options->journalFilename != NULL) {
+            journalSheet(&run, nr, inputFileNames, outputFileNames);
+          }
+          av_frame_free(&sheet);
+          sheet = NULL;
+          goto sheet_end;
         }
-        applyMasks(preMask, preMaskCount, sheet);
       }
 
+      prepareSheet(&run, &sheet);
+
       // --------------------------------------------------------------
       // --- verbose parameter output,                              ---
       // --------------------------------------------------------------
 
       // parameters and size are known now
 
-      if (verbose >= VERBOSE_MORE) {
-        switch (layout) {
+      if (options->verbose >= VERBOSE_MORE) {
+        switch (options->layout) {
         case LAYOUT_SINGLE:
           printf("layout: single\n");
           break;
@@ -1194,724 +967,453 @@ int main(int argc, char *argv[]) {
           break;
         }
 
-        if (preRotate != 0) {
-          printf("pre-rotate: %d\n", preRotate);
+        if (options->preRotate != 0) {
+          printf("pre-rotate: %d\n", options->preRotate);
         }
-        if (preMirror != 0) {
-          printf("pre-mirror: %s\n", getDirections(preMirror));
+        if (options->preMirror != 0) {
+          printf("pre-mirror: %s\n", getDirections(options->preMirror));
         }
-        if ((preShift[WIDTH] != 0) || ((preShift[HEIGHT] != 0))) {
-          printf("pre-shift: [%d,%d]\n", preShift[WIDTH], preShift[HEIGHT]);
+        if ((options->preShift[WIDTH] != 0) ||
+            ((options->preShift[HEIGHT] != 0))) {
+          printf("pre-shift: [%d,%d]\n", options->preShift[WIDTH],
+                 options->preShift[HEIGHT]);
         }
-        if (preWipeCount > 0) {
+        if (options->preWipeCount > 0) {
           printf("pre-wipe: ");
-          for (int i = 0; i < preWipeCount; i++) {
-            printf("[%d,%d,%d,%d] ", preWipe[i][LEFT], preWipe[i][TOP],
-                   preWipe[i][RIGHT], preWipe[i][BOTTOM]);
+          for (int i = 0; i < options->preWipeCount; i++) {
+            printf("[%d,%d,%d,%d] ", options->preWipe[i][LEFT],
+                   options->preWipe[i][TOP], options->preWipe[i][RIGHT],
+                   options->preWipe[i][BOTTOM]);
           }
           printf("\n");
         }
-        if (preBorder[LEFT] != 0 || preBorder[TOP] != 0 ||
-            preBorder[RIGHT] != 0 || preBorder[BOTTOM] != 0) {
-          printf("pre-border: [%d,%d,%d,%d]\n", preBorder[LEFT], preBorder[TOP],
-                 preBorder[RIGHT], preBorder[BOTTOM]);
+        if (options->preBorder[LEFT] != 0 || options->preBorder[TOP] != 0 ||
+            options->preBorder[RIGHT] != 0 || options->preBorder[BOTTOM] != 0) {
+          printf("pre-border: [%d,%d,%d,%d]\n", options->preBorder[LEFT],
+                 options->preBorder[TOP], options->preBorder[RIGHT],
+                 options->preBorder[BOTTOM]);
         }
-        if (preMaskCount > 0) {
+        if (options->preMaskCount > 0) {
           printf("pre-masking: ");
-          for (int i = 0; i < preMaskCount; i++) {
-            printf("[%d,%d,%d,%d] ", preMask[i][LEFT], preMask[i][TOP],
-                   preMask[i][RIGHT], preMask[i][BOTTOM]);
+          for (int i = 0; i < options->preMaskCount; i++) {
+            printf("[%d,%d,%d,%d] ", options->preMask[i][LEFT],
+                   options->preMask[i][TOP], options->preMask[i][RIGHT],
+                   options->preMask[i][BOTTOM]);
           }
           printf("\n");
         }
-        if ((stretchSize[WIDTH] != -1) || (stretchSize[HEIGHT] != -1)) {
-          printf("stretch to: %dx%d\n", stretchSize[WIDTH],
-                 stretchSize[HEIGHT]);
+        if ((options->stretchSize[WIDTH] != -1) ||
+            (options->stretchSize[HEIGHT] != -1)) {
+          printf("stretch to: %dx%d\n", options->stretchSize[WIDTH],
+                 options->stretchSize[HEIGHT]);
         }
-        if ((postStretchSize[WIDTH] != -1) || (postStretchSize[HEIGHT] != -1)) {
-          printf("post-stretch to: %dx%d\n", postStretchSize[WIDTH],
-                 postStretchSize[HEIGHT]);
+        if ((options->postStretchSize[WIDTH] != -1) ||
+            (options->postStretchSize[HEIGHT] != -1)) {
+          printf("post-stretch to: %dx%d\n", options->postStretchSize[WIDTH],
+                 options->postStretchSize[HEIGHT]);
         }
-        if (zoomFactor != 1.0) {
-          printf("zoom: %f\n", zoomFactor);
+        if (options->zoomFactor != 1.0) {
+          printf("zoom: %f\n", options->zoomFactor);
         }
-        if (postZoomFactor != 1.0) {
-          printf("post-zoom: %f\n", postZoomFactor);
+        if (options->postZoomFactor != 1.0) {
+          printf("post-zoom: %f\n", options->postZoomFactor);
         }
-        if (noBlackfilterMultiIndex.count != -1) {
+        if (options->noBlackfilterMultiIndex.count != -1) {
           printf("blackfilter-scan-direction: %s\n",
-                 getDirections(blackfilterScanDirections));
-          printf("blackfilter-scan-size: [%d,%d]\n", blackfilterScanSize[0],
-                 blackfilterScanSize[1]);
-          printf("blackfilter-scan-depth: [%d,%d]\n", blackfilterScanDepth[0],
-                 blackfilterScanDepth[1]);
-          printf("blackfilter-scan-step: [%d,%d]\n", blackfilterScanStep[0],
-                 blackfilterScanStep[1]);
-          printf("blackfilter-scan-threshold: %f\n", blackfilterScanThreshold);
-          if (blackfilterExcludeCount > 0) {
+                 getDirections(options->blackfilterScanDirections));
+          printf("blackfilter-scan-size: [%d,%d]\n",
+                 options->blackfilterScanSize[0],
+                 options->blackfilterScanSize[1]);
+          printf("blackfilter-scan-depth: [%d,%d]\n",
+                 options->blackfilterScanDepth[0],
+                 options->blackfilterScanDepth[1]);
+          printf("blackfilter-scan-step: [%d,%d]\n",
+                 options->blackfilterScanStep[0],
+                 options->blackfilterScanStep[1]);
+          printf("blackfilter-scan-threshold: %f\n",
+                 options->blackfilterScanThreshold);
+          if (options->blackfilterExcludeCount > 0) {
             printf("blackfilter-scan-exclude: ");
-            for (int i = 0; i < blackfilterExcludeCount; i++) {
-              printf("[%d,%d,%d,%d] ", blackfilterExclude[i][LEFT],
-                     blackfilterExclude[i][TOP], blackfilterExclude[i][RIGHT],
-                     blackfilterExclude[i][BOTTOM]);
+            for (int i = 0; i < options->blackfilterExcludeCount; i++) {
+              printf("[%d,%d,%d,%d] ", options->blackfilterExclude[i][LEFT],
+                     options->blackfilterExclude[i][TOP],
+                     options->blackfilterExclude[i][RIGHT],
+                     options->blackfilterExclude[i][BOTTOM]);
             }
             printf("\n");
           }
-          printf("blackfilter-intensity: %d\n", blackfilterIntensity);
-          if (noBlackfilterMultiIndex.count > 0) {
+          printf("blackfilter-intensity: %d\n", options->blackfilterIntensity);
+          if (options->noBlackfilterMultiIndex.count > 0) {
             printf("blackfilter DISABLED for sheets: ");
-            printMultiIndex(noBlackfilterMultiIndex);
+            printMultiIndex(options->noBlackfilterMultiIndex);
           }
         } else {
           printf("blackfilter DISABLED for all sheets.\n");
         }
-        if (noNoisefilterMultiIndex.count != -1) {
-          printf("noisefilter-intensity: %d\n", noisefilterIntensity);
-          if (noNoisefilterMultiIndex.count > 0) {
+        if (options->noNoisefilterMultiIndex.count != -1) {
+          printf("noisefilter-intensity: %d\n", options->noisefilterIntensity);
+          if (options->noNoisefilterMultiIndex.count > 0) {
             printf("noisefilter DISABLED for sheets: ");
-            printMultiIndex(noNoisefilterMultiIndex);
+            printMultiIndex(options->noNoisefilterMultiIndex);
           }
         } else {
           printf("noisefilter DISABLED for all sheets.\n");
         }
-        if (noBlurfilterMultiIndex.count != -1) {
-          printf("blurfilter-size: [%d,%d]\n", blurfilterScanSize[0],
-                 blurfilterScanSize[1]);
-          printf("blurfilter-step: [%d,%d]\n", blurfilterScanStep[0],
-                 blurfilterScanStep[1]);
-          printf("blurfilter-intensity: %f\n", blurfilterIntensity);
-          if (noBlurfilterMultiIndex.count > 0) {
+        if (options->noBlurfilterMultiIndex.count != -1) {
+          printf("blurfilter-size: [%d,%d]\n", options->blurfilterScanSize[0],
+                 options->blurfilterScanSize[1]);
+          printf("blurfilter-step: [%d,%d]\n", options->blurfilterScanStep[0],
+                 options->blurfilterScanStep[1]);
+          printf("blurfilter-intensity: %f\n", options->blurfilterIntensity);
+          if (options->noBlurfilterMultiIndex.count > 0) {
             printf("blurfilter DISABLED for sheets: ");
-            printMultiIndex(noBlurfilterMultiIndex);
+            printMultiIndex(options->noBlurfilterMultiIndex);
           }
         } else {
           printf("blurfilter DISABLED for all sheets.\n");
         }
-        if (noGrayfilterMultiIndex.count != -1) {
-          printf("grayfilter-size: [%d,%d]\n", grayfilterScanSize[0],
-                 grayfilterScanSize[1]);
-          printf("grayfilter-step: [%d,%d]\n", grayfilterScanStep[0],
-                 grayfilterScanStep[1]);
-          printf("grayfilter-threshold: %f\n", grayfilterThreshold);
-          if (noGrayfilterMultiIndex.count > 0) {
+        if (options->noGrayfilterMultiIndex.count != -1) {
+          printf("grayfilter-size: [%d,%d]\n", options->grayfilterScanSize[0],
+                 options->grayfilterScanSize[1]);
+          printf("grayfilter-step: [%d,%d]\n", options->grayfilterScanStep[0],
+                 options->grayfilterScanStep[1]);
+          printf("grayfilter-threshold: %f\n", options->grayfilterThreshold);
+          if (options->noGrayfilterMultiIndex.count > 0) {
             printf("grayfilter DISABLED for sheets: ");
-            printMultiIndex(noGrayfilterMultiIndex);
+            printMultiIndex(options->noGrayfilterMultiIndex);
           }
         } else {
           printf("grayfilter DISABLED for all sheets.\n");
         }
-        if (noMaskScanMultiIndex.count != -1) {
+        if (options->noMaskScanMultiIndex.count != -1) {
           printf("mask points: ");
-          for (int i = 0; i < pointCount; i++) {
-            printf("(%d,%d) ", point[i][X], point[i][Y]);
+          for (int i = 0; i < options->pointCount; i++) {
+            printf("(%d,%d) ", options->point[i][X], options->point[i][Y]);
           }
           printf("\n");
           printf("mask-scan-direction: %s\n",
-                 getDirections(maskScanDirections));
-          printf("mask-scan-size: [%d,%d]\n", maskScanSize[0], maskScanSize[1]);
-          printf("mask-scan-depth: [%d,%d]\n", maskScanDepth[0],
-                 maskScanDepth[1]);
-          printf("mask-scan-step: [%d,%d]\n", maskScanStep[0], maskScanStep[1]);
-          printf("mask-scan-threshold: [%f,%f]\n", maskScanThreshold[0],
-                 maskScanThreshold[1]);
-          printf("mask-scan-minimum: [%d,%d]\n", maskScanMinimum[0],
-                 maskScanMinimum[1]);
-          printf("mask-scan-maximum: [%d,%d]\n", maskScanMaximum[0],
-                 maskScanMaximum[1]);
-          printf("mask-color: %d\n", maskColor);
-          if (noMaskScanMultiIndex.count > 0) {
+                 getDirections(options->maskScanDirections));
+          printf("mask-scan-size: [%d,%d]\n", options->maskScanSize[0],
+                 options->maskScanSize[1]);
+          printf("mask-scan-depth: [%d,%d]\n", options->maskScanDepth[0],
+                 options->maskScanDepth[1]);
+          printf("mask-scan-step: [%d,%d]\n", options->maskScanStep[0],
+                 options->maskScanStep[1]);
+          printf("mask-scan-threshold: [%f,%f]\n",
+                 options->maskScanThreshold[0], options->maskScanThreshold[1]);
+          printf("mask-scan-minimum: [%d,%d]\n", options->maskScanMinimum[0],
+                 options->maskScanMinimum[1]);
+          printf("mask-scan-maximum: [%d,%d]\n", options->maskScanMaximum[0],
+                 options->maskScanMaximum[1]);
+          printf("mask-color: %d\n", options->maskColor);
+          if (options->noMaskScanMultiIndex.count > 0) {
             printf("mask-scan DISABLED for sheets: ");
-            printMultiIndex(noMaskScanMultiIndex);
+            printMultiIndex(options->noMaskScanMultiIndex);
           }
         } else {
           printf("mask-scan DISABLED for all sheets.\n");
         }
-        if (noDeskewMultiIndex.count != -1) {
+        if (options->noDeskewMultiIndex.count != -1) {
           printf("deskew-scan-direction: ");
-          printEdges(deskewScanEdges);
-          printf("deskew-scan-size: %d\n", deskewScanSize);
-          printf("deskew-scan-depth: %f\n", deskewScanDepth);
-          printf("deskew-scan-range: %f\n", deskewScanRange);
-          printf("deskew-scan-step: %f\n", deskewScanStep);
-          printf("deskew-scan-deviation: %f\n", deskewScanDeviation);
-          if (noDeskewMultiIndex.count > 0) {
+          printEdges(options->deskewScanEdges);
+          printf("deskew-scan-size: %d\n", run.deskewScanSize);
+          printf("deskew-scan-depth: %f\n", options->deskewScanDepth);
+          printf("deskew-scan-range: %f\n", options->deskewScanRange);
+          printf("deskew-scan-step: %f\n", options->deskewScanStep);
+          printf("deskew-scan-deviation: %f\n", options->deskewScanDeviation);
+          if (options->noDeskewMultiIndex.count > 0) {
             printf("deskew-scan DISABLED for sheets: ");
-            printMultiIndex(noDeskewMultiIndex);
+            printMultiIndex(options->noDeskewMultiIndex);
           }
         } else {
           printf("deskew-scan DISABLED for all sheets.\n");
         }
-        if (noWipeMultiIndex.count != -1) {
-          if (wipeCount > 0) {
+        if (options->noWipeMultiIndex.count != -1) {
+          if (options->wipeCount > 0) {
             printf("wipe areas: ");
-            for (int i = 0; i < wipeCount; i++) {
-              printf("[%d,%d,%d,%d] ", wipe[i][LEFT], wipe[i][TOP],
-                     wipe[i][RIGHT], wipe[i][BOTTOM]);
+            for (int i = 0; i < options->wipeCount; i++) {
+              printf("[%d,%d,%d,%d] ", options->wipe[i][LEFT],
+                     options->wipe[i][TOP], options->wipe[i][RIGHT],
+                     options->wipe[i][BOTTOM]);
             }
             printf("\n");
           }
         } else {
           printf("wipe DISABLED for all sheets.\n");
         }
-        if (middleWipe[0] > 0 || middleWipe[1] > 0) {
-          printf("middle-wipe (l,r): %d,%d\n", middleWipe[0], middleWipe[1]);
+        if (options->middleWipe[0] > 0 || options->middleWipe[1] > 0) {
+          printf("middle-wipe (l,r): %d,%d\n", options->middleWipe[0],
+                 options->middleWipe[1]);
         }
-        if (noBorderMultiIndex.count != -1) {
-          if (border[LEFT] != 0 || border[TOP] != 0 || border[RIGHT] != 0 ||
-              border[BOTTOM] != 0) {
-            printf("explicit border: [%d,%d,%d,%d]\n", border[LEFT],
-                   border[TOP], border[RIGHT], border[BOTTOM]);
+        if (options->noBorderMultiIndex.count != -1) {
+          if (options->border[LEFT] != 0 || options->border[TOP] != 0 ||
+              options->border[RIGHT] != 0 || options->border[BOTTOM] != 0) {
+            printf("explicit border: [%d,%d,%d,%d]\n", options->border[LEFT],
+                   options->border[TOP], options->border[RIGHT],
+                   options->border[BOTTOM]);
           }
         } else {
           printf("border DISABLED for all sheets.\n");
         }
-        if (noBorderScanMultiIndex.count != -1) {
+        if (options->noBorderScanMultiIndex.count != -1) {
           printf("border-scan-direction: %s\n",
-                 getDirections(borderScanDirections));
-          printf("border-scan-size: [%d,%d]\n", borderScanSize[0],
-                 borderScanSize[1]);
-          printf("border-scan-step: [%d,%d]\n", borderScanStep[0],
-                 borderScanStep[1]);
-          printf("border-scan-threshold: [%d,%d]\n", borderScanThreshold[0],
-                 borderScanThreshold[1]);
-          if (noBorderScanMultiIndex.count > 0) {
+                 getDirections(options->borderScanDirections));
+          printf("border-scan-size: [%d,%d]\n", options->borderScanSize[0],
+                 options->borderScanSize[1]);
+          printf("border-scan-step: [%d,%d]\n", options->borderScanStep[0],
+                 options->borderScanStep[1]);
+          printf("border-scan-threshold: [%d,%d]\n",
+                 options->borderScanThreshold[0],
+                 options->borderScanThreshold[1]);
+          if (options->noBorderScanMultiIndex.count > 0) {
             printf("border-scan DISABLED for sheets: ");
-            printMultiIndex(noBorderScanMultiIndex);
+            printMultiIndex(options->noBorderScanMultiIndex);
           }
           printf("border-align: ");
-          printEdges(borderAlign);
-          printf("border-margin: [%d,%d]\n", borderAlignMargin[0],
-                 borderAlignMargin[1]);
+          printEdges(options->borderAlign);
+          printf("border-margin: [%d,%d]\n", options->borderAlignMargin[0],
+                 options->borderAlignMargin[1]);
         } else {
           printf("border-scan DISABLED for all sheets.\n");
         }
-        if (postWipeCount > 0) {
+        if (options->postWipeCount > 0) {
           printf("post-wipe: ");
-          for (int i = 0; i < postWipeCount; i++) {
-            printf("[%d,%d,%d,%d] ", postWipe[i][LEFT], postWipe[i][TOP],
-                   postWipe[i][RIGHT], postWipe[i][BOTTOM]);
+          for (int i = 0; i < options->postWipeCount; i++) {
+            printf("[%d,%d,%d,%d] ", options->postWipe[i][LEFT],
+                   options->postWipe[i][TOP], options->postWipe[i][RIGHT],
+                   options->postWipe[i][BOTTOM]);
           }
           printf("\n");
         }
-        if (postBorder[LEFT] != 0 || postBorder[TOP] != 0 ||
-            postBorder[RIGHT] != 0 || postBorder[BOTTOM] != 0) {
-          printf("post-border: [%d,%d,%d,%d]\n", postBorder[LEFT],
-                 postBorder[TOP], postBorder[RIGHT], postBorder[BOTTOM]);
+        if (options->postBorder[LEFT] != 0 || options->postBorder[TOP] != 0 ||
+            options->postBorder[RIGHT] != 0 ||
+            options->postBorder[BOTTOM] != 0) {
+          printf("post-border: [%d,%d,%d,%d]\n", options->postBorder[LEFT],
+                 options->postBorder[TOP], options->postBorder[RIGHT],
+                 options->postBorder[BOTTOM]);
         }
-        if (postMirror != 0) {
-          printf("post-mirror: %s\n", getDirections(postMirror));
+        if (options->postMirror != 0) {
+          printf("post-mirror: %s\n", getDirections(options->postMirror));
         }
-        if ((postShift[WIDTH] != 0) || ((postShift[HEIGHT] != 0))) {
-          printf("post-shift: [%d,%d]\n", postShift[WIDTH], postShift[HEIGHT]);
+        if ((options->postShift[WIDTH] != 0) ||
+            ((options->postShift[HEIGHT] != 0))) {
+          printf("post-shift: [%d,%d]\n", options->postShift[WIDTH],
+                 options->postShift[HEIGHT]);
         }
-        if (postRotate != 0) {
-          printf("post-rotate: %d\n", postRotate);
+        if (options->postRotate != 0) {
+          printf("post-rotate: %d\n", options->postRotate);
         }
         // if (ignoreMultiIndex.count > 0) {
         //    printf("EXCLUDE sheets: ");
         //    printMultiIndex(ignoreMultiIndex);
         //}
-        printf("white-threshold: %f\n", whiteThreshold);
-        printf("black-threshold: %f\n", blackThreshold);
+        printf("white-threshold: %f\n", options->whiteThreshold);
+        printf("black-threshold: %f\n", options->blackThreshold);
         printf("sheet-background: %s %6x\n",
-               ((sheetBackground == BLACK24) ? "black" : "white"),
-               sheetBackground);
-        printf("dpi: %d\n", dpi);
-        printf("input-files per sheet: %d\n", inputCount);
-        printf("output-files per sheet: %d\n", outputCount);
-        if ((sheetSize[WIDTH] != -1) || (sheetSize[HEIGHT] != -1)) {
-          printf("sheet size forced to: %d x %d pixels\n", sheetSize[WIDTH],
-                 sheetSize[HEIGHT]);
+               ((options->sheetBackground == BLACK24) ? "black" : "white"),
+               options->sheetBackground);
+        printf("dpi: %d\n", options->dpi);
+        printf("input-files per sheet: %d\n", options->inputCount);
+        printf("output-files per sheet: %d\n", options->outputCount);
+        if ((options->sheetSize[WIDTH] != -1) ||
+            (options->sheetSize[HEIGHT] != -1)) {
+          printf("sheet size forced to: %d x %d pixels\n",
+                 options->sheetSize[WIDTH], options->sheetSize[HEIGHT]);
         }
         printf("input-file-sequence:  %s\n",
-               implode(s1, (const char **)inputFileNames, inputCount));
+               implode(s1, (const char **)inputFileNames, options->inputCount));
         printf("output-file-sequence: %s\n",
-               implode(s1, (const char **)outputFileNames, outputCount));
-        if (overwrite) {
+               implode(s1, (const char **)outputFileNames,
+                       options->outputCount));
+        if (options->overwrite) {
           printf("OVERWRITING EXISTING FILES\n");
         }
+        if (useDetectionCache) {
+          printf("detection cache: %s\n", options->detectionCacheDirectory);
+        }
         printf("\n");
       }
-      if (verbose >= VERBOSE_NORMAL) {
-        printf("input-file%s for sheet %d: %s\n", pluralS(inputCount), nr,
-               implode(s1, (const char **)inputFileNames, inputCount));
-        printf("output-file%s for sheet %d: %s\n", pluralS(outputCount), nr,
-               implode(s1, (const char **)outputFileNames, outputCount));
+      if (options->verbose >= VERBOSE_NORMAL) {
+        printf("input-file%s for sheet %d: %s\n", pluralS(options->inputCount),
+               nr,
+               implode(s1, (const char **)inputFileNames, options->inputCount));
+        printf(
+            "output-file%s for sheet %d: %s\n", pluralS(options->outputCount),
+            nr,
+            implode(s1, (const char **)outputFileNames, options->outputCount));
         printf("sheet size: %dx%d\n", sheet->width, sheet->height);
         printf("...\n");
       }
-
       // -------------------------------------------------------
       // --- process image data                              ---
       // -------------------------------------------------------
 
-      // stretch
-      if (stretchSize[WIDTH] != -1) {
-        w = stretchSize[WIDTH];
-      } else {
-        w = sheet->width;
-      }
-      if (stretchSize[HEIGHT] != -1) {
-        h = stretchSize[HEIGHT];
-      } else {
-        h = sheet->height;
-      }
-
-      w *= zoomFactor;
-      h *= zoomFactor;
+      stretchSheet(&run, nr, &sheet);
 
-      saveDebug("_before-stretch%d.pnm", nr, sheet);
-      stretch(w, h, &sheet);
-      saveDebug("_after-stretch%d.pnm", nr, sheet);
-
-      // size
-      if ((size[WIDTH] != -1) || (size[HEIGHT] != -1)) {
-        if (size[WIDTH] != -1) {
-          w = size[WIDTH];
-        } else {
-          w = sheet->width;
-        }
-        if (size[HEIGHT] != -1) {
-          h = size[HEIGHT];
-        } else {
-          h = sheet->height;
-        }
-        saveDebug("_before-resize%d.pnm", nr, sheet);
-        resize(w, h, &sheet);
-        saveDebug("_after-resize%d.pnm", nr, sheet);
+      // look up previous detection results for the same input and parameters
+      struct DetectionResult detection = {0};
+      char detectionKey[DETECTION_KEY_SIZE];
+      bool detectionCached = false;
+      if (useDetectionCache) {
+        detectionCacheKey(&run, detectionKey, inputFileNames, nr, sheet);
+        detectionCached =
+            detectionCacheLookup(options, detectionKey, &detection);
       }
 
-      // handle sheet layout
-
-      // LAYOUT_SINGLE
-      if (layout == LAYOUT_SINGLE) {
-        // set middle of sheet as single starting point for mask detection
-        if (pointCount == 0) { // no manual settings, use auto-values
-          point[pointCount][X] = sheet->width / 2;
-          point[pointCount][Y] = sheet->height / 2;
-          pointCount++;
-        }
-        if (maskScanMaximum[WIDTH] == -1) {
-          maskScanMaximum[WIDTH] = sheet->width;
-        }
-        if (maskScanMaximum[HEIGHT] == -1) {
-          maskScanMaximum[HEIGHT] = sheet->height;
-        }
-        // avoid inner half of the sheet to be blackfilter-detectable
-        if (blackfilterExcludeCount ==
-            0) { // no manual settings, use auto-values
-          blackfilterExclude[blackfilterExcludeCount][LEFT] = sheet->width / 4;
-          blackfilterExclude[blackfilterExcludeCount][TOP] = sheet->height / 4;
-          blackfilterExclude[blackfilterExcludeCount][RIGHT] =
-              sheet->width / 2 + sheet->width / 4;
-          blackfilterExclude[blackfilterExcludeCount][BOTTOM] =
-              sheet->height / 2 + sheet->height / 4;
-          blackfilterExcludeCount++;
-        }
-        // set single outside border to start scanning for final border-scan
-        if (outsideBorderscanMaskCount ==
-            0) { // no manual settings, use auto-values
-          outsideBorderscanMaskCount = 1;
-          outsideBorderscanMask[0][LEFT] = 0;
-          outsideBorderscanMask[0][RIGHT] = sheet->width - 1;
-          outsideBorderscanMask[0][TOP] = 0;
-          outsideBorderscanMask[0][BOTTOM] = sheet->height - 1;
-        }
+      preWipeSheet(&run, nr, sheet);
 
-        // LAYOUT_DOUBLE
-      } else if (layout == LAYOUT_DOUBLE) {
-        // set two middle of left/right side of sheet as starting points for
-        // mask detection
-        if (pointCount == 0) { // no manual settings, use auto-values
-          point[pointCount][X] = sheet->width / 4;
-          point[pointCount][Y] = sheet->height / 2;
-          pointCount++;
-          point[pointCount][X] = sheet->width - sheet->width / 4;
-          point[pointCount][Y] = sheet->height / 2;
-          pointCount++;
-        }
-        if (maskScanMaximum[WIDTH] == -1) {
-          maskScanMaximum[WIDTH] = sheet->width / 2;
-        }
-        if (maskScanMaximum[HEIGHT] == -1) {
-          maskScanMaximum[HEIGHT] = sheet->height;
-        }
-        if (middleWipe[0] > 0 || middleWipe[1] > 0) { // left, right
-          wipe[wipeCount][LEFT] = sheet->width / 2 - middleWipe[0];
-          wipe[wipeCount][TOP] = 0;
-          wipe[wipeCount][RIGHT] = sheet->width / 2 + middleWipe[1];
-          wipe[wipeCount][BOTTOM] = sheet->height - 1;
-          wipeCount++;
-        }
-        // avoid inner half of each page to be blackfilter-detectable
-        if (blackfilterExcludeCount ==
-            0) { // no manual settings, use auto-values
-          blackfilterExclude[blackfilterExcludeCount][LEFT] = sheet->width / 8;
-          blackfilterExclude[blackfilterExcludeCount][TOP] = sheet->height / 4;
-          blackfilterExclude[blackfilterExcludeCount][RIGHT] =
-              sheet->width / 4 + sheet->width / 8;
-          blackfilterExclude[blackfilterExcludeCount][BOTTOM] =
-              sheet->height / 2 + sheet->height / 4;
-          blackfilterExcludeCount++;
-          blackfilterExclude[blackfilterExcludeCount][LEFT] =
-              sheet->width / 2 + sheet->width / 8;
-          blackfilterExclude[blackfilterExcludeCount][TOP] = sheet->height / 4;
-          blackfilterExclude[blackfilterExcludeCount][RIGHT] =
-              sheet->width / 2 + sheet->width / 4 + sheet->width / 8;
-          blackfilterExclude[blackfilterExcludeCount][BOTTOM] =
-              sheet->height / 2 + sheet->height / 4;
-          blackfilterExcludeCount++;
-        }
-        // set two outside borders to start scanning for final border-scan
-        if (outsideBorderscanMaskCount ==
-            0) { // no manual settings, use auto-values
-          outsideBorderscanMaskCount = 2;
-          outsideBorderscanMask[0][LEFT] = 0;
-          outsideBorderscanMask[0][RIGHT] = sheet->width / 2;
-          outsideBorderscanMask[0][TOP] = 0;
-          outsideBorderscanMask[0][BOTTOM] = sheet->height - 1;
-          outsideBorderscanMask[1][LEFT] = sheet->width / 2;
-          outsideBorderscanMask[1][RIGHT] = sheet->width - 1;
-          outsideBorderscanMask[1][TOP] = 0;
-          outsideBorderscanMask[1][BOTTOM] = sheet->height - 1;
+      for (SWEEP_STAGES stage = SWEEP_STAGE_BLACKFILTER;
+           stage < SWEEP_STAGE_OUTPUT; stage++) {
+        if (stage == SWEEP_STAGE_POST && useDetectionCache) {
+          if (detectionCached) {
+            // detectRotation() may have limited the scan size, replay that
+            // too
+            run.deskewScanSize = detection.deskewScanSize;
+          } else {
+            detection.deskewScanSize = run.deskewScanSize;
+            detectionCacheStore(options, detectionKey, &detection);
+          }
         }
-      }
-      // if maskScanMaximum still unset (no --layout specified), set to full
-      // sheet size now
-      if (maskScanMinimum[WIDTH] == -1) {
-        maskScanMaximum[WIDTH] = sheet->width;
-      }
-      if (maskScanMinimum[HEIGHT] == -1) {
-        maskScanMaximum[HEIGHT] = sheet->height;
-      }
-
-      // pre-wipe
-      if (!isExcluded(nr, noWipeMultiIndex, ignoreMultiIndex)) {
-        applyWipes(preWipe, preWipeCount, sheet);
-      }
 
-      // pre-border
-      if (!isExcluded(nr, noBorderMultiIndex, ignoreMultiIndex)) {
-        applyBorder(preBorder, sheet);
-      }
+        if (sweepBranch(stage, applySweepVariant, &run))
+          goto sheet_processed;
 
-      // black area filter
-      if (!isExcluded(nr, noBlackfilterMultiIndex, ignoreMultiIndex)) {
-        saveDebug("_before-blackfilter%d.pnm", nr, sheet);
-        blackfilter(sheet);
-        saveDebug("_after-blackfilter%d.pnm", nr, sheet);
-      } else {
-        if (verbose >= VERBOSE_MORE) {
-          printf("+ blackfilter DISABLED for sheet %d\n", nr);
-        }
+        processStage(&run, stage, nr, &sheet, &detection, detectionCached);
       }
 
-      // noise filter
-      if (!isExcluded(nr, noNoisefilterMultiIndex, ignoreMultiIndex)) {
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("noise-filter ...");
-        }
-        saveDebug("_before-noisefilter%d.pnm", nr, sheet);
-        int filterResult = noisefilter(sheet);
-        saveDebug("_after-noisefilter%d.pnm", nr, sheet);
-        if (verbose >= VERBOSE_NORMAL) {
-          printf(" deleted %d clusters.\n", filterResult);
-        }
-      } else {
-        if (verbose >= VERBOSE_MORE) {
-          printf("+ noisefilter DISABLED for sheet %d\n", nr);
-        }
+      // the other shards carry the sheet over without deskewing it, so they
+      // would go on with the deskew scan size it started with
+      if (options->shardCount > 1 && run.deskewScanSize != sheetScanSize) {
+        errOutput("sheet %d narrowed the deskew scan size to %d, which the "
+                  "other shards do not know about; pass a --deskew-scan-size "
+                  "of at most %d to every shard.",
+                  nr, run.deskewScanSize, run.deskewScanSize);
       }
 
-      // blur filter
-      if (!isExcluded(nr, noBlurfilterMultiIndex, ignoreMultiIndex)) {
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("blur-filter...");
-        }
-        saveDebug("_before-blurfilter%d.pnm", nr, sheet);
-        int filterResult = blurfilter(sheet);
-        saveDebug("_after-blurfilter%d.pnm", nr, sheet);
-        if (verbose >= VERBOSE_NORMAL) {
-          printf(" deleted %d pixels.\n", filterResult);
-        }
-      } else {
-        if (verbose >= VERBOSE_MORE) {
-          printf("+ blurfilter DISABLED for sheet %d\n", nr);
-        }
-      }
+      if (sweepBranch(SWEEP_STAGE_OUTPUT, applySweepVariant, &run))
+        goto sheet_processed;
 
-      // mask-detection
-      if (!isExcluded(nr, noMaskScanMultiIndex, ignoreMultiIndex)) {
-        detectMasks(sheet);
-      } else {
-        if (verbose >= VERBOSE_MORE) {
-          printf("+ mask-scan DISABLED for sheet %d\n", nr);
-        }
-      }
+      // --- write output file ---
 
-      // permanently apply masks
-      if (maskCount > 0) {
-        saveDebug("_before-masking%d.pnm", nr, sheet);
-        applyMasks(mask, maskCount, sheet);
-        saveDebug("_after-masking%d.pnm", nr, sheet);
-      }
+      // write split pages output
 
-      // gray filter
-      if (!isExcluded(nr, noGrayfilterMultiIndex, ignoreMultiIndex)) {
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("gray-filter...");
-        }
-        saveDebug("_before-grayfilter%d.pnm", nr, sheet);
-        int filterResult = grayfilter(sheet);
-        saveDebug("_after-grayfilter%d.pnm", nr, sheet);
-        if (verbose >= VERBOSE_NORMAL) {
-          printf(" deleted %d pixels.\n", filterResult);
-        }
-      } else {
-        if (verbose >= VERBOSE_MORE) {
-          printf("+ grayfilter DISABLED for sheet %d\n", nr);
+      if (options->writeoutput == true) {
+        if (options->verbose >= VERBOSE_NORMAL) {
+          printf("writing output.\n");
         }
-      }
-
-      // rotation-detection
-      if ((!isExcluded(nr, noDeskewMultiIndex, ignoreMultiIndex))) {
-        saveDebug("_before-deskew%d.pnm", nr, sheet);
+        // write files
+        saveDebug(options, "_before-save%d.pnm", nr, sheet);
 
-        // detect masks again, we may get more precise results now after first
-        // masking and grayfilter
-        if (!isExcluded(nr, noMaskScanMultiIndex, ignoreMultiIndex)) {
-          detectMasks(sheet);
-        } else {
-          if (verbose >= VERBOSE_MORE) {
-            printf("(mask-scan before deskewing disabled)\n");
-          }
+        if (run.outputPixFmt == -1) {
+          run.outputPixFmt = sheet->format;
         }
 
-        // auto-deskew each mask
-        for (int i = 0; i < maskCount; i++) {
-          saveDebug("_before-deskew-detect%d.pnm", nr * maskCount + i, sheet);
-          float rotation = detectRotation(sheet, mask[i]);
-          saveDebug("_after-deskew-detect%d.pnm", nr * maskCount + i, sheet);
+        for (int j = 0; j < options->outputCount; j++) {
+          char outputFilename[PATH_MAX];
 
-          if (verbose >= VERBOSE_NORMAL) {
-            printf("rotate (%d,%d): %f\n", point[i][X], point[i][Y], rotation);
+          sweepOutputName(outputFilename, sizeof(outputFilename),
+                          outputFileNames[j]);
+          if (sweeping && !options->overwrite &&
+              access(outputFilename, F_OK) == 0) {
+            errOutput("output file '%s' already present.\n", outputFilename);
           }
 
-          if (rotation != 0.0) {
-            AVFrame *rect;
-            AVFrame *rectTarget;
-            initImage(&rect, (mask[i][RIGHT] - mask[i][LEFT] + 1),
-                      (mask[i][BOTTOM] - mask[i][TOP] + 1), sheet->format,
-                      false);
-            initImage(&rectTarget, rect->width, rect->height, sheet->format,
-                      true);
-
-            // copy area to rotate into rSource
-            copyImageArea(mask[i][LEFT], mask[i][TOP], rect->width,
-                          rect->height, sheet, 0, 0, rect);
-
-            // rotate
-            rotate(-rotation, rect, rectTarget);
-
-            // copy result back into whole image
-            copyImageArea(0, 0, rectTarget->width, rectTarget->height,
-                          rectTarget, mask[i][LEFT], mask[i][TOP], sheet);
+          // get pagebuffer
+          page = sheetPage(&run, sheet, j);
 
-            av_frame_free(&rect);
-            av_frame_free(&rectTarget);
+          if (options->verbose >= VERBOSE_MORE) {
+            printf("saving file %s.\n", outputFilename);
           }
-        }
 
-        saveDebug("_after-deskew%d.pnm", nr, sheet);
-      } else {
-        if (verbose >= VERBOSE_MORE) {
-          printf("+ deskewing DISABLED for sheet %d\n", nr);
-        }
-      }
+          beginStage(STAGE_SAVE);
+          saveImage(options, outputFilename, page, run.outputPixFmt);
+          endStage(STAGE_SAVE, page);
 
-      // auto-center masks on either single-page or double-page layout
-      if (!isExcluded(
-              nr, noMaskCenterMultiIndex,
-              ignoreMultiIndex)) { // (maskCount==pointCount to make sure all
-                                   // masks had correctly been detected)
-        // perform auto-masking again to get more precise masks after rotation
-        if (!isExcluded(nr, noMaskScanMultiIndex, ignoreMultiIndex)) {
-          detectMasks(sheet);
-        } else {
-          if (verbose >= VERBOSE_MORE) {
-            printf("(mask-scan before centering disabled)\n");
+          if (page != sheet) {
+            av_frame_free(&page);
           }
         }
+        countPages(options->outputCount);
 
-        saveDebug("_before-centering%d.pnm", nr, sheet);
-        // center masks on the sheet, according to their page position
-        for (int i = 0; i < maskCount; i++) {
-          centerMask(sheet, point[i], mask[i]);
-        }
-        saveDebug("_after-centering%d.pnm", nr, sheet);
-      } else {
-        if (verbose >= VERBOSE_MORE) {
-          printf("+ auto-centering DISABLED for sheet %d\n", nr);
-        }
-      }
-
-      // explicit wipe
-      if (!isExcluded(nr, noWipeMultiIndex, ignoreMultiIndex)) {
-        applyWipes(wipe, wipeCount, sheet);
-      } else {
-        if (verbose >= VERBOSE_MORE) {
-          printf("+ wipe DISABLED for sheet %d\n", nr);
-        }
-      }
-
-      // explicit border
-      if (!isExcluded(nr, noBorderMultiIndex, ignoreMultiIndex)) {
-        applyBorder(border, sheet);
-      } else {
-        if (verbose >= VERBOSE_MORE) {
-          printf("+ border DISABLED for sheet %d\n", nr);
-        }
-      }
-
-      // border-detection
-      if (!isExcluded(nr, noBorderScanMultiIndex, ignoreMultiIndex)) {
-        int autoborder[MAX_MASKS][EDGES_COUNT];
-        int autoborderMask[MAX_MASKS][EDGES_COUNT];
-        saveDebug("_before-border%d.pnm", nr, sheet);
-        for (int i = 0; i < outsideBorderscanMaskCount; i++) {
-          detectBorder(autoborder[i], outsideBorderscanMask[i], sheet);
-          borderToMask(autoborder[i], autoborderMask[i], sheet);
-        }
-        applyMasks(autoborderMask, outsideBorderscanMaskCount, sheet);
-        for (int i = 0; i < outsideBorderscanMaskCount; i++) {
-          // border-centering
-          if (!isExcluded(nr, noBorderAlignMultiIndex, ignoreMultiIndex)) {
-            alignMask(autoborderMask[i], outsideBorderscanMask[i], sheet);
-          } else {
-            if (verbose >= VERBOSE_MORE) {
-              printf("+ border-centering DISABLED for sheet %d\n", nr);
-            }
-          }
+        if (options->journalFilename != NULL) {
+          journalSheet(&run, nr, inputFileNames, outputFileNames);
         }
-        saveDebug("_after-border%d.pnm", nr, sheet);
-      } else {
-        if (verbose >= VERBOSE_MORE) {
-          printf("+ border-scan DISABLED for sheet %d\n", nr);
-        }
-      }
-
-      // post-wipe
-      if (!isExcluded(nr, noWipeMultiIndex, ignoreMultiIndex)) {
-        applyWipes(postWipe, postWipeCount, sheet);
-      }
-
-      // post-border
-      if (!isExcluded(nr, noBorderMultiIndex, ignoreMultiIndex)) {
-        applyBorder(postBorder, sheet);
-      }
 
-      // post-mirroring
-      if (postMirror != 0) {
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("post-mirroring %s\n", getDirections(postMirror));
+        if (useDedupe) {
+          dedupeStore(&run, dedupeKey, outputFileNames);
         }
-        mirror(postMirror, sheet);
-      }
 
-      // post-shifting
-      if ((postShift[WIDTH] != 0) || ((postShift[HEIGHT] != 0))) {
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("post-shifting [%d,%d]\n", postShift[WIDTH],
-                 postShift[HEIGHT]);
-        }
-        shift(postShift[WIDTH], postShift[HEIGHT], &sheet);
+        av_frame_free(&sheet);
+        sheet = NULL;
       }
 
-      // post-rotating
-      if (postRotate != 0) {
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("post-rotating %d degrees.\n", postRotate);
-        }
-        flipRotate(postRotate / 90, &sheet);
+    sheet_processed:
+      if (sweeping) {
+        // the main process stops early when only the variants write output
+        av_frame_free(&sheet);
+        sheet = NULL;
+        instrumentSheetEnd();
+        sweepEndSheet();
       }
+    }
 
-      // post-stretch
-      if (postStretchSize[WIDTH] != -1) {
-        w = postStretchSize[WIDTH];
-      } else {
-        w = sheet->width;
-      }
-      if (postStretchSize[HEIGHT] != -1) {
-        h = postStretchSize[HEIGHT];
-      } else {
-        h = sheet->height;
+  sheet_end:
+    instrumentSheetEnd();
+
+    // the options of a manifest sheet apply to it alone, but the deskew scan
+    // size its pages limited carries over as usual
+    if (sheetOptions != NULL) {
+      const int scanSize = run.deskewScanSize;
+
+      restoreOptions(options, sheetOptions);
+      free(sheetOptions);
+      run.deskewScanSize = savedScanSize;
+      if (scanSize != sheetScanSize) {
+        run.deskewScanSize = min(savedScanSize, scanSize);
       }
+    }
 
-      w *= postZoomFactor;
-      h *= postZoomFactor;
-
-      stretch(w, h, &sheet);
+    /* if we're not given an input wildcard, and we finished the
+     * arguments, we don't want to keep looping, unless watching.
+     */
+    if (manifesting)
+      continue;
+    else if (watching || inputTarMembers)
+      optind--;
+    else if (optind >= argc && !inputWildcard)
+      break;
+    else if (inputWildcard && outputWildcard)
+      optind -= 2;
+  }
 
-      // post-size
-      if ((postSize[WIDTH] != -1) || (postSize[HEIGHT] != -1)) {
-        if (postSize[WIDTH] != -1) {
-          w = postSize[WIDTH];
-        } else {
-          w = sheet->width;
-        }
-        if (postSize[HEIGHT] != -1) {
-          h = postSize[HEIGHT];
-        } else {
-          h = sheet->height;
-        }
-        resize(w, h, &sheet);
-      }
+  asyncClose();
 
-      // --- write output file ---
+  if (useDetectionCache && options->verbose > VERBOSE_QUIET) {
+    printDetectionCacheStats();
+  }
 
-      // write split pages output
+  if (useDedupe) {
+    if (options->verbose > VERBOSE_QUIET) {
+      printDedupeStats();
+    }
+    dedupeClose();
+  }
 
-      if (writeoutput == true) {
-        if (verbose >= VERBOSE_NORMAL) {
-          printf("writing output.\n");
-        }
-        // write files
-        saveDebug("_before-save%d.pnm", nr, sheet);
+  journalClose();
 
-        if (outputPixFmt == -1) {
-          outputPixFmt = sheet->format;
-        }
+  watchClose();
 
-        for (int j = 0; j < outputCount; j++) {
-          // get pagebuffer
-          initImage(&page, sheet->width / outputCount, sheet->height,
-                    sheet->format, false);
-          copyImageArea(page->width * j, 0, page->width, page->height, sheet, 0,
-                        0, page);
+  manifestClose();
 
-          if (verbose >= VERBOSE_MORE) {
-            printf("saving file %s.\n", outputFileNames[j]);
-          }
+  tarClose();
 
-          saveImage(outputFileNames[j], page, outputPixFmt);
+  instrumentClose(options->verbose);
 
-          av_frame_free(&page);
-        }
+  sweepFinish();
 
-        av_frame_free(&sheet);
-        sheet = NULL;
-      }
-    }
+  parallelFinish();
 
-  sheet_end:
-    /* if we're not given an input wildcard, and we finished the
-     * arguments, we don't want to keep looping.
-     */
-    if (optind >= argc && !inputWildcard)
-      break;
-    else if (inputWildcard && outputWildcard)
-      optind -= 2;
-  }
+  runFree(&run);
 
   return 0;
 }
@@ -9,11 +9,14 @@
 #pragma once
 
 #include <math.h>
+#include <setjmp.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #include <libavutil/frame.h>
 
 #include "constants.h"
+#include "parse.h"
 
 /* --- preprocessor macros ------------------------------------------------ */
 
@@ -22,129 +25,206 @@
 void errOutput(const char *fmt, ...) __attribute__((format(printf, 1, 2)))
 __attribute__((noreturn));
 
-/* --- global variable ---------------------------------------------------- */
-
-extern VERBOSE_LEVEL verbose;
-extern INTERP_FUNCTIONS interpolateType;
-
-extern unsigned int absBlackThreshold;
-extern unsigned int absWhiteThreshold;
-extern unsigned int absBlackfilterScanThreshold;
-extern unsigned int absGrayfilterThreshold;
-extern float deskewScanRangeRad;
-extern float deskewScanStepRad;
-extern float deskewScanDeviationRad;
-
-extern int layout;
-extern int startSheet;
-extern int endSheet;
-extern int startInput;
-extern int startOutput;
-extern int inputCount;
-extern int outputCount;
-extern int sheetSize[DIMENSIONS_COUNT];
-extern int sheetBackground;
-extern int preRotate;
-extern int postRotate;
-extern int preMirror;
-extern int postMirror;
-extern int preShift[DIRECTIONS_COUNT];
-extern int postShift[DIRECTIONS_COUNT];
-extern int size[DIRECTIONS_COUNT];
-extern int postSize[DIRECTIONS_COUNT];
-extern int stretchSize[DIRECTIONS_COUNT];
-extern int postStretchSize[DIRECTIONS_COUNT];
-extern float zoomFactor;
-extern float postZoomFactor;
-extern int pointCount;
-extern int point[MAX_POINTS][COORDINATES_COUNT];
-extern int maskCount;
-extern int mask[MAX_MASKS][EDGES_COUNT];
-extern int wipeCount;
-extern int wipe[MAX_MASKS][EDGES_COUNT];
-extern int middleWipe[2];
-extern int preWipeCount;
-extern int preWipe[MAX_MASKS][EDGES_COUNT];
-extern int postWipeCount;
-extern int postWipe[MAX_MASKS][EDGES_COUNT];
-extern int preBorder[EDGES_COUNT];
-extern int postBorder[EDGES_COUNT];
-extern int border[EDGES_COUNT];
-extern bool maskValid[MAX_MASKS];
-extern int preMaskCount;
-extern int preMask[MAX_MASKS][EDGES_COUNT];
-extern int blackfilterScanDirections;
-extern int blackfilterScanSize[DIRECTIONS_COUNT];
-extern int blackfilterScanDepth[DIRECTIONS_COUNT];
-extern int blackfilterScanStep[DIRECTIONS_COUNT];
-extern float blackfilterScanThreshold;
-extern int blackfilterExcludeCount;
-extern int blackfilterExclude[MAX_MASKS][EDGES_COUNT];
-extern int blackfilterIntensity;
-extern int noisefilterIntensity;
-extern int blurfilterScanSize[DIRECTIONS_COUNT];
-extern int blurfilterScanStep[DIRECTIONS_COUNT];
-extern float blurfilterIntensity;
-extern int grayfilterScanSize[DIRECTIONS_COUNT];
-extern int grayfilterScanStep[DIRECTIONS_COUNT];
-extern float grayfilterThreshold;
-extern int maskScanDirections;
-extern int maskScanSize[DIRECTIONS_COUNT];
-extern int maskScanDepth[DIRECTIONS_COUNT];
-extern int maskScanStep[DIRECTIONS_COUNT];
-extern float maskScanThreshold[DIRECTIONS_COUNT];
-extern int maskScanMinimum[DIMENSIONS_COUNT];
-extern int maskScanMaximum[DIMENSIONS_COUNT]; // set default later
-extern int maskColor;
-extern int deskewScanEdges;
-extern int deskewScanSize;
-extern float deskewScanDepth;
-extern float deskewScanRange;
-extern float deskewScanStep;
-extern float deskewScanDeviation;
-extern int borderScanDirections;
-extern int borderScanSize[DIRECTIONS_COUNT];
-extern int borderScanStep[DIRECTIONS_COUNT];
-extern int borderScanThreshold[DIRECTIONS_COUNT];
-extern int borderAlign;                                   // center
-extern int borderAlignMargin[DIRECTIONS_COUNT];           // center
-extern int outsideBorderscanMask[MAX_PAGES][EDGES_COUNT]; // set by --layout
-extern int outsideBorderscanMaskCount;
-extern float whiteThreshold;
-extern float blackThreshold;
-extern bool writeoutput;
-extern bool multisheets;
-
-extern struct MultiIndex noBlackfilterMultiIndex;
-extern struct MultiIndex noNoisefilterMultiIndex;
-extern struct MultiIndex noBlurfilterMultiIndex;
-extern struct MultiIndex noGrayfilterMultiIndex;
-extern struct MultiIndex noMaskScanMultiIndex;
-extern struct MultiIndex noMaskCenterMultiIndex;
-extern struct MultiIndex noDeskewMultiIndex;
-extern struct MultiIndex noWipeMultiIndex;
-extern struct MultiIndex noBorderMultiIndex;
-extern struct MultiIndex noBorderScanMultiIndex;
-extern struct MultiIndex noBorderAlignMultiIndex;
-extern struct MultiIndex sheetMultiIndex;
-extern struct MultiIndex excludeMultiIndex;
-extern struct MultiIndex ignoreMultiIndex;
-extern struct MultiIndex insertBlank;
-extern struct MultiIndex replaceBlank;
-
-extern int autoborder[MAX_MASKS][EDGES_COUNT];
-extern int autoborderMask[MAX_MASKS][EDGES_COUNT];
-extern bool overwrite;
-extern int dpi;
+// set by the library while it processes a sheet on this thread: errors go
+// back to it with their message, instead of exiting
+extern _Thread_local jmp_buf *errorJump;
+extern _Thread_local char errorMessage[256];
+
+/* --- options ------------------------------------------------------------ */
+
+// The parameters of a run, as set by the options. Sheets are processed with
+// the options of a struct RunState (see sheet.h), into which the masks found
+// and the defaults of the layout are filled in as the sheets go.
+struct Options {
+  VERBOSE_LEVEL verbose;
+  INTERP_FUNCTIONS interpolateType;
+
+  // calculated from the relative parameters by updateAbsoluteParameters()
+  unsigned int absBlackThreshold;
+  unsigned int absWhiteThreshold;
+  unsigned int absBlackfilterScanThreshold;
+  unsigned int absGrayfilterThreshold;
+  float deskewScanRangeRad;
+  float deskewScanStepRad;
+  float deskewScanDeviationRad;
+
+  int layout;
+  int startSheet;
+  int endSheet;
+  int startInput;
+  int startOutput;
+  int inputCount;
+  int outputCount;
+  int sheetSize[DIMENSIONS_COUNT];
+  int sheetBackground;
+  int preRotate;
+  int postRotate;
+  int preMirror;
+  int postMirror;
+  int preShift[DIRECTIONS_COUNT];
+  int postShift[DIRECTIONS_COUNT];
+  int size[DIRECTIONS_COUNT];
+  int postSize[DIRECTIONS_COUNT];
+  int stretchSize[DIRECTIONS_COUNT];
+  int postStretchSize[DIRECTIONS_COUNT];
+  float zoomFactor;
+  float postZoomFactor;
+  int pointCount;
+  int point[MAX_POINTS][COORDINATES_COUNT];
+  int maskCount;
+  int mask[MAX_MASKS][EDGES_COUNT];
+  bool maskValid[MAX_MASKS];
+  int wipeCount;
+  int wipe[MAX_MASKS][EDGES_COUNT];
+  int middleWipe[2];
+  int preWipeCount;
+  int preWipe[MAX_MASKS][EDGES_COUNT];
+  int postWipeCount;
+  int postWipe[MAX_MASKS][EDGES_COUNT];
+  int preBorder[EDGES_COUNT];
+  int postBorder[EDGES_COUNT];
+  int border[EDGES_COUNT];
+  int preMaskCount;
+  int preMask[MAX_MASKS][EDGES_COUNT];
+  int blackfilterScanDirections;
+  int blackfilterScanSize[DIRECTIONS_COUNT];
+  int blackfilterScanDepth[DIRECTIONS_COUNT];
+  int blackfilterScanStep[DIRECTIONS_COUNT];
+  float blackfilterScanThreshold;
+  int blackfilterExcludeCount;
+  int blackfilterExclude[MAX_MASKS][EDGES_COUNT];
+  int blackfilterIntensity;
+  int noisefilterIntensity;
+  int blurfilterScanSize[DIRECTIONS_COUNT];
+  int blurfilterScanStep[DIRECTIONS_COUNT];
+  float blurfilterIntensity;
+  int grayfilterScanSize[DIRECTIONS_COUNT];
+  int grayfilterScanStep[DIRECTIONS_COUNT];
+  float grayfilterThreshold;
+  int maskScanDirections;
+  int maskScanSize[DIRECTIONS_COUNT];
+  int maskScanDepth[DIRECTIONS_COUNT];
+  int maskScanStep[DIRECTIONS_COUNT];
+  float maskScanThreshold[DIRECTIONS_COUNT];
+  int maskScanMinimum[DIMENSIONS_COUNT];
+  int maskScanMaximum[DIMENSIONS_COUNT]; // set default later
+  int maskColor;
+  int deskewScanEdges;
+  int deskewScanSize;
+  bool deskewScanSizeGiven; // true once set by --deskew-scan-size
+  float deskewScanDepth;
+  float deskewScanRange;
+  float deskewScanStep;
+  float deskewScanDeviation;
+  int borderScanDirections;
+  int borderScanSize[DIRECTIONS_COUNT];
+  int borderScanStep[DIRECTIONS_COUNT];
+  int borderScanThreshold[DIRECTIONS_COUNT];
+  int borderAlign;                                   // center
+  int borderAlignMargin[DIRECTIONS_COUNT];           // center
+  int outsideBorderscanMask[MAX_PAGES][EDGES_COUNT]; // set by --layout
+  int outsideBorderscanMaskCount;
+  float whiteThreshold;
+  float blackThreshold;
+  bool writeoutput;
+  bool multisheets;
+  int outputPixFmt; // set by --type, -1 for the format of the input
+
+  // 0: allow all, -1: disable all, n: individual entries
+  struct MultiIndex noBlackfilterMultiIndex;
+  struct MultiIndex noNoisefilterMultiIndex;
+  struct MultiIndex noBlurfilterMultiIndex;
+  struct MultiIndex noGrayfilterMultiIndex;
+  struct MultiIndex noMaskScanMultiIndex;
+  struct MultiIndex noMaskCenterMultiIndex;
+  struct MultiIndex noDeskewMultiIndex;
+  struct MultiIndex noWipeMultiIndex;
+  struct MultiIndex noBorderMultiIndex;
+  struct MultiIndex noBorderScanMultiIndex;
+  struct MultiIndex noBorderAlignMultiIndex;
+
+  // default: process all between start-sheet and end-sheet
+  struct MultiIndex sheetMultiIndex;
+  struct MultiIndex excludeMultiIndex;
+  struct MultiIndex ignoreMultiIndex;
+  struct MultiIndex insertBlank;
+  struct MultiIndex replaceBlank;
+
+  bool overwrite;
+  int dpi;
+  char *detectionCacheDirectory;
+  bool noCache;
+  char *journalFilename;
+  bool resume;
+  int dedupeSize;
+  float blankThreshold;
+  char *sweepFilename;
+  char *timingsFilename;
+  char *traceFilename;
+  bool perfCounters;
+  bool memoryStats;
+  bool summary;
+  char *metricsFilename;
+  int threadCount;
+  int shardIndex;
+  int shardCount;
+  int shardMode;
+  char *spoolDirectory;
+  int spoolLease;
+  char *watchDirectory;
+  char *daemonSocket;
+  int daemonJobs;
+  char *manifestFilename;
+  char *inputTarFilename;
+  char *outputTarFilename;
+  int asyncSheets;
+};
+
+typedef enum {
+  OPTIONS_OK,
+  OPTIONS_HELP,    // --help
+  OPTIONS_UNKNOWN, // an option unpaper does not know
+  OPTIONS_VERSION, // --version
+  OPTIONS_INVALID, // an option with an invalid value
+} OPTIONS_STATUS;
+
+void optionsInit(struct Options *options);
+
+OPTIONS_STATUS parseOptions(struct Options *options, int argc, char *argv[],
+                            char *error, size_t errorSize);
+
+void restoreOptions(struct Options *options, const struct Options *saved);
+
+void freeOptions(struct Options *options);
+
+void updateAbsoluteParameters(struct Options *options);
+
+int nextOption(int argc, char *argv[]);
+
+const char *optionName(int option);
 
 /* --- tool function for file handling ------------------------------------ */
 
-void loadImage(const char *filename, AVFrame **image);
+void loadImage(const struct Options *options, const char *filename,
+               AVFrame **image);
+
+AVFrame *outputImage(const struct Options *options, AVFrame *input,
+                     int outputPixFmt);
+
+void saveImage(const struct Options *options, char *filename, AVFrame *image,
+               int outputPixFmt);
+
+void saveBlankImage(const struct Options *options, char *filename, int width,
+                    int height, int outputPixFmt);
+
+void saveDebug(const struct Options *options, char *filenameTemplate,
+               int index, AVFrame *image) __attribute__((format(printf, 2, 0)));
 
-void saveImage(char *filename, AVFrame *image, int outputPixFmt);
+struct AVHashContext;
 
-void saveDebug(char *filenameTemplate, int index, AVFrame *image)
-    __attribute__((format(printf, 1, 0)));
+void hashFile(struct AVHashContext *ctx, const char *filename);
+
+bool imageExists(const char *filename);
 
 /* --- arithmetic tool functions ------------------------------------------ */
 
@@ -163,6 +243,13 @@ static inline void limit(int *i, int max) {
     _a > _b ? _a : _b;                                                         \
   })
 
+#define min(a, b)                                                              \
+  ({                                                                           \
+    __typeof__(a) _a = (a);                                                    \
+    __typeof__(b) _b = (b);                                                    \
+    _a < _b ? _a : _b;                                                         \
+  })
+
 #define max3(a, b, c)                                                          \
   ({                                                                           \
     __typeof__(a) _a = (a);                                                    \
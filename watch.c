@@ -0,0 +1,156 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- watch directory ---------------------------------------------------- */
+
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#include "unpaper.h"
+#include "watch.h"
+
+/*
+ * Input files are picked up as they land in the watched directory: once
+ * written and closed there, or once moved there, which is how files written
+ * elsewhere, or under a hidden name first, show up complete. Hidden files
+ * are left alone. Files already there when the watch starts are not picked
+ * up.
+ */
+
+static int watchFd = -1;
+
+#ifdef HAVE_INOTIFY
+// events read but not handed out yet
+static alignas(struct inotify_event) char events[64 * 1024];
+static size_t eventsLength = 0;
+static size_t eventsOffset = 0;
+#endif
+
+// set by SIGINT and SIGTERM: the sheet being processed is finished, and no
+// more files are picked up
+static volatile sig_atomic_t stopping = 0;
+
+static void stopWatching(int signum) { stopping = 1; }
+
+void watchOpen(const struct Options *options) {
+#ifdef HAVE_INOTIFY
+  struct sigaction action;
+
+  watchFd = inotify_init1(IN_CLOEXEC);
+  if (watchFd < 0 ||
+      inotify_add_watch(watchFd, options->watchDirectory,
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+    errOutput("unable to watch directory %s: %s.", options->watchDirectory,
+              strerror(errno));
+  }
+
+  // no SA_RESTART, so that waiting for a file stops right away; a second
+  // signal stops unpaper the usual way
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stopWatching;
+  action.sa_flags = SA_RESETHAND;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  if (options->verbose >= VERBOSE_NORMAL) {
+    printf("watching directory %s for input files.\n", options->watchDirectory);
+  }
+#else
+  errOutput("--watch is not supported on this system.");
+#endif
+}
+
+/**
+ * Tells whether filename goes to the watched directory, where writing it
+ * would be picked up as an input file.
+ */
+bool watchContains(const struct Options *options, const char *filename) {
+  char copy[PATH_MAX];
+  struct stat directory;
+  struct stat watched;
+
+  snprintf(copy, sizeof(copy), "%s", filename);
+  if (stat(dirname(copy), &directory) != 0 ||
+      stat(options->watchDirectory, &watched) != 0) {
+    return false;
+  }
+  return directory.st_dev == watched.st_dev &&
+         directory.st_ino == watched.st_ino;
+}
+
+/**
+ * Waits for the next input file to land in the watched directory, and
+ * stores its path in filename. Returns false once unpaper is told to stop.
+ */
+bool watchNext(const struct Options *options, char *filename, size_t size) {
+#ifdef HAVE_INOTIFY
+  while (!stopping) {
+    if (eventsOffset >= eventsLength) {
+      // the messages of the sheets so far show up before waiting
+      fflush(stdout);
+      const ssize_t length = read(watchFd, events, sizeof(events));
+      if (length < 0) {
+        if (errno == EINTR)
+          continue;
+        errOutput("unable to watch directory %s: %s.", options->watchDirectory,
+                  strerror(errno));
+      }
+      eventsLength = length;
+      eventsOffset = 0;
+    }
+
+    const struct inotify_event *event =
+        (const struct inotify_event *)(events + eventsOffset);
+    eventsOffset += sizeof(struct inotify_event) + event->len;
+
+    if (event->mask & IN_Q_OVERFLOW) {
+      fprintf(stderr,
+              "unpaper: warning: too many files landed in %s at once, some "
+              "of them were not picked up.\n",
+              options->watchDirectory);
+      continue;
+    }
+    if (event->mask & IN_IGNORED) {
+      errOutput("watched directory %s went away.", options->watchDirectory);
+    }
+    if (event->len == 0 || event->name[0] == '.' || (event->mask & IN_ISDIR))
+      continue;
+
+    if (snprintf(filename, size, "%s/%s", options->watchDirectory,
+                 event->name) >= (int)size) {
+      fprintf(stderr,
+              "unpaper: warning: file name %s/%s too long, skipped.\n",
+              options->watchDirectory, event->name);
+      continue;
+    }
+    // moved on again before its turn came
+    if (access(filename, F_OK) != 0)
+      continue;
+    return true;
+  }
+#endif
+  return false;
+}
+
+void watchClose(void) {
+  if (watchFd >= 0) {
+    close(watchFd);
+    watchFd = -1;
+  }
+}
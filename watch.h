@@ -0,0 +1,20 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* --- watch directory ---------------------------------------------------- */
+
+struct Options;
+
+void watchOpen(const struct Options *options);
+
+bool watchContains(const struct Options *options, const char *filename);
+
+bool watchNext(const struct Options *options, char *filename, size_t size);
+
+void watchClose(void);